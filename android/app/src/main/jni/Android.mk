@@ -71,11 +71,20 @@ GBE_SRC_BASE := $(ROOT_PATH)/src
 GBE_SRC_FILES := \
     $(GBE_SRC_BASE)/audio.cpp \
     $(GBE_SRC_BASE)/cartridge.cpp \
+    $(GBE_SRC_BASE)/cheats.cpp \
     $(GBE_SRC_BASE)/cpu.cpp \
     $(GBE_SRC_BASE)/cpu_disasm.cpp \
+    $(GBE_SRC_BASE)/dataset.cpp \
     $(GBE_SRC_BASE)/display.cpp \
+    $(GBE_SRC_BASE)/input_movie.cpp \
     $(GBE_SRC_BASE)/link.cpp \
+    $(GBE_SRC_BASE)/mapper.cpp \
+    $(GBE_SRC_BASE)/memory_arena.cpp \
+    $(GBE_SRC_BASE)/render_capture.cpp \
+    $(GBE_SRC_BASE)/rom_archive.cpp \
+    $(GBE_SRC_BASE)/rom_profile.cpp \
     $(GBE_SRC_BASE)/serial.cpp \
+    $(GBE_SRC_BASE)/state_snapshot.cpp \
     $(GBE_SRC_BASE)/structures.cpp \
     $(GBE_SRC_BASE)/system.cpp
 
@@ -87,7 +96,7 @@ ALL_SRC_FILES := $(JNI_SRC_FILES) $(GBE_SRC_FILES) $(GBSNDEMU_SRC_FILES) $(YBASE
 LOCAL_MODULE    := gbe
 LOCAL_CFLAGS	:= -std=c++11 $(INCLUDE_DIRS)
 LOCAL_SRC_FILES := $(ALL_SRC_FILES:$(LOCAL_PATH)/%=%)
-LOCAL_LDLIBS 	:= -llog -ljnigraphics -lGLESv1_CM -lGLESv2
+LOCAL_LDLIBS 	:= -llog -ljnigraphics -lGLESv1_CM -lGLESv2 -lz
 
 include $(BUILD_SHARED_LIBRARY)
 
@@ -0,0 +1,147 @@
+#include "allocation_counter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef ENABLE_ALLOCATION_COUNTING
+
+static std::atomic<uint64> s_total_allocation_count(0);
+static thread_local uint64 s_thread_allocation_count = 0;
+
+static void CountAllocation()
+{
+  s_total_allocation_count.fetch_add(1, std::memory_order_relaxed);
+  s_thread_allocation_count++;
+}
+
+#ifdef ENABLE_MALLOC_COUNTING
+
+// linked with -Wl,--wrap, so every call to these from gbe and its static libraries lands here
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+  CountAllocation();
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+  CountAllocation();
+  return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+  CountAllocation();
+  return __real_realloc(ptr, size);
+}
+}
+
+#endif
+
+static void* CountedAllocate(size_t size)
+{
+  // the malloc call is counted by the wrapper when there is one
+#ifndef ENABLE_MALLOC_COUNTING
+  CountAllocation();
+#endif
+  return std::malloc((size > 0) ? size : 1);
+}
+
+void* operator new(size_t size)
+{
+  void* ptr = CountedAllocate(size);
+  if (ptr == nullptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new[](size_t size)
+{
+  void* ptr = CountedAllocate(size);
+  if (ptr == nullptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+  return CountedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+  return CountedAllocate(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+  std::free(ptr);
+}
+
+bool AllocationCounter::IsEnabled()
+{
+  return true;
+}
+
+bool AllocationCounter::IsCountingMalloc()
+{
+#ifdef ENABLE_MALLOC_COUNTING
+  return true;
+#else
+  return false;
+#endif
+}
+
+uint64 AllocationCounter::GetThreadAllocationCount()
+{
+  return s_thread_allocation_count;
+}
+
+uint64 AllocationCounter::GetTotalAllocationCount()
+{
+  return s_total_allocation_count.load(std::memory_order_relaxed);
+}
+
+#else
+
+bool AllocationCounter::IsEnabled()
+{
+  return false;
+}
+
+bool AllocationCounter::IsCountingMalloc()
+{
+  return false;
+}
+
+uint64 AllocationCounter::GetThreadAllocationCount()
+{
+  return 0;
+}
+
+uint64 AllocationCounter::GetTotalAllocationCount()
+{
+  return 0;
+}
+
+#endif
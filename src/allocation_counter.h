@@ -0,0 +1,21 @@
+#pragma once
+#include "YBaseLib/Common.h"
+
+// Heap allocation accounting, for checking that the emulation loop doesn't allocate. Builds with
+// ENABLE_ALLOCATION_COUNTING (debug builds, or the cmake option) replace the global operator new/delete to count
+// calls. Where the linker supports --wrap, ENABLE_MALLOC_COUNTING also counts malloc/calloc/realloc calls, which
+// covers Y_malloc and the static libraries. Other builds always report zero, so check IsEnabled() first.
+class AllocationCounter
+{
+public:
+  static bool IsEnabled();
+
+  // whether malloc/calloc/realloc are counted, rather than just operator new
+  static bool IsCountingMalloc();
+
+  // allocation calls made by the calling thread since it started
+  static uint64 GetThreadAllocationCount();
+
+  // allocation calls made by every thread since startup
+  static uint64 GetTotalAllocationCount();
+};
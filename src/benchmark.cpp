@@ -0,0 +1,215 @@
+#include "benchmark.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Error.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/Timer.h"
+#include "allocation_counter.h"
+#include "audio.h"
+#include "cartridge.h"
+#include "link.h"
+#include "memory_arena.h"
+#include "rom_archive.h"
+Log_SetChannel(Benchmark);
+
+Benchmark::Benchmark() {}
+
+Benchmark::~Benchmark()
+{
+  if (!m_instances.empty())
+    m_instances[0].cartridge->SaveProfile();
+
+  for (Instance& instance : m_instances)
+  {
+    delete instance.system;
+    delete instance.cartridge;
+  }
+}
+
+bool Benchmark::Init(const char* cart_filename, SYSTEM_MODE mode, uint32 num_instances, const char* profile_directory,
+                     Error* pError)
+{
+  for (uint32 i = 0; i < num_instances; i++)
+  {
+    if (!CreateInstance(cart_filename, mode, (i == 0) ? profile_directory : nullptr, pError))
+      return false;
+  }
+
+  return true;
+}
+
+bool Benchmark::CreateInstance(const char* cart_filename, SYSTEM_MODE mode, const char* profile_directory,
+                               Error* pError)
+{
+  Instance instance;
+  instance.system = new System(this);
+  instance.cartridge = new Cartridge(instance.system);
+  if (profile_directory != nullptr)
+    instance.cartridge->SetProfileDirectory(profile_directory);
+  m_instances.push_back(instance);
+
+  if (ROMArchiveReader::IsArchiveFileName(cart_filename))
+  {
+    if (!ROMArchiveReader::LoadCartridge(instance.cartridge, cart_filename, nullptr, pError))
+      return false;
+  }
+  else
+  {
+    ByteStream* pStream = FileSystem::OpenFile(cart_filename, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_STREAMED);
+    if (pStream == nullptr)
+    {
+      pError->SetErrorUserFormatted(1, "Could not open '%s'", cart_filename);
+      return false;
+    }
+
+    bool result = instance.cartridge->Load(pStream, pError);
+    pStream->Release();
+    if (!result)
+      return false;
+  }
+
+  if (!instance.system->Init(mode, nullptr, 0, instance.cartridge))
+  {
+    pError->SetErrorUser(1, "Failed to initialize system");
+    return false;
+  }
+
+  SetupHeadlessSystem(instance.system, instance.cartridge);
+  return true;
+}
+
+// one frame's worth of clocks
+static const uint64 FRAME_CLOCKS = 70224;
+
+// a little more than a frame of stereo samples at 44.1KHz, read back each frame like the audio callback does
+static const uint32 AUDIO_DRAIN_SAMPLES = 2048;
+
+bool Benchmark::Run(uint32 frames, bool step_loop, bool io)
+{
+  const Cartridge* cartridge = m_instances[0].cartridge;
+  uint32 num_instances = static_cast<uint32>(m_instances.size());
+  Log_InfoPrintf("Running '%s' for %u frames, %u instance(s), %s loop%s...", cartridge->GetName().GetCharArray(),
+                 frames, num_instances, step_loop ? "Step()" : "RunUntil()", io ? ", audio and loopback link" : "");
+  Log_InfoPrintf("Cartridge memory is %s.", cartridge->IsMemoryHugePageBacked() ? "huge page backed" : "4KB pages");
+
+  // the link is process-wide, so a second instance would take the first one's responses
+  if (io)
+  {
+    Error error;
+    if (num_instances > 1)
+    {
+      Log_ErrorPrintf("Audio and link output only runs with a single instance");
+      return false;
+    }
+    if (!LinkConnectionManager::GetInstance().EnableLoopback(&error))
+    {
+      Log_ErrorPrintf("Failed to loop back link: %s", error.GetErrorDescription().GetCharArray());
+      return false;
+    }
+
+    m_instances[0].system->SetAudioEnabled(true);
+  }
+  int16 audio_samples[AUDIO_DRAIN_SAMPLES];
+
+  MemoryCounters counters;
+  Timer timer;
+  counters.Begin();
+
+  // the first frame can set things up, everything after it should be steady state
+  uint64 allocations_start = AllocationCounter::GetThreadAllocationCount();
+
+  // both loops execute exactly the same clocks, RunUntil() returns early at each vblank
+  for (uint32 i = 0; i < frames; i++)
+  {
+    for (Instance& instance : m_instances)
+    {
+      System* system = instance.system;
+      uint64 target_clocks = system->GetClocksSinceReset() + FRAME_CLOCKS;
+      if (step_loop)
+      {
+        while (system->GetClocksSinceReset() < target_clocks)
+          system->Step();
+      }
+      else
+      {
+        // Step() also picks up the link's answer while the transfer has the system paused
+        while (system->GetClocksSinceReset() < target_clocks)
+        {
+          if (system->GetSerialPause())
+            system->Step();
+          else
+            system->RunUntil(target_clocks);
+        }
+      }
+
+      if (io)
+        system->GetAudio()->ReadSamples(audio_samples, AUDIO_DRAIN_SAMPLES);
+    }
+
+    if (i == 0)
+      allocations_start = AllocationCounter::GetThreadAllocationCount();
+  }
+  uint64 allocations = AllocationCounter::GetThreadAllocationCount() - allocations_start;
+  if (io)
+  {
+    m_instances[0].system->SetAudioEnabled(false);
+    LinkConnectionManager::GetInstance().Shutdown();
+  }
+
+  counters.End();
+  double elapsed = timer.GetTimeSeconds();
+
+  // speed is per instance, i.e. how fast each one would appear to run
+  uint64 total_frames = uint64(frames) * num_instances;
+  double instance_fps = double(frames) / elapsed;
+  Log_InfoPrintf("%u frames in %.3f seconds: %.1f fps, %.1f%% speed per instance", frames, elapsed, instance_fps,
+                 instance_fps / 59.7275 * 100.0);
+  Log_InfoPrintf("%.2f ns per emulated clock", (elapsed * 1000000000.0) / double(total_frames * FRAME_CLOCKS));
+
+  if (counters.HasPageFaults())
+  {
+    Log_InfoPrintf("Page faults: %llu minor, %llu major",
+                   static_cast<unsigned long long>(counters.GetMinorPageFaults()),
+                   static_cast<unsigned long long>(counters.GetMajorPageFaults()));
+  }
+  else
+  {
+    Log_InfoPrintf("Page faults: unavailable");
+  }
+
+  if (counters.HasTLBMisses())
+  {
+    Log_InfoPrintf("dTLB read misses: %llu (%.1f per frame)", static_cast<unsigned long long>(counters.GetTLBMisses()),
+                   double(counters.GetTLBMisses()) / double(total_frames));
+  }
+  else
+  {
+    Log_InfoPrintf("dTLB read misses: unavailable");
+  }
+
+  if (counters.HasL1DMisses())
+  {
+    Log_InfoPrintf("L1D read misses: %llu (%.1f per frame)", static_cast<unsigned long long>(counters.GetL1DMisses()),
+                   double(counters.GetL1DMisses()) / double(total_frames));
+  }
+  else
+  {
+    Log_InfoPrintf("L1D read misses: unavailable");
+  }
+
+  if (!AllocationCounter::IsEnabled())
+  {
+    Log_InfoPrintf("Heap allocations: unavailable");
+    return true;
+  }
+
+  uint32 steady_frames = (frames > 1) ? (frames - 1) : 0;
+  Log_InfoPrintf("Heap allocations after the first frame (%s): %llu (%.2f per frame)",
+                 AllocationCounter::IsCountingMalloc() ? "new and malloc" : "new only",
+                 static_cast<unsigned long long>(allocations),
+                 (steady_frames > 0) ? (double(allocations) / double(uint64(steady_frames) * num_instances)) : 0.0);
+  if (allocations > 0)
+    Log_ErrorPrintf("Steady-state emulation allocated memory");
+
+  return (allocations == 0);
+}
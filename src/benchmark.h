@@ -0,0 +1,39 @@
+#pragma once
+#include "YBaseLib/Common.h"
+#include "headless.h"
+#include <vector>
+
+class Cartridge;
+class Error;
+
+// Headless benchmark. Runs a cartridge without the boot rom, frame limiter, video or audio output, and logs the
+// emulation speed along with the page faults and cache/TLB misses taken over the run. Several instances can be
+// interleaved on the one thread, to see how the per-instance working set holds up when many share a core.
+class Benchmark : private HeadlessCallbacks
+{
+public:
+  Benchmark();
+  ~Benchmark();
+
+  // mode can be NUM_SYSTEM_MODES to use the cartridge's mode
+  // the first instance updates the rom's profile in profile_directory, if it is not null
+  bool Init(const char* cart_filename, SYSTEM_MODE mode, uint32 num_instances, const char* profile_directory,
+            Error* pError);
+
+  // Runs each instance for the given number of frames. step_loop drives the system one instruction at a time through
+  // Step() rather than through RunUntil(), to measure the cost of the execution loop itself. io runs a single instance
+  // the way the frontend does, with audio output drained every frame and the link connected to a loopback.
+  // Returns false if anything was heap allocated after the first frame, when allocation counting is built in.
+  bool Run(uint32 frames, bool step_loop, bool io);
+
+private:
+  struct Instance
+  {
+    System* system;
+    Cartridge* cartridge;
+  };
+
+  bool CreateInstance(const char* cart_filename, SYSTEM_MODE mode, const char* profile_directory, Error* pError);
+
+  std::vector<Instance> m_instances;
+};
@@ -9,8 +9,11 @@
 #include "YBaseLib/Log.h"
 #include "YBaseLib/String.h"
 #include "YBaseLib/StringConverter.h"
+#include "mapper.h"
+#include "rom_archive.h"
 #include "structures.h"
 #include "system.h"
+#include <zlib.h>
 Log_SetChannel(Cartridge);
 
 // http://bgb.bircd.org/pandocs.htm#thecartridgeheader
@@ -53,23 +56,105 @@ static const uint32 CART_ROM_BANK_COUNT[][2] = {
   {0x06, 128}, {0x07, 256}, {0x52, 72}, {0x53, 80}, {0x54, 96},
 };
 
+// RTC counts in emulated time, at the normal speed clock rate
+static const uint32 RTC_CLOCKS_PER_SECOND = 4194304;
+
+// stored in the last byte of the .rtc file, older files stored offsets from the host clock instead of counters
+static const uint8 RTC_FILE_VERSION = 1;
+
 Cartridge::Cartridge(System* system)
   : m_system(system), m_mbc(NUM_MBC_TYPES), m_crc(0), m_typeinfo(nullptr), m_rom_banks(nullptr), m_num_rom_banks(0),
-    m_external_ram(nullptr), m_external_ram_size(0), m_external_ram_modified(false)
+    m_external_ram(nullptr), m_external_ram_size(0), m_external_ram_modified(false), m_mapper(nullptr),
+    m_profile_frame_base(0), m_rtc_wall_time(0), m_rtc_last_cycle(0), m_rtc_wall_clock_sync(true),
+    m_rtc_modified(false)
 {
-  Y_memzero(&m_mbc_data, sizeof(m_mbc_data));
+  Y_memzero(&m_rtc, sizeof(m_rtc));
 }
 
 Cartridge::~Cartridge()
 {
-  for (uint32 i = 0; i < m_num_rom_banks; i++)
-    Y_free(m_rom_banks[i]);
+  delete m_mapper;
+
+  // only banks found past the header's rom size are allocated outside the arena
+  if (m_rom_banks != nullptr)
+  {
+    for (uint32 i = 0; i < m_num_rom_banks; i++)
+    {
+      if (!m_memory.Contains(m_rom_banks[i]))
+        Y_free(m_rom_banks[i]);
+    }
+  }
   delete[] m_rom_banks;
 }
 
+bool Cartridge::DecodeHeader(const CART_HEADER* header, CartridgeHeaderInfo* info, Error* pError)
+{
+  // set name
+  info->name.Clear();
+  if ((header->cgb_flag & 0x80) || (header->cgb_flag & 0xC0))
+    info->name.AppendString(header->cgb_title, sizeof(header->cgb_title));
+  else
+    info->name.AppendString(header->title, sizeof(header->title));
+  info->name.UpdateSize();
+  info->cgb_flag = header->cgb_flag;
+
+  // get info
+  info->typeinfo = nullptr;
+  for (uint32 i = 0; i < countof(CART_TYPEINFOS); i++)
+  {
+    if (CART_TYPEINFOS[i].id == header->type)
+    {
+      info->typeinfo = &CART_TYPEINFOS[i];
+      break;
+    }
+  }
+  if (info->typeinfo == nullptr)
+  {
+    pError->SetErrorUserFormatted(1, "Unknown cartridge type: 0x%02X", header->type);
+    return false;
+  }
+
+  // parse rom banks
+  info->num_rom_banks = 0;
+  for (uint32 i = 0; i < countof(CART_ROM_BANK_COUNT); i++)
+  {
+    if (CART_ROM_BANK_COUNT[i][0] == header->rom_size)
+    {
+      info->num_rom_banks = CART_ROM_BANK_COUNT[i][1];
+      break;
+    }
+  }
+  if (info->num_rom_banks == 0)
+  {
+    pError->SetErrorUserFormatted(1, "Unknown rom size code: 0x%02X", header->rom_size);
+    return false;
+  }
+
+  // parse ram
+  if (header->ram_size >= countof(CART_EXTERNAL_RAM_SIZES) || (header->ram_size > 0 && !info->typeinfo->ram))
+  {
+    pError->SetErrorUserFormatted(1, "Unknown ram size code: %02X", header->ram_size);
+    return false;
+  }
+  info->external_ram_size = CART_EXTERNAL_RAM_SIZES[header->ram_size];
+
+  // choose system mode
+  info->system_mode = SYSTEM_MODE_DMG;
+  if (header->cgb_flag & 0x80)
+    info->system_mode = SYSTEM_MODE_CGB;
+  // else if (header->sgb_flag != 0x03)
+  // info->system_mode = SYSTEM_MODE_SGB;
+
+  return true;
+}
+
+const char* Cartridge::GetMBCName(MBC mbc)
+{
+  return (mbc < NUM_MBC_TYPES) ? MBC_NAME_STRINGS[mbc] : "UNKNOWN";
+}
+
 bool Cartridge::ParseHeader(ByteStream* pStream, Error* pError)
 {
-  SmallString str;
   CART_HEADER header;
   if (!pStream->SeekAbsolute(CART_HEADER_OFFSET) || !pStream->Read2(&header, sizeof(header)))
   {
@@ -77,6 +162,29 @@ bool Cartridge::ParseHeader(ByteStream* pStream, Error* pError)
     return false;
   }
 
+  if (!ApplyHeader(&header, pError))
+    return false;
+
+  size_t extra_bytes = static_cast<size_t>(pStream->GetSize());
+  DebugAssert(extra_bytes >= (ROM_BANK_SIZE * m_num_rom_banks));
+  if (extra_bytes > (ROM_BANK_SIZE * m_num_rom_banks))
+  {
+    Log_WarningPrintf("  ROM has %u extra bytes at end of bank space", extra_bytes);
+    if (m_mbc != MBC_NONE)
+    {
+      m_num_rom_banks = extra_bytes / ROM_BANK_SIZE;
+      Log_WarningPrintf("    Recalculated ROM banks: %u", m_num_rom_banks);
+    }
+  }
+
+  return true;
+}
+
+bool Cartridge::ApplyHeader(const CART_HEADER* header_ptr, Error* pError)
+{
+  SmallString str;
+  const CART_HEADER& header = *header_ptr;
+
   Log_InfoPrint("Cartridge info: ");
 
   str.Clear();
@@ -103,28 +211,17 @@ bool Cartridge::ParseHeader(ByteStream* pStream, Error* pError)
   Log_InfoPrintf("  Header Checksum: 0x%02X", header.header_checksum);
   Log_InfoPrintf("  Cartridge Checksum: 0x%04X", header.cartridge_checksum);
 
-  // set name
-  m_name.Clear();
-  if ((header.cgb_flag & 0x80) || (header.cgb_flag & 0xC0))
-    m_name.AppendString(header.cgb_title, sizeof(header.cgb_title));
-  else
-    m_name.AppendString(header.title, sizeof(header.title));
-  m_name.UpdateSize();
-
-  // get info
-  for (uint32 i = 0; i < countof(CART_TYPEINFOS); i++)
-  {
-    if (CART_TYPEINFOS[i].id == header.type)
-    {
-      m_typeinfo = &CART_TYPEINFOS[i];
-      break;
-    }
-  }
-  if (m_typeinfo == nullptr)
-  {
-    pError->SetErrorUserFormatted(1, "Unknown cartridge type: 0x%02X", header.type);
+  // decode
+  CartridgeHeaderInfo info;
+  if (!DecodeHeader(&header, &info, pError))
     return false;
-  }
+
+  m_name = info.name;
+  m_typeinfo = info.typeinfo;
+  m_mbc = m_typeinfo->mbc;
+  m_num_rom_banks = info.num_rom_banks;
+  m_external_ram_size = info.external_ram_size;
+  m_system_mode = info.system_mode;
 
   // dump cart type info
   Log_InfoPrintf("  Cartridge type description: %s", m_typeinfo->description);
@@ -134,60 +231,16 @@ bool Cartridge::ParseHeader(ByteStream* pStream, Error* pError)
   Log_InfoPrintf("    Battery: %s", m_typeinfo->battery ? "yes" : "no");
   Log_InfoPrintf("    Timer: %s", m_typeinfo->timer ? "yes" : "no");
   Log_InfoPrintf("    Rumble: %s", m_typeinfo->rumble ? "yes" : "no");
-  m_mbc = m_typeinfo->mbc;
-
-  // parse rom banks
-  m_num_rom_banks = 0;
-  for (uint32 i = 0; i < countof(CART_ROM_BANK_COUNT); i++)
-  {
-    if (CART_ROM_BANK_COUNT[i][0] == header.rom_size)
-    {
-      m_num_rom_banks = CART_ROM_BANK_COUNT[i][1];
-      break;
-    }
-  }
-  if (m_num_rom_banks == 0)
-  {
-    pError->SetErrorUserFormatted(1, "Unknown rom size code: 0x%02X", header.rom_size);
-    return false;
-  }
   Log_InfoPrintf("  ROM Banks: %u (%s)", m_num_rom_banks,
                  StringConverter::SizeToHumanReadableString(ROM_BANK_SIZE * m_num_rom_banks).GetCharArray());
-
-  // parse ram
-  if (header.ram_size >= countof(CART_EXTERNAL_RAM_SIZES) || (header.ram_size > 0 && !m_typeinfo->ram))
-  {
-    pError->SetErrorUserFormatted(1, "Unknown ram size code: %02X", header.ram_size);
-    return false;
-  }
-  m_external_ram_size = CART_EXTERNAL_RAM_SIZES[header.ram_size];
   Log_InfoPrintf("  External ram size: %s",
                  StringConverter::SizeToHumanReadableString(m_external_ram_size).GetCharArray());
-
-  // choose system mode
-  m_system_mode = SYSTEM_MODE_DMG;
-  if (header.cgb_flag & 0x80)
-    m_system_mode = SYSTEM_MODE_CGB;
-  // else if (header.sgb_flag != 0x03)
-  // m_system_mode = SYSTEM_MODE_SGB;
   Log_InfoPrintf("  Detected system mode: %s", NameTable_GetNameString(NameTables::SystemMode, m_system_mode));
 
   //     // MBC2 mapper provides 512 bytes of 4-bit memory
   //     if (m_mbc == MBC_MBC2)
   //         m_external_ram_size = 512;
 
-  size_t extra_bytes = static_cast<size_t>(pStream->GetSize());
-  DebugAssert(extra_bytes >= (ROM_BANK_SIZE * m_num_rom_banks));
-  if (extra_bytes > (ROM_BANK_SIZE * m_num_rom_banks))
-  {
-    Log_WarningPrintf("  ROM has %u extra bytes at end of bank space", extra_bytes);
-    if (m_mbc != MBC_NONE)
-    {
-      m_num_rom_banks = extra_bytes / ROM_BANK_SIZE;
-      Log_WarningPrintf("    Recalculated ROM banks: %u", m_num_rom_banks);
-    }
-  }
-
   return true;
 }
 
@@ -215,11 +268,10 @@ bool Cartridge::Load(ByteStream* pStream, Error* pError)
 
   // read rom banks
   DebugAssert(m_num_rom_banks > 0);
-  m_rom_banks = new byte*[m_num_rom_banks];
+  if (!CreateMemoryArena(m_num_rom_banks, pError))
+    return false;
   for (uint32 i = 0; i < m_num_rom_banks; i++)
   {
-    m_rom_banks[i] = (byte*)Y_malloc(ROM_BANK_SIZE);
-    DebugAssert(m_rom_banks[i] != nullptr);
     if (!pStream->Read2(m_rom_banks[i], ROM_BANK_SIZE))
     {
       pError->SetErrorUserFormatted(1, "Failed to read ROM bank %u", i);
@@ -227,33 +279,145 @@ bool Cartridge::Load(ByteStream* pStream, Error* pError)
     }
   }
 
-  // handle mappers
-  bool mbc_init_result;
-  switch (m_mbc)
+  return CreateMemoryAndMapper(pError);
+}
+
+bool Cartridge::LoadFromArchive(ROMArchiveReader* pReader, Error* pError)
+{
+  // the header is inside the first bank, so the rom size is only known once that has been read
+  byte* first_bank = (byte*)Y_malloc(ROM_BANK_SIZE);
+  uint32 bytes_read;
+  if (!pReader->Read(first_bank, ROM_BANK_SIZE, &bytes_read, pError))
+  {
+    Y_free(first_bank);
+    return false;
+  }
+  if (bytes_read < ROM_BANK_SIZE)
   {
-  case MBC_NONE:
-    mbc_init_result = MBC_NONE_Init();
-    break;
+    pError->SetErrorUser(1, "Failed to read ROM bank 0");
+    Y_free(first_bank);
+    return false;
+  }
 
-  case MBC_MBC1:
-    mbc_init_result = MBC_MBC1_Init();
-    break;
+  uLong crc = crc32(crc32(0, Z_NULL, 0), first_bank, ROM_BANK_SIZE);
+  if (!ApplyHeader(reinterpret_cast<const CART_HEADER*>(first_bank + CART_HEADER_OFFSET), pError) ||
+      !CreateMemoryArena(MAX_NUM_ROM_BANKS, pError))
+  {
+    Y_free(first_bank);
+    return false;
+  }
 
-  case MBC_MBC3:
-    mbc_init_result = MBC_MBC3_Init();
-    break;
+  Y_memcpy(m_rom_banks[0], first_bank, ROM_BANK_SIZE);
+  Y_free(first_bank);
 
-  case MBC_MBC5:
-    mbc_init_result = MBC_MBC5_Init();
-    break;
+  // banks the header declares are decompressed straight into the arena, the file may hold more than that
+  uint32 header_rom_banks = m_num_rom_banks;
+  m_num_rom_banks = 1;
 
-  default:
-    pError->SetErrorUserFormatted(1, "MBC %s not implemented", MBC_NAME_STRINGS[m_mbc]);
+  // as with uncompressed files, full banks past the header size are kept when there is a mapper to reach them
+  uint32 extra_bytes = 0;
+  byte* extra_bank = nullptr;
+  for (;;)
+  {
+    byte* bank;
+    if (m_num_rom_banks < header_rom_banks)
+    {
+      bank = m_rom_banks[m_num_rom_banks];
+    }
+    else
+    {
+      if (extra_bank == nullptr)
+        extra_bank = (byte*)Y_malloc(ROM_BANK_SIZE);
+      bank = extra_bank;
+    }
+
+    if (!pReader->Read(bank, ROM_BANK_SIZE, &bytes_read, pError))
+    {
+      if (extra_bank != nullptr)
+        Y_free(extra_bank);
+      return false;
+    }
+    if (bytes_read == 0)
+      break;
+
+    crc = crc32(crc, bank, bytes_read);
+    if (m_num_rom_banks >= header_rom_banks)
+      extra_bytes += bytes_read;
+
+    if (bytes_read == ROM_BANK_SIZE && m_num_rom_banks < MAX_NUM_ROM_BANKS &&
+        (m_num_rom_banks < header_rom_banks || m_mbc != MBC_NONE))
+    {
+      m_rom_banks[m_num_rom_banks++] = bank;
+      if (bank == extra_bank)
+        extra_bank = nullptr;
+    }
+
+    if (bytes_read < ROM_BANK_SIZE)
+      break;
+  }
+  if (extra_bank != nullptr)
+    Y_free(extra_bank);
+  m_crc = static_cast<uint32>(crc);
+
+  if (m_num_rom_banks < header_rom_banks)
+  {
+    pError->SetErrorUserFormatted(1, "Failed to read ROM bank %u", m_num_rom_banks);
+    return false;
+  }
+  if (extra_bytes > 0)
+  {
+    Log_WarningPrintf("  ROM has %u extra bytes at end of bank space", extra_bytes);
+    if (m_num_rom_banks != header_rom_banks)
+      Log_WarningPrintf("    Recalculated ROM banks: %u", m_num_rom_banks);
+  }
+
+  return CreateMemoryAndMapper(pError);
+}
+
+bool Cartridge::CreateMemoryArena(uint32 bank_table_size, Error* pError)
+{
+  // rom banks then external ram, rounded up to whole banks so a bank pointer always covers the window
+  size_t rom_size = size_t(m_num_rom_banks) * ROM_BANK_SIZE;
+  size_t ram_size = size_t((m_external_ram_size + RAM_BANK_SIZE - 1) / RAM_BANK_SIZE) * RAM_BANK_SIZE;
+  // a load which failed part way through can be retried from another source, e.g. after a corrupt rom cache, so
+  // drop the previous attempt's bank table. its banks were all in the arena, which Create() replaces.
+  delete[] m_rom_banks;
+  m_rom_banks = nullptr;
+  m_external_ram = nullptr;
+
+  if (!m_memory.Create(rom_size + ram_size))
+  {
+    pError->SetErrorUserFormatted(1, "Failed to allocate %u KB for cartridge memory",
+                                  static_cast<uint32>((rom_size + ram_size) / 1024));
     return false;
   }
 
-  // errors
-  if (!mbc_init_result)
+  byte* rom = m_memory.Allocate(rom_size);
+  DebugAssert(bank_table_size >= m_num_rom_banks);
+  m_rom_banks = new byte*[bank_table_size];
+  for (uint32 i = 0; i < m_num_rom_banks; i++)
+    m_rom_banks[i] = rom + i * ROM_BANK_SIZE;
+
+  // the arena is zeroed, so unbacked ram starts out clear
+  if (ram_size > 0)
+    m_external_ram = m_memory.Allocate(ram_size);
+
+  Log_DevPrintf("Cartridge memory: %u KB rom, %u KB ram%s", static_cast<uint32>(rom_size / 1024),
+                static_cast<uint32>(ram_size / 1024), m_memory.IsHugePageBacked() ? ", huge pages" : "");
+  return true;
+}
+
+bool Cartridge::CreateMemoryAndMapper(Error* pError)
+{
+  // handle mappers
+  delete m_mapper;
+  m_mapper = Mapper::Create(m_mbc, this);
+  if (m_mapper == nullptr)
+  {
+    pError->SetErrorUserFormatted(1, "MBC %s not implemented", MBC_NAME_STRINGS[m_mbc]);
+    return false;
+  }
+  if (!m_mapper->Init())
   {
     pError->SetErrorUserFormatted(1, "MBC %s failed initialization", MBC_NAME_STRINGS[m_mbc]);
     return false;
@@ -262,9 +426,48 @@ bool Cartridge::Load(ByteStream* pStream, Error* pError)
   // load sram/rtc
   LoadRAM();
   LoadRTC();
+  LoadProfile();
   return true;
 }
 
+void Cartridge::ReloadBatteryData()
+{
+  LoadRAM();
+  LoadRTC();
+}
+
+void Cartridge::FlushBatteryData()
+{
+  if (m_external_ram_modified)
+    SaveRAM();
+  else
+    SaveRTC();
+}
+
+void Cartridge::LoadProfile()
+{
+  m_profile.Reset(m_crc);
+  if (m_profile_directory.IsEmpty())
+    return;
+
+  m_profile_filename.Format("%s/%08X.profile", m_profile_directory.GetCharArray(), m_crc);
+  m_profile.LoadFromFile(m_profile_filename, m_crc);
+}
+
+void Cartridge::SaveProfile()
+{
+  if (m_profile_filename.IsEmpty())
+    return;
+
+  // the frame counter restarts on reset
+  uint32 frame_counter = m_system->GetFrameCounter();
+  m_profile.AddObservedFrames((frame_counter >= m_profile_frame_base) ? (frame_counter - m_profile_frame_base) :
+                                                                         frame_counter);
+  m_profile_frame_base = frame_counter;
+  if (m_profile.IsModified())
+    m_profile.SaveToFile(m_profile_filename);
+}
+
 void Cartridge::LoadRAM()
 {
   // if no battery, we assume the contents is lost at power-down
@@ -283,36 +486,50 @@ void Cartridge::SaveRAM()
   if (m_external_ram_size > 0 && m_typeinfo->battery)
     m_system->m_callbacks->SaveCartridgeRAM(m_external_ram, m_external_ram_size);
 
+  // keep the clock file in step with the save, so emulated time isn't lost
+  SaveRTC();
   m_external_ram_modified = false;
 }
 
 void Cartridge::LoadRTC()
 {
-  Y_memzero(&m_rtc_data, sizeof(m_rtc_data));
+  Y_memzero(&m_rtc, sizeof(m_rtc));
+  m_rtc_wall_time = Timestamp::Now().AsUnixTimestamp();
   if (!m_typeinfo->timer)
     return;
 
-  // set defaults
-  m_rtc_data.base_time = Timestamp::Now().AsUnixTimestamp();
-  m_rtc_data.active = false;
-
   // load data
   BinaryReadBuffer buffer(16);
-  if (m_system->m_callbacks->LoadCartridgeRTC(buffer.GetBufferPointer(), buffer.GetBufferSize()))
+  if (!m_system->m_callbacks->LoadCartridgeRTC(buffer.GetBufferPointer(), buffer.GetBufferSize()))
   {
-    // read buffer
-    m_rtc_data.base_time = buffer.ReadUInt64();
-    m_rtc_data.offset_seconds = buffer.ReadUInt8();
-    m_rtc_data.offset_minutes = buffer.ReadUInt8();
-    m_rtc_data.offset_hours = buffer.ReadUInt8();
-    m_rtc_data.offset_days = buffer.ReadUInt16();
-    m_rtc_data.active = buffer.ReadBool();
+    // new file - save the rtc state
+    SaveRTC();
+    return;
   }
-  else
+
+  Timestamp::UnixTimestampValue saved_time = buffer.ReadUInt64();
+  uint8 registers[5];
+  for (uint32 i = 0; i < countof(registers); i++)
+    registers[i] = buffer.ReadUInt8();
+  buffer.ReadUInt8();
+  buffer.ReadUInt8();
+  if (buffer.ReadUInt8() != RTC_FILE_VERSION)
   {
-    // new file - save the rtc state
+    Log_WarningPrintf("RTC file is from an older version, resetting clock.");
     SaveRTC();
+    return;
   }
+
+  m_rtc.seconds = registers[0];
+  m_rtc.minutes = registers[1];
+  m_rtc.hours = registers[2];
+  m_rtc.days = uint16(registers[3]) | (uint16(registers[4] & 0x01) << 8);
+  m_rtc.halt = (registers[4] & 0x40) != 0;
+  m_rtc.day_carry = (registers[4] & 0x80) != 0;
+
+  // the first wall clock sync catches up on the time since the file was written
+  if (saved_time < m_rtc_wall_time)
+    m_rtc_wall_time = saved_time;
 }
 
 void Cartridge::SaveRTC()
@@ -320,134 +537,180 @@ void Cartridge::SaveRTC()
   if (!m_typeinfo->timer)
     return;
 
-  // save offset
+  // the counters are only in step with the host clock in wall clock mode
+  Timestamp::UnixTimestampValue saved_time =
+    m_rtc_wall_clock_sync ? m_rtc_wall_time : Timestamp::Now().AsUnixTimestamp();
+
   BinaryWriteBuffer buffer;
-  buffer.WriteUInt64(m_rtc_data.base_time);
-  buffer.WriteUInt16(m_rtc_data.offset_days);
-  buffer.WriteUInt8(m_rtc_data.offset_hours);
-  buffer.WriteUInt8(m_rtc_data.offset_minutes);
-  buffer.WriteUInt8(m_rtc_data.offset_seconds);
-  buffer.WriteUInt8(0);
+  buffer.WriteUInt64(saved_time);
+  buffer.WriteUInt8(m_rtc.seconds);
+  buffer.WriteUInt8(m_rtc.minutes);
+  buffer.WriteUInt8(m_rtc.hours);
+  buffer.WriteUInt8(uint8(m_rtc.days & 0xFF));
+  buffer.WriteUInt8(uint8((m_rtc.days >> 8) & 0x01) | (m_rtc.halt ? 0x40 : 0x00) | (m_rtc.day_carry ? 0x80 : 0x00));
   buffer.WriteUInt8(0);
   buffer.WriteUInt8(0);
+  buffer.WriteUInt8(RTC_FILE_VERSION);
   m_system->m_callbacks->SaveCartridgeRTC(buffer.GetBufferPointer(), (size_t)buffer.GetStreamPosition());
+  m_rtc_modified = false;
 }
 
-Cartridge::RTCValue Cartridge::GetCurrentRTCTime() const
+void Cartridge::SetRTCWallClockSync(bool enabled)
 {
-  Timestamp current_time = Timestamp::Now();
-  uint64 current_time_unix = current_time.AsUnixTimestamp();
-
-#if 0
-    // apply offset
-    (m_rtc_data.offset_seconds >= 0) ? (current_time_unix += uint64(m_rtc_data.offset_seconds)) : (current_time_unix -= uint64(-m_rtc_data.offset_seconds));
-    (m_rtc_data.offset_minutes >= 0) ? (current_time_unix += uint64(m_rtc_data.offset_minutes * 60)) : (current_time_unix -= uint64(-m_rtc_data.offset_minutes * 60));
-    (m_rtc_data.offset_hours >= 0) ? (current_time_unix += uint64(m_rtc_data.offset_hours * 3600)) : (current_time_unix -= uint64(-m_rtc_data.offset_hours * 3600));
-    (m_rtc_data.offset_days >= 0) ? (current_time_unix += uint64(m_rtc_data.offset_days * 86400)) : (current_time_unix -= uint64(-m_rtc_data.offset_days * 86400));
-
-    // apply offset
-    if (m_rtc_data.use_offset)
-    {
-        uint64 diff_time = current_time_unix - m_rtc_data.base_time;
-        diff_time += uint64(m_rtc_data.offset_seconds);
-        diff_time += uint64(m_rtc_data.offset_minutes * 60);
-        diff_time += uint64(m_rtc_data.offset_hours * 3600);
-        diff_time += uint64(m_rtc_data.offset_days * 86400);
-
-        // convert to format
-        out_value.seconds = uint32(diff_time % 60);
-        out_value.minutes = uint32((diff_time / 60) % 60);
-        out_value.hours = uint32((diff_time / 3600) % 24);
-        out_value.days = uint32((diff_time / 86400));
-    }
-    else
+  if (m_rtc_wall_clock_sync == enabled)
+    return;
+
+  // don't jump by the time spent in emulated mode
+  m_rtc_wall_clock_sync = enabled;
+  m_rtc_wall_time = Timestamp::Now().AsUnixTimestamp();
+  m_rtc.subsecond_clocks = 0;
+  Log_InfoPrintf("RTC %s", enabled ? "synced to host clock" : "running in emulated time");
+}
+
+void Cartridge::Synchronize()
+{
+  if (m_typeinfo->timer)
+  {
+    SynchronizeRTC();
+
+    // poll the host clock once per emulated second, rather than on every latch
+    if (m_rtc_wall_clock_sync)
     {
-        Timestamp::ExpandedTime base_time_expanded = Timestamp::FromUnixTimestamp(m_rtc_data.base_time).AsExpandedTime();
-        Timestamp::ExpandedTime current_time_expanded = current_time.AsExpandedTime();
-
-        // return the current time
-        out_value.seconds = current_time_expanded.Second;
-        out_value.minutes = current_time_expanded.Minute;
-        out_value.hours = current_time_expanded.Hour;
-        out_value.days = base_time_expanded.DayOfWeek + uint32((current_time_unix - m_rtc_data.base_time) / 86400);
+      Timestamp::UnixTimestampValue current_time = Timestamp::Now().AsUnixTimestamp();
+      if (current_time > m_rtc_wall_time && !m_rtc.halt)
+        AdvanceRTC(current_time - m_rtc_wall_time);
+
+      m_rtc_wall_time = current_time;
     }
+  }
+
+  m_system->SetNextCartridgeSyncCycle(RTC_CLOCKS_PER_SECOND - m_rtc.subsecond_clocks);
+}
 
-    return out_value;
+void Cartridge::SynchronizeRTC()
+{
+  uint32 clocks = m_system->CalculateCycleCount(m_rtc_last_cycle);
+  m_rtc_last_cycle = m_system->GetCycleNumber();
+  if (m_rtc_wall_clock_sync || m_rtc.halt)
+    return;
 
-#endif
+  m_rtc.subsecond_clocks += clocks;
+  if (m_rtc.subsecond_clocks >= RTC_CLOCKS_PER_SECOND)
+  {
+    AdvanceRTC(m_rtc.subsecond_clocks / RTC_CLOCKS_PER_SECOND);
+    m_rtc.subsecond_clocks %= RTC_CLOCKS_PER_SECOND;
+  }
+}
 
-  uint64 diff_time = current_time_unix - m_rtc_data.base_time;
-  diff_time += uint64(m_rtc_data.offset_seconds);
-  diff_time += uint64(m_rtc_data.offset_minutes * 60);
-  diff_time += uint64(m_rtc_data.offset_hours * 3600);
-  diff_time += uint64(m_rtc_data.offset_days * 86400);
+void Cartridge::AdvanceRTC(uint64 seconds)
+{
+  uint64 value = uint64(m_rtc.seconds) + seconds;
+  m_rtc.seconds = uint8(value % 60);
+  value = value / 60 + m_rtc.minutes;
+  m_rtc.minutes = uint8(value % 60);
+  value = value / 60 + m_rtc.hours;
+  m_rtc.hours = uint8(value % 24);
+  value = value / 24 + m_rtc.days;
 
-  // convert to format
-  RTCValue out_value;
-  out_value.seconds = uint32(diff_time % 60);
-  out_value.minutes = uint32((diff_time / 60) % 60);
-  out_value.hours = uint32((diff_time / 3600) % 24);
-  out_value.days = uint32((diff_time / 86400));
-  return out_value;
+  // day counter is 9 bits, the carry bit stays set until cleared by the game
+  if (value >= 512)
+    m_rtc.day_carry = true;
+  m_rtc.days = uint16(value % 512);
 }
 
 void Cartridge::Reset()
 {
-  switch (m_mbc)
-  {
-  case MBC_NONE:
-    MBC_NONE_Reset();
-    break;
-  case MBC_MBC1:
-    MBC_MBC1_Reset();
-    break;
-  case MBC_MBC3:
-    MBC_MBC3_Reset();
-    break;
-  case MBC_MBC5:
-    MBC_MBC5_Reset();
-    break;
-  }
+  // the clock is battery backed, only the cycle counter restarts
+  m_rtc_last_cycle = 0;
+  m_mapper->Reset();
 }
 
 uint8 Cartridge::CPURead(uint16 address)
 {
-  switch (m_mbc)
+  switch (address & 0xF000)
+  {
+    // rom bank 0
+  case 0x0000:
+  case 0x1000:
+  case 0x2000:
+  case 0x3000:
+    return m_mapper->GetROM0Pointer()[address];
+
+    // rom bank 1
+  case 0x4000:
+  case 0x5000:
+  case 0x6000:
+  case 0x7000:
+    return m_mapper->GetROMXPointer()[address & 0x3FFF];
+
+    // eram
+  case 0xA000:
+  case 0xB000:
   {
-  case MBC_NONE:
-    return MBC_NONE_Read(address);
-  case MBC_MBC1:
-    return MBC_MBC1_Read(address);
-  case MBC_MBC3:
-    return MBC_MBC3_Read(address);
-  case MBC_MBC5:
-    return MBC_MBC5_Read(address);
+    const byte* ram = m_mapper->GetRAMPointer();
+    return (ram != nullptr) ? ram[address & 0x1FFF] : m_mapper->ReadRegister(address);
+  }
   }
 
+  Log_WarningPrintf("Unhandled cartridge read from 0x%04X", address);
   return 0x00;
 }
 
 void Cartridge::CPUWrite(uint16 address, uint8 value)
 {
-  switch (m_mbc)
+  if ((address & 0xE000) == 0xA000)
   {
-  case MBC_NONE:
-    return MBC_NONE_Write(address, value);
-  case MBC_MBC1:
-    return MBC_MBC1_Write(address, value);
-  case MBC_MBC3:
-    return MBC_MBC3_Write(address, value);
-  case MBC_MBC5:
-    return MBC_MBC5_Write(address, value);
+    byte* ram = m_mapper->GetRAMPointer();
+    if (ram != nullptr)
+    {
+      if (ram[address & 0x1FFF] != value)
+      {
+        ram[address & 0x1FFF] = value;
+        m_external_ram_modified = true;
+      }
+
+      return;
+    }
   }
+
+  m_mapper->WriteRegister(address, value);
 }
 
-bool Cartridge::LoadState(ByteStream* pStream, BinaryReader& binaryReader, Error* pError)
+void Cartridge::PublishMemoryMap()
 {
-  uint32 crc = binaryReader.ReadUInt32();
-  if (crc != m_crc)
-  {
-    pError->SetErrorUser(1, "CRC mismatch between save state cartridge and this cartridge");
+  // not attached to the system yet, System::Init() resets us
+  if (m_system->m_cartridge != this)
+    return;
+
+  m_system->SetCartridgeMemoryMap(m_mapper->GetROM0Pointer(), m_mapper->GetROMXPointer(), m_mapper->GetRAMPointer());
+  if (m_rom_page_overlays.empty())
+    return;
+
+  // swap in patched pages, this only happens on bank switches
+  for (uint32 i = 0; i < 8; i++)
+  {
+    auto iter = m_rom_page_overlays.find(m_system->m_cartridge_read_map[i]);
+    if (iter != m_rom_page_overlays.end())
+      m_system->m_cartridge_read_map[i] = iter->second;
+  }
+}
+
+void Cartridge::SetROMPageOverlay(const byte* page, const byte* overlay)
+{
+  if (overlay != nullptr)
+    m_rom_page_overlays[page] = overlay;
+  else
+    m_rom_page_overlays.erase(page);
+
+  PublishMemoryMap();
+}
+
+bool Cartridge::LoadState(ByteStream* pStream, BinaryReader& binaryReader, Error* pError)
+{
+  uint32 crc = binaryReader.ReadUInt32();
+  if (crc != m_crc)
+  {
+    pError->SetErrorUser(1, "CRC mismatch between save state cartridge and this cartridge");
     return false;
   }
 
@@ -462,15 +725,23 @@ bool Cartridge::LoadState(ByteStream* pStream, BinaryReader& binaryReader, Error
     binaryReader.ReadBytes(m_external_ram, m_external_ram_size);
 
   bool has_timer = binaryReader.ReadBool();
+  if (has_timer != m_typeinfo->timer)
+  {
+    pError->SetErrorUser(1, "RTC presence mismatch.");
+    return false;
+  }
   if (has_timer)
   {
-    m_rtc_data.base_time = binaryReader.ReadUInt64();
-    m_rtc_data.offset_days = binaryReader.ReadUInt16();
-    m_rtc_data.offset_hours = binaryReader.ReadUInt8();
-    m_rtc_data.offset_minutes = binaryReader.ReadUInt8();
-    m_rtc_data.offset_seconds = binaryReader.ReadUInt8();
-    m_rtc_data.active = binaryReader.ReadBool();
+    m_rtc.subsecond_clocks = binaryReader.ReadUInt32();
+    m_rtc.seconds = binaryReader.ReadUInt8();
+    m_rtc.minutes = binaryReader.ReadUInt8();
+    m_rtc.hours = binaryReader.ReadUInt8();
+    m_rtc.days = binaryReader.ReadUInt16();
+    m_rtc.halt = binaryReader.ReadBool();
+    m_rtc.day_carry = binaryReader.ReadBool();
+    m_rtc_wall_time = Timestamp::Now().AsUnixTimestamp();
   }
+  m_rtc_last_cycle = m_system->GetCycleNumber();
 
   // MBC specific stuff follows
   uint32 ss_mbc = binaryReader.ReadUInt32();
@@ -480,22 +751,7 @@ bool Cartridge::LoadState(ByteStream* pStream, BinaryReader& binaryReader, Error
     return false;
   }
 
-  bool loadResult = false;
-  switch (m_mbc)
-  {
-  case MBC_NONE:
-    loadResult = MBC_NONE_LoadState(pStream, binaryReader);
-    break;
-  case MBC_MBC1:
-    loadResult = MBC_MBC1_LoadState(pStream, binaryReader);
-    break;
-  case MBC_MBC3:
-    loadResult = MBC_MBC3_LoadState(pStream, binaryReader);
-    break;
-  case MBC_MBC5:
-    loadResult = MBC_MBC5_LoadState(pStream, binaryReader);
-    break;
-  }
+  bool loadResult = m_mapper->LoadState(pStream, binaryReader);
   if (!loadResult)
   {
     pError->SetErrorUser(1, "MBC state load error");
@@ -525,681 +781,18 @@ void Cartridge::SaveState(ByteStream* pStream, BinaryWriter& binaryWriter)
   binaryWriter.WriteBool(m_typeinfo->timer);
   if (m_typeinfo->timer)
   {
-    binaryWriter.WriteUInt64(m_rtc_data.base_time);
-    binaryWriter.WriteUInt16(m_rtc_data.offset_days);
-    binaryWriter.WriteUInt8(m_rtc_data.offset_hours);
-    binaryWriter.WriteUInt8(m_rtc_data.offset_minutes);
-    binaryWriter.WriteUInt8(m_rtc_data.offset_seconds);
-    binaryWriter.WriteBool(m_rtc_data.active);
+    SynchronizeRTC();
+    binaryWriter.WriteUInt32(m_rtc.subsecond_clocks);
+    binaryWriter.WriteUInt8(m_rtc.seconds);
+    binaryWriter.WriteUInt8(m_rtc.minutes);
+    binaryWriter.WriteUInt8(m_rtc.hours);
+    binaryWriter.WriteUInt16(m_rtc.days);
+    binaryWriter.WriteBool(m_rtc.halt);
+    binaryWriter.WriteBool(m_rtc.day_carry);
   }
 
   // MBC specific stuff follows
   binaryWriter.WriteUInt32(m_mbc);
-  switch (m_mbc)
-  {
-  case MBC_NONE:
-    MBC_NONE_SaveState(pStream, binaryWriter);
-    break;
-  case MBC_MBC1:
-    MBC_MBC1_SaveState(pStream, binaryWriter);
-    break;
-  case MBC_MBC3:
-    MBC_MBC3_SaveState(pStream, binaryWriter);
-    break;
-  case MBC_MBC5:
-    MBC_MBC5_SaveState(pStream, binaryWriter);
-    break;
-  }
+  m_mapper->SaveState(pStream, binaryWriter);
   binaryWriter.WriteUInt32(~(uint32)m_mbc);
 }
-
-bool Cartridge::MBC_NONE_Init()
-{
-  if (m_num_rom_banks != 2)
-  {
-    Log_ErrorPrint("MBC_NONE expects 2 rom banks");
-    return false;
-  }
-
-  // create external ram
-  if (m_external_ram_size > 0)
-  {
-    m_external_ram = new byte[m_external_ram_size];
-    Y_memzero(m_external_ram, m_external_ram_size);
-  }
-
-  MBC_NONE_Reset();
-  return true;
-}
-
-void Cartridge::MBC_NONE_Reset() {}
-
-uint8 Cartridge::MBC_NONE_Read(uint16 address)
-{
-  // Should have two banks
-  switch (address & 0xF000)
-  {
-    // rom bank 0
-  case 0x0000:
-  case 0x1000:
-  case 0x2000:
-  case 0x3000:
-    return m_rom_banks[0][address];
-
-    // rom bank 1
-  case 0x4000:
-  case 0x5000:
-  case 0x6000:
-  case 0x7000:
-    return m_rom_banks[1][address & 0x3FFF];
-
-    // eram
-  case 0xA000:
-  case 0xB000:
-  {
-    if (m_external_ram != nullptr)
-    {
-      uint16 eram_offset = address - 0xA000;
-      if (eram_offset < m_external_ram_size)
-        return m_external_ram[eram_offset];
-    }
-
-    break;
-  }
-  }
-
-  Log_WarningPrintf("MBC_NONE unhandled read from 0x%04X", address);
-  return 0x00;
-}
-
-void Cartridge::MBC_NONE_Write(uint16 address, uint8 value)
-{
-  if (address >= 0xA000 && address < 0xC000)
-  {
-    if (m_external_ram != nullptr)
-    {
-      uint16 eram_offset = address - 0xA000;
-      if (eram_offset < m_external_ram_size)
-      {
-        m_external_ram[eram_offset] = value;
-        return;
-      }
-    }
-  }
-
-  // ignore all writes
-  Log_WarningPrintf("MBC_NONE unhandled write to 0x%04X (value %02X)", address, value);
-  return;
-}
-
-bool Cartridge::MBC_NONE_LoadState(ByteStream* pStream, BinaryReader& binaryReader)
-{
-  return true;
-}
-
-void Cartridge::MBC_NONE_SaveState(ByteStream* pStream, BinaryWriter& binaryWriter)
-{
-  return;
-}
-
-bool Cartridge::MBC_MBC1_Init()
-{
-  // create external ram
-  if (m_external_ram_size > 0)
-  {
-    m_external_ram = new byte[m_external_ram_size];
-    Y_memzero(m_external_ram, m_external_ram_size);
-  }
-
-  MBC_MBC1_Reset();
-  return true;
-}
-
-void Cartridge::MBC_MBC1_Reset()
-{
-  m_mbc_data.mbc1.ram_enable = false;
-  m_mbc_data.mbc1.bank_mode = 0;
-  m_mbc_data.mbc1.rom_bank_number = 1;
-  m_mbc_data.mbc1.ram_bank_number = 0;
-  MBC_MBC1_UpdateActiveBanks();
-}
-
-uint8 Cartridge::MBC_MBC1_Read(uint16 address)
-{
-  // Should have two banks
-  switch (address & 0xF000)
-  {
-    // rom bank 0
-  case 0x0000:
-  case 0x1000:
-  case 0x2000:
-  case 0x3000:
-    return m_rom_banks[0][address];
-
-    // rom bank 1
-  case 0x4000:
-  case 0x5000:
-  case 0x6000:
-  case 0x7000:
-    return m_rom_banks[m_mbc_data.mbc1.active_rom_bank][address & 0x3FFF];
-
-    // eram
-  case 0xA000:
-  case 0xB000:
-  {
-    if (m_external_ram != nullptr && m_mbc_data.mbc1.ram_enable)
-    {
-      uint16 eram_offset = (uint16)m_mbc_data.mbc1.active_ram_bank * (uint16)8192 + (address - 0xA000);
-      if (eram_offset < m_external_ram_size)
-        return m_external_ram[eram_offset];
-    }
-
-    return 0x00;
-  }
-  }
-
-  Log_WarningPrintf("MBC_MBC1 unhandled read from 0x%04X", address);
-  return 0x00;
-}
-
-void Cartridge::MBC_MBC1_Write(uint16 address, uint8 value)
-{
-  switch (address & 0xF000)
-  {
-  case 0x0000:
-  case 0x1000:
-    m_mbc_data.mbc1.ram_enable = (value == 0x0A);
-    TRACE("MBC1 ram %s", m_mbc_data.mbc1.ram_enable ? "enable" : "disable");
-    if (!m_mbc_data.mbc1.ram_enable && m_external_ram_modified)
-      SaveRAM();
-
-    return;
-
-  case 0x2000:
-  case 0x3000:
-    m_mbc_data.mbc1.rom_bank_number = value;
-    MBC_MBC1_UpdateActiveBanks();
-    return;
-
-  case 0x4000:
-  case 0x5000:
-    m_mbc_data.mbc1.ram_bank_number = value;
-    MBC_MBC1_UpdateActiveBanks();
-    return;
-
-  case 0x6000:
-  case 0x7000:
-    m_mbc_data.mbc1.bank_mode = value;
-    MBC_MBC1_UpdateActiveBanks();
-    return;
-  }
-
-  if (address >= 0xA000 && address < 0xC000)
-  {
-    if (m_external_ram != nullptr && m_mbc_data.mbc1.ram_enable)
-    {
-      uint16 eram_offset = (uint16)m_mbc_data.mbc1.active_ram_bank * (uint16)8192 + (address - 0xA000);
-      if (eram_offset < m_external_ram_size)
-      {
-        if (m_external_ram[eram_offset] != value)
-          m_external_ram_modified = true;
-
-        m_external_ram[eram_offset] = value;
-      }
-    }
-
-    return;
-  }
-
-  // ignore all writes
-  Log_WarningPrintf("MBC_MBC1 unhandled write to 0x%04X (value %02X)", address, value);
-  return;
-}
-
-bool Cartridge::MBC_MBC1_LoadState(ByteStream* pStream, BinaryReader& binaryReader)
-{
-  m_mbc_data.mbc1.active_rom_bank = binaryReader.ReadUInt8();
-  m_mbc_data.mbc1.active_ram_bank = binaryReader.ReadUInt8();
-  m_mbc_data.mbc1.ram_enable = binaryReader.ReadBool();
-  m_mbc_data.mbc1.bank_mode = binaryReader.ReadUInt8();
-  m_mbc_data.mbc1.rom_bank_number = binaryReader.ReadUInt8();
-  m_mbc_data.mbc1.ram_bank_number = binaryReader.ReadUInt8();
-  if (m_mbc_data.mbc1.active_rom_bank >= m_num_rom_banks)
-    return false;
-
-  return true;
-}
-
-void Cartridge::MBC_MBC1_SaveState(ByteStream* pStream, BinaryWriter& binaryWriter)
-{
-  binaryWriter.WriteUInt8(m_mbc_data.mbc1.active_rom_bank);
-  binaryWriter.WriteUInt8(m_mbc_data.mbc1.active_ram_bank);
-  binaryWriter.WriteBool(m_mbc_data.mbc1.ram_enable);
-  binaryWriter.WriteUInt8(m_mbc_data.mbc1.bank_mode);
-  binaryWriter.WriteUInt8(m_mbc_data.mbc1.rom_bank_number);
-  binaryWriter.WriteUInt8(m_mbc_data.mbc1.ram_bank_number);
-}
-
-void Cartridge::MBC_MBC1_UpdateActiveBanks()
-{
-  if (m_mbc_data.mbc1.bank_mode == 0)
-  {
-    m_mbc_data.mbc1.active_ram_bank = 0;
-    m_mbc_data.mbc1.active_rom_bank = (m_mbc_data.mbc1.ram_bank_number << 5) | (m_mbc_data.mbc1.rom_bank_number & 0x1F);
-  }
-  else
-  {
-    m_mbc_data.mbc1.active_ram_bank = m_mbc_data.mbc1.ram_bank_number & 0x03;
-    m_mbc_data.mbc1.active_rom_bank = m_mbc_data.mbc1.rom_bank_number;
-  }
-
-  // "But (when using the register below to specify the upper ROM Bank bits), the same happens for Bank 20h, 40h, and
-  // 60h. Any attempt to address these ROM Banks will select Bank 21h, 41h, and 61h instead."
-  if (m_mbc_data.mbc1.active_rom_bank == 0x00 || m_mbc_data.mbc1.active_rom_bank == 0x20 ||
-      m_mbc_data.mbc1.active_rom_bank == 0x40 || m_mbc_data.mbc1.active_rom_bank == 0x60)
-    m_mbc_data.mbc1.active_rom_bank++;
-
-  // check ranges
-  if (m_mbc_data.mbc1.active_rom_bank >= m_num_rom_banks)
-  {
-    Log_WarningPrintf("ROM bank out of range (%u / %u)", m_mbc_data.mbc1.active_rom_bank, m_num_rom_banks);
-    m_mbc_data.mbc1.active_rom_bank = (uint8)m_num_rom_banks - 1;
-  }
-
-  TRACE("MBC1 ROM bank: %u", m_mbc_data.mbc1.active_rom_bank);
-  TRACE("MBC1 RAM bank: %u", m_mbc_data.mbc1.active_ram_bank);
-}
-
-bool Cartridge::MBC_MBC3_Init()
-{
-  // create external ram
-  if (m_external_ram_size > 0)
-  {
-    m_external_ram = new byte[m_external_ram_size];
-    Y_memzero(m_external_ram, m_external_ram_size);
-  }
-
-  MBC_MBC3_Reset();
-  return true;
-}
-
-void Cartridge::MBC_MBC3_Reset()
-{
-  m_mbc_data.mbc3.rom_bank_number = 1;
-  m_mbc_data.mbc3.ram_bank_number = 0;
-  m_mbc_data.mbc3.ram_rtc_enable = false;
-  MBC_MBC3_UpdateActiveBanks();
-}
-
-uint8 Cartridge::MBC_MBC3_Read(uint16 address)
-{
-  // Should have two banks
-  switch (address & 0xF000)
-  {
-    // rom bank 0
-  case 0x0000:
-  case 0x1000:
-  case 0x2000:
-  case 0x3000:
-    return m_rom_banks[0][address];
-
-    // rom bank 1
-  case 0x4000:
-  case 0x5000:
-  case 0x6000:
-  case 0x7000:
-    return m_rom_banks[m_mbc_data.mbc3.rom_bank_number][address & 0x3FFF];
-
-    // eram
-  case 0xA000:
-  case 0xB000:
-  {
-    if (m_mbc_data.mbc3.ram_rtc_enable)
-    {
-      if (m_mbc_data.mbc3.ram_bank_number <= 0x07)
-      {
-        uint16 eram_offset = (uint16)m_mbc_data.mbc3.ram_bank_number * (uint16)8192 + (address - 0xA000);
-        if (eram_offset < m_external_ram_size)
-          return m_external_ram[eram_offset];
-      }
-      else if (m_mbc_data.mbc3.ram_bank_number >= 0x08 && m_mbc_data.mbc3.ram_bank_number <= 0x0C)
-      {
-        uint8 rtc_register = m_mbc_data.mbc3.ram_bank_number - 0x08;
-        return m_mbc_data.mbc3.rtc_latch_data[rtc_register];
-      }
-    }
-
-    // ram not enabled
-    return 0x00;
-  }
-  }
-
-  Log_WarningPrintf("MBC_MBC3 unhandled read from 0x%04X", address);
-  return 0x00;
-}
-
-void Cartridge::MBC_MBC3_Write(uint16 address, uint8 value)
-{
-  switch (address & 0xF000)
-  {
-  case 0x0000:
-  case 0x1000:
-    m_mbc_data.mbc3.ram_rtc_enable = (value == 0x0A);
-    TRACE("MBC3 ram %s", m_mbc_data.mbc3.ram_rtc_enable ? "enable" : "disable");
-    if (!m_mbc_data.mbc3.ram_rtc_enable && m_external_ram_modified)
-      SaveRAM();
-
-    return;
-
-  case 0x2000:
-  case 0x3000:
-    m_mbc_data.mbc3.rom_bank_number = value & 0x7F;
-    MBC_MBC3_UpdateActiveBanks();
-    return;
-
-  case 0x4000:
-  case 0x5000:
-    m_mbc_data.mbc3.ram_bank_number = value;
-    MBC_MBC3_UpdateActiveBanks();
-    return;
-
-  case 0x6000:
-  case 0x7000:
-  {
-    // When writing 00h, and then 01h to this register, the current time becomes latched into the RTC registers.
-    if (m_mbc_data.mbc3.rtc_latch != 0x01 && value == 0x01)
-    {
-      // Latch the current time
-      RTCValue current_time(GetCurrentRTCTime());
-      m_mbc_data.mbc3.rtc_latch_data[0] = (uint8)current_time.seconds;       // 0x08
-      m_mbc_data.mbc3.rtc_latch_data[1] = (uint8)current_time.minutes;       // 0x09
-      m_mbc_data.mbc3.rtc_latch_data[2] = (uint8)current_time.hours;         // 0x0A
-      m_mbc_data.mbc3.rtc_latch_data[3] = (uint8)(current_time.days & 0xFF); // 0x0B
-      m_mbc_data.mbc3.rtc_latch_data[4] = (uint8)((current_time.days >> 8) & 0x01);
-      m_mbc_data.mbc3.rtc_latch_data[4] |= ((uint8)(current_time.days >= 512) << 7); // 0x0C
-    }
-
-    // Update value
-    m_mbc_data.mbc3.rtc_latch = value;
-    return;
-  }
-  }
-
-  if (address >= 0xA000 && address < 0xC000)
-  {
-    if (m_mbc_data.mbc3.ram_rtc_enable)
-    {
-      if (m_mbc_data.mbc3.ram_bank_number <= 0x07)
-      {
-        uint16 eram_offset = (uint16)m_mbc_data.mbc3.ram_bank_number * (uint16)8192 + (address - 0xA000);
-        if (eram_offset < m_external_ram_size)
-        {
-          if (m_external_ram[eram_offset] != value)
-            m_external_ram_modified = true;
-
-          m_external_ram[eram_offset] = value;
-        }
-      }
-      else if (m_mbc_data.mbc3.ram_bank_number >= 0x08 && m_mbc_data.mbc3.ram_bank_number <= 0x0C)
-      {
-        // RTC
-        TRACE("RTC register write 0x%02X - 0x%02X (%u)", m_mbc_data.mbc3.ram_bank_number, value, value);
-        switch (m_mbc_data.mbc3.ram_bank_number)
-        {
-        case 0x08:
-        {
-          if (m_rtc_data.offset_seconds != value)
-          {
-            m_rtc_data.offset_seconds = value;
-            SaveRTC();
-          }
-
-          return;
-        }
-
-        case 0x09:
-        {
-          if (m_rtc_data.offset_minutes != value)
-          {
-            m_rtc_data.offset_minutes = value;
-            SaveRTC();
-          }
-
-          return;
-        }
-
-        case 0x0A:
-        {
-          if (m_rtc_data.offset_hours != value)
-          {
-            m_rtc_data.offset_hours = value;
-            SaveRTC();
-          }
-
-          return;
-        }
-
-        case 0x0B:
-        {
-          uint16 new_offset_days = (m_rtc_data.offset_days & 0x300) | (uint16)value;
-          if (new_offset_days != m_rtc_data.offset_days)
-          {
-            m_rtc_data.offset_days = new_offset_days;
-            SaveRTC();
-          }
-
-          return;
-        }
-
-        case 0x0C:
-        {
-          uint16 new_offset_days =
-            (m_rtc_data.offset_days & 0xFF) | (uint16(value & 0x01) << 8) | (uint16(value & 0x80) << 2);
-          if (new_offset_days != m_rtc_data.offset_days)
-          {
-            m_rtc_data.offset_days = new_offset_days;
-            SaveRTC();
-          }
-
-          // disabling of timer not currently implemented.
-          bool new_active = !(value & (1 << 6));
-          m_rtc_data.active = new_active;
-          return;
-        }
-        }
-      }
-    }
-
-    // ram not enabled
-    return;
-  }
-
-  // ignore all writes
-  Log_WarningPrintf("MBC_MBC3 unhandled write to 0x%04X (value %02X)", address, value);
-  return;
-}
-
-bool Cartridge::MBC_MBC3_LoadState(ByteStream* pStream, BinaryReader& binaryReader)
-{
-  m_mbc_data.mbc3.rom_bank_number = binaryReader.ReadUInt8();
-  m_mbc_data.mbc3.ram_bank_number = binaryReader.ReadUInt8();
-  m_mbc_data.mbc3.ram_rtc_enable = binaryReader.ReadBool();
-  if (m_mbc_data.mbc3.rom_bank_number >= m_num_rom_banks)
-    return false;
-
-  return true;
-}
-
-void Cartridge::MBC_MBC3_SaveState(ByteStream* pStream, BinaryWriter& binaryWriter)
-{
-  binaryWriter.WriteUInt8(m_mbc_data.mbc3.rom_bank_number);
-  binaryWriter.WriteUInt8(m_mbc_data.mbc3.ram_bank_number);
-  binaryWriter.WriteBool(m_mbc_data.mbc3.ram_rtc_enable);
-}
-
-void Cartridge::MBC_MBC3_UpdateActiveBanks()
-{
-  // Same as for MBC1, except that the whole 7 bits of the RAM Bank Number are written directly to this address. As for
-  // the MBC1, writing a value of 00h, will select Bank 01h instead. All other values 01-7Fh select the corresponding
-  // ROM Banks.
-  if (m_mbc_data.mbc3.rom_bank_number == 0x00)
-    m_mbc_data.mbc3.rom_bank_number++;
-
-  // check ranges
-  if (m_mbc_data.mbc3.rom_bank_number >= m_num_rom_banks)
-  {
-    Log_WarningPrintf("ROM bank out of range (%u / %u)", m_mbc_data.mbc3.rom_bank_number, m_num_rom_banks);
-    m_mbc_data.mbc3.rom_bank_number = (uint8)m_num_rom_banks - 1;
-  }
-
-  TRACE("MBC3 ROM bank: %u", m_mbc_data.mbc3.rom_bank_number);
-  TRACE("MBC3 RAM bank: %u", m_mbc_data.mbc3.ram_bank_number);
-}
-
-bool Cartridge::MBC_MBC5_Init()
-{
-  // create external ram
-  if (m_external_ram_size > 0)
-  {
-    m_external_ram = new byte[m_external_ram_size];
-    Y_memzero(m_external_ram, m_external_ram_size);
-  }
-
-  MBC_MBC5_Reset();
-  return true;
-}
-
-void Cartridge::MBC_MBC5_Reset()
-{
-  m_mbc_data.mbc5.rom_bank_number = 1;
-  m_mbc_data.mbc5.ram_bank_number = 0;
-  m_mbc_data.mbc5.ram_enable = false;
-  MBC_MBC5_UpdateActiveBanks();
-}
-
-uint8 Cartridge::MBC_MBC5_Read(uint16 address)
-{
-  // Should have two banks
-  switch (address & 0xF000)
-  {
-    // rom bank 0
-  case 0x0000:
-  case 0x1000:
-  case 0x2000:
-  case 0x3000:
-    return m_rom_banks[0][address];
-
-    // rom bank 1
-  case 0x4000:
-  case 0x5000:
-  case 0x6000:
-  case 0x7000:
-    return m_rom_banks[m_mbc_data.mbc5.active_rom_bank][address & 0x3FFF];
-
-    // eram
-  case 0xA000:
-  case 0xB000:
-  {
-    if (m_mbc_data.mbc5.ram_enable)
-    {
-      uint16 eram_offset = (uint16)m_mbc_data.mbc5.ram_bank_number * (uint16)8192 + (address - 0xA000);
-      if (eram_offset < m_external_ram_size)
-        return m_external_ram[eram_offset];
-    }
-
-    // ram not enabled
-    return 0x00;
-  }
-  }
-
-  Log_WarningPrintf("MBC_MBC5 unhandled read from 0x%04X", address);
-  return 0x00;
-}
-
-void Cartridge::MBC_MBC5_Write(uint16 address, uint8 value)
-{
-  switch (address & 0xF000)
-  {
-  case 0x0000:
-  case 0x1000:
-    m_mbc_data.mbc5.ram_enable = (value == 0x0A);
-    TRACE("MBC5 ram %s", m_mbc_data.mbc5.ram_enable ? "enable" : "disable");
-    if (!m_mbc_data.mbc5.ram_enable && m_external_ram_modified)
-      SaveRAM();
-
-    return;
-
-  case 0x2000:
-    m_mbc_data.mbc5.rom_bank_number = (m_mbc_data.mbc5.rom_bank_number & 0x100) | (uint16)value;
-    MBC_MBC5_UpdateActiveBanks();
-    return;
-
-  case 0x3000:
-    m_mbc_data.mbc5.rom_bank_number = (m_mbc_data.mbc5.rom_bank_number & 0xFF) | ((uint16)(value & 0x01) << 8);
-    MBC_MBC5_UpdateActiveBanks();
-    return;
-
-  case 0x4000:
-  case 0x5000:
-    m_mbc_data.mbc5.ram_bank_number = value;
-    MBC_MBC5_UpdateActiveBanks();
-    return;
-  }
-
-  if (address >= 0xA000 && address < 0xC000)
-  {
-    if (m_mbc_data.mbc5.ram_enable)
-    {
-      uint16 eram_offset = (uint16)m_mbc_data.mbc5.ram_bank_number * (uint16)8192 + (address - 0xA000);
-      if (eram_offset < m_external_ram_size)
-      {
-        if (m_external_ram[eram_offset] != value)
-          m_external_ram_modified = true;
-
-        m_external_ram[eram_offset] = value;
-      }
-    }
-
-    // ram not enabled
-    return;
-  }
-
-  // ignore all writes
-  Log_WarningPrintf("MBC_MBC5 unhandled write to 0x%04X (value %02X)", address, value);
-  return;
-}
-
-bool Cartridge::MBC_MBC5_LoadState(ByteStream* pStream, BinaryReader& binaryReader)
-{
-  m_mbc_data.mbc5.active_rom_bank = binaryReader.ReadUInt16();
-  m_mbc_data.mbc5.rom_bank_number = binaryReader.ReadUInt16();
-  m_mbc_data.mbc5.ram_bank_number = binaryReader.ReadUInt8();
-  m_mbc_data.mbc5.ram_enable = binaryReader.ReadBool();
-  if (m_mbc_data.mbc5.active_rom_bank >= m_num_rom_banks)
-    return false;
-
-  return true;
-}
-
-void Cartridge::MBC_MBC5_SaveState(ByteStream* pStream, BinaryWriter& binaryWriter)
-{
-  binaryWriter.WriteUInt16(m_mbc_data.mbc5.active_rom_bank);
-  binaryWriter.WriteUInt16(m_mbc_data.mbc5.rom_bank_number);
-  binaryWriter.WriteUInt8(m_mbc_data.mbc5.ram_bank_number);
-  binaryWriter.WriteBool(m_mbc_data.mbc5.ram_enable);
-}
-
-void Cartridge::MBC_MBC5_UpdateActiveBanks()
-{
-  // Same as for MBC1, except that accessing up to bank 1E0h is supported now. Also, bank 0 is actually bank 0.
-  m_mbc_data.mbc5.active_rom_bank = m_mbc_data.mbc5.rom_bank_number;
-  if (m_mbc_data.mbc5.active_rom_bank >= m_num_rom_banks)
-  {
-    // since this is written as two different values, provided PC isn't in cart space,
-    // it may be temporarily out of range, and this is okay, it'll be fixed afterwards
-    m_mbc_data.mbc5.active_rom_bank = (uint8)m_num_rom_banks - 1;
-  }
-
-  TRACE("MBC5 ROM bank: %u", m_mbc_data.mbc5.rom_bank_number);
-  TRACE("MBC5 RAM bank: %u", m_mbc_data.mbc5.ram_bank_number);
-}
@@ -3,7 +3,10 @@
 #include "YBaseLib/Common.h"
 #include "YBaseLib/String.h"
 #include "YBaseLib/Timestamp.h"
+#include "memory_arena.h"
+#include "rom_profile.h"
 #include "structures.h"
+#include <unordered_map>
 
 class ByteStream;
 class BinaryReader;
@@ -11,8 +14,11 @@ class BinaryWriter;
 class Error;
 
 class System;
+class Mapper;
+class ROMArchiveReader;
 
 #define ROM_BANK_SIZE (16384)
+#define RAM_BANK_SIZE (8192)
 #define MAX_NUM_ROM_BANKS (4096)
 
 enum MBC
@@ -38,9 +44,21 @@ struct CartridgeTypeInfo
   const char* description;
 };
 
+// header fields decoded without loading the rom
+struct CartridgeHeaderInfo
+{
+  String name;
+  const CartridgeTypeInfo* typeinfo;
+  uint32 num_rom_banks;
+  uint32 external_ram_size;
+  SYSTEM_MODE system_mode;
+  uint8 cgb_flag;
+};
+
 class Cartridge
 {
   friend System;
+  friend Mapper;
 
 public:
   Cartridge(System* system);
@@ -50,6 +68,7 @@ public:
   const MBC GetMBC() const { return m_mbc; }
   const SYSTEM_MODE GetSystemMode() const { return m_system_mode; }
   const uint32 GetExternalRAMSize() const { return m_external_ram_size; }
+  const uint32 GetCRC() const { return m_crc; }
   const CartridgeTypeInfo* GetTypeInfo() const { return m_typeinfo; }
 
   const byte* GetROMBank(uint32 bank) const
@@ -58,16 +77,50 @@ public:
     return m_rom_banks[bank];
   }
   const uint32 GetROMBankCount() const { return m_num_rom_banks; }
+  bool IsMemoryHugePageBacked() const { return m_memory.IsHugePageBacked(); }
+
+  // profiles are read from and written to this directory, none are kept if it isn't set before loading
+  void SetProfileDirectory(const char* directory) { m_profile_directory = directory; }
+  ROMProfile* GetProfile() { return &m_profile; }
+  const ROMProfile* GetProfile() const { return &m_profile; }
+
+  // adds the frames run since the last save to the profile, and writes it if anything changed
+  void SaveProfile();
 
   bool Load(ByteStream* pStream, Error* pError);
 
+  // loads from a compressed image, decompressing sequentially into the rom banks
+  bool LoadFromArchive(ROMArchiveReader* pReader, Error* pError);
+
+  // decodes the header at CART_HEADER_OFFSET, fails on unsupported type or size codes
+  static bool DecodeHeader(const CART_HEADER* header, CartridgeHeaderInfo* info, Error* pError);
+  static const char* GetMBCName(MBC mbc);
+
+  // re-read external ram and the clock from the battery files, e.g. after restoring a cached state
+  void ReloadBatteryData();
+
+  // write external ram (if modified) and the clock to the battery files, e.g. before snapshotting the session
+  void FlushBatteryData();
+
+  // Substitutes overlay for the 4KB rom page starting at page wherever it is mapped, or restores the original if
+  // overlay is null. The rom banks themselves are never modified.
+  void SetROMPageOverlay(const byte* page, const byte* overlay);
+
   // CPU Reads/Writes
   void Reset();
   uint8 CPURead(uint16 address);
   void CPUWrite(uint16 address, uint8 value);
 
+  // When enabled, the RTC follows the host clock (catching up on time spent outside the emulator), otherwise it only
+  // counts emulated time, which keeps fast-forward and headless runs deterministic.
+  bool GetRTCWallClockSync() const { return m_rtc_wall_clock_sync; }
+  void SetRTCWallClockSync(bool enabled);
+
 private:
   bool ParseHeader(ByteStream* pStream, Error* pError);
+  bool ApplyHeader(const CART_HEADER* header, Error* pError);
+  bool CreateMemoryArena(uint32 bank_table_size, Error* pError);
+  bool CreateMemoryAndMapper(Error* pError);
 
   // state saving
   bool LoadState(ByteStream* pStream, BinaryReader& binaryReader, Error* pError);
@@ -76,6 +129,15 @@ private:
   void SaveRAM();
   void LoadRTC();
   void SaveRTC();
+  void LoadProfile();
+
+  // pass the mapper's current windows to the system memory map
+  void PublishMemoryMap();
+
+  // RTC tick, scheduled once per emulated second
+  void Synchronize();
+  void SynchronizeRTC();
+  void AdvanceRTC(uint64 seconds);
 
   System* m_system;
 
@@ -86,6 +148,9 @@ private:
 
   const CartridgeTypeInfo* m_typeinfo;
 
+  // rom banks and external ram share one contiguous block
+  MemoryArena m_memory;
+
   byte** m_rom_banks;
   uint32 m_num_rom_banks;
 
@@ -93,92 +158,33 @@ private:
   uint32 m_external_ram_size;
   bool m_external_ram_modified;
 
-  // MBC data
-  union
-  {
-    struct
-    {
-      uint8 active_rom_bank;
-      uint8 active_ram_bank;
-
-      bool ram_enable;
-      uint8 bank_mode;
-      uint8 rom_bank_number;
-      uint8 ram_bank_number;
-    } mbc1;
-
-    struct
-    {
-      uint8 rom_bank_number;
-      uint8 ram_bank_number;
-      bool ram_rtc_enable;
-
-      uint8 rtc_latch;
-      uint8 rtc_latch_data[5];
-    } mbc3;
-
-    struct
-    {
-      uint16 active_rom_bank;
-      uint16 rom_bank_number;
-      uint8 ram_bank_number;
-      bool ram_enable;
-    } mbc5;
-  } m_mbc_data;
-
-  // RTC calculator
-  struct RTCValue
-  {
-    uint32 seconds;
-    uint32 minutes;
-    uint32 hours;
-    uint32 days;
-  };
-  RTCValue GetCurrentRTCTime() const;
-
-  // RTC data
+  // memory bank controller
+  Mapper* m_mapper;
+
+  // learned facts about this rom
+  ROMProfile m_profile;
+  String m_profile_directory;
+  String m_profile_filename;
+  uint32 m_profile_frame_base;
+
+  // patched copies of rom pages, keyed by the original page
+  std::unordered_map<const byte*, const byte*> m_rom_page_overlays;
+
+  // RTC counters, in register format
   struct
   {
-    Timestamp::UnixTimestampValue base_time;
-    uint8 offset_seconds;
-    uint8 offset_minutes;
-    uint8 offset_hours;
-    uint16 offset_days;
-    bool active;
-  } m_rtc_data;
-
-  // MBC_NONE
-  bool MBC_NONE_Init();
-  void MBC_NONE_Reset();
-  uint8 MBC_NONE_Read(uint16 address);
-  void MBC_NONE_Write(uint16 address, uint8 value);
-  bool MBC_NONE_LoadState(ByteStream* pStream, BinaryReader& binaryReader);
-  void MBC_NONE_SaveState(ByteStream* pStream, BinaryWriter& binaryWriter);
-
-  // MBC_MBC1
-  bool MBC_MBC1_Init();
-  void MBC_MBC1_Reset();
-  uint8 MBC_MBC1_Read(uint16 address);
-  void MBC_MBC1_Write(uint16 address, uint8 value);
-  bool MBC_MBC1_LoadState(ByteStream* pStream, BinaryReader& binaryReader);
-  void MBC_MBC1_SaveState(ByteStream* pStream, BinaryWriter& binaryWriter);
-  void MBC_MBC1_UpdateActiveBanks();
-
-  // MBC_MBC3
-  bool MBC_MBC3_Init();
-  void MBC_MBC3_Reset();
-  uint8 MBC_MBC3_Read(uint16 address);
-  void MBC_MBC3_Write(uint16 address, uint8 value);
-  bool MBC_MBC3_LoadState(ByteStream* pStream, BinaryReader& binaryReader);
-  void MBC_MBC3_SaveState(ByteStream* pStream, BinaryWriter& binaryWriter);
-  void MBC_MBC3_UpdateActiveBanks();
-
-  // MBC_MBC5
-  bool MBC_MBC5_Init();
-  void MBC_MBC5_Reset();
-  uint8 MBC_MBC5_Read(uint16 address);
-  void MBC_MBC5_Write(uint16 address, uint8 value);
-  bool MBC_MBC5_LoadState(ByteStream* pStream, BinaryReader& binaryReader);
-  void MBC_MBC5_SaveState(ByteStream* pStream, BinaryWriter& binaryWriter);
-  void MBC_MBC5_UpdateActiveBanks();
+    uint32 subsecond_clocks;
+    uint8 seconds;
+    uint8 minutes;
+    uint8 hours;
+    uint16 days;
+    bool halt;
+    bool day_carry;
+  } m_rtc;
+
+  // host time the counters were last synced to, in wall clock mode
+  Timestamp::UnixTimestampValue m_rtc_wall_time;
+  uint32 m_rtc_last_cycle;
+  bool m_rtc_wall_clock_sync;
+  bool m_rtc_modified;
 };
@@ -0,0 +1,252 @@
+#include "cheats.h"
+#include "YBaseLib/Error.h"
+#include "YBaseLib/Log.h"
+#include "cartridge.h"
+#include "system.h"
+#include <algorithm>
+Log_SetChannel(CheatEngine);
+
+static const uint32 ROM_PAGE_SIZE = 0x1000;
+static const uint32 ROM_PAGES_PER_BANK = ROM_BANK_SIZE / ROM_PAGE_SIZE;
+
+static int32 HexDigitValue(char ch)
+{
+  if (ch >= '0' && ch <= '9')
+    return ch - '0';
+  else if (ch >= 'A' && ch <= 'F')
+    return ch - 'A' + 10;
+  else if (ch >= 'a' && ch <= 'f')
+    return ch - 'a' + 10;
+  else
+    return -1;
+}
+
+// collects the hex digits of a code, ignoring dashes and spaces
+static bool GetCodeDigits(const char* text, uint8* digits, uint32 max_digits, uint32* num_digits)
+{
+  *num_digits = 0;
+  for (; *text != '\0'; text++)
+  {
+    if (*text == '-' || *text == ' ')
+      continue;
+
+    int32 value = HexDigitValue(*text);
+    if (value < 0 || *num_digits == max_digits)
+      return false;
+
+    digits[(*num_digits)++] = static_cast<uint8>(value);
+  }
+
+  return true;
+}
+
+CheatEngine::CheatEngine(System* system) : m_system(system), m_num_enabled_ram_codes(0) {}
+
+CheatEngine::~CheatEngine()
+{
+  // the cartridge may already be gone, so only free our copies
+  for (auto& it : m_patched_rom_pages)
+    delete[] it.second;
+}
+
+bool CheatEngine::ParseGameGenieCode(const char* text, Code* code)
+{
+  // ABC-DEF-GHI: AB = value, FCDE ^ F000 = address, GI ror 2 ^ BA = compare, H unused
+  uint8 d[9];
+  uint32 count;
+  if (!GetCodeDigits(text, d, countof(d), &count) || (count != 6 && count != 9))
+    return false;
+
+  code->type = CODE_TYPE_GAME_GENIE;
+  code->value = uint8((d[0] << 4) | d[1]);
+  code->address = uint16(((d[5] ^ 0xF) << 12) | (d[2] << 8) | (d[3] << 4) | d[4]);
+  code->has_compare = (count == 9);
+  code->compare = 0;
+  code->gameshark_type = 0;
+  if (code->has_compare)
+  {
+    uint8 compare = uint8((d[6] << 4) | d[8]);
+    code->compare = uint8(((compare >> 2) | (compare << 6)) ^ 0xBA);
+  }
+
+  // game genie only sits on the rom bus
+  return (code->address < 0x8000);
+}
+
+bool CheatEngine::ParseGameSharkCode(const char* text, Code* code)
+{
+  // TTVVLLHH: type, value, address low, address high
+  uint8 d[8];
+  uint32 count;
+  if (!GetCodeDigits(text, d, countof(d), &count) || count != 8)
+    return false;
+
+  code->type = CODE_TYPE_GAMESHARK;
+  code->gameshark_type = uint8((d[0] << 4) | d[1]);
+  code->value = uint8((d[2] << 4) | d[3]);
+  code->address = uint16((d[6] << 12) | (d[7] << 8) | (d[4] << 4) | d[5]);
+  code->compare = 0;
+  code->has_compare = false;
+  return true;
+}
+
+bool CheatEngine::AddCode(const char* text, Error* pError)
+{
+  Code code;
+  code.text = text;
+  code.enabled = false;
+  if (!ParseGameSharkCode(text, &code) && !ParseGameGenieCode(text, &code))
+  {
+    pError->SetErrorUserFormatted(1, "'%s' is not a Game Genie or GameShark code", text);
+    return false;
+  }
+
+  if (code.type == CODE_TYPE_GAME_GENIE && m_system->GetCartridge() == nullptr)
+  {
+    pError->SetErrorUser(1, "Game Genie codes need a cartridge");
+    return false;
+  }
+
+  if (code.type == CODE_TYPE_GAME_GENIE)
+  {
+    Log_InfoPrintf("Added Game Genie code %s: %02X -> %04X (compare %s%02X)", text, code.value, code.address,
+                   code.has_compare ? "" : "none ", code.compare);
+  }
+  else
+  {
+    Log_InfoPrintf("Added GameShark code %s: %02X -> %04X (type %02X)", text, code.value, code.address,
+                   code.gameshark_type);
+  }
+
+  m_codes.push_back(code);
+  SetCodeEnabled(GetCodeCount() - 1, true);
+  return true;
+}
+
+void CheatEngine::RemoveCode(uint32 index)
+{
+  DebugAssert(index < m_codes.size());
+  SetCodeEnabled(index, false);
+  m_codes.erase(m_codes.begin() + index);
+}
+
+void CheatEngine::RemoveAllCodes()
+{
+  while (!m_codes.empty())
+    RemoveCode(GetCodeCount() - 1);
+}
+
+void CheatEngine::SetCodeEnabled(uint32 index, bool enabled)
+{
+  DebugAssert(index < m_codes.size());
+  Code& code = m_codes[index];
+  if (code.enabled == enabled)
+    return;
+
+  code.enabled = enabled;
+  if (code.type == CODE_TYPE_GAMESHARK)
+  {
+    m_num_enabled_ram_codes = enabled ? (m_num_enabled_ram_codes + 1) : (m_num_enabled_ram_codes - 1);
+    return;
+  }
+
+  // only the pages this code lands on need rebuilding
+  std::vector<uint32> pages;
+  GetAffectedROMPages(code, &pages);
+  for (uint32 page_key : pages)
+    RebuildROMPage(page_key);
+}
+
+void CheatEngine::GetAffectedROMPages(const Code& code, std::vector<uint32>* pages) const
+{
+  const Cartridge* cartridge = m_system->GetCartridge();
+  uint32 offset = code.address & (ROM_BANK_SIZE - 1);
+  uint32 page = offset / ROM_PAGE_SIZE;
+
+  // 0000-3FFF is always bank 0, 4000-7FFF is any switchable bank, narrowed by the compare value
+  uint32 first_bank = (code.address < 0x4000) ? 0 : 1;
+  uint32 last_bank = (code.address < 0x4000) ? 1 : cartridge->GetROMBankCount();
+  for (uint32 bank = first_bank; bank < last_bank; bank++)
+  {
+    if (!code.has_compare || cartridge->GetROMBank(bank)[offset] == code.compare)
+      pages->push_back(bank * ROM_PAGES_PER_BANK + page);
+  }
+}
+
+bool CheatEngine::CodeAffectsROMPage(const Code& code, uint32 page_key) const
+{
+  uint32 bank = page_key / ROM_PAGES_PER_BANK;
+  uint32 offset = code.address & (ROM_BANK_SIZE - 1);
+  if ((offset / ROM_PAGE_SIZE) != (page_key % ROM_PAGES_PER_BANK) || (bank == 0) != (code.address < 0x4000))
+    return false;
+
+  // compare against the original rom, not a previous patch
+  return (!code.has_compare || m_system->GetCartridge()->GetROMBank(bank)[offset] == code.compare);
+}
+
+void CheatEngine::RebuildROMPage(uint32 page_key)
+{
+  Cartridge* cartridge = m_system->GetCartridge();
+  const byte* original_page =
+    cartridge->GetROMBank(page_key / ROM_PAGES_PER_BANK) + (page_key % ROM_PAGES_PER_BANK) * ROM_PAGE_SIZE;
+
+  // the shared rom image is never modified, patches go into a private copy of the page
+  byte* patched_page = nullptr;
+  for (const Code& code : m_codes)
+  {
+    if (!code.enabled || code.type != CODE_TYPE_GAME_GENIE || !CodeAffectsROMPage(code, page_key))
+      continue;
+
+    if (patched_page == nullptr)
+    {
+      auto iter = m_patched_rom_pages.find(page_key);
+      if (iter != m_patched_rom_pages.end())
+      {
+        patched_page = iter->second;
+      }
+      else
+      {
+        patched_page = new byte[ROM_PAGE_SIZE];
+        m_patched_rom_pages[page_key] = patched_page;
+      }
+
+      Y_memcpy(patched_page, original_page, ROM_PAGE_SIZE);
+    }
+
+    patched_page[code.address & (ROM_PAGE_SIZE - 1)] = code.value;
+  }
+
+  if (patched_page != nullptr)
+  {
+    cartridge->SetROMPageOverlay(original_page, patched_page);
+    return;
+  }
+
+  // no codes left on this page, go back to the original
+  auto iter = m_patched_rom_pages.find(page_key);
+  if (iter != m_patched_rom_pages.end())
+  {
+    cartridge->SetROMPageOverlay(original_page, nullptr);
+    delete[] iter->second;
+    m_patched_rom_pages.erase(iter);
+  }
+}
+
+void CheatEngine::ApplyRAMCodes()
+{
+  if (m_num_enabled_ram_codes == 0)
+    return;
+
+  for (const Code& code : m_codes)
+  {
+    if (!code.enabled || code.type != CODE_TYPE_GAMESHARK)
+      continue;
+
+    // 0x9X selects wram bank X for D000-DFFF, with bank 0 meaning bank 1 as in the register
+    uint8 wram_bank = 0;
+    if ((code.gameshark_type & 0xF0) == 0x90)
+      wram_bank = Max(uint8(code.gameshark_type & 0x07), uint8(1));
+
+    m_system->CheatWriteMemory(code.address, code.value, wram_bank);
+  }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "YBaseLib/Common.h"
+#include "YBaseLib/String.h"
+#include <unordered_map>
+#include <vector>
+
+class Error;
+class System;
+
+// Game Genie and GameShark codes.
+// Game Genie codes patch rom. Each 4KB rom page touched by an enabled code gets a patched copy, which the cartridge
+// substitutes into the memory map in place of the original page, so reads still go through the page table and
+// unpatched pages are untouched. Changing a code only rebuilds the pages it touches.
+// GameShark codes write ram, and are applied once per frame when the display enters vblank.
+class CheatEngine
+{
+public:
+  enum CODE_TYPE
+  {
+    CODE_TYPE_GAME_GENIE,
+    CODE_TYPE_GAMESHARK
+  };
+
+  struct Code
+  {
+    String text;
+    CODE_TYPE type;
+    uint16 address;
+    uint8 value;
+
+    // game genie: patch only applies where the original byte matches
+    uint8 compare;
+    bool has_compare;
+
+    // gameshark: 0x01 writes to the current wram bank, 0x9X writes to wram bank X
+    uint8 gameshark_type;
+
+    bool enabled;
+  };
+
+  CheatEngine(System* system);
+  ~CheatEngine();
+
+  uint32 GetCodeCount() const { return static_cast<uint32>(m_codes.size()); }
+  const Code& GetCode(uint32 index) const { return m_codes[index]; }
+
+  // accepts ABC-DEF, ABC-DEF-GHI (game genie) or 8 hex digits (gameshark), enabled on success
+  bool AddCode(const char* text, Error* pError);
+  void RemoveCode(uint32 index);
+  void SetCodeEnabled(uint32 index, bool enabled);
+  void RemoveAllCodes();
+
+  // called by the display at the start of vblank
+  void ApplyRAMCodes();
+
+private:
+  static bool ParseGameGenieCode(const char* text, Code* code);
+  static bool ParseGameSharkCode(const char* text, Code* code);
+
+  // rom pages are identified by bank * 4 + page within the bank
+  void GetAffectedROMPages(const Code& code, std::vector<uint32>* pages) const;
+  bool CodeAffectsROMPage(const Code& code, uint32 page_key) const;
+  void RebuildROMPage(uint32 page_key);
+
+  System* m_system;
+  std::vector<Code> m_codes;
+  std::unordered_map<uint32, byte*> m_patched_rom_pages;
+  uint32 m_num_enabled_ram_codes;
+};
@@ -0,0 +1,656 @@
+#include "control_server.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Error.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/Timer.h"
+#include "cartridge.h"
+#include "display.h"
+#include "state_snapshot.h"
+Log_SetChannel(ControlServer);
+
+#ifndef Y_PLATFORM_WINDOWS
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// frames are stepped to the next vblank, or a frame's worth of clocks while the lcd is off
+static const uint64 FRAME_CLOCKS = 70224;
+
+// anything larger is a broken client
+static const uint32 MAX_MESSAGE_SIZE = 16 * 1024 * 1024;
+static const uint32 MAX_PEEK_SIZE = 1024 * 1024;
+
+// pipelined requests are all sent before any response is read, so both directions have to fit in the socket buffers
+static const uint32 MAX_BENCHMARK_ITERATIONS = 4096;
+
+static const uint32 FRAMEBUFFER_ROW_STRIDE = Display::SCREEN_WIDTH * 4;
+static const uint32 FRAMEBUFFER_FILE_SIZE =
+  CONTROL_FRAMEBUFFER_PIXELS_OFFSET + FRAMEBUFFER_ROW_STRIDE * Display::SCREEN_HEIGHT;
+
+static uint16 ReadUInt16(const byte* data)
+{
+  uint16 value;
+  Y_memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint32 ReadUInt32(const byte* data)
+{
+  uint32 value;
+  Y_memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+template<typename T>
+static void AppendValue(std::vector<byte>* buffer, T value)
+{
+  size_t offset = buffer->size();
+  buffer->resize(offset + sizeof(value));
+  Y_memcpy(buffer->data() + offset, &value, sizeof(value));
+}
+
+ControlServer::ControlServer()
+  : m_system(nullptr), m_listen_fd(-1), m_client_fd(-1), m_quit_requested(false), m_framebuffer_mapping(nullptr),
+    m_frame_pixels(nullptr), m_frame_row_stride(0), m_frame_number(0)
+{
+  for (uint32 i = 0; i < NUM_SLOTS; i++)
+    m_slots[i] = nullptr;
+}
+
+ControlServer::~ControlServer()
+{
+  Close();
+}
+
+#ifdef Y_PLATFORM_WINDOWS
+
+bool ControlServer::Open(const char* socket_path, System* system, Error* pError)
+{
+  pError->SetErrorUser(1, "The control server needs unix domain sockets, which this platform doesn't support");
+  return false;
+}
+
+void ControlServer::Close() {}
+
+void ControlServer::Poll(uint32 timeout_ms) {}
+
+void ControlServer::AcceptClient() {}
+
+void ControlServer::DisconnectClient() {}
+
+void ControlServer::ReadClient() {}
+
+bool ControlServer::RunBenchmark(const char* socket_path, uint32 iterations, Error* pError)
+{
+  pError->SetErrorUser(1, "The control server needs unix domain sockets, which this platform doesn't support");
+  return false;
+}
+
+#else
+
+static bool MakeSocketAddress(const char* path, sockaddr_un* address)
+{
+  uint32 length = Y_strlen(path);
+  if (length >= sizeof(address->sun_path))
+    return false;
+
+  Y_memzero(address, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  Y_memcpy(address->sun_path, path, length + 1);
+  return true;
+}
+
+bool ControlServer::Open(const char* socket_path, System* system, Error* pError)
+{
+  Close();
+
+  sockaddr_un address;
+  if (!MakeSocketAddress(socket_path, &address))
+  {
+    pError->SetErrorUserFormatted(1, "Socket path '%s' is too long", socket_path);
+    return false;
+  }
+
+  // a previous run which didn't shut down cleanly leaves its socket file behind
+  unlink(socket_path);
+  m_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (m_listen_fd < 0 || bind(m_listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+      listen(m_listen_fd, 1) != 0)
+  {
+    pError->SetErrorUserFormatted(1, "Could not listen on '%s'", socket_path);
+    Close();
+    return false;
+  }
+  m_socket_path = socket_path;
+
+  m_framebuffer_path.Format("%s.fb", socket_path);
+  int fd = open(m_framebuffer_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd >= 0 && ftruncate(fd, FRAMEBUFFER_FILE_SIZE) == 0)
+  {
+    void* mapping = mmap(nullptr, FRAMEBUFFER_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping != MAP_FAILED)
+      m_framebuffer_mapping = static_cast<byte*>(mapping);
+  }
+  if (fd >= 0)
+    close(fd);
+  if (m_framebuffer_mapping == nullptr)
+  {
+    pError->SetErrorUserFormatted(1, "Could not map framebuffer file '%s'", m_framebuffer_path.GetCharArray());
+    Close();
+    return false;
+  }
+
+  CONTROL_FRAMEBUFFER_HEADER* header = reinterpret_cast<CONTROL_FRAMEBUFFER_HEADER*>(m_framebuffer_mapping);
+  header->magic = CONTROL_FRAMEBUFFER_MAGIC;
+  header->width = Display::SCREEN_WIDTH;
+  header->height = Display::SCREEN_HEIGHT;
+  header->row_stride = FRAMEBUFFER_ROW_STRIDE;
+  header->frame = 0;
+  header->sequence = 0;
+
+  m_system = system;
+  m_quit_requested = false;
+  Log_InfoPrintf("Control server listening on '%s'", socket_path);
+  return true;
+}
+
+void ControlServer::Close()
+{
+  DisconnectClient();
+
+  if (m_listen_fd >= 0)
+  {
+    close(m_listen_fd);
+    m_listen_fd = -1;
+    if (!m_socket_path.IsEmpty())
+      unlink(m_socket_path);
+  }
+
+  if (m_framebuffer_mapping != nullptr)
+  {
+    munmap(m_framebuffer_mapping, FRAMEBUFFER_FILE_SIZE);
+    m_framebuffer_mapping = nullptr;
+    unlink(m_framebuffer_path);
+  }
+
+  for (uint32 i = 0; i < NUM_SLOTS; i++)
+  {
+    delete m_slots[i];
+    m_slots[i] = nullptr;
+  }
+
+  m_socket_path.Clear();
+  m_framebuffer_path.Clear();
+  m_system = nullptr;
+}
+
+void ControlServer::Poll(uint32 timeout_ms)
+{
+  if (m_listen_fd < 0)
+    return;
+
+  pollfd fds[2] = {{m_listen_fd, POLLIN, 0}, {m_client_fd, POLLIN, 0}};
+  nfds_t num_fds = (m_client_fd >= 0) ? 2 : 1;
+  if (poll(fds, num_fds, static_cast<int>(timeout_ms)) <= 0)
+    return;
+
+  if (fds[0].revents & POLLIN)
+    AcceptClient();
+  if (num_fds > 1 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)))
+    ReadClient();
+}
+
+void ControlServer::AcceptClient()
+{
+  int fd = accept(m_listen_fd, nullptr, nullptr);
+  if (fd < 0)
+    return;
+
+  if (m_client_fd >= 0)
+  {
+    Log_WarningPrintf("Rejecting control connection, a client is already connected");
+    close(fd);
+    return;
+  }
+
+  Log_InfoPrintf("Control client connected");
+  m_client_fd = fd;
+  m_receive_buffer.clear();
+}
+
+void ControlServer::DisconnectClient()
+{
+  if (m_client_fd < 0)
+    return;
+
+  Log_InfoPrintf("Control client disconnected");
+  close(m_client_fd);
+  m_client_fd = -1;
+  m_receive_buffer.clear();
+  m_send_buffer.clear();
+}
+
+void ControlServer::ReadClient()
+{
+  byte chunk[65536];
+  ssize_t bytes_received = recv(m_client_fd, chunk, sizeof(chunk), 0);
+  if (bytes_received <= 0)
+  {
+    DisconnectClient();
+    return;
+  }
+  m_receive_buffer.insert(m_receive_buffer.end(), chunk, chunk + bytes_received);
+
+  // everything complete is answered in one write
+  size_t offset = 0;
+  while ((m_receive_buffer.size() - offset) >= sizeof(uint32))
+  {
+    uint32 length = ReadUInt32(m_receive_buffer.data() + offset);
+    if (length == 0 || length > MAX_MESSAGE_SIZE)
+    {
+      Log_ErrorPrintf("Bad control message length %u", length);
+      DisconnectClient();
+      return;
+    }
+    if ((m_receive_buffer.size() - offset - sizeof(uint32)) < length)
+      break;
+
+    ExecuteRequest(m_receive_buffer.data() + offset + sizeof(uint32), length, false, &m_send_buffer);
+    offset += sizeof(uint32) + length;
+  }
+  m_receive_buffer.erase(m_receive_buffer.begin(), m_receive_buffer.begin() + offset);
+
+  size_t bytes_sent = 0;
+  while (bytes_sent < m_send_buffer.size())
+  {
+    ssize_t result = send(m_client_fd, m_send_buffer.data() + bytes_sent, m_send_buffer.size() - bytes_sent,
+                          MSG_NOSIGNAL);
+    if (result <= 0)
+    {
+      DisconnectClient();
+      return;
+    }
+    bytes_sent += static_cast<size_t>(result);
+  }
+  m_send_buffer.clear();
+}
+
+static bool SendAll(int fd, const std::vector<byte>& data)
+{
+  size_t bytes_sent = 0;
+  while (bytes_sent < data.size())
+  {
+    ssize_t result = send(fd, data.data() + bytes_sent, data.size() - bytes_sent, MSG_NOSIGNAL);
+    if (result <= 0)
+      return false;
+    bytes_sent += static_cast<size_t>(result);
+  }
+  return true;
+}
+
+static bool ReceiveAll(int fd, void* buffer, size_t length)
+{
+  size_t bytes_received = 0;
+  while (bytes_received < length)
+  {
+    ssize_t result = recv(fd, static_cast<byte*>(buffer) + bytes_received, length - bytes_received, 0);
+    if (result <= 0)
+      return false;
+    bytes_received += static_cast<size_t>(result);
+  }
+  return true;
+}
+
+// reads num_responses responses and checks they all succeeded
+static bool ReceiveResponses(int fd, uint32 num_responses, std::vector<byte>* buffer)
+{
+  for (uint32 i = 0; i < num_responses; i++)
+  {
+    uint32 length;
+    if (!ReceiveAll(fd, &length, sizeof(length)) || length < 2 || length > MAX_MESSAGE_SIZE)
+      return false;
+
+    buffer->resize(length);
+    if (!ReceiveAll(fd, buffer->data(), length) || (*buffer)[1] != CONTROL_STATUS_OK)
+      return false;
+  }
+  return true;
+}
+
+static void AppendStepRequest(std::vector<byte>* buffer, uint32 frames)
+{
+  AppendValue<uint32>(buffer, 1 + sizeof(uint32) + 2);
+  AppendValue<uint8>(buffer, CONTROL_COMMAND_STEP);
+  AppendValue<uint32>(buffer, frames);
+  AppendValue<uint8>(buffer, 0);
+  AppendValue<uint8>(buffer, 0);
+}
+
+bool ControlServer::RunBenchmark(const char* socket_path, uint32 iterations, Error* pError)
+{
+  iterations = Max(Min(iterations, MAX_BENCHMARK_ITERATIONS), 1u);
+
+  sockaddr_un address;
+  int fd = MakeSocketAddress(socket_path, &address) ? socket(AF_UNIX, SOCK_STREAM, 0) : -1;
+  if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+  {
+    pError->SetErrorUserFormatted(1, "Could not connect to '%s'", socket_path);
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+
+  std::vector<byte> request;
+  std::vector<byte> response;
+  bool result = true;
+
+  // round trip with no emulation behind it
+  AppendValue<uint32>(&request, 1);
+  AppendValue<uint8>(&request, CONTROL_COMMAND_INFO);
+  Timer timer;
+  for (uint32 i = 0; i < iterations && result; i++)
+    result = SendAll(fd, request) && ReceiveResponses(fd, 1, &response);
+  double round_trip_time = timer.GetTimeSeconds();
+
+  // one frame per round trip
+  request.clear();
+  AppendStepRequest(&request, 1);
+  timer.Reset();
+  for (uint32 i = 0; i < iterations && result; i++)
+    result = SendAll(fd, request) && ReceiveResponses(fd, 1, &response);
+  double step_time = timer.GetTimeSeconds();
+
+  // every step sent up front, answered as they complete
+  request.clear();
+  for (uint32 i = 0; i < iterations; i++)
+    AppendStepRequest(&request, 1);
+  timer.Reset();
+  result = result && SendAll(fd, request) && ReceiveResponses(fd, iterations, &response);
+  double pipelined_time = timer.GetTimeSeconds();
+
+  // every step plus a framebuffer fetch in one batch, answered once
+  std::vector<byte> batch;
+  for (uint32 i = 0; i < iterations; i++)
+    AppendStepRequest(&batch, 1);
+  AppendValue<uint32>(&batch, 1);
+  AppendValue<uint8>(&batch, CONTROL_COMMAND_FRAMEBUFFER);
+  request.clear();
+  AppendValue<uint32>(&request, static_cast<uint32>(1 + batch.size()));
+  AppendValue<uint8>(&request, CONTROL_COMMAND_BATCH);
+  request.insert(request.end(), batch.begin(), batch.end());
+  timer.Reset();
+  result = result && SendAll(fd, request) && ReceiveResponses(fd, 1, &response);
+  double batch_time = timer.GetTimeSeconds();
+
+  close(fd);
+  if (!result)
+  {
+    pError->SetErrorUser(1, "Control connection failed or a command returned an error");
+    return false;
+  }
+
+  Log_InfoPrintf("Round trip: %.2f us average over %u requests", round_trip_time * 1000000.0 / iterations, iterations);
+  Log_InfoPrintf("Step per round trip: %.1f steps/s", iterations / step_time);
+  Log_InfoPrintf("Pipelined steps: %.1f steps/s", iterations / pipelined_time);
+  Log_InfoPrintf("Batched steps: %.1f steps/s", iterations / batch_time);
+  return true;
+}
+
+#endif
+
+void ControlServer::SetFrameBuffer(const void* pixels, uint32 row_stride)
+{
+  m_frame_pixels = static_cast<const byte*>(pixels);
+  m_frame_row_stride = row_stride;
+  m_frame_number = (m_system != nullptr) ? m_system->GetFrameCounter() : 0;
+}
+
+void ControlServer::CopyFrameBuffer()
+{
+  CONTROL_FRAMEBUFFER_HEADER* header = reinterpret_cast<CONTROL_FRAMEBUFFER_HEADER*>(m_framebuffer_mapping);
+  if (m_frame_pixels != nullptr)
+  {
+    byte* destination = m_framebuffer_mapping + CONTROL_FRAMEBUFFER_PIXELS_OFFSET;
+    for (uint32 y = 0; y < Display::SCREEN_HEIGHT; y++)
+      Y_memcpy(destination + y * FRAMEBUFFER_ROW_STRIDE, m_frame_pixels + y * m_frame_row_stride,
+               FRAMEBUFFER_ROW_STRIDE);
+  }
+
+  header->frame = m_frame_number;
+  header->sequence++;
+}
+
+bool ControlServer::StepFrame()
+{
+  // nothing runs while paused or waiting on the link
+  uint32 start_frame = m_system->GetFrameCounter();
+  uint64 target_clocks = m_system->GetClocksSinceReset() + FRAME_CLOCKS;
+  while (m_system->GetFrameCounter() == start_frame && m_system->GetClocksSinceReset() < target_clocks)
+  {
+    uint64 last_clocks = m_system->GetClocksSinceReset();
+    m_system->RunUntil(target_clocks);
+    if (m_system->GetClocksSinceReset() == last_clocks)
+      return false;
+  }
+
+  return true;
+}
+
+void ControlServer::ExecuteRequest(const byte* request, uint32 length, bool in_batch, std::vector<byte>* response)
+{
+  size_t header_offset = response->size();
+  AppendValue<uint32>(response, 0);
+  AppendValue<uint8>(response, request[0]);
+  AppendValue<uint8>(response, 0);
+
+  CONTROL_STATUS status = ExecuteCommand(request[0], request + 1, length - 1, in_batch, response);
+  uint32 response_length = static_cast<uint32>(response->size() - header_offset - sizeof(uint32));
+  Y_memcpy(response->data() + header_offset, &response_length, sizeof(response_length));
+  (*response)[header_offset + sizeof(uint32) + 1] = static_cast<byte>(status);
+}
+
+CONTROL_STATUS ControlServer::ExecuteCommand(uint8 command, const byte* args, uint32 args_length, bool in_batch,
+                                             std::vector<byte>* response)
+{
+  switch (command)
+  {
+  case CONTROL_COMMAND_INFO:
+  {
+    AppendValue<uint32>(response, CONTROL_PROTOCOL_VERSION);
+    AppendValue<uint32>(response, FRAMEBUFFER_FILE_SIZE);
+    AppendValue<uint32>(response, m_framebuffer_path.GetLength());
+    response->insert(response->end(), m_framebuffer_path.GetCharArray(),
+                     m_framebuffer_path.GetCharArray() + m_framebuffer_path.GetLength());
+    return CONTROL_STATUS_OK;
+  }
+
+  case CONTROL_COMMAND_STEP:
+  {
+    if (args_length != sizeof(uint32) + 2)
+      return CONTROL_STATUS_BAD_REQUEST;
+
+    // input applies from the current clock, through the queue so movie recording sees it
+    System::InputEvent event;
+    event.clock = m_system->GetEmulatedClocks();
+    event.direction_state = args[4] & PAD_DIRECTION_MASK;
+    event.button_state = args[5] & PAD_BUTTON_MASK;
+    m_system->QueueInputEvent(event);
+
+    CONTROL_STATUS status = CONTROL_STATUS_OK;
+    uint32 frames = ReadUInt32(args);
+    for (uint32 i = 0; i < frames; i++)
+    {
+      if (!StepFrame())
+      {
+        status = CONTROL_STATUS_FAILED;
+        break;
+      }
+    }
+
+    AppendValue<uint32>(response, m_system->GetFrameCounter());
+    AppendValue<uint64>(response, m_system->GetEmulatedClocks());
+    return status;
+  }
+
+  case CONTROL_COMMAND_PEEK:
+  {
+    if (args_length < sizeof(uint32))
+      return CONTROL_STATUS_BAD_REQUEST;
+
+    static const uint32 RANGE_SIZE = sizeof(uint16) + sizeof(uint32);
+    // divide rather than multiply, a huge count could wrap around to match the length
+    uint32 count = ReadUInt32(args);
+    if (((args_length - sizeof(uint32)) % RANGE_SIZE) != 0 || count != (args_length - sizeof(uint32)) / RANGE_SIZE)
+      return CONTROL_STATUS_BAD_REQUEST;
+
+    // validate everything before writing any of it
+    const byte* ranges = args + sizeof(uint32);
+    uint32 total_length = 0;
+    for (uint32 i = 0; i < count; i++)
+    {
+      uint32 address = ReadUInt16(ranges + i * RANGE_SIZE);
+      uint32 length = ReadUInt32(ranges + i * RANGE_SIZE + sizeof(uint16));
+      if (length > 0x10000 - address || (total_length + length) > MAX_PEEK_SIZE)
+        return CONTROL_STATUS_BAD_REQUEST;
+      total_length += length;
+    }
+
+    size_t offset = response->size();
+    response->resize(offset + total_length);
+    for (uint32 i = 0; i < count; i++)
+    {
+      uint16 address = ReadUInt16(ranges + i * RANGE_SIZE);
+      uint32 length = ReadUInt32(ranges + i * RANGE_SIZE + sizeof(uint16));
+      m_system->PeekMemory(address, response->data() + offset, length);
+      offset += length;
+    }
+
+    return CONTROL_STATUS_OK;
+  }
+
+  case CONTROL_COMMAND_SAVE_SLOT:
+  {
+    if (args_length != 1 || args[0] >= NUM_SLOTS)
+      return CONTROL_STATUS_BAD_REQUEST;
+
+    StateSnapshot* snapshot = StateSnapshot::Capture(m_system);
+    if (snapshot == nullptr)
+      return CONTROL_STATUS_FAILED;
+
+    delete m_slots[args[0]];
+    m_slots[args[0]] = snapshot;
+    return CONTROL_STATUS_OK;
+  }
+
+  case CONTROL_COMMAND_LOAD_SLOT:
+  {
+    if (args_length != 1 || args[0] >= NUM_SLOTS)
+      return CONTROL_STATUS_BAD_REQUEST;
+
+    Error error;
+    if (m_slots[args[0]] == nullptr || !m_slots[args[0]]->Restore(m_system, &error))
+      return CONTROL_STATUS_FAILED;
+
+    return CONTROL_STATUS_OK;
+  }
+
+  case CONTROL_COMMAND_FRAMEBUFFER:
+  {
+    CopyFrameBuffer();
+
+    const CONTROL_FRAMEBUFFER_HEADER* header =
+      reinterpret_cast<const CONTROL_FRAMEBUFFER_HEADER*>(m_framebuffer_mapping);
+    AppendValue<uint32>(response, header->frame);
+    AppendValue<uint32>(response, header->sequence);
+    return CONTROL_STATUS_OK;
+  }
+
+  case CONTROL_COMMAND_BATCH:
+  {
+    if (in_batch)
+      return CONTROL_STATUS_BAD_REQUEST;
+
+    // a malformed entry ends the batch, the responses so far are still returned
+    uint32 offset = 0;
+    while (offset < args_length)
+    {
+      if ((args_length - offset) < sizeof(uint32))
+        return CONTROL_STATUS_BAD_REQUEST;
+
+      uint32 length = ReadUInt32(args + offset);
+      offset += sizeof(uint32);
+      if (length == 0 || length > (args_length - offset))
+        return CONTROL_STATUS_BAD_REQUEST;
+
+      ExecuteRequest(args + offset, length, true, response);
+      offset += length;
+    }
+
+    return CONTROL_STATUS_OK;
+  }
+
+  case CONTROL_COMMAND_QUIT:
+  {
+    m_quit_requested = true;
+    return CONTROL_STATUS_OK;
+  }
+
+  default:
+    return CONTROL_STATUS_BAD_REQUEST;
+  }
+}
+
+int ControlServer::RunHeadless(const char* socket_path, const char* cart_filename, SYSTEM_MODE mode)
+{
+  ControlServer server;
+  System* system = new System(&server);
+  Cartridge* cartridge = new Cartridge(system);
+
+  Error error;
+  bool result = false;
+  ByteStream* pStream = FileSystem::OpenFile(cart_filename, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_STREAMED);
+  if (pStream == nullptr)
+  {
+    Log_ErrorPrintf("Could not open '%s'", cart_filename);
+  }
+  else
+  {
+    result = cartridge->Load(pStream, &error);
+    pStream->Release();
+    if (!result)
+      Log_ErrorPrintf("Failed to load cartridge: %s", error.GetErrorDescription().GetCharArray());
+  }
+
+  if (result)
+  {
+    result = system->Init(mode, nullptr, 0, cartridge);
+    if (!result)
+      Log_ErrorPrintf("Failed to initialize system");
+  }
+
+  if (result)
+  {
+    SetupHeadlessSystem(system, cartridge);
+
+    result = server.Open(socket_path, system, &error);
+    if (!result)
+      Log_ErrorPrintf("Failed to start control server: %s", error.GetErrorDescription().GetCharArray());
+  }
+
+  while (result && !server.IsQuitRequested())
+    server.Poll(100);
+
+  server.Close();
+  delete system;
+  delete cartridge;
+  return result ? 0 : 2;
+}
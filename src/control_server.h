@@ -0,0 +1,115 @@
+#pragma once
+#include "YBaseLib/Common.h"
+#include "YBaseLib/String.h"
+#include "headless.h"
+#include <vector>
+
+class Error;
+class StateSnapshot;
+
+// Local automation protocol, over a unix domain socket. Values are in native byte order.
+//
+// Each request is a uint32 length, followed by that many bytes: a uint8 command, then its arguments. Each response
+// is a uint32 length, followed by the uint8 command, a uint8 status, then its results. Requests can be pipelined,
+// they are executed in order and every complete request received is answered in a single write. BATCH carries a
+// list of requests and answers with the list of their responses, so one message can advance many frames.
+enum CONTROL_COMMAND
+{
+  CONTROL_COMMAND_INFO,        // -> uint32 version, uint32 framebuffer file size, uint32 path length, char path[]
+  CONTROL_COMMAND_STEP,        // uint32 frames, uint8 directions, uint8 buttons -> uint32 frame, uint64 clocks
+  CONTROL_COMMAND_PEEK,        // uint32 count, {uint16 address, uint32 length}[count] -> the bytes, back to back
+  CONTROL_COMMAND_SAVE_SLOT,   // uint8 slot
+  CONTROL_COMMAND_LOAD_SLOT,   // uint8 slot
+  CONTROL_COMMAND_FRAMEBUFFER, // -> uint32 frame, uint32 sequence, with the pixels in the framebuffer file
+  CONTROL_COMMAND_BATCH,       // {uint32 length, request}[] -> {uint32 length, response}[]
+  CONTROL_COMMAND_QUIT,
+  NUM_CONTROL_COMMANDS
+};
+
+enum CONTROL_STATUS
+{
+  CONTROL_STATUS_OK,
+  CONTROL_STATUS_BAD_REQUEST,
+  CONTROL_STATUS_FAILED
+};
+
+// Start of the shared framebuffer file, the pixels follow at CONTROL_FRAMEBUFFER_PIXELS_OFFSET as 32-bit RGBA.
+// The sequence is bumped once the pixels have been written.
+struct CONTROL_FRAMEBUFFER_HEADER
+{
+  uint32 magic;
+  uint32 width;
+  uint32 height;
+  uint32 row_stride;
+  uint32 frame;
+  uint32 sequence;
+};
+
+#define CONTROL_PROTOCOL_VERSION (1)
+#define CONTROL_FRAMEBUFFER_MAGIC (0x42464247)
+#define CONTROL_FRAMEBUFFER_PIXELS_OFFSET (64)
+
+// Serves one client at a time from the thread which runs the system. The framebuffer is shared through a file
+// mapped by both sides, named after the socket with ".fb" appended.
+class ControlServer : private HeadlessCallbacks
+{
+public:
+  static const uint32 NUM_SLOTS = 16;
+
+  ControlServer();
+  ~ControlServer();
+
+  bool IsOpen() const { return (m_listen_fd >= 0); }
+  bool HasClient() const { return (m_client_fd >= 0); }
+  bool IsQuitRequested() const { return m_quit_requested; }
+
+  bool Open(const char* socket_path, System* system, Error* pError);
+  void Close();
+
+  // latest complete frame, copied out when a client asks for it
+  void SetFrameBuffer(const void* pixels, uint32 row_stride);
+
+  // accepts and services the client, waiting up to timeout_ms for anything to happen
+  void Poll(uint32 timeout_ms);
+
+  // runs a cartridge with no window, audio or frame limiter until a client sends QUIT
+  // mode can be NUM_SYSTEM_MODES to use the cartridge's mode
+  static int RunHeadless(const char* socket_path, const char* cart_filename, SYSTEM_MODE mode);
+
+  // client side, logs round trip latency and stepping rates against a running server
+  static bool RunBenchmark(const char* socket_path, uint32 iterations, Error* pError);
+
+private:
+  // headless frames go straight to the shared framebuffer
+  void PresentDisplayBuffer(const void* pPixels, uint32 row_stride) override final
+  {
+    SetFrameBuffer(pPixels, row_stride);
+  }
+
+  void AcceptClient();
+  void DisconnectClient();
+  void ReadClient();
+
+  void ExecuteRequest(const byte* request, uint32 length, bool in_batch, std::vector<byte>* response);
+  CONTROL_STATUS ExecuteCommand(uint8 command, const byte* args, uint32 args_length, bool in_batch,
+                                std::vector<byte>* response);
+  bool StepFrame();
+  void CopyFrameBuffer();
+
+  System* m_system;
+  String m_socket_path;
+  String m_framebuffer_path;
+  int m_listen_fd;
+  int m_client_fd;
+  bool m_quit_requested;
+
+  std::vector<byte> m_receive_buffer;
+  std::vector<byte> m_send_buffer;
+
+  byte* m_framebuffer_mapping;
+  const byte* m_frame_pixels;
+  uint32 m_frame_row_stride;
+  uint32 m_frame_number;
+
+  StateSnapshot* m_slots[NUM_SLOTS];
+};
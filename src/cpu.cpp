@@ -9,7 +9,7 @@
 #include "YBaseLib/String.h"
 Log_SetChannel(CPU);
 
-CPU::CPU(System* system) : m_system(system) {}
+CPU::CPU(System* system) : m_interrupt_pending(false), m_ei_pending(false), m_system(system) {}
 
 CPU::~CPU() {}
 
@@ -20,6 +20,8 @@ void CPU::Reset()
 
   // enable master interrupts, but keep all interrupts blocked
   m_registers.IME = true;
+  m_ei_pending = false;
+  UpdateInterruptPending();
   m_clock = 0;
   m_halted = false;
   m_disabled = false;
@@ -75,6 +77,19 @@ void CPU::RaiseInterrupt(uint8 index)
   // Log_DevPrintf("Raise interrupt %u", index);
   m_registers.IF |= (1 << index);
   m_halted = false;
+  UpdateInterruptPending();
+}
+
+void CPU::SetInterruptFlags(uint8 value)
+{
+  m_registers.IF = value;
+  UpdateInterruptPending();
+}
+
+void CPU::SetInterruptEnable(uint8 value)
+{
+  m_registers.IE = value;
+  UpdateInterruptPending();
 }
 
 void CPU::Disable(bool disabled)
@@ -102,6 +117,8 @@ bool CPU::LoadState(ByteStream* pStream, BinaryReader& binaryReader, Error* pErr
   m_clock = binaryReader.ReadUInt32();
   m_halted = binaryReader.ReadBool();
   m_disabled = binaryReader.ReadBool();
+  m_ei_pending = binaryReader.ReadBool();
+  UpdateInterruptPending();
   return true;
 }
 
@@ -124,6 +141,7 @@ void CPU::SaveState(ByteStream* pStream, BinaryWriter& binaryWriter)
   binaryWriter.WriteUInt32(m_clock);
   binaryWriter.WriteBool(m_halted);
   binaryWriter.WriteBool(m_disabled);
+  binaryWriter.WriteBool(m_ei_pending);
 }
 
 uint8 CPU::ReadOperandByte()
@@ -566,6 +584,14 @@ void CPU::CheckOAMBug(uint16 current_value)
     m_system->TriggerOAMBug();
 }
 
+void CPU::ExecuteUntil(uint64 target_clocks)
+{
+  // ExecuteInstruction is in this file, so this is a direct call with both exit conditions in the system's hot block
+  System* system = m_system;
+  while (system->m_clocks_since_reset < target_clocks && !system->m_stop_execution)
+    ExecuteInstruction();
+}
+
 void CPU::ExecuteInstruction()
 {
   // cpu disabled for memory transfer?
@@ -575,11 +601,13 @@ void CPU::ExecuteInstruction()
     return;
   }
 
-  // interrupts enabled?
-  if (m_registers.IME)
+  // interrupt pending, or EI waiting to take effect?
+  if (m_interrupt_pending)
   {
     // have we got a pending interrupt?
     uint8 interrupt_mask = ((1 << (NUM_CPU_INT)) - 1) & m_registers.IF & m_registers.IE;
+    if (!m_registers.IME)
+      interrupt_mask = 0;
     if (interrupt_mask != 0)
     {
       // http://bgb.bircd.org/pandocs.htm#interrupts
@@ -594,6 +622,7 @@ void CPU::ExecuteInstruction()
 
           // disable interrupts
           m_registers.IME = false;
+          UpdateInterruptPending();
 
           // Jump to vector
           static const uint16 jump_locations[] = {
@@ -617,6 +646,14 @@ void CPU::ExecuteInstruction()
         }
       }
     }
+
+    // the instruction after EI has been reached, so interrupts are live from the one after this
+    if (m_ei_pending)
+    {
+      m_registers.IME = true;
+      m_ei_pending = false;
+      UpdateInterruptPending();
+    }
   }
 
   // if halted, simulate a single cycle to keep the display/audio going
@@ -885,7 +922,12 @@ void CPU::ExecuteInstruction()
     m_registers.SetFlagC(!m_registers.GetFlagC());
     break; // CCF
   case 0x40:
-    m_registers.B = m_registers.B;
+    // no-op, which test roms use as a breakpoint
+    if (m_system->m_magic_breakpoint)
+    {
+      m_system->m_magic_breakpoint_hit = true;
+      m_system->m_stop_execution = true;
+    }
     break; // LD B, B
   case 0x41:
     m_registers.B = m_registers.C;
@@ -1387,6 +1429,7 @@ void CPU::ExecuteInstruction()
   case 0xD9:
     INSTR_ret();
     m_registers.IME = true;
+    UpdateInterruptPending();
     break; // RETI
   case 0xDA:
     dstaddr = ReadOperandWord();
@@ -1480,6 +1523,8 @@ void CPU::ExecuteInstruction()
     break; // LD A, (C)
   case 0xF3:
     m_registers.IME = false;
+    m_ei_pending = false;
+    UpdateInterruptPending();
     break; // DI
   case 0xF4:
     UnreachableCode();
@@ -1505,7 +1550,12 @@ void CPU::ExecuteInstruction()
     m_registers.A = MemReadByte(ReadOperandWord());
     break; // LD A, (a16)
   case 0xFB:
-    m_registers.IME = true;
+    // takes effect after the next instruction
+    if (!m_registers.IME)
+    {
+      m_ei_pending = true;
+      UpdateInterruptPending();
+    }
     break; // EI
   case 0xFC:
     UnreachableCode();
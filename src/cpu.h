@@ -208,6 +208,9 @@ public:
   // step
   void ExecuteInstruction();
 
+  // executes instructions until the system's clock reaches target_clocks, or the system asks to stop
+  void ExecuteUntil(uint64 target_clocks);
+
   // disassemble an instruction
   static bool Disassemble(String* pDestination, System* memory, uint16 address);
   static void DisassembleFrom(System* system, uint16 address, uint16 count, ByteStream* pStream);
@@ -245,6 +248,17 @@ private:
   // raise interrupt
   void RaiseInterrupt(uint8 index);
 
+  // FF0F/FFFF writes, these keep m_interrupt_pending in sync
+  void SetInterruptFlags(uint8 value);
+  void SetInterruptEnable(uint8 value);
+
+  // must be called whenever IF, IE or IME change
+  inline void UpdateInterruptPending()
+  {
+    m_interrupt_pending =
+      (m_registers.IME && (m_registers.IF & m_registers.IE & ((1 << NUM_CPU_INT) - 1)) != 0) || m_ei_pending;
+  }
+
   // halt cycles
   void Disable(bool disabled);
 
@@ -255,6 +269,12 @@ private:
   // registers
   Registers m_registers;
 
+  // an interrupt can be dispatched, or EI is waiting to take effect, so the next instruction takes the slow path
+  bool m_interrupt_pending;
+
+  // EI enables interrupts after the following instruction
+  bool m_ei_pending;
+
   // memory
   System* m_system;
 
@@ -42,11 +42,11 @@ void CPU::DisassembleFrom(System* system, uint16 address, uint16 count, ByteStre
 
 bool CPU::Disassemble(String* pDestination, System* memory, uint16 address)
 {
-  // read first byte
-  uint8 instr = memory->CPURead(address);
-  uint8 imm8 = memory->CPURead(address + 1);
+  // read first byte, peeking so disassembly doesn't disturb emulation
+  uint8 instr = memory->PeekMemory(address);
+  uint8 imm8 = memory->PeekMemory(address + 1);
   uint8 imm16b1 = imm8;
-  uint8 imm16b2 = memory->CPURead(address + 2);
+  uint8 imm16b2 = memory->PeekMemory(address + 2);
   uint16 imm16 = (uint16)imm16b1 | ((uint16)imm16b2 << 8);
 
   // ugly as hell
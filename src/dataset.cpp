@@ -0,0 +1,553 @@
+#include "dataset.h"
+#include "YBaseLib/BinaryReader.h"
+#include "YBaseLib/BinaryWriter.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Error.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+#include "system.h"
+#include <zlib.h>
+Log_SetChannel(Dataset);
+
+// 'GBDS'
+static const uint32 DATASET_FILE_MAGIC = 0x53444247;
+static const uint32 DATASET_FILE_VERSION = 1;
+
+// File layout:
+//   header: magic, version, cartridge crc, frames per chunk, record size, region count, (uint16 address, uint32 length)
+//   per region
+//   chunks: zlib compressed records, back to back, every chunk but the last holding frames per chunk records
+//   index: (uint64 offset, uint32 compressed size, uint32 frame count) per chunk
+//   footer: uint64 index offset, uint32 chunk count, magic
+//
+// Record layout, padded to a multiple of four bytes:
+//   uint32 frame counter, uint8 directions, uint8 buttons, uint16 palette size, uint32 palette[MAX_PALETTE_SIZE],
+//   uint8 pixels[SCREEN_WIDTH * SCREEN_HEIGHT], then the regions
+static const uint32 MAX_PALETTE_SIZE = 256;
+static const uint32 PIXEL_COUNT = Display::SCREEN_WIDTH * Display::SCREEN_HEIGHT;
+static const uint32 RECORD_PALETTE_OFFSET = 8;
+static const uint32 RECORD_PIXELS_OFFSET = RECORD_PALETTE_OFFSET + MAX_PALETTE_SIZE * sizeof(uint32);
+static const uint32 RECORD_RAM_OFFSET = RECORD_PIXELS_OFFSET + PIXEL_COUNT;
+static const uint32 FOOTER_SIZE = 16;
+
+// regions can overlap, but together they can't be more than the address space
+static const uint32 MAX_RAM_SIZE = 0x10000;
+
+// uncompressed, keeps the ring and a reader's cached chunk to a sensible size
+static const uint64 MAX_CHUNK_SIZE = 64 * 1024 * 1024;
+
+// enough for the writer thread to absorb a slow write of one chunk while the next is filled
+static const uint32 RING_CHUNKS = 3;
+
+// Open addressing, only palette colours are inserted so the table is never more than a quarter full. A cgb frame with
+// palette writes every scanline can show thousands of colours, those past the palette are matched without caching.
+static const uint32 COLOR_HASH_SIZE = 1024;
+
+static int32 HexDigitValue(char ch)
+{
+  if (ch >= '0' && ch <= '9')
+    return ch - '0';
+  else if (ch >= 'A' && ch <= 'F')
+    return ch - 'A' + 10;
+  else if (ch >= 'a' && ch <= 'f')
+    return ch - 'a' + 10;
+  else
+    return -1;
+}
+
+static bool ParseHexValue(const char*& str, uint32 max_value, uint32* value)
+{
+  *value = 0;
+  const char* start = str;
+  for (; HexDigitValue(*str) >= 0; str++)
+  {
+    *value = (*value << 4) | static_cast<uint32>(HexDigitValue(*str));
+    if (*value > max_value)
+      return false;
+  }
+
+  return (str != start);
+}
+
+static uint32 ColorDistance(uint32 a, uint32 b)
+{
+  uint32 distance = 0;
+  for (uint32 shift = 0; shift < 24; shift += 8)
+  {
+    int32 delta = int32((a >> shift) & 0xFF) - int32((b >> shift) & 0xFF);
+    distance += static_cast<uint32>(delta * delta);
+  }
+  return distance;
+}
+
+// Converts the frame buffer to palette indices. A frame with more colours than the palette holds (only possible with
+// cgb palette writes mid-frame) maps the remainder to the closest colour already in the palette.
+static uint32 IndexFrameBuffer(const void* pixels, uint32 row_stride, uint32* palette, uint8* indices)
+{
+  uint16 hash_keys[COLOR_HASH_SIZE];
+  uint32 hash_colors[COLOR_HASH_SIZE];
+  for (uint32 i = 0; i < COLOR_HASH_SIZE; i++)
+    hash_keys[i] = 0xFFFF;
+
+  uint32 palette_size = 0;
+  for (uint32 y = 0; y < Display::SCREEN_HEIGHT; y++)
+  {
+    const byte* row = reinterpret_cast<const byte*>(pixels) + y * row_stride;
+    for (uint32 x = 0; x < Display::SCREEN_WIDTH; x++)
+    {
+      uint32 color;
+      Y_memcpy(&color, row + x * sizeof(uint32), sizeof(color));
+
+      uint32 slot = ((color * 2654435761u) >> 22) & (COLOR_HASH_SIZE - 1);
+      while (hash_keys[slot] != 0xFFFF && hash_colors[slot] != color)
+        slot = (slot + 1) & (COLOR_HASH_SIZE - 1);
+
+      uint32 index;
+      if (hash_keys[slot] != 0xFFFF)
+      {
+        index = hash_keys[slot];
+      }
+      else if (palette_size < MAX_PALETTE_SIZE)
+      {
+        index = palette_size++;
+        palette[index] = color;
+        hash_keys[slot] = static_cast<uint16>(index);
+        hash_colors[slot] = color;
+      }
+      else
+      {
+        index = 0;
+        for (uint32 i = 1; i < MAX_PALETTE_SIZE; i++)
+        {
+          if (ColorDistance(palette[i], color) < ColorDistance(palette[index], color))
+            index = i;
+        }
+      }
+
+      indices[y * Display::SCREEN_WIDTH + x] = static_cast<uint8>(index);
+    }
+  }
+
+  return palette_size;
+}
+
+DatasetWriter::DatasetWriter()
+  : m_stream(nullptr), m_frames_per_chunk(0), m_record_size(0), m_frame_count(0), m_stall_count(0), m_ring_head(0),
+    m_ring_pending(0), m_ring_fill(0), m_shutdown(false), m_write_error(false)
+{
+}
+
+DatasetWriter::~DatasetWriter()
+{
+  Close();
+}
+
+bool DatasetWriter::Open(const char* filename, uint32 cartridge_crc, const DatasetRegion* regions, uint32 num_regions,
+                         uint32 frames_per_chunk, Error* pError)
+{
+  Close();
+
+  m_regions.assign(regions, regions + num_regions);
+  uint32 ram_size = 0;
+  for (const DatasetRegion& region : m_regions)
+  {
+    if (region.length == 0 || (uint32(region.address) + region.length) > 0x10000)
+    {
+      pError->SetErrorUserFormatted(1, "Region %04X:%X is outside the address space", region.address, region.length);
+      return false;
+    }
+    if (region.length > (MAX_RAM_SIZE - ram_size))
+    {
+      pError->SetErrorUserFormatted(1, "Regions add up to more than %X bytes", MAX_RAM_SIZE);
+      return false;
+    }
+    ram_size += region.length;
+  }
+  m_record_size = (RECORD_RAM_OFFSET + ram_size + 3) & ~3u;
+
+  frames_per_chunk = Max(frames_per_chunk, 1u);
+  if ((uint64(frames_per_chunk) * m_record_size) > MAX_CHUNK_SIZE)
+  {
+    pError->SetErrorUserFormatted(1, "Chunks of %u frames would be too large", frames_per_chunk);
+    return false;
+  }
+
+  m_stream = FileSystem::OpenFile(filename, BYTESTREAM_OPEN_CREATE | BYTESTREAM_OPEN_CREATE_PATH |
+                                              BYTESTREAM_OPEN_WRITE | BYTESTREAM_OPEN_TRUNCATE |
+                                              BYTESTREAM_OPEN_STREAMED | BYTESTREAM_OPEN_ATOMIC_UPDATE);
+  if (m_stream == nullptr)
+  {
+    pError->SetErrorUserFormatted(1, "Could not open '%s'", filename);
+    return false;
+  }
+
+  m_filename = filename;
+  m_frames_per_chunk = frames_per_chunk;
+  m_frame_count = 0;
+  m_stall_count = 0;
+
+  BinaryWriter binaryWriter(m_stream);
+  binaryWriter.WriteUInt32(DATASET_FILE_MAGIC);
+  binaryWriter.WriteUInt32(DATASET_FILE_VERSION);
+  binaryWriter.WriteUInt32(cartridge_crc);
+  binaryWriter.WriteUInt32(m_frames_per_chunk);
+  binaryWriter.WriteUInt32(m_record_size);
+  binaryWriter.WriteUInt32(num_regions);
+  for (const DatasetRegion& region : m_regions)
+  {
+    binaryWriter.WriteUInt16(region.address);
+    binaryWriter.WriteUInt32(region.length);
+  }
+
+  // everything the steady state needs is allocated up front
+  m_region_ranges.resize(m_regions.size());
+  m_ring.resize(RING_CHUNKS);
+  for (Chunk& chunk : m_ring)
+  {
+    chunk.records.assign(m_record_size * m_frames_per_chunk, 0);
+    chunk.frame_count = 0;
+  }
+  m_compressed_buffer.resize(compressBound(m_record_size * m_frames_per_chunk));
+  m_index.clear();
+  m_write_error = false;
+  m_ring_head = 0;
+  m_ring_pending = 0;
+  m_ring_fill = 0;
+  m_shutdown = false;
+  m_writer_thread = std::thread(&DatasetWriter::WriterThread, this);
+
+  Log_InfoPrintf("Recording dataset to '%s', %u byte records, %u frames per chunk.", filename, m_record_size,
+                 m_frames_per_chunk);
+  return true;
+}
+
+void DatasetWriter::Close()
+{
+  if (m_stream == nullptr)
+    return;
+
+  if (m_ring[m_ring_fill].frame_count > 0)
+    SubmitChunk();
+
+  {
+    std::unique_lock<std::mutex> lock(m_ring_mutex);
+    m_shutdown = true;
+    m_ring_cv.notify_all();
+  }
+  m_writer_thread.join();
+
+  BinaryWriter binaryWriter(m_stream);
+  uint64 index_offset = m_stream->GetPosition();
+  for (const ChunkIndexEntry& entry : m_index)
+  {
+    binaryWriter.WriteUInt64(entry.offset);
+    binaryWriter.WriteUInt32(entry.compressed_size);
+    binaryWriter.WriteUInt32(entry.frame_count);
+  }
+  binaryWriter.WriteUInt64(index_offset);
+  binaryWriter.WriteUInt32(static_cast<uint32>(m_index.size()));
+  binaryWriter.WriteUInt32(DATASET_FILE_MAGIC);
+
+  if (m_write_error || m_stream->InErrorState() || !m_stream->Commit())
+  {
+    Log_ErrorPrintf("Failed to write dataset '%s'", m_filename.GetCharArray());
+    m_stream->Discard();
+  }
+  else
+  {
+    Log_InfoPrintf("Wrote %u frames in %u chunks to dataset '%s', waited on the writer %u times.", m_frame_count,
+                   static_cast<uint32>(m_index.size()), m_filename.GetCharArray(), m_stall_count);
+  }
+
+  m_stream->Release();
+  m_stream = nullptr;
+
+  m_ring.clear();
+  m_compressed_buffer.clear();
+  m_index.clear();
+}
+
+void DatasetWriter::AddFrame(const System* system, const void* pixels, uint32 row_stride)
+{
+  if (m_stream == nullptr)
+    return;
+
+  // the chunk being filled is only touched here, the writer thread leaves it alone until it is submitted
+  Chunk& chunk = m_ring[m_ring_fill];
+  byte* record = chunk.records.data() + chunk.frame_count * m_record_size;
+
+  uint32 frame_counter = system->GetFrameCounter();
+  Y_memcpy(record, &frame_counter, sizeof(frame_counter));
+  record[4] = system->GetPadDirectionState();
+  record[5] = system->GetPadButtonState();
+
+  uint32 palette[MAX_PALETTE_SIZE];
+  uint16 palette_size =
+    static_cast<uint16>(IndexFrameBuffer(pixels, row_stride, palette, record + RECORD_PIXELS_OFFSET));
+  Y_memcpy(record + 6, &palette_size, sizeof(palette_size));
+  Y_memcpy(record + RECORD_PALETTE_OFFSET, palette, sizeof(uint32) * palette_size);
+  Y_memzero(record + RECORD_PALETTE_OFFSET + sizeof(uint32) * palette_size,
+            sizeof(uint32) * (MAX_PALETTE_SIZE - palette_size));
+
+  byte* ram = record + RECORD_RAM_OFFSET;
+  for (size_t i = 0; i < m_regions.size(); i++)
+  {
+    m_region_ranges[i].address = m_regions[i].address;
+    m_region_ranges[i].length = m_regions[i].length;
+    m_region_ranges[i].buffer = ram;
+    ram += m_regions[i].length;
+  }
+  system->PeekMemoryRanges(m_region_ranges.data(), static_cast<uint32>(m_region_ranges.size()));
+
+  m_frame_count++;
+  if (++chunk.frame_count == m_frames_per_chunk)
+    SubmitChunk();
+}
+
+void DatasetWriter::SubmitChunk()
+{
+  std::unique_lock<std::mutex> lock(m_ring_mutex);
+  m_ring_pending++;
+  m_ring_fill = (m_ring_fill + 1) % RING_CHUNKS;
+  m_ring_cv.notify_all();
+
+  // the next chunk to fill is still queued for writing
+  if (m_ring_pending == RING_CHUNKS)
+  {
+    m_stall_count++;
+    m_ring_cv.wait(lock, [this]() { return (m_ring_pending < RING_CHUNKS); });
+  }
+}
+
+void DatasetWriter::WriterThread()
+{
+  std::unique_lock<std::mutex> lock(m_ring_mutex);
+  for (;;)
+  {
+    m_ring_cv.wait(lock, [this]() { return (m_ring_pending > 0 || m_shutdown); });
+    if (m_ring_pending == 0)
+      break;
+
+    Chunk& chunk = m_ring[m_ring_head];
+    lock.unlock();
+
+    uLongf compressed_size = static_cast<uLongf>(m_compressed_buffer.size());
+    if (compress2(m_compressed_buffer.data(), &compressed_size, chunk.records.data(),
+                  chunk.frame_count * m_record_size, Z_BEST_SPEED) == Z_OK)
+    {
+      ChunkIndexEntry entry;
+      entry.offset = m_stream->GetPosition();
+      entry.compressed_size = static_cast<uint32>(compressed_size);
+      entry.frame_count = chunk.frame_count;
+      if (!m_stream->Write2(m_compressed_buffer.data(), entry.compressed_size))
+        m_write_error = true;
+      m_index.push_back(entry);
+    }
+    else
+    {
+      Log_ErrorPrintf("Failed to compress %u frame chunk", chunk.frame_count);
+      m_write_error = true;
+    }
+
+    lock.lock();
+    chunk.frame_count = 0;
+    m_ring_head = (m_ring_head + 1) % RING_CHUNKS;
+    m_ring_pending--;
+    m_ring_cv.notify_all();
+  }
+}
+
+bool DatasetWriter::ParseRegions(const char* str, std::vector<DatasetRegion>* regions, Error* pError)
+{
+  regions->clear();
+  const char* start = str;
+  while (*str != '\0')
+  {
+    uint32 address, length;
+    if (!ParseHexValue(str, 0xFFFF, &address) || *(str++) != ':' || !ParseHexValue(str, 0x10000, &length) ||
+        (*str != ',' && *str != '\0'))
+    {
+      pError->SetErrorUserFormatted(1, "Bad region list '%s', expected address:length[,address:length...]", start);
+      return false;
+    }
+
+    DatasetRegion region;
+    region.address = static_cast<uint16>(address);
+    region.length = length;
+    regions->push_back(region);
+    if (*str == ',')
+      str++;
+  }
+
+  return true;
+}
+
+DatasetReader::DatasetReader()
+  : m_stream(nullptr), m_cartridge_crc(0), m_frames_per_chunk(0), m_record_size(0), m_frame_count(0),
+    m_cached_chunk(0xFFFFFFFF)
+{
+}
+
+DatasetReader::~DatasetReader()
+{
+  Close();
+}
+
+bool DatasetReader::Open(const char* filename, Error* pError)
+{
+  Close();
+
+  m_stream = FileSystem::OpenFile(filename, BYTESTREAM_OPEN_READ);
+  if (m_stream == nullptr)
+  {
+    pError->SetErrorUserFormatted(1, "Could not open '%s'", filename);
+    return false;
+  }
+
+  BinaryReader binaryReader(m_stream);
+  uint32 magic = binaryReader.ReadUInt32();
+  uint32 version = binaryReader.ReadUInt32();
+  m_cartridge_crc = binaryReader.ReadUInt32();
+  m_frames_per_chunk = binaryReader.ReadUInt32();
+  m_record_size = binaryReader.ReadUInt32();
+  uint32 num_regions = binaryReader.ReadUInt32();
+  if (m_stream->InErrorState() || magic != DATASET_FILE_MAGIC || version != DATASET_FILE_VERSION ||
+      m_frames_per_chunk == 0 || num_regions > 0x10000)
+  {
+    pError->SetErrorUserFormatted(1, "'%s' is not a dataset, or is from another version", filename);
+    Close();
+    return false;
+  }
+
+  // the record size has to be exactly what the writer would have used for these regions
+  uint64 ram_size = 0;
+  bool regions_valid = true;
+  m_regions.resize(num_regions);
+  for (DatasetRegion& region : m_regions)
+  {
+    region.address = binaryReader.ReadUInt16();
+    region.length = binaryReader.ReadUInt32();
+    if (region.length == 0 || (uint64(region.address) + region.length) > 0x10000)
+      regions_valid = false;
+    ram_size += region.length;
+  }
+  if (!regions_valid || ram_size > MAX_RAM_SIZE ||
+      m_record_size != ((RECORD_RAM_OFFSET + uint32(ram_size) + 3) & ~3u) ||
+      (uint64(m_frames_per_chunk) * m_record_size) > MAX_CHUNK_SIZE)
+  {
+    pError->SetErrorUserFormatted(1, "Dataset '%s' has a corrupted header", filename);
+    Close();
+    return false;
+  }
+
+  // the index is found through the footer
+  uint64 file_size = m_stream->GetSize();
+  uint64 index_offset = 0;
+  uint32 num_chunks = 0;
+  if (file_size >= FOOTER_SIZE && m_stream->SeekAbsolute(file_size - FOOTER_SIZE))
+  {
+    index_offset = binaryReader.ReadUInt64();
+    num_chunks = binaryReader.ReadUInt32();
+    magic = binaryReader.ReadUInt32();
+  }
+  if (m_stream->InErrorState() || magic != DATASET_FILE_MAGIC ||
+      (index_offset + uint64(num_chunks) * 16 + FOOTER_SIZE) != file_size || !m_stream->SeekAbsolute(index_offset))
+  {
+    pError->SetErrorUserFormatted(1, "Dataset '%s' is truncated or corrupted", filename);
+    Close();
+    return false;
+  }
+
+  // frames are located by dividing by the chunk size, so only the last chunk can be partial
+  m_chunks.resize(num_chunks);
+  uint64 frame_count = 0;
+  bool chunks_valid = true;
+  for (uint32 i = 0; i < num_chunks; i++)
+  {
+    ChunkInfo& chunk = m_chunks[i];
+    chunk.offset = binaryReader.ReadUInt64();
+    chunk.compressed_size = binaryReader.ReadUInt32();
+    chunk.frame_count = binaryReader.ReadUInt32();
+    frame_count += chunk.frame_count;
+    if (chunk.frame_count == 0 || chunk.frame_count > m_frames_per_chunk ||
+        (i != (num_chunks - 1) && chunk.frame_count != m_frames_per_chunk) ||
+        (chunk.offset + chunk.compressed_size) > index_offset)
+    {
+      chunks_valid = false;
+    }
+  }
+  if (m_stream->InErrorState() || !chunks_valid || frame_count > 0xFFFFFFFFu)
+  {
+    pError->SetErrorUserFormatted(1, "Dataset '%s' has a corrupted index", filename);
+    Close();
+    return false;
+  }
+
+  m_frame_count = static_cast<uint32>(frame_count);
+  m_cached_chunk = 0xFFFFFFFF;
+  return true;
+}
+
+void DatasetReader::Close()
+{
+  if (m_stream != nullptr)
+  {
+    m_stream->Release();
+    m_stream = nullptr;
+  }
+
+  m_regions.clear();
+  m_chunks.clear();
+  m_frame_count = 0;
+  m_cached_chunk = 0xFFFFFFFF;
+}
+
+bool DatasetReader::LoadChunk(uint32 chunk, Error* pError)
+{
+  const ChunkInfo& info = m_chunks[chunk];
+  m_cached_chunk = 0xFFFFFFFF;
+  m_compressed_data.resize(info.compressed_size);
+  m_chunk_data.resize(info.frame_count * m_record_size);
+  if (!m_stream->SeekAbsolute(info.offset) || !m_stream->Read2(m_compressed_data.data(), info.compressed_size))
+  {
+    pError->SetErrorUserFormatted(1, "Failed to read chunk %u", chunk);
+    return false;
+  }
+
+  uLongf data_size = static_cast<uLongf>(m_chunk_data.size());
+  if (uncompress(m_chunk_data.data(), &data_size, m_compressed_data.data(), info.compressed_size) != Z_OK ||
+      data_size != m_chunk_data.size())
+  {
+    pError->SetErrorUserFormatted(1, "Failed to decompress chunk %u", chunk);
+    return false;
+  }
+
+  m_cached_chunk = chunk;
+  return true;
+}
+
+bool DatasetReader::ReadFrame(uint32 index, Frame* frame, Error* pError)
+{
+  if (index >= m_frame_count)
+  {
+    pError->SetErrorUserFormatted(1, "Frame %u is past the end of the dataset (%u frames)", index, m_frame_count);
+    return false;
+  }
+
+  // every chunk but the last is full
+  uint32 chunk = index / m_frames_per_chunk;
+  if (chunk != m_cached_chunk && !LoadChunk(chunk, pError))
+    return false;
+
+  const byte* record = m_chunk_data.data() + (index % m_frames_per_chunk) * m_record_size;
+  uint16 palette_size;
+  Y_memcpy(&frame->frame_counter, record, sizeof(frame->frame_counter));
+  frame->direction_state = record[4];
+  frame->button_state = record[5];
+  Y_memcpy(&palette_size, record + 6, sizeof(palette_size));
+  frame->palette_size = palette_size;
+  frame->palette = reinterpret_cast<const uint32*>(record + RECORD_PALETTE_OFFSET);
+  frame->pixels = record + RECORD_PIXELS_OFFSET;
+  frame->ram = record + RECORD_RAM_OFFSET;
+  return true;
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include "YBaseLib/Common.h"
+#include "YBaseLib/String.h"
+#include "display.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ByteStream;
+class Error;
+class System;
+
+// Training data recording. Every frame is stored as a fixed-size record holding the frame counter, the pad state, the
+// frame buffer as indices into a per-frame palette, and a copy of the selected memory regions. Records are grouped
+// into chunks which are zlib compressed independently, with an index of the chunks at the end of the file, so any
+// frame can be read back by decompressing the one chunk which holds it.
+struct DatasetRegion
+{
+  uint16 address;
+  uint32 length;
+};
+
+class DatasetWriter
+{
+public:
+  static const uint32 DEFAULT_FRAMES_PER_CHUNK = 256;
+
+  DatasetWriter();
+  ~DatasetWriter();
+
+  bool IsOpen() const { return (m_stream != nullptr); }
+  uint32 GetFrameCount() const { return m_frame_count; }
+
+  bool Open(const char* filename, uint32 cartridge_crc, const DatasetRegion* regions, uint32 num_regions,
+            uint32 frames_per_chunk, Error* pError);
+  void Close();
+
+  // Copies a frame into the ring, which a background thread compresses and writes out a chunk at a time. Only
+  // blocks if that thread has fallen behind by the whole ring.
+  void AddFrame(const System* system, const void* pixels, uint32 row_stride);
+
+  // parses "address:length[,address:length...]", in hex
+  static bool ParseRegions(const char* str, std::vector<DatasetRegion>* regions, Error* pError);
+
+private:
+  struct Chunk
+  {
+    std::vector<byte> records;
+    uint32 frame_count;
+  };
+
+  struct ChunkIndexEntry
+  {
+    uint64 offset;
+    uint32 compressed_size;
+    uint32 frame_count;
+  };
+
+  void SubmitChunk();
+  void WriterThread();
+
+  ByteStream* m_stream;
+  String m_filename;
+  std::vector<DatasetRegion> m_regions;
+  std::vector<System::MemoryRange> m_region_ranges;
+  uint32 m_frames_per_chunk;
+  uint32 m_record_size;
+  uint32 m_frame_count;
+  uint32 m_stall_count;
+
+  // chunks [m_ring_head, m_ring_head + m_ring_pending) are waiting for the writer, m_ring_fill is being filled
+  std::vector<Chunk> m_ring;
+  uint32 m_ring_head;
+  uint32 m_ring_pending;
+  uint32 m_ring_fill;
+  bool m_shutdown;
+  std::mutex m_ring_mutex;
+  std::condition_variable m_ring_cv;
+  std::thread m_writer_thread;
+
+  // only touched by the writer thread until it is joined
+  std::vector<byte> m_compressed_buffer;
+  std::vector<ChunkIndexEntry> m_index;
+  bool m_write_error;
+};
+
+class DatasetReader
+{
+public:
+  // Points into the reader's cached chunk, valid until the next ReadFrame.
+  struct Frame
+  {
+    uint32 frame_counter;
+    uint8 direction_state;
+    uint8 button_state;
+    uint32 palette_size;
+    const uint32* palette;
+    const uint8* pixels; // SCREEN_WIDTH * SCREEN_HEIGHT palette indices
+    const byte* ram;     // each region in turn, back to back
+  };
+
+  DatasetReader();
+  ~DatasetReader();
+
+  bool Open(const char* filename, Error* pError);
+  void Close();
+
+  uint32 GetCartridgeCRC() const { return m_cartridge_crc; }
+  uint32 GetFrameCount() const { return m_frame_count; }
+  uint32 GetChunkCount() const { return static_cast<uint32>(m_chunks.size()); }
+  uint32 GetRegionCount() const { return static_cast<uint32>(m_regions.size()); }
+  const DatasetRegion& GetRegion(uint32 index) const { return m_regions[index]; }
+
+  bool ReadFrame(uint32 index, Frame* frame, Error* pError);
+
+private:
+  struct ChunkInfo
+  {
+    uint64 offset;
+    uint32 compressed_size;
+    uint32 frame_count;
+  };
+
+  bool LoadChunk(uint32 chunk, Error* pError);
+
+  ByteStream* m_stream;
+  uint32 m_cartridge_crc;
+  uint32 m_frames_per_chunk;
+  uint32 m_record_size;
+  uint32 m_frame_count;
+  std::vector<DatasetRegion> m_regions;
+  std::vector<ChunkInfo> m_chunks;
+
+  uint32 m_cached_chunk;
+  std::vector<byte> m_chunk_data;
+  std::vector<byte> m_compressed_data;
+};
@@ -7,8 +7,12 @@
 #include "YBaseLib/Log.h"
 #include "YBaseLib/Memory.h"
 #include "YBaseLib/String.h"
+#include "cheats.h"
+#include "render_capture.h"
 Log_SetChannel(Display);
 
+const uint32 Display::DMG_GRAYSCALE_COLORS[4] = {0xFFFFFFFF, 0xFFC0C0C0, 0xFF606060, 0xFF000000};
+
 static uint32 CalculateHDMATransferCycles(uint32 length)
 {
   // 32 cycles per 16 bytes?
@@ -18,7 +22,10 @@ static uint32 CalculateHDMATransferCycles(uint32 length)
   return (length / 0x10) * 32;
 }
 
-Display::Display(System* memory) : m_system(memory), m_last_cycle(0), m_frameReady(false) {}
+Display::Display(System* memory)
+  : m_system(memory), m_last_cycle(0), m_vram_tracking(false), m_frameReady(false), m_render_capture(nullptr)
+{
+}
 
 Display::~Display() {}
 
@@ -174,6 +181,8 @@ void Display::Reset()
   Y_memzero(&m_registers, sizeof(m_registers));
   Y_memzero(m_cgb_bg_palette, sizeof(m_cgb_bg_palette));
   Y_memzero(m_cgb_sprite_palette, sizeof(m_cgb_sprite_palette));
+  Y_memset(m_dirty_tiles, 0xFF, sizeof(m_dirty_tiles));
+  m_dirty_maps = 0x03;
 
   // start at the end of vblank which is equal to starting fresh
   m_modeClocksRemaining = 0;
@@ -216,6 +225,10 @@ bool Display::LoadState(ByteStream* pStream, BinaryReader& binaryReader, Error*
   m_HDMATransferClocksRemaining = binaryReader.ReadUInt32();
   m_cyclesSinceVBlank = binaryReader.ReadUInt32();
   m_currentScanLine = binaryReader.ReadUInt8();
+
+  // vram was replaced wholesale
+  Y_memset(m_dirty_tiles, 0xFF, sizeof(m_dirty_tiles));
+  m_dirty_maps = 0x03;
   return true;
 }
 
@@ -294,6 +307,9 @@ void Display::SetState(DISPLAY_STATE state)
     m_frameReady = true;
     PushFrame();
 
+    // gameshark codes are applied once per frame, as the real device does from the vblank handler
+    m_system->m_cheat_engine->ApplyRAMCodes();
+
     // Fire interrupts
     if (display_enabled)
     {
@@ -351,10 +367,32 @@ void Display::SetLCDCRegister(uint8 value)
       m_frameReady = true;
       ClearFrameBuffer();
       PushFrame();
+
+      // The controller sits in mode 0 at LY 0 with memory unlocked until it is turned back on. Nothing is
+      // scheduled while off, Synchronize only counts time so blank frames keep arriving at the normal rate.
+      m_registers.LCDC = value;
+      m_state = DISPLAY_STATE_HBLANK;
+      m_registers.STAT &= ~0x3;
+      m_system->SetOAMLock(false);
+      m_system->SetVRAMLock(false);
+      m_currentScanLine = 0;
+      m_cyclesSinceVBlank = 0;
+      m_registers.LY = 0;
+      m_registers.STAT = (m_registers.STAT & ~(1 << 2)) | (uint8(m_registers.LYC == 0) << 2);
+      m_system->SetNextDisplaySyncCycle(70224);
+      return;
     }
     else
     {
+      // Start again from the top of the frame.
       TRACE("Display enabled.");
+      m_registers.LCDC = value;
+      m_currentScanLine = 0;
+      m_cyclesSinceVBlank = 0;
+      SetState(DISPLAY_STATE_OAM_READ);
+      SetLYRegister(0);
+      m_system->SetNextDisplaySyncCycle(m_modeClocksRemaining);
+      return;
     }
   }
 
@@ -424,11 +462,32 @@ void Display::ExecuteHDMATransferBlock(uint32 bytes)
   if ((source_address > 0x7FF0 && source_address < 0xA000) || source_address > 0xDFF0)
     Log_WarningPrintf("Source address out of range (0x%04X)", source_address);
 
-  // transfer bytes
-  for (uint32 i = 0; i < copy_length; i++)
+  // transfer bytes, in runs that don't cross a 4KB source page or the end of vram
+  uint32 bytes_remaining = copy_length;
+  while (bytes_remaining > 0)
   {
-    DebugAssert(current_destination_address < 0x2000);
-    vram[current_destination_address++] = m_system->CPURead(current_source_address++);
+    uint32 run_length = Min(bytes_remaining, 0x1000u - (current_source_address & 0xFFFu));
+    run_length = Min(run_length, 0x2000u - current_destination_address);
+
+    // vram->vram isn't a valid source, leave it to the bus
+    const byte* source = nullptr;
+    if (current_source_address < 0x8000 || current_source_address >= 0xA000)
+      source = m_system->GetDMASourcePointer(current_source_address, run_length);
+
+    if (source != nullptr)
+    {
+      Y_memcpy(vram + current_destination_address, source, run_length);
+    }
+    else
+    {
+      for (uint32 i = 0; i < run_length; i++)
+        vram[current_destination_address + i] = m_system->CPURead(current_source_address + (uint16)i);
+    }
+
+    MarkVRAMDirty(m_system->GetActiveCPUVRAMBank(), current_destination_address, run_length);
+    current_source_address += (uint16)run_length;
+    current_destination_address = uint16((current_destination_address + run_length) & 0x1FF0);
+    bytes_remaining -= run_length;
   }
 
   // update registers with addresses
@@ -451,6 +510,45 @@ void Display::ExecuteHDMATransferBlock(uint32 bytes)
   // calculate how many cycles we need to block the cpu for
   m_HDMATransferClocksRemaining = CalculateHDMATransferCycles(copy_length);
   m_system->DisableCPU(true);
+
+  // with the display off, the next sync could be most of a frame away, so make sure the cpu is released on time
+  // SetNextDisplaySyncCycle() applies the speed divider itself, the minimum keeps the result above zero
+  if (!IsDisplayEnabled())
+    m_system->SetNextDisplaySyncCycle(Max(m_HDMATransferClocksRemaining, 1u << m_system->GetDoubleSpeedDivider()));
+}
+
+void Display::SetVRAMTracking(bool enabled)
+{
+  if (m_vram_tracking == enabled)
+    return;
+
+  // nothing was tracked while off
+  m_vram_tracking = enabled;
+  Y_memset(m_dirty_tiles, 0xFF, sizeof(m_dirty_tiles));
+  m_dirty_maps = 0x03;
+}
+
+void Display::MarkVRAMDirty(uint32 bank, uint32 offset, uint32 length)
+{
+  DebugAssert(bank < 2 && (offset + length) <= 0x2000);
+  if (!m_vram_tracking)
+    return;
+
+  uint32 end = offset + length;
+
+  // tile data, 16 bytes per tile
+  if (offset < 0x1800)
+  {
+    uint32 last_tile = (Min(end, 0x1800u) - 1) / 16;
+    for (uint32 tile = offset / 16; tile <= last_tile; tile++)
+      m_dirty_tiles[bank][tile / 32] |= (1u << (tile % 32));
+  }
+
+  // tile maps, bank 1 holds the cgb attributes
+  if (end > 0x1800 && offset < 0x1C00)
+    m_dirty_maps |= 0x01;
+  if (end > 0x1C00)
+    m_dirty_maps |= 0x02;
 }
 
 bool Display::CanTriggerOAMBug() const
@@ -481,6 +579,9 @@ void Display::Synchronize()
   uint32 cycles_to_execute = m_system->CalculateCycleCount(m_last_cycle);
   m_last_cycle = m_system->GetCycleNumber();
 
+  // Bring OAM up to date before rendering from it.
+  m_system->SynchronizeOAMDMA();
+
   // Handle HDMA transfers blocking of cpu.
   // This would be better placed elsewhere.
   if (m_HDMATransferClocksRemaining > 0)
@@ -499,6 +600,26 @@ void Display::Synchronize()
     }
   }
 
+  // With the LCD off there are no modes to step through, just emit a blank frame every frame's worth of time.
+  if (!IsDisplayEnabled())
+  {
+    m_cyclesSinceVBlank += cycles_to_execute;
+    while (m_cyclesSinceVBlank >= 70224)
+    {
+      m_cyclesSinceVBlank -= 70224;
+      PushFrame();
+      m_system->m_cheat_engine->ApplyRAMCodes();
+    }
+
+    // wake up early if the cpu is waiting on a hdma transfer
+    uint32 next_sync = 70224 - m_cyclesSinceVBlank;
+    if (m_HDMATransferClocksRemaining > 0)
+      next_sync = Min(next_sync, Max(m_HDMATransferClocksRemaining, 1u << m_system->GetDoubleSpeedDivider()));
+
+    m_system->SetNextDisplaySyncCycle(next_sync);
+    return;
+  }
+
   // Execute as much time as we can.
   while (cycles_to_execute > 0)
   {
@@ -527,11 +648,20 @@ void Display::Synchronize()
 
     case DISPLAY_STATE_OAM_VRAM_READ:
     {
-      // Render this scanline.
-      if (!m_system->InCGBMode())
-        RenderScanline(m_currentScanLine);
-      else
-        RenderScanline_CGB(m_currentScanLine);
+      // Render this scanline, nothing is shown while turbo booting.
+      if (!m_system->m_turbo_boot_active)
+      {
+        if (!m_system->InCGBMode())
+          RenderScanline(m_currentScanLine);
+        else
+          RenderScanline_CGB(m_currentScanLine);
+
+        if (m_render_capture != nullptr)
+          m_render_capture->AddScanline(this, m_currentScanLine);
+
+        // Publish finished lines to the frontend.
+        PushScanlines(m_currentScanLine);
+      }
 
       // Enter HBLANK for this scanline
       SetState(DISPLAY_STATE_HBLANK);
@@ -631,8 +761,7 @@ uint32 Display::ReadCGBPalette(const uint8* palette, uint8 palette_index, uint8
 
 void Display::RenderScanline(uint8 LINE)
 {
-  const uint32 grayscale_colors[4] = {0xFFFFFFFF, 0xFFC0C0C0, 0xFF606060, 0xFF000000};
-  // const uint32 grayscale_colors[4] = { 0xFF000000, 0xFF606060, 0xFFC0C0C0, 0xFFFFFFFF};
+  const uint32* grayscale_colors = DMG_GRAYSCALE_COLORS;
 
   // blank the line
   byte* pFrameBufferLine = m_frameBuffer + (LINE * SCREEN_WIDTH * 4);
@@ -1082,12 +1211,13 @@ void Display::PutPixel(uint32 x, uint32 y, uint32 color)
 
 void Display::PushFrame()
 {
-  if (m_system->m_callbacks != nullptr)
+  if (m_system->m_callbacks != nullptr && !m_system->m_turbo_boot_active)
     m_system->m_callbacks->PresentDisplayBuffer(m_frameBuffer, SCREEN_WIDTH * 4);
 
   m_system->m_frame_counter++;
   m_system->m_frames_since_speed_update++;
   m_system->m_last_vblank_clocks = m_system->m_clocks_since_reset;
+  m_system->m_stop_execution = true;
   // Log_DevPrintf("SCX: %u, SCY: %u", m_registers.SCX, m_registers.SCY);
 
   // static Timer timer;
@@ -1095,89 +1225,61 @@ void Display::PushFrame()
   // timer.Reset();
 }
 
-void Display::DisplayTiles()
+void Display::PushScanlines(uint8 LINE)
 {
-  const uint32 grayscale_colors[4] = {0xFFFFFFFF, 0xFFC0C0C0, 0xFF606060, 0xFF000000};
-
-  uint32 draw_x = 0;
-  uint32 draw_y = 0;
-
-  Y_memzero(m_frameBuffer, sizeof(m_frameBuffer));
-
-  for (uint32 bank = 0; bank < 2; bank++)
-  {
-    for (uint32 tile = 0; tile < 192; tile++)
-    {
-      for (uint8 y = 0; y < 8; y++)
-      {
-        for (uint8 x = 0; x < 8; x++)
-        {
-          uint8 paletteidx;
-          if (tile <= 64)
-            paletteidx = ReadTile(bank, false, tile, x, y);
-          else
-            paletteidx = ReadTile(bank, true, -128 + (int32)(tile), x, y);
-
-          PutPixel(draw_x + x, draw_y + y, grayscale_colors[paletteidx]);
-        }
-      }
+  uint32 slice_size = m_system->m_scanline_slice_size;
+  if (slice_size == 0 || m_system->m_callbacks == nullptr)
+    return;
 
-      draw_x += 8;
-      if (draw_x == 160)
-      {
-        draw_x = 0;
-        draw_y += 8;
-        if (draw_y >= Display::SCREEN_HEIGHT)
-        {
-          PushFrame();
-          break;
-        }
-      }
-    }
-  }
+  // Slices are aligned to multiples of the slice size, the last one may be shorter.
+  uint32 next_line = uint32(LINE) + 1;
+  if ((next_line % slice_size) != 0 && next_line != SCREEN_HEIGHT)
+    return;
 
-  PushFrame();
+  uint32 first_line = (uint32(LINE) / slice_size) * slice_size;
+  m_system->m_callbacks->PresentDisplayScanlines(m_frameBuffer + (first_line * SCREEN_WIDTH * 4), SCREEN_WIDTH * 4,
+                                                 first_line, next_line - first_line);
 }
 
-void Display::RenderFull()
+void Display::GetPaletteColors(bool sprite, uint32 palette_index, uint32 colors[4]) const
 {
-  for (uint32 y = 0; y < SCREEN_HEIGHT; y++)
+  if (m_system->InCGBMode())
   {
-    if (m_system->InCGBMode())
-      RenderScanline_CGB((uint8)y);
-    else
-      RenderScanline((uint8)y);
+    const uint8* palette = sprite ? m_cgb_sprite_palette : m_cgb_bg_palette;
+    for (uint8 i = 0; i < 4; i++)
+      colors[i] = ReadCGBPalette(palette, uint8(palette_index & 7), i);
+
+    return;
   }
 
-  PushFrame();
+  uint8 reg = sprite ? ((palette_index & 1) ? m_registers.OBP1 : m_registers.OBP0) : m_registers.BGP;
+  for (uint32 i = 0; i < 4; i++)
+    colors[i] = DMG_GRAYSCALE_COLORS[(reg >> (i * 2)) & 0x3];
 }
 
-void Display::DumpTiles(uint8 tilemap)
+void Display::DecodeTile(uint32 bank, uint32 tile, const uint32 colors[4], bool hflip, bool vflip, uint32* pixels,
+                         uint32 stride) const
 {
-  uint8 LCDC = m_registers.LCDC;
-  const byte* VRAM = m_system->GetVRAM(0);
-  const byte* VRAM1 = m_system->GetVRAM(1);
-  uint8 BG_ENABLE = !!(LCDC & 0x01);
-  uint16 BGMAPBASE = (tilemap) ? 0x1C00 : 0x1800;
-  Log_DevPrintf("BGMAPBASE = %04X", BGMAPBASE);
-
-  if (BG_ENABLE)
+  DebugAssert(bank < 2 && tile < TILES_PER_VRAM_BANK);
+  const byte* tilemem = m_system->GetVRAM(bank) + tile * 16;
+  for (uint32 y = 0; y < 8; y++)
   {
-    String msg;
-
-    for (uint32 gy = 0; gy < 32; gy++)
+    uint32 row = vflip ? (7 - y) : y;
+    uint8 lsb = tilemem[row * 2];
+    uint8 msb = tilemem[row * 2 + 1];
+    uint32* out_row = pixels + y * stride;
+    for (uint32 x = 0; x < 8; x++)
     {
-      msg.Clear();
-      msg.AppendFormattedString("Group %u: ", gy);
-      for (uint32 gx = 0; gx < 32; gx++)
-      {
-        int8 id = (int8)VRAM[BGMAPBASE + gy * 32 + gx];
-        // uint8 flags = VRAM1[BGMAPBASE + gy * 32 + gx];
-        // uint8 palette = flags & 0x7;
-        // msg.AppendFormattedString("%d (p%u), ", (int)id, (uint32)palette);
-        msg.AppendFormattedString("%d, ", (int)id);
-      }
-      Log_DevPrint(msg);
+      uint32 bit = hflip ? x : (7 - x);
+      out_row[x] = colors[((lsb >> bit) & 0x1) | (((msb >> bit) & 0x1) << 1)];
     }
   }
 }
+
+void Display::TakeDirtyVRAM(uint32 dirty_tiles[2][TILES_PER_VRAM_BANK / 32], uint8* dirty_maps)
+{
+  Y_memcpy(dirty_tiles, m_dirty_tiles, sizeof(m_dirty_tiles));
+  *dirty_maps = m_dirty_maps;
+  Y_memzero(m_dirty_tiles, sizeof(m_dirty_tiles));
+  m_dirty_maps = 0;
+}
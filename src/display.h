@@ -7,14 +7,23 @@ class ByteStream;
 class BinaryReader;
 class BinaryWriter;
 class Error;
+class RenderCaptureWriter;
+class RenderReplay;
 
 class Display
 {
   friend System;
+  friend RenderCaptureWriter;
+  friend RenderReplay;
 
 public:
   static const uint32 SCREEN_WIDTH = 160;
   static const uint32 SCREEN_HEIGHT = 144;
+  static const uint32 LINE_CLOCKS = 456; // single speed clocks per scanline, vblank lines included
+  static const uint32 TILES_PER_VRAM_BANK = 384;
+
+  // white to black, for dmg palette indices
+  static const uint32 DMG_GRAYSCALE_COLORS[4];
 
   struct Registers
   {
@@ -61,13 +70,28 @@ public:
   // step
   void Synchronize();
 
+  // debug viewer access
+  const Registers& GetRegisters() const { return m_registers; }
+  const byte* GetVRAM(uint32 bank) const { return m_system->GetVRAM(bank); }
+  const OAM_ENTRY* GetOAMEntries() const { return reinterpret_cast<const OAM_ENTRY*>(m_system->GetOAM()); }
+  void GetPaletteColors(bool sprite, uint32 palette_index, uint32 colors[4]) const;
+  void DecodeTile(uint32 bank, uint32 tile, const uint32 colors[4], bool hflip, bool vflip, uint32* pixels,
+                  uint32 stride) const;
+
+  // Returns the tiles/maps modified since the last call, and clears the dirty state. Writes are only tracked while
+  // enabled, so the cpu's vram write path doesn't pay for it when there is no viewer.
+  void TakeDirtyVRAM(uint32 dirty_tiles[2][TILES_PER_VRAM_BANK / 32], uint8* dirty_maps);
+  bool IsVRAMTrackingEnabled() const { return m_vram_tracking; }
+  void SetVRAMTracking(bool enabled);
+
+  // records the renderer's input and output for each line, null to stop
+  void SetRenderCapture(RenderCaptureWriter* capture) { m_render_capture = capture; }
+
 private:
   void RenderScanline(uint8 LINE);
   void RenderScanline_CGB(uint8 LINE);
-  void RenderFull();
-  void DumpTiles(uint8 tilemap);
-  void DisplayTiles();
   void PushFrame();
+  void PushScanlines(uint8 LINE);
 
   void SetState(DISPLAY_STATE state);
   void SetLCDCRegister(uint8 value);
@@ -93,6 +117,9 @@ private:
   // HDMA transfer
   void ExecuteHDMATransferBlock(uint32 bytes);
 
+  // VRAM change tracking for decoded tile/map caches
+  void MarkVRAMDirty(uint32 bank, uint32 offset, uint32 length);
+
   System* m_system;
   uint32 m_last_cycle;
 
@@ -110,6 +137,13 @@ private:
   uint32 m_cyclesSinceVBlank;
   uint8 m_currentScanLine;
 
+  // dirty bit per tile, and per tile map (bit 0 = 9800, bit 1 = 9C00)
+  uint32 m_dirty_tiles[2][TILES_PER_VRAM_BANK / 32];
+  uint8 m_dirty_maps;
+  bool m_vram_tracking;
+
   byte m_frameBuffer[SCREEN_WIDTH * SCREEN_HEIGHT * 4]; // RGBA
   bool m_frameReady;
+
+  RenderCaptureWriter* m_render_capture;
 };
@@ -0,0 +1,10 @@
+#include "headless.h"
+#include "cartridge.h"
+
+void SetupHeadlessSystem(System* system, Cartridge* cartridge)
+{
+  system->SetAudioEnabled(false);
+  system->SetFrameLimiter(false);
+  if (cartridge != nullptr)
+    cartridge->SetRTCWallClockSync(false);
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "YBaseLib/Common.h"
+#include "system.h"
+
+class Cartridge;
+
+// Callbacks for systems driven without a frontend, by the benchmarks, test runner and control server.
+// Nothing is presented or persisted, so battery ram and the rtc always start out clear.
+class HeadlessCallbacks : public System::CallbackInterface
+{
+public:
+  void PresentDisplayBuffer(const void* pPixels, uint32 row_stride) override {}
+  bool LoadCartridgeRAM(void* pData, size_t expected_data_size) override final { return false; }
+  void SaveCartridgeRAM(const void* pData, size_t data_size) override final {}
+  bool LoadCartridgeRTC(void* pData, size_t expected_data_size) override final { return false; }
+  void SaveCartridgeRTC(const void* pData, size_t data_size) override final {}
+};
+
+// Sets up an initialized system for unattended runs, with no audio output or frame limiter. The cartridge's rtc
+// counts emulated time rather than following the host clock, which keeps runs repeatable. cartridge can be null.
+void SetupHeadlessSystem(System* system, Cartridge* cartridge);
@@ -0,0 +1,103 @@
+#include "input_movie.h"
+#include "YBaseLib/BinaryReader.h"
+#include "YBaseLib/BinaryWriter.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Error.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+Log_SetChannel(InputMovie);
+
+static const uint32 MOVIE_FILE_MAGIC = 0x564D4247;
+static const uint32 MOVIE_FILE_VERSION = 2;
+
+// version 1 had no flags
+static const uint32 MOVIE_FILE_MIN_VERSION = 1;
+static const uint32 MOVIE_FLAG_RTC_EMULATED = (1 << 0);
+
+InputMovie::InputMovie() : m_cartridge_crc(0), m_rtc_emulated(false) {}
+
+InputMovie::~InputMovie() {}
+
+bool InputMovie::Load(const char* filename, Error* pError)
+{
+  m_events.clear();
+
+  ByteStream* pStream = FileSystem::OpenFile(filename, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_STREAMED);
+  if (pStream == nullptr)
+  {
+    pError->SetErrorUserFormatted(1, "Could not open '%s'", filename);
+    return false;
+  }
+
+  BinaryReader binaryReader(pStream);
+  uint32 magic = binaryReader.ReadUInt32();
+  uint32 version = binaryReader.ReadUInt32();
+  m_cartridge_crc = binaryReader.ReadUInt32();
+  uint32 flags = (version >= 2) ? binaryReader.ReadUInt32() : 0;
+  uint32 count = binaryReader.ReadUInt32();
+  if (pStream->InErrorState() || magic != MOVIE_FILE_MAGIC || version < MOVIE_FILE_MIN_VERSION ||
+      version > MOVIE_FILE_VERSION)
+  {
+    pError->SetErrorUserFormatted(1, "'%s' is not a movie, or is from another version", filename);
+    pStream->Release();
+    return false;
+  }
+
+  m_rtc_emulated = ((flags & MOVIE_FLAG_RTC_EMULATED) != 0);
+  m_events.resize(count);
+  for (System::InputEvent& event : m_events)
+  {
+    event.clock = binaryReader.ReadUInt64();
+    event.direction_state = binaryReader.ReadUInt8();
+    event.button_state = binaryReader.ReadUInt8();
+  }
+
+  if (pStream->InErrorState() || pStream->GetPosition() != pStream->GetSize())
+  {
+    pError->SetErrorUserFormatted(1, "Movie '%s' is truncated or corrupted", filename);
+    pStream->Release();
+    m_events.clear();
+    return false;
+  }
+
+  pStream->Release();
+  return true;
+}
+
+bool InputMovie::Save(const char* filename, Error* pError) const
+{
+  ByteStream* pStream =
+    FileSystem::OpenFile(filename, BYTESTREAM_OPEN_CREATE | BYTESTREAM_OPEN_CREATE_PATH | BYTESTREAM_OPEN_WRITE |
+                                     BYTESTREAM_OPEN_TRUNCATE | BYTESTREAM_OPEN_STREAMED |
+                                     BYTESTREAM_OPEN_ATOMIC_UPDATE);
+  if (pStream == nullptr)
+  {
+    pError->SetErrorUserFormatted(1, "Could not open '%s'", filename);
+    return false;
+  }
+
+  BinaryWriter binaryWriter(pStream);
+  binaryWriter.WriteUInt32(MOVIE_FILE_MAGIC);
+  binaryWriter.WriteUInt32(MOVIE_FILE_VERSION);
+  binaryWriter.WriteUInt32(m_cartridge_crc);
+  binaryWriter.WriteUInt32(m_rtc_emulated ? MOVIE_FLAG_RTC_EMULATED : 0);
+  binaryWriter.WriteUInt32(GetEventCount());
+  for (const System::InputEvent& event : m_events)
+  {
+    binaryWriter.WriteUInt64(event.clock);
+    binaryWriter.WriteUInt8(event.direction_state);
+    binaryWriter.WriteUInt8(event.button_state);
+  }
+
+  if (pStream->InErrorState())
+  {
+    pError->SetErrorUserFormatted(1, "Failed to write '%s'", filename);
+    pStream->Discard();
+    pStream->Release();
+    return false;
+  }
+
+  pStream->Commit();
+  pStream->Release();
+  return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "YBaseLib/Common.h"
+#include "system.h"
+#include <vector>
+
+class Error;
+
+// Pad input recorded against emulated clocks, so it replays cycle-exact from the same starting state through the
+// system's input queue. Recording starts from whatever state the system is in when the recorder is attached.
+// Movies are recorded and played back with the cartridge rtc counting emulated time, as the host clock would desync.
+class InputMovie
+{
+public:
+  InputMovie();
+  ~InputMovie();
+
+  uint32 GetEventCount() const { return static_cast<uint32>(m_events.size()); }
+  const System::InputEvent& GetEvent(uint32 index) const { return m_events[index]; }
+
+  // crc of the cartridge the movie was recorded on
+  uint32 GetCartridgeCRC() const { return m_cartridge_crc; }
+  void SetCartridgeCRC(uint32 crc) { m_cartridge_crc = crc; }
+
+  // whether the rtc counted emulated time while recording, false for movies from before this was stored
+  bool IsRTCEmulated() const { return m_rtc_emulated; }
+  void SetRTCEmulated(bool emulated) { m_rtc_emulated = emulated; }
+
+  void AddEvent(const System::InputEvent& event) { m_events.push_back(event); }
+  void Clear() { m_events.clear(); }
+
+  bool Load(const char* filename, Error* pError);
+  bool Save(const char* filename, Error* pError) const;
+
+private:
+  std::vector<System::InputEvent> m_events;
+  uint32 m_cartridge_crc;
+  bool m_rtc_emulated;
+};
@@ -9,14 +9,20 @@ Log_SetChannel(Link);
 
 static const uint32 NW_VERSION = 2;
 
-ReadPacket::ReadPacket(LINK_COMMAND command, uint16 size)
-  : BinaryReadBuffer(Max(size, (uint16)1)), m_command(command), m_packetSize(size)
-{
-}
+ReadPacket::ReadPacket() : m_command(LINK_COMMAND_HELLO), m_packetSize(0), m_position(0) {}
 
 ReadPacket::~ReadPacket() {}
 
-WritePacket::WritePacket(LINK_COMMAND command) : BinaryWriteBuffer(), m_command(command) {}
+void ReadPacket::SetContents(LINK_COMMAND command, const void* data, uint16 size)
+{
+  DebugAssert(size <= LINK_MAX_PACKET_SIZE);
+  m_command = command;
+  m_packetSize = size;
+  m_position = 0;
+  Y_memcpy(m_buffer, data, size);
+}
+
+WritePacket::WritePacket(LINK_COMMAND command) : m_command(command), m_packetSize(0) {}
 
 WritePacket::~WritePacket() {}
 
@@ -45,15 +51,24 @@ ReadPacket* LinkSocket::GetPacket()
     return nullptr;
   }
 
-  ReadPacket* pPacket = new ReadPacket((LINK_COMMAND)pPacketHeader->command, pPacketHeader->length);
-  Y_memcpy(pPacket->GetBufferPointer(), (const byte*)pBuffer + sizeof(LINK_PACKET_HEADER), pPacketHeader->length);
+  // no command has a payload this large, so the peer is broken or not speaking our protocol
+  if (pPacketHeader->length > LINK_MAX_PACKET_SIZE)
+  {
+    Log_ErrorPrintf("Dropping %u byte link packet, command %u", pPacketHeader->length, pPacketHeader->command);
+    ReleaseReadBuffer((size_t)pPacketHeader->length + sizeof(LINK_PACKET_HEADER));
+    return nullptr;
+  }
+
+  ReadPacket* pPacket = LinkConnectionManager::GetInstance().AllocatePacket();
+  pPacket->SetContents((LINK_COMMAND)pPacketHeader->command, (const byte*)pBuffer + sizeof(LINK_PACKET_HEADER),
+                       pPacketHeader->length);
   ReleaseReadBuffer((size_t)pPacketHeader->length + sizeof(LINK_PACKET_HEADER));
   return pPacket;
 }
 
 bool LinkSocket::SendPacket(WritePacket* pPacket)
 {
-  return SendPacket(pPacket->GetPacketCommand(), pPacket->GetBufferPointer(), (size_t)pPacket->GetStream()->GetSize());
+  return SendPacket(pPacket->GetPacketCommand(), pPacket->GetBufferPointer(), pPacket->GetPacketSize());
 }
 
 bool LinkSocket::SendPacket(LINK_COMMAND command, const void* pData, size_t dataLength)
@@ -105,7 +120,9 @@ void LinkSocket::OnRead()
   {
   case LINK_COMMAND_HELLO:
   {
+    // Recycle it since we're not queueing this packet.
     uint32 version = packet->ReadUInt32();
+    LinkConnectionManager::GetInstance().ReleasePacket(packet);
     Log_DevPrintf("Link socket received hello: version %u", version);
     if (version != NW_VERSION)
     {
@@ -123,8 +140,6 @@ void LinkSocket::OnRead()
       return;
     }
 
-    // Cleanup memory since we're not queueing this packet.
-    delete packet;
     break;
   }
 
@@ -137,11 +152,20 @@ void LinkSocket::OnRead()
   }
 }
 
-LinkConnectionManager::LinkConnectionManager() : m_multiplexer(nullptr), m_listen_socket(nullptr) {}
+LinkConnectionManager::LinkConnectionManager()
+  : m_multiplexer(nullptr), m_listen_socket(nullptr), m_client_socket(nullptr), m_state(LinkState_NotConnected),
+    m_loopback(false)
+{
+}
 
 LinkConnectionManager::~LinkConnectionManager()
 {
   Shutdown();
+
+  while (m_packet_queue.GetSize() > 0)
+    delete m_packet_queue.PopBack();
+  while (m_free_packets.GetSize() > 0)
+    delete m_free_packets.PopBack();
 }
 
 bool LinkConnectionManager::Host(const char* address, uint32 port, Error* pError)
@@ -193,6 +217,21 @@ bool LinkConnectionManager::Connect(const char* address, uint32 port, Error* pEr
   return true;
 }
 
+bool LinkConnectionManager::EnableLoopback(Error* pError)
+{
+  if (m_listen_socket != nullptr || m_client_socket != nullptr)
+  {
+    pError->SetErrorUser(1, "Can't loop back while hosting or connected.");
+    return false;
+  }
+
+  m_lock.Lock();
+  m_loopback = true;
+  m_state = LinkState_Connected;
+  m_lock.Unlock();
+  return true;
+}
+
 bool LinkConnectionManager::SetClientSocket(LinkSocket* socket)
 {
   m_lock.Lock();
@@ -224,7 +263,7 @@ bool LinkConnectionManager::SetClientSocket(LinkSocket* socket)
 
       // Remove all packets from the queue.
       while (m_packet_queue.GetSize() > 0)
-        delete m_packet_queue.PopBack();
+        m_free_packets.Add(m_packet_queue.PopBack());
 
       // Release reference.
       m_client_socket->Release();
@@ -272,11 +311,40 @@ void LinkConnectionManager::Shutdown()
     DebugAssert(m_client_socket == nullptr);
   }
 
+  // Unplug the loopback, unanswered responses go back to the free list.
+  if (m_loopback)
+  {
+    m_lock.Lock();
+    m_loopback = false;
+    m_state = LinkState_NotConnected;
+    while (m_packet_queue.GetSize() > 0)
+      m_free_packets.Add(m_packet_queue.PopBack());
+    m_lock.Unlock();
+  }
+
   // Cleanup multiplexer.
   delete m_multiplexer;
   m_multiplexer = nullptr;
 }
 
+ReadPacket* LinkConnectionManager::AllocatePacket()
+{
+  ReadPacket* packet = nullptr;
+  m_lock.Lock();
+  if (m_free_packets.GetSize() > 0)
+    packet = m_free_packets.PopBack();
+  m_lock.Unlock();
+
+  return (packet != nullptr) ? packet : new ReadPacket();
+}
+
+void LinkConnectionManager::ReleasePacket(ReadPacket* packet)
+{
+  m_lock.Lock();
+  m_free_packets.Add(packet);
+  m_lock.Unlock();
+}
+
 void LinkConnectionManager::QueuePacket(ReadPacket* packet)
 {
   m_lock.Lock();
@@ -286,6 +354,23 @@ void LinkConnectionManager::QueuePacket(ReadPacket* packet)
 
 void LinkConnectionManager::SendPacket(WritePacket* packet)
 {
+  if (m_loopback)
+  {
+    // only the clocking side gets an answer, responses to a peer's clock have nowhere to go
+    if (packet->GetPacketCommand() != LINK_COMMAND_CLOCK)
+      return;
+
+    // sequence, clocks, data -> sequence, data
+    byte payload[sizeof(uint32) + sizeof(uint8)];
+    Y_memcpy(payload, packet->GetBufferPointer(), sizeof(uint32));
+    payload[sizeof(uint32)] = packet->GetBufferPointer()[sizeof(uint32) * 2];
+
+    ReadPacket* response = AllocatePacket();
+    response->SetContents(LINK_COMMAND_DATA, payload, sizeof(payload));
+    QueuePacket(response);
+    return;
+  }
+
   // This mess is necessary because of the locking order (read below)
   LinkSocket* socket;
   m_lock.Lock();
@@ -294,7 +379,10 @@ void LinkConnectionManager::SendPacket(WritePacket* packet)
   m_lock.Unlock();
 
   if (socket != nullptr)
+  {
     socket->SendPacket(packet);
+    socket->Release();
+  }
 }
 
 LinkConnectionManager::LinkState LinkConnectionManager::MainThreadPull(ReadPacket** out_packet)
@@ -1,6 +1,5 @@
-#include "YBaseLib/BinaryReadBuffer.h"
+#include "YBaseLib/Assert.h"
 #include "YBaseLib/BinaryReader.h"
-#include "YBaseLib/BinaryWriteBuffer.h"
 #include "YBaseLib/BinaryWriter.h"
 #include "YBaseLib/Common.h"
 #include "YBaseLib/Singleton.h"
@@ -24,34 +23,66 @@ struct LINK_PACKET_HEADER
   uint16 length;
 };
 
-// TODO: "Duplex buffer"
+// every command's payload fits in this, larger packets are dropped
+static const uint32 LINK_MAX_PACKET_SIZE = 32;
 
-class ReadPacket : public BinaryReadBuffer
+// Packets are exchanged for every byte transferred, so both kinds hold their payload inline. Read packets are
+// recycled through the connection manager rather than being freed, and write packets live on the stack.
+class ReadPacket
 {
 public:
-  ReadPacket(LINK_COMMAND command, uint16 size);
-  virtual ~ReadPacket();
+  ReadPacket();
+  ~ReadPacket();
 
   const LINK_COMMAND GetPacketCommand() const { return m_command; }
   const size_t GetPacketSize() const { return (size_t)m_packetSize; }
 
+  void SetContents(LINK_COMMAND command, const void* data, uint16 size);
+
+  // reads past the end of the payload return zero
+  uint8 ReadUInt8() { return ReadValue<uint8>(); }
+  uint32 ReadUInt32() { return ReadValue<uint32>(); }
+
 private:
+  template<typename T>
+  T ReadValue()
+  {
+    T value = 0;
+    if ((m_position + sizeof(T)) <= m_packetSize)
+      Y_memcpy(&value, m_buffer + m_position, sizeof(T));
+    m_position += sizeof(T);
+    return value;
+  }
+
   LINK_COMMAND m_command;
   uint16 m_packetSize;
+  uint32 m_position;
+  byte m_buffer[LINK_MAX_PACKET_SIZE];
 };
 
-class WritePacket : public BinaryWriteBuffer
+class WritePacket
 {
 public:
   WritePacket(LINK_COMMAND command);
-
-  virtual ~WritePacket();
+  ~WritePacket();
 
   const LINK_COMMAND GetPacketCommand() const { return m_command; }
-  const size_t GetPacketSize() const { return (size_t)m_pStream->GetSize(); }
+  const size_t GetPacketSize() const { return (size_t)m_packetSize; }
+  const byte* GetBufferPointer() const { return m_buffer; }
+
+  template<typename T>
+  WritePacket& operator<<(T value)
+  {
+    DebugAssert((m_packetSize + sizeof(T)) <= LINK_MAX_PACKET_SIZE);
+    Y_memcpy(m_buffer + m_packetSize, &value, sizeof(T));
+    m_packetSize += sizeof(T);
+    return *this;
+  }
 
 private:
   LINK_COMMAND m_command;
+  uint16 m_packetSize;
+  byte m_buffer[LINK_MAX_PACKET_SIZE];
 };
 
 class LinkSocket : public BufferedStreamSocket
@@ -95,6 +126,16 @@ public:
   bool SetClientSocket(LinkSocket* socket);
   void Shutdown();
 
+  // Connects the link to itself, as if a loopback plug were in the port. Clocked transfers are answered with the byte
+  // sent, which runs the serial and packet paths without a peer or socket.
+  bool EnableLoopback(Error* pError);
+
+  // Takes a packet from the free list, only allocating until enough are in circulation.
+  ReadPacket* AllocatePacket();
+
+  // Returns a packet taken from MainThreadPull or AllocatePacket to the free list.
+  void ReleasePacket(ReadPacket* packet);
+
   // Queues a packet for later pickup by main thread.
   void QueuePacket(ReadPacket* packet);
 
@@ -112,6 +153,8 @@ private:
   LinkSocket* m_client_socket;
 
   PODArray<ReadPacket*> m_packet_queue;
+  PODArray<ReadPacket*> m_free_packets;
   LinkState m_state;
+  bool m_loopback;
   Mutex m_lock;
 };
@@ -2,15 +2,32 @@
 
 #include <SDL.h>
 #include <cstdio>
+#include <cstdlib>
 #include <glad/glad.h>
 #include <hqx.h>
 #include <imgui.h>
+#include <thread>
+#include <vector>
+#include <zlib.h>
 
+#include "allocation_counter.h"
 #include "audio.h"
+#include "benchmark.h"
 #include "cartridge.h"
+#include "cheats.h"
+#include "control_server.h"
+#include "dataset.h"
 #include "display.h"
+#include "input_movie.h"
 #include "link.h"
+#include "opcode_benchmark.h"
+#include "render_capture.h"
+#include "rom_archive.h"
+#include "rom_library.h"
+#include "state_snapshot.h"
 #include "system.h"
+#include "test_runner.h"
+#include "vram_viewer.h"
 
 #include "YBaseLib/AutoReleasePtr.h"
 #include "YBaseLib/BinaryReader.h"
@@ -22,12 +39,20 @@
 #include "YBaseLib/Log.h"
 #include "YBaseLib/Math.h"
 #include "YBaseLib/Platform.h"
+#include "YBaseLib/StringConverter.h"
 #include "YBaseLib/Thread.h"
+#include "YBaseLib/Timer.h"
 
 #include "imgui_impl.h"
 
 Log_SetChannel(Main);
 
+// constructed during static initialization, so this measures from process start to the first presented frame
+static Timer s_startup_timer;
+
+// seconds without input before the session is snapshotted
+static const double SESSION_IDLE_SNAPSHOT_SECONDS = 30.0;
+
 struct ProgramArgs
 {
   const char* bios_filename;
@@ -39,6 +64,44 @@ struct ProgramArgs
   bool frame_limiter;
   bool enable_audio;
   bool enable_hqx;
+  bool accurate_oam_dma;
+  bool rtc_wall_clock_sync;
+  bool turbo_boot;
+  bool boot_snapshot_cache;
+  bool resume_session;
+  uint32 beam_racing_slice_size;
+  const char* library_index_filename;
+  const char* library_scan_directory;
+  const char* library_launch_crc;
+  bool library_list;
+  // owns the path of a rom launched from the library, cart_filename points into it
+  String library_launch_filename;
+  std::vector<const char*> cheat_codes;
+  uint32 benchmark_frames;
+  uint32 benchmark_instances;
+  bool benchmark_step_loop;
+  bool benchmark_io;
+  const char* test_rom_path;
+  uint32 test_timeout;
+  uint32 test_threads;
+  const char* test_junit_filename;
+  const char* test_json_filename;
+  const char* render_capture_filename;
+  uint32 render_capture_frames;
+  const char* render_replay_path;
+  uint32 render_replay_loops;
+  uint32 opcode_benchmark_instructions;
+  const char* opcode_rom_directory;
+  const char* movie_record_filename;
+  const char* movie_play_filename;
+  const char* dataset_record_filename;
+  const char* dataset_regions;
+  uint32 dataset_chunk_frames;
+  const char* dataset_info_filename;
+  const char* control_socket_path;
+  bool control_headless;
+  const char* control_benchmark_path;
+  uint32 control_benchmark_iterations;
 };
 
 struct State : public System::CallbackInterface
@@ -66,6 +129,21 @@ struct State : public System::CallbackInterface
 
   SDL_AudioDeviceID audio_device_id;
 
+  VRAMViewer* vram_viewer;
+
+  RenderCaptureWriter* render_capture;
+
+  // movie being recorded or played back, playback takes over the pad
+  InputMovie* input_movie;
+  String input_movie_record_filename;
+  bool input_movie_playing;
+
+  // training data, every presented frame is recorded
+  DatasetWriter* dataset_writer;
+
+  // automation clients drive emulation themselves while connected
+  ControlServer* control_server;
+
   String savestate_prefix;
 
   bool enable_hqx;
@@ -78,6 +156,36 @@ struct State : public System::CallbackInterface
 
   bool vsync_enabled;
 
+  bool beam_racing;
+  uint32 beam_racing_slice_size;
+
+  // Host scanout estimate for pacing beam racing slices: when the last vsynced swap returned, the refresh period,
+  // and where the window's client area and its display are, vertically, in desktop coordinates.
+  uint64 host_vblank_counter;
+  uint64 host_refresh_ticks;
+  int32 host_window_offset;
+  int32 host_display_height;
+
+  // post-boot snapshot, saved once the boot rom unmaps itself
+  String boot_snapshot_filename;
+  bool boot_snapshot_pending;
+
+  // session snapshot, restored on launch and written on exit or when idle
+  String session_snapshot_filename;
+  std::thread session_snapshot_thread;
+  Timer session_idle_timer;
+  bool session_idle_snapshot_taken;
+
+  bool first_frame_presented;
+
+  // Input-to-present latency measurement, from the key press to the first present of lines which were rendered
+  // after the pad change was applied at input_latency_clock.
+  uint64 input_latency_start;
+  uint64 input_latency_clock;
+  uint64 presented_frame_start_clock;
+  double input_latency_total_ms;
+  uint32 input_latency_samples;
+
   void SetSaveStatePrefix(const char* cartridge_file_name)
   {
     const char* last_part = Y_strrchr(cartridge_file_name, '/');
@@ -224,6 +332,30 @@ struct State : public System::CallbackInterface
 
       ImGui::Separator();
 
+      if (ImGui::BeginMenu("Debug"))
+      {
+        ImGui::MenuItem("Tile Viewer", nullptr, &vram_viewer->show_tiles);
+        ImGui::MenuItem("Tile Map Viewer", nullptr, &vram_viewer->show_maps);
+        ImGui::MenuItem("OAM Viewer", nullptr, &vram_viewer->show_oam);
+        ImGui::MenuItem("Palette Viewer", nullptr, &vram_viewer->show_palettes);
+        ImGui::EndMenu();
+      }
+
+      CheatEngine* cheat_engine = system->GetCheatEngine();
+      if (cheat_engine->GetCodeCount() > 0 && ImGui::BeginMenu("Cheats"))
+      {
+        for (uint32 i = 0; i < cheat_engine->GetCodeCount(); i++)
+        {
+          const CheatEngine::Code& code = cheat_engine->GetCode(i);
+          if (ImGui::MenuItem(code.text, nullptr, code.enabled))
+            cheat_engine->SetCodeEnabled(i, !code.enabled);
+        }
+
+        ImGui::EndMenu();
+      }
+
+      ImGui::Separator();
+
       if (ImGui::MenuItem("Host Link Server"))
       {
         Log_InfoPrintf("Hosting link server.");
@@ -280,35 +412,46 @@ struct State : public System::CallbackInterface
 
       ImGui::End();
     }
+
+    vram_viewer->Draw(system);
   }
 
-  void Redraw()
+  // area of the window the display is drawn to, centered, so the offsets are the same from either edge
+  void GetDisplayViewport(uint32* vp_x, uint32* vp_y, uint32* vp_width, uint32* vp_height)
   {
     int window_width, window_height;
     SDL_GetWindowSize(window, &window_width, &window_height);
-    glViewport(0, 0, window_width, window_height);
-    glDisable(GL_SCISSOR_TEST);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
 
     uint32 width = static_cast<uint32>(window_width);
     uint32 height = static_cast<uint32>(window_height);
-    uint32 vp_width;
-    uint32 vp_height;
     if ((width * Display::SCREEN_HEIGHT / Display::SCREEN_WIDTH) > height)
     {
       // same AR as gameboy, add borders on left/right
-      vp_width = height * Display::SCREEN_WIDTH / Display::SCREEN_HEIGHT;
-      vp_height = height;
+      *vp_width = height * Display::SCREEN_WIDTH / Display::SCREEN_HEIGHT;
+      *vp_height = height;
     }
     else
     {
       // draw borders on top/bottom
-      vp_width = width;
-      vp_height = width * Display::SCREEN_HEIGHT / Display::SCREEN_WIDTH;
+      *vp_width = width;
+      *vp_height = width * Display::SCREEN_HEIGHT / Display::SCREEN_WIDTH;
     }
-    glViewport(static_cast<int>((width - vp_width) / 2), static_cast<int>((height - vp_height) / 2), vp_width,
-               vp_height);
+    *vp_x = (width - *vp_width) / 2;
+    *vp_y = (height - *vp_height) / 2;
+  }
+
+  void DrawDisplay()
+  {
+    int window_width, window_height;
+    SDL_GetWindowSize(window, &window_width, &window_height);
+    glViewport(0, 0, window_width, window_height);
+    glDisable(GL_SCISSOR_TEST);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    uint32 vp_x, vp_y, vp_width, vp_height;
+    GetDisplayViewport(&vp_x, &vp_y, &vp_width, &vp_height);
+    glViewport(static_cast<int>(vp_x), static_cast<int>(vp_y), vp_width, vp_height);
 
     glDisable(GL_DEPTH_TEST);
     glDepthMask(GL_FALSE);
@@ -325,19 +468,160 @@ struct State : public System::CallbackInterface
     glBindVertexArray(attributeless_vao);
 
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  }
+
+  void Redraw()
+  {
+    DrawDisplay();
 
     ImGui::Render();
 
-    bool new_vsync_state = system->GetFrameLimiter();
-    if (new_vsync_state != vsync_enabled)
+    // With beam racing, the slices of a frame are swapped without vsync, tearing between lines which already match.
+    // The frame itself still waits for vsync, which is what the scanout estimate is taken from.
+    SetVSync(system->GetFrameLimiter());
+    SDL_GL_SwapWindow(window);
+    if (vsync_enabled && IsBeamRacingActive())
+      UpdateHostScanout();
+    else
+      host_vblank_counter = 0;
+
+    EndInputLatencyMeasurement(presented_frame_start_clock);
+
+    needs_redraw = false;
+  }
+
+  void SetVSync(bool enabled)
+  {
+    if (vsync_enabled == enabled)
+      return;
+
+    SDL_GL_SetSwapInterval(enabled ? 1 : 0);
+    vsync_enabled = enabled;
+  }
+
+  bool IsBeamRacingActive() const { return beam_racing && system->GetFrameLimiter(); }
+
+  void UpdateHostScanout()
+  {
+    // drivers can return from the swap before the flip, waiting for the gpu brings it closer to the vblank
+    glFinish();
+    host_vblank_counter = SDL_GetPerformanceCounter();
+
+    int display_index = SDL_GetWindowDisplayIndex(window);
+    SDL_DisplayMode mode;
+    SDL_Rect bounds;
+    if (display_index < 0 || SDL_GetCurrentDisplayMode(display_index, &mode) != 0 ||
+        SDL_GetDisplayBounds(display_index, &bounds) != 0 || bounds.h <= 0)
     {
-      SDL_GL_SetSwapInterval(new_vsync_state ? 1 : 0);
-      vsync_enabled = new_vsync_state;
+      host_vblank_counter = 0;
+      return;
     }
 
-    SDL_GL_SwapWindow(window);
+    int window_x, window_y;
+    SDL_GetWindowPosition(window, &window_x, &window_y);
+    host_refresh_ticks = SDL_GetPerformanceFrequency() / uint64((mode.refresh_rate > 0) ? mode.refresh_rate : 60);
+    host_window_offset = window_y - bounds.y;
+    host_display_height = bounds.h;
+  }
 
-    needs_redraw = false;
+  // Sleeps until the host scanout reaches the previous slice, so presenting this one tears inside lines which
+  // already show the current frame, just ahead of the beam. The scanout is extrapolated from the last vsynced swap,
+  // top to bottom over the refresh period, ignoring the blanking interval. If that refresh has already passed, the
+  // slice is late and goes out straight away.
+  void WaitForHostScanout(uint32 first_line)
+  {
+    if (host_vblank_counter == 0)
+      return;
+
+    uint32 vp_x, vp_y, vp_width, vp_height;
+    GetDisplayViewport(&vp_x, &vp_y, &vp_width, &vp_height);
+    uint32 target_line = (first_line > beam_racing_slice_size) ? (first_line - beam_racing_slice_size) : 0;
+    int32 target_y = host_window_offset + int32(vp_y + target_line * vp_height / Display::SCREEN_HEIGHT);
+    target_y = Math::Clamp(target_y, 0, host_display_height);
+
+    uint64 target_counter = host_vblank_counter + host_refresh_ticks * uint64(target_y) / uint64(host_display_height);
+    uint64 frequency = SDL_GetPerformanceFrequency();
+    uint64 now = SDL_GetPerformanceCounter();
+    if ((now - host_vblank_counter) >= host_refresh_ticks)
+      return;
+
+    // sleep through most of it, then spin, since sleeps are only millisecond accurate
+    while (now < target_counter)
+    {
+      if ((target_counter - now) * 1000 / frequency > 1)
+        Thread::Sleep(1);
+      now = SDL_GetPerformanceCounter();
+    }
+  }
+
+  // pressed keys only, repeats don't change the pad
+  void BeginInputLatencyMeasurement(uint64 apply_clock)
+  {
+    if (input_latency_start != 0)
+      return;
+
+    input_latency_start = SDL_GetPerformanceCounter();
+    input_latency_clock = apply_clock;
+  }
+
+  // region_start_clock is when the first line of what was just presented started rendering
+  void EndInputLatencyMeasurement(uint64 region_start_clock)
+  {
+    if (input_latency_start == 0 || region_start_clock < input_latency_clock)
+      return;
+
+    uint64 elapsed = SDL_GetPerformanceCounter() - input_latency_start;
+    input_latency_total_ms += double(elapsed) * 1000.0 / double(SDL_GetPerformanceFrequency());
+    input_latency_samples++;
+    input_latency_start = 0;
+  }
+
+  void ReportInputLatency()
+  {
+    double queued_error_ms, immediate_error_ms;
+    uint32 input_events = system->GetInputTimingStatistics(&queued_error_ms, &immediate_error_ms);
+    if (input_events > 0)
+    {
+      Log_InfoPrintf("Input timing: applied %.2f ms from its timestamp on average, %.2f ms if applied at the poll "
+                     "(%u events)",
+                     queued_error_ms, immediate_error_ms, input_events);
+    }
+
+    if (input_latency_samples == 0)
+      return;
+
+    Log_InfoPrintf("Input-to-present latency: %.2f ms average over %u samples (%s)",
+                   input_latency_total_ms / double(input_latency_samples), input_latency_samples,
+                   beam_racing ? "beam racing" : "full frame");
+    input_latency_total_ms = 0.0;
+    input_latency_samples = 0;
+  }
+
+  // seconds since SDL timestamped an event
+  static double GetInputAge(uint32 timestamp)
+  {
+    uint32 now = SDL_GetTicks();
+    return (now > timestamp) ? (double(now - timestamp) / 1000.0) : 0.0;
+  }
+
+  void QueuePadDirection(PAD_DIRECTION direction, bool down, const SDL_KeyboardEvent& key)
+  {
+    if (input_movie_playing)
+      return;
+
+    uint64 apply_clock = system->QueuePadDirection(direction, down, GetInputAge(key.timestamp));
+    if (down && !key.repeat)
+      BeginInputLatencyMeasurement(apply_clock);
+  }
+
+  void QueuePadButton(PAD_BUTTON button, bool down, const SDL_KeyboardEvent& key)
+  {
+    if (input_movie_playing)
+      return;
+
+    uint64 apply_clock = system->QueuePadButton(button, down, GetInputAge(key.timestamp));
+    if (down && !key.repeat)
+      BeginInputLatencyMeasurement(apply_clock);
   }
 
   bool LoadState(uint32 index)
@@ -345,90 +629,240 @@ struct State : public System::CallbackInterface
     SmallString filename;
     filename.Format("%s_%02u.savestate", savestate_prefix.GetCharArray(), index);
     Log_DevPrintf("Savestate filename: '%s'", filename.GetCharArray());
+    return LoadStateFile(filename);
+  }
+
+  bool SaveState(uint32 index)
+  {
+    SmallString filename;
+    filename.Format("%s_%02u.savestate", savestate_prefix.GetCharArray(), index);
+    Log_DevPrintf("Savestate filename: '%s'", filename.GetCharArray());
+    return SaveStateFile(filename);
+  }
 
+  bool LoadStateFile(const char* filename)
+  {
     ByteStream* pStream = FileSystem::OpenFile(filename, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_STREAMED);
     if (pStream == nullptr)
     {
-      Log_ErrorPrintf("Failed to load state '%s': could not open file", filename.GetCharArray());
+      Log_ErrorPrintf("Failed to load state '%s': could not open file", filename);
       return false;
     }
 
     Error error;
     if (!system->LoadState(pStream, &error))
     {
-      Log_ErrorPrintf("Failed to save state '%s': load error: %s", filename.GetCharArray(),
+      Log_ErrorPrintf("Failed to save state '%s': load error: %s", filename,
                       error.GetErrorCodeAndDescription().GetCharArray());
       pStream->Release();
       return false;
     }
 
-    Log_InfoPrintf("Save state '%s' loaded.", filename.GetCharArray());
+    Log_InfoPrintf("Save state '%s' loaded.", filename);
     pStream->Release();
     return true;
   }
 
-  bool SaveState(uint32 index)
+  bool SaveStateFile(const char* filename)
   {
-    SmallString filename;
-    filename.Format("%s_%02u.savestate", savestate_prefix.GetCharArray(), index);
-    Log_DevPrintf("Savestate filename: '%s'", filename.GetCharArray());
-
     ByteStream* pStream = FileSystem::OpenFile(filename, BYTESTREAM_OPEN_CREATE | BYTESTREAM_OPEN_CREATE_PATH |
                                                            BYTESTREAM_OPEN_WRITE | BYTESTREAM_OPEN_TRUNCATE |
                                                            BYTESTREAM_OPEN_STREAMED | BYTESTREAM_OPEN_ATOMIC_UPDATE);
     if (pStream == nullptr)
     {
-      Log_ErrorPrintf("Failed to save state '%s': could not open file", filename.GetCharArray());
+      Log_ErrorPrintf("Failed to save state '%s': could not open file", filename);
       return false;
     }
 
     if (!system->SaveState(pStream))
     {
-      Log_ErrorPrintf("Failed to save state '%s': save error", filename.GetCharArray());
+      Log_ErrorPrintf("Failed to save state '%s': save error", filename);
       pStream->Discard();
       pStream->Release();
       return false;
     }
 
-    Log_InfoPrintf("Save state '%s' saved.", filename.GetCharArray());
+    Log_InfoPrintf("Save state '%s' saved.", filename);
     pStream->Commit();
     pStream->Release();
     return true;
   }
 
+  bool LoadBootSnapshot()
+  {
+    ByteStream* pStream =
+      FileSystem::OpenFile(boot_snapshot_filename, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_STREAMED);
+    if (pStream == nullptr)
+      return false;
+
+    Error error;
+    bool result = system->LoadState(pStream, &error);
+    pStream->Release();
+    if (!result)
+    {
+      // a failed load leaves a partial state behind, boot normally instead
+      Log_WarningPrintf("Discarding boot snapshot '%s': %s", boot_snapshot_filename.GetCharArray(),
+                        error.GetErrorCodeAndDescription().GetCharArray());
+      system->Reset();
+      return false;
+    }
+
+    // the snapshot contains the battery ram from when it was taken
+    cart->ReloadBatteryData();
+    Log_InfoPrintf("Restored boot snapshot '%s'.", boot_snapshot_filename.GetCharArray());
+    return true;
+  }
+
+  bool LoadSessionSnapshot()
+  {
+    Timer restore_timer;
+    Error error;
+    StateSnapshot* snapshot = StateSnapshot::ReadFromFile(session_snapshot_filename, &error);
+    if (snapshot == nullptr)
+    {
+      Log_DevPrintf("No session snapshot: %s", error.GetErrorCodeAndDescription().GetCharArray());
+      return false;
+    }
+
+    // the rom may have been replaced since the session was saved
+    if (snapshot->GetCartridgeCRC() != cart->GetCRC())
+    {
+      Log_WarningPrintf("Ignoring session snapshot '%s': cartridge CRC mismatch (%08X, expected %08X)",
+                        session_snapshot_filename.GetCharArray(), snapshot->GetCartridgeCRC(), cart->GetCRC());
+      delete snapshot;
+      return false;
+    }
+
+    bool result = snapshot->Restore(system, &error);
+    delete snapshot;
+    if (!result)
+    {
+      Log_WarningPrintf("Discarding session snapshot '%s': %s", session_snapshot_filename.GetCharArray(),
+                        error.GetErrorCodeAndDescription().GetCharArray());
+      system->Reset();
+      return false;
+    }
+
+    // battery files may have been written after the snapshot
+    cart->ReloadBatteryData();
+    Log_InfoPrintf("Resumed session '%s' in %.2f ms.", session_snapshot_filename.GetCharArray(),
+                   restore_timer.GetTimeMilliseconds());
+    return true;
+  }
+
+  void SaveSessionSnapshot()
+  {
+    // compression and the file write happen on a worker thread, only the capture stalls emulation
+    Timer capture_timer;
+    cart->FlushBatteryData();
+    StateSnapshot* snapshot = StateSnapshot::Capture(system);
+    if (snapshot == nullptr)
+    {
+      Log_ErrorPrintf("Failed to capture session snapshot");
+      return;
+    }
+
+    Log_DevPrintf("Captured session snapshot (%u bytes) in %.2f ms", snapshot->GetStateSize(),
+                  capture_timer.GetTimeMilliseconds());
+
+    WaitForSessionSnapshot();
+    String filename(session_snapshot_filename);
+    session_snapshot_thread = std::thread([snapshot, filename]() {
+      if (snapshot->Compress())
+        snapshot->WriteToFile(filename);
+      delete snapshot;
+    });
+  }
+
+  void WaitForSessionSnapshot()
+  {
+    if (session_snapshot_thread.joinable())
+      session_snapshot_thread.join();
+  }
+
   // Callback to present a frame
   virtual void PresentDisplayBuffer(const void* pixels, uint32 row_stride) override final
   {
-    const void* upload_src = pixels;
-    uint32 upload_src_stride = row_stride;
+    if (control_server != nullptr)
+      control_server->SetFrameBuffer(pixels, row_stride);
+    if (dataset_writer != nullptr)
+      dataset_writer->AddFrame(system, pixels, row_stride);
+
+    // write to gpu texture, the whole frame again when beam racing, since slices are upscaled without what follows
+    UploadLines(static_cast<const byte*>(pixels), row_stride, 0, Display::SCREEN_HEIGHT);
+    needs_redraw = true;
+
+    // the last slice goes out with the frame
+    uint32 presented_lines = Display::SCREEN_HEIGHT;
+    if (IsBeamRacingActive())
+      presented_lines -= ((Display::SCREEN_HEIGHT - 1) / beam_racing_slice_size) * beam_racing_slice_size;
+    presented_frame_start_clock = system->GetEmulatedClocks() - presented_lines * Display::LINE_CLOCKS;
+
+    if (!first_frame_presented)
+    {
+      Log_InfoPrintf("First frame presented %.2f ms after launch.", s_startup_timer.GetTimeMilliseconds());
+      first_frame_presented = true;
+    }
+  }
+
+  // Uploads lines [first_line, first_line + num_lines) of the frame, which starts at frame_pixels, upscaling them first
+  // if enabled. The upscaler samples the neighbouring lines, so the line above is redone with the new one below it,
+  // and the last line is redone by the next call, or the full frame.
+  void UploadLines(const byte* frame_pixels, uint32 row_stride, uint32 first_line, uint32 num_lines)
+  {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (hq_scale == 1)
+    {
+      glPixelStorei(GL_UNPACK_ROW_LENGTH, row_stride / 4);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first_line, Display::SCREEN_WIDTH, num_lines, GL_RGBA, GL_UNSIGNED_BYTE,
+                      frame_pixels + first_line * row_stride);
+      glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+      return;
+    }
 
-    // handle hq upscaling
+    uint32 end_line = first_line + num_lines;
+    uint32 upload_line = (first_line > 0) ? (first_line - 1) : 0;
+    uint32 source_line = (upload_line > 0) ? (upload_line - 1) : 0;
+    uint32_t* source = (uint32_t*)(frame_pixels + source_line * row_stride);
+    uint32_t* destination = (uint32_t*)(hq_texture_buffer + source_line * hq_scale * hq_texture_buffer_stride);
+    int source_lines = static_cast<int>(end_line - source_line);
     switch (hq_scale)
     {
     case 2:
-      hq2x_32_rb((uint32_t*)pixels, row_stride, (uint32_t*)hq_texture_buffer, hq_texture_buffer_stride, 160, 144);
-      upload_src = hq_texture_buffer;
-      upload_src_stride = hq_texture_buffer_stride;
+      hq2x_32_rb(source, row_stride, destination, hq_texture_buffer_stride, Display::SCREEN_WIDTH, source_lines);
       break;
 
     case 3:
-      hq3x_32_rb((uint32_t*)pixels, row_stride, (uint32_t*)hq_texture_buffer, hq_texture_buffer_stride, 160, 144);
-      upload_src = hq_texture_buffer;
-      upload_src_stride = hq_texture_buffer_stride;
+      hq3x_32_rb(source, row_stride, destination, hq_texture_buffer_stride, Display::SCREEN_WIDTH, source_lines);
       break;
 
     case 4:
-      hq4x_32_rb((uint32_t*)pixels, row_stride, (uint32_t*)hq_texture_buffer, hq_texture_buffer_stride, 160, 144);
-      upload_src = hq_texture_buffer;
-      upload_src_stride = hq_texture_buffer_stride;
+      hq4x_32_rb(source, row_stride, destination, hq_texture_buffer_stride, Display::SCREEN_WIDTH, source_lines);
       break;
     }
 
-    // write to gpu texture
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, gpu_texture_width, gpu_texture_height, GL_RGBA, GL_UNSIGNED_BYTE,
-                    upload_src);
-    needs_redraw = true;
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload_line * hq_scale, gpu_texture_width,
+                    (end_line - upload_line) * hq_scale, GL_RGBA, GL_UNSIGNED_BYTE,
+                    hq_texture_buffer + upload_line * hq_scale * hq_texture_buffer_stride);
+  }
+
+  // Callback to present a slice of scanlines while the frame is still being rendered
+  virtual void PresentDisplayScanlines(const void* pixels, uint32 row_stride, uint32 first_line,
+                                       uint32 num_lines) override final
+  {
+    // the last slice is presented along with the overlay after the frame completes
+    if (!IsBeamRacingActive() || (first_line + num_lines) >= Display::SCREEN_HEIGHT)
+      return;
+
+    // the remainder of the texture still holds the previous frame
+    const byte* frame_pixels = static_cast<const byte*>(pixels) - first_line * row_stride;
+    UploadLines(frame_pixels, row_stride, first_line, num_lines);
+
+    WaitForHostScanout(first_line);
+    SetVSync(false);
+    DrawDisplay();
+    SDL_GL_SwapWindow(window);
+    EndInputLatencyMeasurement(system->GetEmulatedClocks() - num_lines * Display::LINE_CLOCKS);
   }
 
   virtual bool LoadCartridgeRAM(void* pData, size_t expected_data_size) override final
@@ -585,8 +1019,40 @@ static bool LoadBIOS(State* state, SYSTEM_MODE mode)
   return true;
 }
 
+// per-rom profiles live next to the program
+static void GetProfileDirectory(String* directory)
+{
+  SmallString program_file_name;
+  Platform::GetProgramFileName(program_file_name);
+  FileSystem::BuildPathRelativeToFile(*directory, program_file_name, "profiles", true, true);
+}
+
 static bool LoadCart(const char* filename, State* state)
 {
+  String profile_directory;
+  GetProfileDirectory(&profile_directory);
+
+  // compressed images are streamed into the cartridge, with a decompressed copy cached for later launches
+  if (ROMArchiveReader::IsArchiveFileName(filename))
+  {
+    SmallString cache_directory;
+    Platform::GetProgramFileName(cache_directory);
+    FileSystem::BuildPathRelativeToFile(cache_directory, cache_directory, "romcache", true, true);
+
+    state->SetSaveStatePrefix(filename);
+    state->cart = new Cartridge(state->system);
+    state->cart->SetProfileDirectory(profile_directory);
+    Error error;
+    if (!ROMArchiveReader::LoadCartridge(state->cart, filename, cache_directory, &error))
+    {
+      Log_ErrorPrintf("Failed to load cartridge file '%s': %s", filename, error.GetErrorDescription().GetCharArray());
+      SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Cart load error", error.GetErrorCodeAndDescription(), nullptr);
+      return false;
+    }
+
+    return true;
+  }
+
   AutoReleasePtr<ByteStream> pStream = FileSystem::OpenFile(filename, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_STREAMED);
   if (pStream == nullptr)
   {
@@ -596,6 +1062,7 @@ static bool LoadCart(const char* filename, State* state)
 
   state->SetSaveStatePrefix(filename);
   state->cart = new Cartridge(state->system);
+  state->cart->SetProfileDirectory(profile_directory);
   Error error;
   if (!state->cart->Load(pStream, &error))
   {
@@ -610,7 +1077,28 @@ static bool LoadCart(const char* filename, State* state)
 static void ShowUsage(const char* progname)
 {
   fprintf(stderr, "gbe\n");
-  fprintf(stderr, "usage: %s [-h] [-bios <bios file>] [-nobios] [-permissivememory] [cart file]\n", progname);
+  fprintf(stderr, "usage: %s [-h] [-bios <bios file>] [-nobios] [-permissivememory] [-beamrace <lines>] [cart file]\n",
+          progname);
+  fprintf(stderr, "       %s [-libraryindex <file>] -scanlibrary <directory> | -listlibrary | -launchcrc <crc>\n",
+          progname);
+  fprintf(stderr, "       %s -benchmark <frames> [-benchmarkinstances <count>] [-benchmarksteploop] [-benchmarkio] "
+                  "<cart file>\n",
+          progname);
+  fprintf(stderr, "       %s -testroms <file or directory> [-testtimeout <seconds>] [-testthreads <count>]\n",
+          progname);
+  fprintf(stderr, "          [-testjunit <file>] [-testjson <file>]\n");
+  fprintf(stderr, "       %s -renderbenchmark <capture file or directory> [-renderbenchmarkloops <count>]\n",
+          progname);
+  fprintf(stderr, "       %s -opcodebenchmark <instructions per rom> | -writeopcoderoms <directory>\n", progname);
+  fprintf(stderr, "       %s -controlsocket <path> [-headless] <cart file> | -controlbenchmark <path> "
+                  "[-controlbenchmarkiterations <count>]\n",
+          progname);
+  fprintf(stderr, "       %s -datasetinfo <dataset file>\n", progname);
+  fprintf(stderr, "  -capturerender <file> [-capturerenderframes <count>] records frames for -renderbenchmark\n");
+  fprintf(stderr, "  -recordmovie <file> | -playmovie <file> records or replays pad input from startup\n");
+  fprintf(stderr, "  -recorddataset <file> [-datasetregions <addr:len,...>] [-datasetchunkframes <count>] records "
+                  "frames, input and memory\n");
+  fprintf(stderr, "  -cheat <code> may be repeated, Game Genie (ABC-DEF-GHI) or GameShark (01VVLLHH)\n");
 }
 
 static bool ParseArguments(int argc, char* argv[], ProgramArgs* out_args)
@@ -627,6 +1115,41 @@ static bool ParseArguments(int argc, char* argv[], ProgramArgs* out_args)
   out_args->frame_limiter = true;
   out_args->enable_audio = true;
   out_args->enable_hqx = false;
+  out_args->accurate_oam_dma = false;
+  out_args->rtc_wall_clock_sync = true;
+  out_args->turbo_boot = false;
+  out_args->boot_snapshot_cache = false;
+  out_args->resume_session = false;
+  out_args->beam_racing_slice_size = 0;
+  out_args->library_index_filename = nullptr;
+  out_args->library_scan_directory = nullptr;
+  out_args->library_launch_crc = nullptr;
+  out_args->library_list = false;
+  out_args->benchmark_frames = 0;
+  out_args->benchmark_instances = 1;
+  out_args->benchmark_step_loop = false;
+  out_args->benchmark_io = false;
+  out_args->test_rom_path = nullptr;
+  out_args->test_timeout = 120;
+  out_args->test_threads = 0;
+  out_args->test_junit_filename = nullptr;
+  out_args->test_json_filename = nullptr;
+  out_args->render_capture_filename = nullptr;
+  out_args->render_capture_frames = 600;
+  out_args->render_replay_path = nullptr;
+  out_args->render_replay_loops = 10;
+  out_args->opcode_benchmark_instructions = 0;
+  out_args->opcode_rom_directory = nullptr;
+  out_args->movie_record_filename = nullptr;
+  out_args->movie_play_filename = nullptr;
+  out_args->dataset_record_filename = nullptr;
+  out_args->dataset_regions = "C000:2000,FF80:7F";
+  out_args->dataset_chunk_frames = DatasetWriter::DEFAULT_FRAMES_PER_CHUNK;
+  out_args->dataset_info_filename = nullptr;
+  out_args->control_socket_path = nullptr;
+  out_args->control_headless = false;
+  out_args->control_benchmark_path = nullptr;
+  out_args->control_benchmark_iterations = 1000;
 
   for (int i = 1; i < argc; i++)
   {
@@ -700,6 +1223,173 @@ static bool ParseArguments(int argc, char* argv[], ProgramArgs* out_args)
     {
       out_args->enable_hqx = false;
     }
+    else if (CHECK_ARG("-accuratedma"))
+    {
+      out_args->accurate_oam_dma = true;
+    }
+    else if (CHECK_ARG("-noaccuratedma"))
+    {
+      out_args->accurate_oam_dma = false;
+    }
+    else if (CHECK_ARG("-turboboot"))
+    {
+      out_args->turbo_boot = true;
+    }
+    else if (CHECK_ARG("-noturboboot"))
+    {
+      out_args->turbo_boot = false;
+      out_args->boot_snapshot_cache = false;
+    }
+    else if (CHECK_ARG("-bootcache"))
+    {
+      // snapshot is taken when the turbo boot finishes
+      out_args->turbo_boot = true;
+      out_args->boot_snapshot_cache = true;
+    }
+    else if (CHECK_ARG("-resume"))
+    {
+      out_args->resume_session = true;
+    }
+    else if (CHECK_ARG("-noresume"))
+    {
+      out_args->resume_session = false;
+    }
+    else if (CHECK_ARG("-rtcwallclock"))
+    {
+      out_args->rtc_wall_clock_sync = true;
+    }
+    else if (CHECK_ARG("-rtcemulated"))
+    {
+      out_args->rtc_wall_clock_sync = false;
+    }
+    else if (CHECK_ARG_PARAM("-beamrace"))
+    {
+      out_args->beam_racing_slice_size = StringConverter::StringToUInt32(argv[++i]);
+    }
+    else if (CHECK_ARG("-nobeamrace"))
+    {
+      out_args->beam_racing_slice_size = 0;
+    }
+    else if (CHECK_ARG_PARAM("-libraryindex"))
+    {
+      out_args->library_index_filename = argv[++i];
+    }
+    else if (CHECK_ARG_PARAM("-scanlibrary"))
+    {
+      out_args->library_scan_directory = argv[++i];
+    }
+    else if (CHECK_ARG("-listlibrary"))
+    {
+      out_args->library_list = true;
+    }
+    else if (CHECK_ARG_PARAM("-launchcrc"))
+    {
+      out_args->library_launch_crc = argv[++i];
+    }
+    else if (CHECK_ARG_PARAM("-cheat"))
+    {
+      out_args->cheat_codes.push_back(argv[++i]);
+    }
+    else if (CHECK_ARG_PARAM("-benchmark"))
+    {
+      out_args->benchmark_frames = StringConverter::StringToUInt32(argv[++i]);
+    }
+    else if (CHECK_ARG_PARAM("-benchmarkinstances"))
+    {
+      out_args->benchmark_instances = Max(StringConverter::StringToUInt32(argv[++i]), 1u);
+    }
+    else if (CHECK_ARG("-benchmarksteploop"))
+    {
+      out_args->benchmark_step_loop = true;
+    }
+    else if (CHECK_ARG("-benchmarkio"))
+    {
+      out_args->benchmark_io = true;
+    }
+    else if (CHECK_ARG_PARAM("-testroms"))
+    {
+      out_args->test_rom_path = argv[++i];
+    }
+    else if (CHECK_ARG_PARAM("-testtimeout"))
+    {
+      out_args->test_timeout = Max(StringConverter::StringToUInt32(argv[++i]), 1u);
+    }
+    else if (CHECK_ARG_PARAM("-testthreads"))
+    {
+      out_args->test_threads = StringConverter::StringToUInt32(argv[++i]);
+    }
+    else if (CHECK_ARG_PARAM("-testjunit"))
+    {
+      out_args->test_junit_filename = argv[++i];
+    }
+    else if (CHECK_ARG_PARAM("-testjson"))
+    {
+      out_args->test_json_filename = argv[++i];
+    }
+    else if (CHECK_ARG_PARAM("-capturerender"))
+    {
+      out_args->render_capture_filename = argv[++i];
+    }
+    else if (CHECK_ARG_PARAM("-capturerenderframes"))
+    {
+      out_args->render_capture_frames = Max(StringConverter::StringToUInt32(argv[++i]), 1u);
+    }
+    else if (CHECK_ARG_PARAM("-renderbenchmark"))
+    {
+      out_args->render_replay_path = argv[++i];
+    }
+    else if (CHECK_ARG_PARAM("-renderbenchmarkloops"))
+    {
+      out_args->render_replay_loops = Max(StringConverter::StringToUInt32(argv[++i]), 1u);
+    }
+    else if (CHECK_ARG_PARAM("-controlsocket"))
+    {
+      out_args->control_socket_path = argv[++i];
+    }
+    else if (CHECK_ARG("-headless"))
+    {
+      out_args->control_headless = true;
+    }
+    else if (CHECK_ARG_PARAM("-controlbenchmark"))
+    {
+      out_args->control_benchmark_path = argv[++i];
+    }
+    else if (CHECK_ARG_PARAM("-controlbenchmarkiterations"))
+    {
+      out_args->control_benchmark_iterations = Max(StringConverter::StringToUInt32(argv[++i]), 1u);
+    }
+    else if (CHECK_ARG_PARAM("-recorddataset"))
+    {
+      out_args->dataset_record_filename = argv[++i];
+    }
+    else if (CHECK_ARG_PARAM("-datasetregions"))
+    {
+      out_args->dataset_regions = argv[++i];
+    }
+    else if (CHECK_ARG_PARAM("-datasetchunkframes"))
+    {
+      out_args->dataset_chunk_frames = Max(StringConverter::StringToUInt32(argv[++i]), 1u);
+    }
+    else if (CHECK_ARG_PARAM("-datasetinfo"))
+    {
+      out_args->dataset_info_filename = argv[++i];
+    }
+    else if (CHECK_ARG_PARAM("-recordmovie"))
+    {
+      out_args->movie_record_filename = argv[++i];
+    }
+    else if (CHECK_ARG_PARAM("-playmovie"))
+    {
+      out_args->movie_play_filename = argv[++i];
+    }
+    else if (CHECK_ARG_PARAM("-opcodebenchmark"))
+    {
+      out_args->opcode_benchmark_instructions = StringConverter::StringToUInt32(argv[++i]);
+    }
+    else if (CHECK_ARG_PARAM("-writeopcoderoms"))
+    {
+      out_args->opcode_rom_directory = argv[++i];
+    }
     else
     {
       out_args->cart_filename = argv[i];
@@ -712,6 +1402,226 @@ static bool ParseArguments(int argc, char* argv[], ProgramArgs* out_args)
 #undef CHECK_ARG_PARAM
 }
 
+static void PrintLibrary(const ROMLibrary& library)
+{
+  fprintf(stdout, "%-8s  %-16s  %-8s  %-3s  %-8s  %s\n", "CRC", "Title", "MBC", "CGB", "RAM", "Path");
+  for (uint32 i = 0; i < library.GetEntryCount(); i++)
+  {
+    const ROMLibrary::Entry& entry = library.GetEntry(i);
+    fprintf(stdout, "%08X  %-16s  %-8s  %-3s  %-8s  %s\n", entry.crc, entry.name.GetCharArray(),
+            Cartridge::GetMBCName(entry.mbc), (entry.system_mode == SYSTEM_MODE_CGB) ? "yes" : "no",
+            StringConverter::SizeToHumanReadableString(entry.external_ram_size).GetCharArray(),
+            entry.path.GetCharArray());
+  }
+}
+
+// Handles the library options. Returns false if the program should exit, with the exit code in *exit_code.
+static bool HandleLibraryArguments(ProgramArgs* args, int* exit_code)
+{
+  if (args->library_scan_directory == nullptr && !args->library_list && args->library_launch_crc == nullptr)
+    return true;
+
+  SmallString index_filename;
+  if (args->library_index_filename != nullptr)
+  {
+    index_filename = args->library_index_filename;
+  }
+  else
+  {
+    Platform::GetProgramFileName(index_filename);
+    FileSystem::BuildPathRelativeToFile(index_filename, index_filename, "library.idx", true, true);
+  }
+
+  ROMLibrary library;
+  Error error;
+  if (!library.LoadIndex(index_filename, &error))
+    Log_WarningPrintf("Rebuilding library index: %s", error.GetErrorCodeAndDescription().GetCharArray());
+
+  if (args->library_scan_directory != nullptr)
+  {
+    ROMLibrary::ScanStatistics stats;
+    library.Scan(args->library_scan_directory, 0, &stats);
+    if (!library.SaveIndex(index_filename))
+    {
+      *exit_code = 1;
+      return false;
+    }
+  }
+
+  if (args->library_launch_crc != nullptr)
+  {
+    uint32 crc = static_cast<uint32>(std::strtoul(args->library_launch_crc, nullptr, 16));
+    const ROMLibrary::Entry* entry = library.FindEntryByCRC(crc);
+    if (entry == nullptr)
+    {
+      Log_ErrorPrintf("No rom with CRC %08X in library index '%s'", crc, index_filename.GetCharArray());
+      *exit_code = 1;
+      return false;
+    }
+
+    // the index owns the path, copy it before the library goes away
+    args->library_launch_filename = entry->path;
+    args->cart_filename = args->library_launch_filename;
+    Log_InfoPrintf("Launching '%s' (%s) from library.", entry->name.GetCharArray(),
+                   args->library_launch_filename.GetCharArray());
+    return true;
+  }
+
+  PrintLibrary(library);
+  *exit_code = 0;
+  return false;
+}
+
+static int RunBenchmark(const ProgramArgs* args)
+{
+  if (args->cart_filename == nullptr)
+  {
+    fprintf(stderr, "-benchmark needs a cart file\n");
+    return 1;
+  }
+
+  String profile_directory;
+  GetProfileDirectory(&profile_directory);
+
+  Benchmark benchmark;
+  Error error;
+  if (!benchmark.Init(args->cart_filename, args->system_mode, args->benchmark_instances, profile_directory, &error))
+  {
+    Log_ErrorPrintf("Failed to start benchmark: %s", error.GetErrorDescription().GetCharArray());
+    return 2;
+  }
+
+  return benchmark.Run(args->benchmark_frames, args->benchmark_step_loop, args->benchmark_io) ? 0 : 1;
+}
+
+static int RunTestROMs(const ProgramArgs* args)
+{
+  TestRunner runner;
+  Error error;
+  if (!runner.AddTests(args->test_rom_path, &error))
+  {
+    Log_ErrorPrintf("Failed to find test roms: %s", error.GetErrorDescription().GetCharArray());
+    return 2;
+  }
+
+  runner.Run(args->system_mode, args->test_timeout, args->test_threads);
+
+  if (args->test_junit_filename != nullptr && !runner.WriteJUnitXML(args->test_junit_filename, &error))
+    Log_ErrorPrintf("Failed to write JUnit report: %s", error.GetErrorDescription().GetCharArray());
+  if (args->test_json_filename != nullptr && !runner.WriteJSON(args->test_json_filename, &error))
+    Log_ErrorPrintf("Failed to write JSON report: %s", error.GetErrorDescription().GetCharArray());
+
+  // non-zero if anything didn't pass, for scripts
+  return (runner.GetResultCount(TestRunner::RESULT_PASSED) == runner.GetTestCount()) ? 0 : 1;
+}
+
+static int RunRenderBenchmark(const ProgramArgs* args)
+{
+  RenderReplay replay;
+  Error error;
+  if (!replay.Load(args->render_replay_path, &error))
+  {
+    Log_ErrorPrintf("Failed to load render captures: %s", error.GetErrorDescription().GetCharArray());
+    return 2;
+  }
+
+  return replay.Run(args->render_replay_loops) ? 0 : 1;
+}
+
+static int RunDatasetInfo(const ProgramArgs* args)
+{
+  DatasetReader reader;
+  Error error;
+  if (!reader.Open(args->dataset_info_filename, &error))
+  {
+    Log_ErrorPrintf("Failed to open dataset: %s", error.GetErrorDescription().GetCharArray());
+    return 2;
+  }
+
+  Log_InfoPrintf("%u frames in %u chunks, cartridge CRC %08X, %u memory regions:", reader.GetFrameCount(),
+                 reader.GetChunkCount(), reader.GetCartridgeCRC(), reader.GetRegionCount());
+  for (uint32 i = 0; i < reader.GetRegionCount(); i++)
+    Log_InfoPrintf("  %04X:%X", reader.GetRegion(i).address, reader.GetRegion(i).length);
+  if (reader.GetFrameCount() == 0)
+    return 0;
+
+  // scattered reads decompress a chunk each, sequential reads share them
+  DatasetReader::Frame frame;
+  uint32 random_reads = Min(reader.GetFrameCount(), 256u);
+  Timer random_timer;
+  for (uint32 i = 0; i < random_reads; i++)
+  {
+    if (!reader.ReadFrame(static_cast<uint32>((uint64(i) * 2654435761u) % reader.GetFrameCount()), &frame, &error))
+    {
+      Log_ErrorPrintf("Failed to read frame: %s", error.GetErrorDescription().GetCharArray());
+      return 1;
+    }
+  }
+  double random_time = random_timer.GetTimeSeconds();
+
+  Timer sequential_timer;
+  uint32 max_palette_size = 0;
+  for (uint32 i = 0; i < reader.GetFrameCount(); i++)
+  {
+    if (!reader.ReadFrame(i, &frame, &error))
+    {
+      Log_ErrorPrintf("Failed to read frame: %s", error.GetErrorDescription().GetCharArray());
+      return 1;
+    }
+    max_palette_size = Max(max_palette_size, frame.palette_size);
+  }
+  double sequential_time = sequential_timer.GetTimeSeconds();
+
+  Log_InfoPrintf("Random access: %.3f ms/frame, sequential: %.0f frames/s, at most %u colors per frame",
+                 random_time * 1000.0 / double(random_reads), double(reader.GetFrameCount()) / sequential_time,
+                 max_palette_size);
+  return 0;
+}
+
+static int RunHeadlessControlServer(const ProgramArgs* args)
+{
+  if (args->control_socket_path == nullptr || args->cart_filename == nullptr)
+  {
+    fprintf(stderr, "-headless needs -controlsocket and a cart file\n");
+    return 1;
+  }
+
+  return ControlServer::RunHeadless(args->control_socket_path, args->cart_filename, args->system_mode);
+}
+
+static int RunControlBenchmark(const ProgramArgs* args)
+{
+  Error error;
+  if (!ControlServer::RunBenchmark(args->control_benchmark_path, args->control_benchmark_iterations, &error))
+  {
+    Log_ErrorPrintf("Control benchmark failed: %s", error.GetErrorDescription().GetCharArray());
+    return 2;
+  }
+
+  return 0;
+}
+
+static int RunOpcodeBenchmark(const ProgramArgs* args)
+{
+  OpcodeBenchmark benchmark;
+  if (args->opcode_rom_directory != nullptr)
+  {
+    Error error;
+    if (!benchmark.WriteROMs(args->opcode_rom_directory, &error))
+    {
+      Log_ErrorPrintf("Failed to write opcode roms: %s", error.GetErrorDescription().GetCharArray());
+      return 2;
+    }
+  }
+
+  if (args->opcode_benchmark_instructions == 0)
+    return 0;
+
+  // non-zero if any opcode's timing is off
+  benchmark.Run(args->opcode_benchmark_instructions);
+  return (benchmark.GetMismatchCount() == 0) ? 0 : 1;
+}
+
 static GLuint CompileShader(GLenum type, const char* source)
 {
   GLuint shader = glCreateShader(type);
@@ -863,11 +1773,31 @@ static bool InitializeState(const ProgramArgs* args, State* state)
   state->hq_texture_buffer_stride = 0;
   state->hq_scale = 0;
   state->audio_device_id = 0;
+  state->vram_viewer = nullptr;
+  state->render_capture = nullptr;
+  state->input_movie = nullptr;
+  state->input_movie_playing = false;
+  state->control_server = nullptr;
+  state->dataset_writer = nullptr;
   state->enable_hqx = args->enable_hqx;
   state->running = true;
   state->needs_redraw = false;
   state->show_info_window = false;
   state->vsync_enabled = false;
+  state->beam_racing = (args->beam_racing_slice_size > 0);
+  state->beam_racing_slice_size = args->beam_racing_slice_size;
+  state->host_vblank_counter = 0;
+  state->host_refresh_ticks = 0;
+  state->host_window_offset = 0;
+  state->host_display_height = 0;
+  state->input_latency_start = 0;
+  state->input_latency_clock = 0;
+  state->presented_frame_start_clock = 0;
+  state->input_latency_total_ms = 0.0;
+  state->input_latency_samples = 0;
+  state->boot_snapshot_pending = false;
+  state->session_idle_snapshot_taken = false;
+  state->first_frame_presented = false;
 
   // load cart
   state->system = new System(state);
@@ -924,6 +1854,9 @@ static bool InitializeState(const ProgramArgs* args, State* state)
   if (!ImGui_Impl_Init(state->window))
     return false;
 
+  // debug windows
+  state->vram_viewer = new VRAMViewer();
+
   // create audio device
   SDL_AudioSpec audio_spec = {44100, AUDIO_S16, 2, 0, 2048, 0, 0, &State::AudioCallback, (void*)state};
   SDL_AudioSpec obtained_audio_spec;
@@ -957,20 +1890,163 @@ static bool InitializeState(const ProgramArgs* args, State* state)
   // apply options
   state->system->SetPermissiveMemoryAccess(args->permissive_memory);
   state->system->SetAccurateTiming(args->accurate_timing);
+  state->system->SetAccurateOAMDMA(args->accurate_oam_dma);
   state->system->SetAudioEnabled(args->enable_audio);
   state->system->SetFrameLimiter(args->frame_limiter);
+  state->system->SetScanlineOutputSliceSize(args->beam_racing_slice_size);
+  if (state->cart != nullptr)
+    state->cart->SetRTCWallClockSync(args->rtc_wall_clock_sync);
+
+  // cheats
+  for (const char* code : args->cheat_codes)
+  {
+    Error error;
+    if (!state->system->GetCheatEngine()->AddCode(code, &error))
+      Log_ErrorPrintf("Failed to add cheat: %s", error.GetErrorDescription().GetCharArray());
+  }
+
+  // turbo boot after the audio setting, it is restored once the boot rom finishes
+  state->system->SetTurboBoot(args->turbo_boot);
+
+  // renderer input capture for -renderbenchmark, the file is finished once enough frames are recorded
+  if (args->render_capture_filename != nullptr)
+  {
+    Error error;
+    state->render_capture = new RenderCaptureWriter();
+    if (state->render_capture->Open(args->render_capture_filename, args->render_capture_frames, &error))
+      state->system->GetDisplay()->SetRenderCapture(state->render_capture);
+    else
+      Log_ErrorPrintf("Failed to start render capture: %s", error.GetErrorDescription().GetCharArray());
+  }
+
+  // resume the previous session, which makes the boot snapshot redundant
+  bool session_resumed = false;
+  if (args->resume_session && state->cart != nullptr)
+  {
+    state->session_snapshot_filename.Format("%s.session", state->savestate_prefix.GetCharArray());
+    session_resumed = state->LoadSessionSnapshot();
+  }
+
+  // restore the cached post-boot state, or take it when this boot finishes
+  if (args->boot_snapshot_cache && !session_resumed && state->cart != nullptr && state->bios != nullptr)
+  {
+    // keyed on the boot rom too, since its state is what gets restored
+    uint32 bios_crc = static_cast<uint32>(crc32(crc32(0, Z_NULL, 0), state->bios, state->bios_length));
+    SmallString snapshot_filepart;
+    snapshot_filepart.Format("bootcache/%08X_%08X_%s.savestate", state->cart->GetCRC(), bios_crc,
+                             NameTable_GetNameString(NameTables::SystemMode, system_mode));
+    Platform::GetProgramFileName(state->boot_snapshot_filename);
+    FileSystem::BuildPathRelativeToFile(state->boot_snapshot_filename, state->boot_snapshot_filename,
+                                        snapshot_filepart, true, true);
+    state->boot_snapshot_pending = !state->LoadBootSnapshot();
+  }
+
+  // movies are timed from the state the system is in now, so they start after any snapshot is restored
+  // the rtc counts emulated time for both, a wall clock rtc would give a different result on every run
+  if ((args->movie_play_filename != nullptr || args->movie_record_filename != nullptr) && state->cart != nullptr)
+    state->cart->SetRTCWallClockSync(false);
+
+  if (args->movie_play_filename != nullptr)
+  {
+    Error error;
+    state->input_movie = new InputMovie();
+    if (state->input_movie->Load(args->movie_play_filename, &error))
+    {
+      if (state->cart != nullptr && state->input_movie->GetCartridgeCRC() != state->cart->GetCRC())
+      {
+        Log_WarningPrintf("Movie was recorded on another cartridge (CRC %08X), it is likely to desync",
+                          state->input_movie->GetCartridgeCRC());
+      }
+      if (!state->input_movie->IsRTCEmulated())
+        Log_WarningPrintf("Movie was recorded with a wall clock rtc, it may desync");
+
+      state->system->SetInputPlayback(state->input_movie);
+      state->input_movie_playing = true;
+    }
+    else
+    {
+      Log_ErrorPrintf("Failed to load movie: %s", error.GetErrorDescription().GetCharArray());
+    }
+  }
+  else if (args->movie_record_filename != nullptr)
+  {
+    state->input_movie = new InputMovie();
+    state->input_movie->SetCartridgeCRC((state->cart != nullptr) ? state->cart->GetCRC() : 0);
+    state->input_movie->SetRTCEmulated(true);
+    state->input_movie_record_filename = args->movie_record_filename;
+    state->system->SetInputRecorder(state->input_movie);
+  }
+
+  if (args->control_socket_path != nullptr)
+  {
+    Error error;
+    state->control_server = new ControlServer();
+    if (!state->control_server->Open(args->control_socket_path, state->system, &error))
+    {
+      Log_ErrorPrintf("Failed to start control server: %s", error.GetErrorDescription().GetCharArray());
+      delete state->control_server;
+      state->control_server = nullptr;
+    }
+  }
+
+  if (args->dataset_record_filename != nullptr)
+  {
+    Error error;
+    std::vector<DatasetRegion> regions;
+    state->dataset_writer = new DatasetWriter();
+    if (!DatasetWriter::ParseRegions(args->dataset_regions, &regions, &error) ||
+        !state->dataset_writer->Open(args->dataset_record_filename,
+                                     (state->cart != nullptr) ? state->cart->GetCRC() : 0, regions.data(),
+                                     static_cast<uint32>(regions.size()), args->dataset_chunk_frames, &error))
+    {
+      Log_ErrorPrintf("Failed to start dataset recording: %s", error.GetErrorDescription().GetCharArray());
+      delete state->dataset_writer;
+      state->dataset_writer = nullptr;
+    }
+  }
+
   return true;
 }
 
 static void CleanupState(State* state)
 {
+  state->WaitForSessionSnapshot();
+
+  // The profile counts frames from the system, so it has to be saved first. Battery ram and the clock are otherwise
+  // only written when the game disables cartridge ram.
+  if (state->cart != nullptr && state->system != nullptr)
+  {
+    state->cart->FlushBatteryData();
+    state->cart->SaveProfile();
+  }
+
+  if (state->input_movie != nullptr && !state->input_movie_record_filename.IsEmpty())
+  {
+    Error error;
+    if (state->input_movie->Save(state->input_movie_record_filename, &error))
+      Log_InfoPrintf("Saved movie with %u events", state->input_movie->GetEventCount());
+    else
+      Log_ErrorPrintf("Failed to save movie: %s", error.GetErrorDescription().GetCharArray());
+  }
+
   delete[] state->bios;
   delete state->cart;
   delete state->system;
+  delete state->render_capture;
+  state->render_capture = nullptr;
+  delete state->input_movie;
+  state->input_movie = nullptr;
+  delete state->control_server;
+  state->control_server = nullptr;
+  delete state->dataset_writer;
+  state->dataset_writer = nullptr;
 
   delete[] state->hq_texture_buffer;
   state->hq_texture_buffer = nullptr;
 
+  delete state->vram_viewer;
+  state->vram_viewer = nullptr;
+
   ImGui_Impl_Shutdown();
   glDeleteTextures(1, &state->texture);
 
@@ -984,6 +2060,8 @@ static void CleanupState(State* state)
 static int Run(State* state)
 {
   Timer time_since_last_report;
+  uint64 last_allocation_count = AllocationCounter::GetThreadAllocationCount();
+  bool control_client_connected = false;
 
   // resume audio
   if (state->audio_device_id != 0)
@@ -1021,42 +2099,45 @@ static int Run(State* state)
         case SDL_KEYUP:
         {
           bool down = (event->type == SDL_KEYDOWN);
+          state->session_idle_timer.Reset();
+          state->session_idle_snapshot_taken = false;
+
           switch (event->key.keysym.sym)
           {
           case SDLK_w:
           case SDLK_UP:
-            state->system->SetPadDirection(PAD_DIRECTION_UP, down);
+            state->QueuePadDirection(PAD_DIRECTION_UP, down, event->key);
             break;
 
           case SDLK_a:
           case SDLK_LEFT:
-            state->system->SetPadDirection(PAD_DIRECTION_LEFT, down);
+            state->QueuePadDirection(PAD_DIRECTION_LEFT, down, event->key);
             break;
 
           case SDLK_s:
           case SDLK_DOWN:
-            state->system->SetPadDirection(PAD_DIRECTION_DOWN, down);
+            state->QueuePadDirection(PAD_DIRECTION_DOWN, down, event->key);
             break;
 
           case SDLK_d:
           case SDLK_RIGHT:
-            state->system->SetPadDirection(PAD_DIRECTION_RIGHT, down);
+            state->QueuePadDirection(PAD_DIRECTION_RIGHT, down, event->key);
             break;
 
           case SDLK_z:
-            state->system->SetPadButton(PAD_BUTTON_B, down);
+            state->QueuePadButton(PAD_BUTTON_B, down, event->key);
             break;
 
           case SDLK_x:
-            state->system->SetPadButton(PAD_BUTTON_A, down);
+            state->QueuePadButton(PAD_BUTTON_A, down, event->key);
             break;
 
           case SDLK_RSHIFT:
-            state->system->SetPadButton(PAD_BUTTON_SELECT, down);
+            state->QueuePadButton(PAD_BUTTON_SELECT, down, event->key);
             break;
 
           case SDLK_RETURN:
-            state->system->SetPadButton(PAD_BUTTON_START, down);
+            state->QueuePadButton(PAD_BUTTON_START, down, event->key);
             break;
 
           case SDLK_TAB:
@@ -1115,10 +2196,61 @@ static int Run(State* state)
                           state->system->GetFrameCounter() + 1, state->system->GetCurrentSpeed() * 100.0f,
                           state->system->GetCurrentFPS());
       SDL_SetWindowTitle(state->window, window_title);
+      state->ReportInputLatency();
+
+      // after startup, nothing in the main loop should allocate, other than in the ui and libraries
+      if (AllocationCounter::IsEnabled())
+      {
+        uint64 allocation_count = AllocationCounter::GetThreadAllocationCount();
+        if (allocation_count != last_allocation_count)
+        {
+          Log_DevPrintf("%llu heap allocations on the main thread in the last second",
+                        static_cast<unsigned long long>(allocation_count - last_allocation_count));
+        }
+
+        // not counting the log message itself
+        last_allocation_count = AllocationCounter::GetThreadAllocationCount();
+      }
     }
 
-    // run a frame
-    double sleep_time_seconds = state->system->ExecuteFrame();
+    // run a frame, unless a control client is driving emulation, in which case wait on it instead
+    double sleep_time_seconds;
+    if (state->control_server != nullptr && state->control_server->HasClient())
+    {
+      state->control_server->Poll(1);
+      if (state->control_server->IsQuitRequested())
+        state->running = false;
+      sleep_time_seconds = 0.0;
+      control_client_connected = true;
+    }
+    else
+    {
+      // the client ran the clock at its own rate, so the limiter starts over from here
+      if (control_client_connected)
+      {
+        state->system->ResetPacing();
+        control_client_connected = false;
+      }
+
+      if (state->control_server != nullptr)
+        state->control_server->Poll(0);
+      sleep_time_seconds = state->system->ExecuteFrame();
+    }
+
+    // cache the post-boot state for the next launch
+    if (state->boot_snapshot_pending && !state->system->IsBootROMMapped())
+    {
+      state->SaveStateFile(state->boot_snapshot_filename);
+      state->boot_snapshot_pending = false;
+    }
+
+    // snapshot the session once per idle period, so a crash or kill loses little progress
+    if (!state->session_snapshot_filename.IsEmpty() && !state->session_idle_snapshot_taken &&
+        state->session_idle_timer.GetTimeSeconds() >= SESSION_IDLE_SNAPSHOT_SECONDS)
+    {
+      state->SaveSessionSnapshot();
+      state->session_idle_snapshot_taken = true;
+    }
 
     // needs redraw?
     if (state->needs_redraw)
@@ -1138,6 +2270,10 @@ static int Run(State* state)
   if (state->audio_device_id != 0)
     SDL_PauseAudioDevice(state->audio_device_id, 1);
 
+  // clean exit, snapshot for the next launch
+  if (!state->session_snapshot_filename.IsEmpty())
+    state->SaveSessionSnapshot();
+
   return 0;
 }
 
@@ -1169,6 +2305,68 @@ extern "C" int main(int argc, char* argv[])
   if (!ParseArguments(argc, argv, &args))
     return 1;
 
+  // library scan/list runs headless and exits, launch fills in the cart filename
+  int library_exit_code;
+  if (!HandleLibraryArguments(&args, &library_exit_code))
+  {
+    SDL_Quit();
+    return library_exit_code;
+  }
+
+  // benchmark runs headless and exits
+  if (args.benchmark_frames > 0)
+  {
+    int benchmark_exit_code = RunBenchmark(&args);
+    SDL_Quit();
+    return benchmark_exit_code;
+  }
+
+  // as does the test rom runner
+  if (args.test_rom_path != nullptr)
+  {
+    int test_exit_code = RunTestROMs(&args);
+    SDL_Quit();
+    return test_exit_code;
+  }
+
+  // and the renderer replay
+  if (args.render_replay_path != nullptr)
+  {
+    int render_exit_code = RunRenderBenchmark(&args);
+    SDL_Quit();
+    return render_exit_code;
+  }
+
+  // and the dataset reader
+  if (args.dataset_info_filename != nullptr)
+  {
+    int dataset_exit_code = RunDatasetInfo(&args);
+    SDL_Quit();
+    return dataset_exit_code;
+  }
+
+  // and the automation server, and its benchmark client
+  if (args.control_headless)
+  {
+    int control_exit_code = RunHeadlessControlServer(&args);
+    SDL_Quit();
+    return control_exit_code;
+  }
+  if (args.control_benchmark_path != nullptr)
+  {
+    int control_exit_code = RunControlBenchmark(&args);
+    SDL_Quit();
+    return control_exit_code;
+  }
+
+  // and the opcode benchmark
+  if (args.opcode_benchmark_instructions > 0 || args.opcode_rom_directory != nullptr)
+  {
+    int opcode_exit_code = RunOpcodeBenchmark(&args);
+    SDL_Quit();
+    return opcode_exit_code;
+  }
+
   // init state
   State state;
   if (!InitializeState(&args, &state))
@@ -0,0 +1,554 @@
+#include "mapper.h"
+#include "YBaseLib/BinaryReader.h"
+#include "YBaseLib/BinaryWriter.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Log.h"
+Log_SetChannel(Mapper);
+
+Mapper::Mapper(Cartridge* cartridge) : m_cartridge(cartridge), m_rom0(nullptr), m_romx(nullptr), m_ram(nullptr) {}
+
+Mapper::~Mapper() {}
+
+bool Mapper::Init()
+{
+  Reset();
+  return true;
+}
+
+uint8 Mapper::ReadRegister(uint16 address)
+{
+  // ram not enabled
+  return 0x00;
+}
+
+uint32 Mapper::GetROMBankCount() const
+{
+  return m_cartridge->m_num_rom_banks;
+}
+
+const byte* Mapper::GetROMBank(uint32 bank) const
+{
+  DebugAssert(bank < m_cartridge->m_num_rom_banks);
+  return m_cartridge->m_rom_banks[bank];
+}
+
+byte* Mapper::GetRAMBank(uint32 bank) const
+{
+  // external ram is allocated in whole banks, so a bank pointer always covers the window
+  if (m_cartridge->m_external_ram == nullptr || (bank * RAM_BANK_SIZE) >= m_cartridge->m_external_ram_size)
+    return nullptr;
+
+  return m_cartridge->m_external_ram + (bank * RAM_BANK_SIZE);
+}
+
+void Mapper::PublishMemoryMap()
+{
+  m_cartridge->PublishMemoryMap();
+}
+
+void Mapper::FlushRAM()
+{
+  if (m_cartridge->m_external_ram_modified)
+    m_cartridge->SaveRAM();
+  else if (m_cartridge->m_rtc_modified)
+    m_cartridge->SaveRTC();
+}
+
+void Mapper::LatchRTC(uint8 registers[5])
+{
+  // bring the counters up to the current cycle
+  m_cartridge->SynchronizeRTC();
+
+  const auto& rtc = m_cartridge->m_rtc;
+  registers[0] = rtc.seconds;            // 0x08
+  registers[1] = rtc.minutes;            // 0x09
+  registers[2] = rtc.hours;              // 0x0A
+  registers[3] = uint8(rtc.days & 0xFF); // 0x0B
+  registers[4] = uint8((rtc.days >> 8) & 0x01);
+  registers[4] |= (rtc.halt ? 0x40 : 0x00) | (rtc.day_carry ? 0x80 : 0x00); // 0x0C
+}
+
+void Mapper::WriteRTCRegister(uint8 index, uint8 value)
+{
+  TRACE("RTC register write 0x%02X - 0x%02X (%u)", index + 0x08, value, value);
+
+  // count the time up to the write with the old values
+  m_cartridge->SynchronizeRTC();
+
+  auto& rtc = m_cartridge->m_rtc;
+  switch (index)
+  {
+  case 0:
+    // writing the seconds register also resets the sub-second divider
+    rtc.seconds = value & 0x3F;
+    rtc.subsecond_clocks = 0;
+    break;
+
+  case 1:
+    rtc.minutes = value & 0x3F;
+    break;
+
+  case 2:
+    rtc.hours = value & 0x1F;
+    break;
+
+  case 3:
+    rtc.days = (rtc.days & 0x100) | uint16(value);
+    break;
+
+  case 4:
+    rtc.days = (rtc.days & 0xFF) | (uint16(value & 0x01) << 8);
+    rtc.halt = (value & 0x40) != 0;
+    rtc.day_carry = (value & 0x80) != 0;
+    break;
+  }
+
+  // written out with the ram when the game disables it, rather than on every write
+  m_cartridge->m_rtc_modified = true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// ROM only, with optional RAM
+//////////////////////////////////////////////////////////////////////////
+class Mapper_NONE : public Mapper
+{
+public:
+  Mapper_NONE(Cartridge* cartridge) : Mapper(cartridge) {}
+
+  bool Init() override
+  {
+    if (GetROMBankCount() != 2)
+    {
+      Log_ErrorPrint("MBC_NONE expects 2 rom banks");
+      return false;
+    }
+
+    return Mapper::Init();
+  }
+
+  void Reset() override { UpdateActiveBanks(); }
+
+  void WriteRegister(uint16 address, uint8 value) override
+  {
+    // ignore all writes
+    Log_WarningPrintf("MBC_NONE unhandled write to 0x%04X (value %02X)", address, value);
+  }
+
+  bool LoadState(ByteStream* pStream, BinaryReader& binaryReader) override
+  {
+    UpdateActiveBanks();
+    return true;
+  }
+
+  void SaveState(ByteStream* pStream, BinaryWriter& binaryWriter) override {}
+
+protected:
+  void UpdateActiveBanks() override
+  {
+    m_rom0 = GetROMBank(0);
+    m_romx = GetROMBank(1);
+    m_ram = GetRAMBank(0);
+    PublishMemoryMap();
+  }
+};
+
+//////////////////////////////////////////////////////////////////////////
+// MBC1
+//////////////////////////////////////////////////////////////////////////
+class Mapper_MBC1 : public Mapper
+{
+public:
+  Mapper_MBC1(Cartridge* cartridge) : Mapper(cartridge) { Y_memzero(&m_data, sizeof(m_data)); }
+
+  void Reset() override
+  {
+    m_data.ram_enable = false;
+    m_data.bank_mode = 0;
+    m_data.rom_bank_number = 1;
+    m_data.ram_bank_number = 0;
+    UpdateActiveBanks();
+  }
+
+  void WriteRegister(uint16 address, uint8 value) override
+  {
+    switch (address & 0xF000)
+    {
+    case 0x0000:
+    case 0x1000:
+      m_data.ram_enable = (value == 0x0A);
+      TRACE("MBC1 ram %s", m_data.ram_enable ? "enable" : "disable");
+      if (!m_data.ram_enable)
+        FlushRAM();
+
+      UpdateActiveBanks();
+      return;
+
+    case 0x2000:
+    case 0x3000:
+      m_data.rom_bank_number = value;
+      UpdateActiveBanks();
+      return;
+
+    case 0x4000:
+    case 0x5000:
+      m_data.ram_bank_number = value;
+      UpdateActiveBanks();
+      return;
+
+    case 0x6000:
+    case 0x7000:
+      m_data.bank_mode = value;
+      UpdateActiveBanks();
+      return;
+
+    case 0xA000:
+    case 0xB000:
+      // ram not enabled
+      return;
+    }
+
+    // ignore all writes
+    Log_WarningPrintf("MBC_MBC1 unhandled write to 0x%04X (value %02X)", address, value);
+  }
+
+  bool LoadState(ByteStream* pStream, BinaryReader& binaryReader) override
+  {
+    m_data.active_rom_bank = binaryReader.ReadUInt8();
+    m_data.active_ram_bank = binaryReader.ReadUInt8();
+    m_data.ram_enable = binaryReader.ReadBool();
+    m_data.bank_mode = binaryReader.ReadUInt8();
+    m_data.rom_bank_number = binaryReader.ReadUInt8();
+    m_data.ram_bank_number = binaryReader.ReadUInt8();
+    if (m_data.active_rom_bank >= GetROMBankCount())
+      return false;
+
+    UpdateActiveBanks();
+    return true;
+  }
+
+  void SaveState(ByteStream* pStream, BinaryWriter& binaryWriter) override
+  {
+    binaryWriter.WriteUInt8(m_data.active_rom_bank);
+    binaryWriter.WriteUInt8(m_data.active_ram_bank);
+    binaryWriter.WriteBool(m_data.ram_enable);
+    binaryWriter.WriteUInt8(m_data.bank_mode);
+    binaryWriter.WriteUInt8(m_data.rom_bank_number);
+    binaryWriter.WriteUInt8(m_data.ram_bank_number);
+  }
+
+protected:
+  void UpdateActiveBanks() override
+  {
+    if (m_data.bank_mode == 0)
+    {
+      m_data.active_ram_bank = 0;
+      m_data.active_rom_bank = (m_data.ram_bank_number << 5) | (m_data.rom_bank_number & 0x1F);
+    }
+    else
+    {
+      m_data.active_ram_bank = m_data.ram_bank_number & 0x03;
+      m_data.active_rom_bank = m_data.rom_bank_number;
+    }
+
+    // "But (when using the register below to specify the upper ROM Bank bits), the same happens for Bank 20h, 40h, and
+    // 60h. Any attempt to address these ROM Banks will select Bank 21h, 41h, and 61h instead."
+    if (m_data.active_rom_bank == 0x00 || m_data.active_rom_bank == 0x20 || m_data.active_rom_bank == 0x40 ||
+        m_data.active_rom_bank == 0x60)
+      m_data.active_rom_bank++;
+
+    // check ranges
+    if (m_data.active_rom_bank >= GetROMBankCount())
+    {
+      Log_WarningPrintf("ROM bank out of range (%u / %u)", m_data.active_rom_bank, GetROMBankCount());
+      m_data.active_rom_bank = (uint8)GetROMBankCount() - 1;
+    }
+
+    TRACE("MBC1 ROM bank: %u", m_data.active_rom_bank);
+    TRACE("MBC1 RAM bank: %u", m_data.active_ram_bank);
+
+    m_rom0 = GetROMBank(0);
+    m_romx = GetROMBank(m_data.active_rom_bank);
+    m_ram = m_data.ram_enable ? GetRAMBank(m_data.active_ram_bank) : nullptr;
+    PublishMemoryMap();
+  }
+
+private:
+  struct
+  {
+    uint8 active_rom_bank;
+    uint8 active_ram_bank;
+
+    bool ram_enable;
+    uint8 bank_mode;
+    uint8 rom_bank_number;
+    uint8 ram_bank_number;
+  } m_data;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// MBC3
+//////////////////////////////////////////////////////////////////////////
+class Mapper_MBC3 : public Mapper
+{
+public:
+  Mapper_MBC3(Cartridge* cartridge) : Mapper(cartridge) { Y_memzero(&m_data, sizeof(m_data)); }
+
+  void Reset() override
+  {
+    m_data.rom_bank_number = 1;
+    m_data.ram_bank_number = 0;
+    m_data.ram_rtc_enable = false;
+    UpdateActiveBanks();
+  }
+
+  uint8 ReadRegister(uint16 address) override
+  {
+    if (m_data.ram_rtc_enable && m_data.ram_bank_number >= 0x08 && m_data.ram_bank_number <= 0x0C)
+      return m_data.rtc_latch_data[m_data.ram_bank_number - 0x08];
+
+    // ram not enabled
+    return 0x00;
+  }
+
+  void WriteRegister(uint16 address, uint8 value) override
+  {
+    switch (address & 0xF000)
+    {
+    case 0x0000:
+    case 0x1000:
+      m_data.ram_rtc_enable = (value == 0x0A);
+      TRACE("MBC3 ram %s", m_data.ram_rtc_enable ? "enable" : "disable");
+      if (!m_data.ram_rtc_enable)
+        FlushRAM();
+
+      UpdateActiveBanks();
+      return;
+
+    case 0x2000:
+    case 0x3000:
+      m_data.rom_bank_number = value & 0x7F;
+      UpdateActiveBanks();
+      return;
+
+    case 0x4000:
+    case 0x5000:
+      m_data.ram_bank_number = value;
+      UpdateActiveBanks();
+      return;
+
+    case 0x6000:
+    case 0x7000:
+    {
+      // When writing 00h, and then 01h to this register, the current time becomes latched into the RTC registers.
+      if (m_data.rtc_latch != 0x01 && value == 0x01)
+        LatchRTC(m_data.rtc_latch_data);
+
+      // Update value
+      m_data.rtc_latch = value;
+      return;
+    }
+
+    case 0xA000:
+    case 0xB000:
+    {
+      if (m_data.ram_rtc_enable && m_data.ram_bank_number >= 0x08 && m_data.ram_bank_number <= 0x0C)
+        WriteRTCRegister(m_data.ram_bank_number - 0x08, value);
+
+      // ram not enabled
+      return;
+    }
+    }
+
+    // ignore all writes
+    Log_WarningPrintf("MBC_MBC3 unhandled write to 0x%04X (value %02X)", address, value);
+  }
+
+  bool LoadState(ByteStream* pStream, BinaryReader& binaryReader) override
+  {
+    m_data.rom_bank_number = binaryReader.ReadUInt8();
+    m_data.ram_bank_number = binaryReader.ReadUInt8();
+    m_data.ram_rtc_enable = binaryReader.ReadBool();
+    m_data.rtc_latch = binaryReader.ReadUInt8();
+    binaryReader.ReadBytes(m_data.rtc_latch_data, sizeof(m_data.rtc_latch_data));
+    if (m_data.rom_bank_number >= GetROMBankCount())
+      return false;
+
+    UpdateActiveBanks();
+    return true;
+  }
+
+  void SaveState(ByteStream* pStream, BinaryWriter& binaryWriter) override
+  {
+    binaryWriter.WriteUInt8(m_data.rom_bank_number);
+    binaryWriter.WriteUInt8(m_data.ram_bank_number);
+    binaryWriter.WriteBool(m_data.ram_rtc_enable);
+    binaryWriter.WriteUInt8(m_data.rtc_latch);
+    binaryWriter.WriteBytes(m_data.rtc_latch_data, sizeof(m_data.rtc_latch_data));
+  }
+
+protected:
+  void UpdateActiveBanks() override
+  {
+    // Same as for MBC1, except that the whole 7 bits of the RAM Bank Number are written directly to this address. As
+    // for the MBC1, writing a value of 00h, will select Bank 01h instead. All other values 01-7Fh select the
+    // corresponding ROM Banks.
+    if (m_data.rom_bank_number == 0x00)
+      m_data.rom_bank_number++;
+
+    // check ranges
+    if (m_data.rom_bank_number >= GetROMBankCount())
+    {
+      Log_WarningPrintf("ROM bank out of range (%u / %u)", m_data.rom_bank_number, GetROMBankCount());
+      m_data.rom_bank_number = (uint8)GetROMBankCount() - 1;
+    }
+
+    TRACE("MBC3 ROM bank: %u", m_data.rom_bank_number);
+    TRACE("MBC3 RAM bank: %u", m_data.ram_bank_number);
+
+    // rtc registers are not memory
+    m_rom0 = GetROMBank(0);
+    m_romx = GetROMBank(m_data.rom_bank_number);
+    m_ram = (m_data.ram_rtc_enable && m_data.ram_bank_number <= 0x07) ? GetRAMBank(m_data.ram_bank_number) : nullptr;
+    PublishMemoryMap();
+  }
+
+private:
+  struct
+  {
+    uint8 rom_bank_number;
+    uint8 ram_bank_number;
+    bool ram_rtc_enable;
+
+    uint8 rtc_latch;
+    uint8 rtc_latch_data[5];
+  } m_data;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// MBC5
+//////////////////////////////////////////////////////////////////////////
+class Mapper_MBC5 : public Mapper
+{
+public:
+  Mapper_MBC5(Cartridge* cartridge) : Mapper(cartridge) { Y_memzero(&m_data, sizeof(m_data)); }
+
+  void Reset() override
+  {
+    m_data.rom_bank_number = 1;
+    m_data.ram_bank_number = 0;
+    m_data.ram_enable = false;
+    UpdateActiveBanks();
+  }
+
+  void WriteRegister(uint16 address, uint8 value) override
+  {
+    switch (address & 0xF000)
+    {
+    case 0x0000:
+    case 0x1000:
+      m_data.ram_enable = (value == 0x0A);
+      TRACE("MBC5 ram %s", m_data.ram_enable ? "enable" : "disable");
+      if (!m_data.ram_enable)
+        FlushRAM();
+
+      UpdateActiveBanks();
+      return;
+
+    case 0x2000:
+      m_data.rom_bank_number = (m_data.rom_bank_number & 0x100) | (uint16)value;
+      UpdateActiveBanks();
+      return;
+
+    case 0x3000:
+      m_data.rom_bank_number = (m_data.rom_bank_number & 0xFF) | ((uint16)(value & 0x01) << 8);
+      UpdateActiveBanks();
+      return;
+
+    case 0x4000:
+    case 0x5000:
+      m_data.ram_bank_number = value;
+      UpdateActiveBanks();
+      return;
+
+    case 0xA000:
+    case 0xB000:
+      // ram not enabled
+      return;
+    }
+
+    // ignore all writes
+    Log_WarningPrintf("MBC_MBC5 unhandled write to 0x%04X (value %02X)", address, value);
+  }
+
+  bool LoadState(ByteStream* pStream, BinaryReader& binaryReader) override
+  {
+    m_data.active_rom_bank = binaryReader.ReadUInt16();
+    m_data.rom_bank_number = binaryReader.ReadUInt16();
+    m_data.ram_bank_number = binaryReader.ReadUInt8();
+    m_data.ram_enable = binaryReader.ReadBool();
+    if (m_data.active_rom_bank >= GetROMBankCount())
+      return false;
+
+    UpdateActiveBanks();
+    return true;
+  }
+
+  void SaveState(ByteStream* pStream, BinaryWriter& binaryWriter) override
+  {
+    binaryWriter.WriteUInt16(m_data.active_rom_bank);
+    binaryWriter.WriteUInt16(m_data.rom_bank_number);
+    binaryWriter.WriteUInt8(m_data.ram_bank_number);
+    binaryWriter.WriteBool(m_data.ram_enable);
+  }
+
+protected:
+  void UpdateActiveBanks() override
+  {
+    // Same as for MBC1, except that accessing up to bank 1E0h is supported now. Also, bank 0 is actually bank 0.
+    m_data.active_rom_bank = m_data.rom_bank_number;
+    if (m_data.active_rom_bank >= GetROMBankCount())
+    {
+      // since this is written as two different values, provided PC isn't in cart space,
+      // it may be temporarily out of range, and this is okay, it'll be fixed afterwards
+      m_data.active_rom_bank = (uint16)GetROMBankCount() - 1;
+    }
+
+    TRACE("MBC5 ROM bank: %u", m_data.rom_bank_number);
+    TRACE("MBC5 RAM bank: %u", m_data.ram_bank_number);
+
+    m_rom0 = GetROMBank(0);
+    m_romx = GetROMBank(m_data.active_rom_bank);
+    m_ram = m_data.ram_enable ? GetRAMBank(m_data.ram_bank_number) : nullptr;
+    PublishMemoryMap();
+  }
+
+private:
+  struct
+  {
+    uint16 active_rom_bank;
+    uint16 rom_bank_number;
+    uint8 ram_bank_number;
+    bool ram_enable;
+  } m_data;
+};
+
+Mapper* Mapper::Create(MBC mbc, Cartridge* cartridge)
+{
+  switch (mbc)
+  {
+  case MBC_NONE:
+    return new Mapper_NONE(cartridge);
+
+  case MBC_MBC1:
+    return new Mapper_MBC1(cartridge);
+
+  case MBC_MBC3:
+    return new Mapper_MBC3(cartridge);
+
+  case MBC_MBC5:
+    return new Mapper_MBC5(cartridge);
+
+  default:
+    return nullptr;
+  }
+}
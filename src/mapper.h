@@ -0,0 +1,61 @@
+#pragma once
+#include "YBaseLib/Common.h"
+#include "cartridge.h"
+
+class ByteStream;
+class BinaryReader;
+class BinaryWriter;
+
+// Memory bank controller interface.
+// Each mapper keeps pointers to the memory currently visible through the 0000-3FFF, 4000-7FFF and A000-BFFF windows.
+// These are only recomputed in UpdateActiveBanks(), which publishes them to the system memory map, so plain memory
+// accesses never reach the mapper. Only bank register writes, and accesses to a RAM window that is not mapped to
+// memory (disabled RAM, RTC registers), go through the virtual interface.
+class Mapper
+{
+public:
+  Mapper(Cartridge* cartridge);
+  virtual ~Mapper();
+
+  // returns nullptr if the controller type is not implemented
+  static Mapper* Create(MBC mbc, Cartridge* cartridge);
+
+  // current windows, RAM is null when it is not mapped to memory
+  const byte* GetROM0Pointer() const { return m_rom0; }
+  const byte* GetROMXPointer() const { return m_romx; }
+  byte* GetRAMPointer() const { return m_ram; }
+
+  virtual bool Init();
+  virtual void Reset() = 0;
+
+  // accesses to the RAM window while it is not mapped to memory
+  virtual uint8 ReadRegister(uint16 address);
+
+  // writes to 0000-7FFF, and to the RAM window while it is not mapped to memory
+  virtual void WriteRegister(uint16 address, uint8 value) = 0;
+
+  // state saving, the active banks are updated after loading
+  virtual bool LoadState(ByteStream* pStream, BinaryReader& binaryReader) = 0;
+  virtual void SaveState(ByteStream* pStream, BinaryWriter& binaryWriter) = 0;
+
+protected:
+  // recompute the window pointers from the bank registers, and publish them
+  virtual void UpdateActiveBanks() = 0;
+
+  uint32 GetROMBankCount() const;
+  const byte* GetROMBank(uint32 bank) const;
+  byte* GetRAMBank(uint32 bank) const;
+  void PublishMemoryMap();
+
+  // writes external ram to the battery save if it was modified
+  void FlushRAM();
+
+  // MBC3 clock access
+  void LatchRTC(uint8 registers[5]);
+  void WriteRTCRegister(uint8 index, uint8 value);
+
+  Cartridge* m_cartridge;
+  const byte* m_rom0;
+  const byte* m_romx;
+  byte* m_ram;
+};
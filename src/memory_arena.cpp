@@ -0,0 +1,216 @@
+#include "memory_arena.h"
+#include "YBaseLib/Log.h"
+Log_SetChannel(MemoryArena);
+
+#ifdef Y_PLATFORM_WINDOWS
+#include "YBaseLib/Windows/WindowsHeaders.h"
+#else
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+static const size_t SMALL_PAGE_SIZE = 4096;
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+MemoryArena::MemoryArena() : m_base(nullptr), m_size(0), m_used(0), m_huge_pages(false) {}
+
+MemoryArena::~MemoryArena()
+{
+  Destroy();
+}
+
+bool MemoryArena::Create(size_t size)
+{
+  Destroy();
+
+  // anything smaller than a huge page gains nothing from the alignment
+  bool use_huge_pages = (size >= HUGE_PAGE_SIZE);
+  size_t page_size = use_huge_pages ? HUGE_PAGE_SIZE : SMALL_PAGE_SIZE;
+  size = (size + page_size - 1) & ~(page_size - 1);
+
+#ifdef Y_PLATFORM_WINDOWS
+  // large pages need SeLockMemoryPrivilege, which normal users don't have, so this is a plain contiguous block
+  byte* base = static_cast<byte*>(VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+  if (base == nullptr)
+  {
+    Log_ErrorPrintf("Failed to allocate %u KB guest memory arena", static_cast<uint32>(size / 1024));
+    return false;
+  }
+#else
+  // over-allocate by a huge page, then trim both ends so the block starts on a huge page boundary
+  size_t mapping_size = use_huge_pages ? (size + HUGE_PAGE_SIZE) : size;
+  void* mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED)
+  {
+    Log_ErrorPrintf("Failed to map %u KB guest memory arena", static_cast<uint32>(size / 1024));
+    return false;
+  }
+
+  byte* base = static_cast<byte*>(mapping);
+  if (use_huge_pages)
+  {
+    byte* aligned_base =
+      reinterpret_cast<byte*>((reinterpret_cast<uintptr_t>(base) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+    size_t head_size = static_cast<size_t>(aligned_base - base);
+    size_t tail_size = mapping_size - head_size - size;
+    if (head_size > 0)
+      munmap(base, head_size);
+    if (tail_size > 0)
+      munmap(aligned_base + size, tail_size);
+    base = aligned_base;
+
+#ifdef MADV_HUGEPAGE
+    // only advisory, the kernel falls back to small pages if thp is disabled or memory is fragmented
+    m_huge_pages = (madvise(base, size, MADV_HUGEPAGE) == 0);
+#endif
+  }
+#endif
+
+  m_base = base;
+  m_size = size;
+  m_used = 0;
+  Log_DevPrintf("Guest memory arena: %u KB at %p%s", static_cast<uint32>(size / 1024), m_base,
+                m_huge_pages ? ", huge pages" : "");
+  return true;
+}
+
+void MemoryArena::Destroy()
+{
+  if (m_base == nullptr)
+    return;
+
+#ifdef Y_PLATFORM_WINDOWS
+  VirtualFree(m_base, 0, MEM_RELEASE);
+#else
+  munmap(m_base, m_size);
+#endif
+
+  m_base = nullptr;
+  m_size = 0;
+  m_used = 0;
+  m_huge_pages = false;
+}
+
+byte* MemoryArena::Allocate(size_t size, size_t alignment)
+{
+  size_t offset = (m_used + alignment - 1) & ~(alignment - 1);
+  if (m_base == nullptr || offset > m_size || size > (m_size - offset))
+    return nullptr;
+
+  m_used = offset + size;
+  return m_base + offset;
+}
+
+#ifndef Y_PLATFORM_WINDOWS
+static bool GetThreadUsage(rusage* usage)
+{
+#ifdef RUSAGE_THREAD
+  return (getrusage(RUSAGE_THREAD, usage) == 0);
+#else
+  // per-thread counts are linux only, the whole process is close enough for a single emulation thread
+  return (getrusage(RUSAGE_SELF, usage) == 0);
+#endif
+}
+#endif
+
+#ifdef __linux__
+// user-space read misses for one cache, counting on the calling thread
+static int OpenCacheMissCounter(uint64 cache)
+{
+  perf_event_attr attr;
+  Y_memzero(&attr, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+static void StartCounter(int fd)
+{
+  if (fd >= 0)
+  {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+static uint64 StopCounter(int fd)
+{
+  uint64 count = 0;
+  if (fd >= 0)
+  {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+      count = 0;
+  }
+  return count;
+}
+#endif
+
+MemoryCounters::MemoryCounters()
+  : m_minor_page_faults(0), m_major_page_faults(0), m_tlb_misses(0), m_l1d_misses(0), m_tlb_fd(-1), m_l1d_fd(-1),
+    m_page_faults_valid(false)
+{
+#ifdef __linux__
+  m_tlb_fd = OpenCacheMissCounter(PERF_COUNT_HW_CACHE_DTLB);
+  m_l1d_fd = OpenCacheMissCounter(PERF_COUNT_HW_CACHE_L1D);
+  if (m_tlb_fd < 0 || m_l1d_fd < 0)
+    Log_DevPrintf("Cache miss counters unavailable, check perf_event_paranoid");
+#endif
+}
+
+MemoryCounters::~MemoryCounters()
+{
+#ifndef Y_PLATFORM_WINDOWS
+  if (m_tlb_fd >= 0)
+    close(m_tlb_fd);
+  if (m_l1d_fd >= 0)
+    close(m_l1d_fd);
+#endif
+}
+
+void MemoryCounters::Begin()
+{
+#ifndef Y_PLATFORM_WINDOWS
+  rusage usage;
+  m_page_faults_valid = GetThreadUsage(&usage);
+  m_minor_page_faults = m_page_faults_valid ? static_cast<uint64>(usage.ru_minflt) : 0;
+  m_major_page_faults = m_page_faults_valid ? static_cast<uint64>(usage.ru_majflt) : 0;
+#endif
+
+#ifdef __linux__
+  StartCounter(m_tlb_fd);
+  StartCounter(m_l1d_fd);
+#endif
+}
+
+void MemoryCounters::End()
+{
+#ifdef __linux__
+  m_tlb_misses = StopCounter(m_tlb_fd);
+  m_l1d_misses = StopCounter(m_l1d_fd);
+#endif
+
+#ifndef Y_PLATFORM_WINDOWS
+  rusage usage;
+  if (m_page_faults_valid && GetThreadUsage(&usage))
+  {
+    m_minor_page_faults = static_cast<uint64>(usage.ru_minflt) - m_minor_page_faults;
+    m_major_page_faults = static_cast<uint64>(usage.ru_majflt) - m_major_page_faults;
+  }
+  else
+  {
+    m_page_faults_valid = false;
+  }
+#endif
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "YBaseLib/Common.h"
+
+// One contiguous, zeroed block of guest memory, handed out front to back.
+// Blocks of 2MB and up are aligned to and advised as transparent huge pages where the host supports it, so a large
+// rom plus its ram is covered by a handful of TLB entries rather than thousands of 4KB pages.
+class MemoryArena
+{
+public:
+  MemoryArena();
+  ~MemoryArena();
+
+  byte* GetBase() const { return m_base; }
+  size_t GetSize() const { return m_size; }
+  size_t GetUsedSize() const { return m_used; }
+  bool IsHugePageBacked() const { return m_huge_pages; }
+
+  bool Contains(const void* ptr) const
+  {
+    return (static_cast<const byte*>(ptr) >= m_base && static_cast<const byte*>(ptr) < (m_base + m_size));
+  }
+
+  // replaces any previous block, which must no longer be referenced
+  bool Create(size_t size);
+  void Destroy();
+
+  // returns nullptr if the block is full
+  byte* Allocate(size_t size, size_t alignment = 64);
+
+private:
+  byte* m_base;
+  size_t m_size;
+  size_t m_used;
+  bool m_huge_pages;
+};
+
+// Page faults, data TLB misses and L1 data cache misses on the calling thread between Begin() and End().
+// Miss counts come from perf events on Linux, and are unavailable elsewhere or when perf access is restricted.
+class MemoryCounters
+{
+public:
+  MemoryCounters();
+  ~MemoryCounters();
+
+  void Begin();
+  void End();
+
+  bool HasPageFaults() const { return m_page_faults_valid; }
+  uint64 GetMinorPageFaults() const { return m_minor_page_faults; }
+  uint64 GetMajorPageFaults() const { return m_major_page_faults; }
+
+  bool HasTLBMisses() const { return (m_tlb_fd >= 0); }
+  uint64 GetTLBMisses() const { return m_tlb_misses; }
+
+  bool HasL1DMisses() const { return (m_l1d_fd >= 0); }
+  uint64 GetL1DMisses() const { return m_l1d_misses; }
+
+private:
+  uint64 m_minor_page_faults;
+  uint64 m_major_page_faults;
+  uint64 m_tlb_misses;
+  uint64 m_l1d_misses;
+  int m_tlb_fd;
+  int m_l1d_fd;
+  bool m_page_faults_valid;
+};
@@ -0,0 +1,478 @@
+#include "opcode_benchmark.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Error.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/Timer.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "structures.h"
+Log_SetChannel(OpcodeBenchmark);
+
+// rom layout: NOP/JP at the entry point, setup code after the header, then the loop
+//   setup: DI, XOR A, LDH ($FF),A
+//   loop:  LD SP,stack; LD BC,target; LD DE,target; LD HL,target; XOR A; <opcode> * unroll_count; JP loop
+// the loop reloads everything the opcode could have moved, and XOR A leaves Z set and C clear for the branches
+static const uint32 ROM_SIZE = 0x8000;
+static const uint16 SETUP_ADDRESS = 0x0150;
+static const uint16 LOOP_ADDRESS = 0x0154;
+static const uint16 BODY_ADDRESS = LOOP_ADDRESS + 13;
+static const uint32 SETUP_INSTRUCTIONS = 5;
+static const uint32 LOOP_OVERHEAD_INSTRUCTIONS = 6;
+static const uint32 LOOP_OVERHEAD_CYCLES = 12 * 4 + 4 + 16;
+static const uint16 STACK_ADDRESS = 0xD000;
+
+// opcodes which move their pointer are kept within 32 instructions of it, leaving HRAM's bounds untouched
+static const uint32 UNROLL_COUNT = 1024;
+static const uint32 POINTER_UNROLL_COUNT = 32;
+
+static const char* TARGET_NAMES[OpcodeBenchmark::NUM_TARGETS] = {"none", "wram", "hram", "rom", "io"};
+
+// pointer registers and addresses are aimed here, the io target is SCY
+static const uint16 TARGET_ADDRESSES[OpcodeBenchmark::NUM_TARGETS] = {0xC800, 0xC800, 0xFFC0, 0x4800, 0xFF42};
+
+// Disassemble() puts the address and instruction bytes ahead of the mnemonic
+static const uint32 DISASSEMBLY_MNEMONIC_OFFSET = 14;
+
+// documented timings in clocks, branches not taken, zero for opcodes which are left out
+// clang-format off
+static const uint8 BASE_CYCLES[256] = {
+  //0  1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
+   4, 12,  8,  8,  4,  4,  8,  4, 20,  8,  8,  8,  4,  4,  8,  4, // 0
+   0, 12,  8,  8,  4,  4,  8,  4, 12,  8,  8,  8,  4,  4,  8,  4, // 1
+   8, 12,  8,  8,  4,  4,  8,  4,  8,  8,  8,  8,  4,  4,  8,  4, // 2
+   8, 12,  8,  8, 12, 12, 12,  4,  8,  8,  8,  8,  4,  4,  8,  4, // 3
+   4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 4
+   4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 5
+   4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 6
+   8,  8,  8,  8,  8,  8,  0,  8,  4,  4,  4,  4,  4,  4,  8,  4, // 7
+   4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 8
+   4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 9
+   4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // A
+   4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // B
+   0, 12, 12, 16,  0, 16,  8,  0,  0,  0, 12,  0,  0,  0,  8,  0, // C
+   0, 12, 12,  0,  0, 16,  8,  0,  0,  0, 12,  0,  0,  0,  8,  0, // D
+  12, 12,  8,  0,  0, 16,  8,  0, 16,  0, 16,  0,  0,  0,  8,  0, // E
+  12, 12,  8,  4,  0, 16,  8,  0, 12,  8, 16,  4,  0,  0,  8,  0, // F
+};
+static const uint8 BASE_LENGTHS[256] = {
+  //0  1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
+   1,  3,  1,  1,  1,  1,  2,  1,  3,  1,  1,  1,  1,  1,  2,  1, // 0
+   2,  3,  1,  1,  1,  1,  2,  1,  2,  1,  1,  1,  1,  1,  2,  1, // 1
+   2,  3,  1,  1,  1,  1,  2,  1,  2,  1,  1,  1,  1,  1,  2,  1, // 2
+   2,  3,  1,  1,  1,  1,  2,  1,  2,  1,  1,  1,  1,  1,  2,  1, // 3
+   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 4
+   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 5
+   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 6
+   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 7
+   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 8
+   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // 9
+   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // A
+   1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1, // B
+   1,  1,  3,  3,  3,  1,  2,  1,  1,  1,  3,  2,  3,  3,  2,  1, // C
+   1,  1,  3,  1,  3,  1,  2,  1,  1,  1,  3,  1,  3,  1,  2,  1, // D
+   2,  1,  1,  1,  1,  1,  2,  1,  2,  1,  3,  1,  1,  1,  2,  1, // E
+   2,  1,  1,  1,  1,  1,  2,  1,  2,  1,  3,  1,  1,  1,  2,  1, // F
+};
+// clang-format on
+
+enum MEMORY_ACCESS
+{
+  MEMORY_ACCESS_NONE,
+  MEMORY_ACCESS_READ,
+  MEMORY_ACCESS_WRITE,
+  MEMORY_ACCESS_STEP_READ,
+  MEMORY_ACCESS_STEP_WRITE,
+  MEMORY_ACCESS_HIGH,
+  MEMORY_ACCESS_STACK,
+  NUM_MEMORY_ACCESSES
+};
+
+// targets each kind of access is run against, writes leave rom alone so the mapper isn't involved
+#define TARGET_BIT(target) (1u << OpcodeBenchmark::target)
+static const uint32 MEMORY_ACCESS_TARGETS[NUM_MEMORY_ACCESSES] = {
+  TARGET_BIT(TARGET_NONE),
+  TARGET_BIT(TARGET_WRAM) | TARGET_BIT(TARGET_HRAM) | TARGET_BIT(TARGET_ROM) | TARGET_BIT(TARGET_IO),
+  TARGET_BIT(TARGET_WRAM) | TARGET_BIT(TARGET_HRAM) | TARGET_BIT(TARGET_IO),
+  TARGET_BIT(TARGET_WRAM) | TARGET_BIT(TARGET_HRAM) | TARGET_BIT(TARGET_ROM),
+  TARGET_BIT(TARGET_WRAM) | TARGET_BIT(TARGET_HRAM),
+  TARGET_BIT(TARGET_HRAM) | TARGET_BIT(TARGET_IO),
+  TARGET_BIT(TARGET_WRAM)};
+#undef TARGET_BIT
+
+static MEMORY_ACCESS GetBaseMemoryAccess(uint8 opcode)
+{
+  switch (opcode)
+  {
+  case 0x0A: // LD A,(BC)
+  case 0x1A: // LD A,(DE)
+  case 0x46: // LD r,(HL)
+  case 0x4E:
+  case 0x56:
+  case 0x5E:
+  case 0x66:
+  case 0x6E:
+  case 0x7E:
+  case 0x86: // ALU A,(HL)
+  case 0x8E:
+  case 0x96:
+  case 0x9E:
+  case 0xA6:
+  case 0xAE:
+  case 0xB6:
+  case 0xBE:
+  case 0xFA: // LD A,(a16)
+    return MEMORY_ACCESS_READ;
+
+  case 0x02: // LD (BC),A
+  case 0x08: // LD (a16),SP
+  case 0x12: // LD (DE),A
+  case 0x34: // INC (HL)
+  case 0x35: // DEC (HL)
+  case 0x36: // LD (HL),d8
+  case 0x70: // LD (HL),r
+  case 0x71:
+  case 0x72:
+  case 0x73:
+  case 0x74:
+  case 0x75:
+  case 0x77:
+  case 0xEA: // LD (a16),A
+    return MEMORY_ACCESS_WRITE;
+
+  case 0x2A: // LD A,(HL+)
+  case 0x3A: // LD A,(HL-)
+    return MEMORY_ACCESS_STEP_READ;
+
+  case 0x22: // LD (HL+),A
+  case 0x32: // LD (HL-),A
+    return MEMORY_ACCESS_STEP_WRITE;
+
+  case 0xE0: // LDH (a8),A
+  case 0xE2: // LD (C),A
+  case 0xF0: // LDH A,(a8)
+  case 0xF2: // LD A,(C)
+    return MEMORY_ACCESS_HIGH;
+
+  case 0xC1: // POP rr
+  case 0xD1:
+  case 0xE1:
+  case 0xF1:
+  case 0xC5: // PUSH rr
+  case 0xD5:
+  case 0xE5:
+  case 0xF5:
+    return MEMORY_ACCESS_STACK;
+
+  default:
+    return MEMORY_ACCESS_NONE;
+  }
+}
+
+static bool IsConditionalBranch(uint8 opcode)
+{
+  // JR cc / JP cc
+  return ((opcode & 0xE7) == 0x20 || (opcode & 0xE7) == 0xC2);
+}
+
+OpcodeBenchmark::OpcodeBenchmark()
+{
+  for (uint32 opcode = 0; opcode < 256; opcode++)
+    AddCases(static_cast<uint8>(opcode), false);
+  for (uint32 opcode = 0; opcode < 256; opcode++)
+    AddCases(static_cast<uint8>(opcode), true);
+}
+
+OpcodeBenchmark::~OpcodeBenchmark() {}
+
+void OpcodeBenchmark::AddCases(uint8 opcode, bool cb_prefix)
+{
+  uint32 cycles;
+  MEMORY_ACCESS access;
+  if (cb_prefix)
+  {
+    // (HL) operands take 16 clocks, or 12 for BIT's read
+    if ((opcode & 0x07) == 0x06)
+    {
+      bool is_bit = ((opcode & 0xC0) == 0x40);
+      cycles = is_bit ? 12 : 16;
+      access = is_bit ? MEMORY_ACCESS_READ : MEMORY_ACCESS_WRITE;
+    }
+    else
+    {
+      cycles = 8;
+      access = MEMORY_ACCESS_NONE;
+    }
+  }
+  else
+  {
+    cycles = BASE_CYCLES[opcode];
+    if (cycles == 0)
+      return;
+
+    // Z set and C clear, so Z and NC are taken
+    uint32 condition = (opcode >> 3) & 0x03;
+    if (IsConditionalBranch(opcode) && (condition == 1 || condition == 2))
+      cycles += 4;
+
+    access = GetBaseMemoryAccess(opcode);
+  }
+
+  bool moves_pointer = (access == MEMORY_ACCESS_STEP_READ || access == MEMORY_ACCESS_STEP_WRITE ||
+                        access == MEMORY_ACCESS_STACK);
+  for (uint32 target = 0; target < NUM_TARGETS; target++)
+  {
+    if (!(MEMORY_ACCESS_TARGETS[access] & (1u << target)))
+      continue;
+
+    Case c;
+    c.opcode = opcode;
+    c.cb_prefix = cb_prefix;
+    c.target = static_cast<TARGET>(target);
+    c.unroll_count = moves_pointer ? POINTER_UNROLL_COUNT : UNROLL_COUNT;
+    c.expected_cycles = cycles;
+    c.measured_cycles = 0.0;
+    c.ns_per_instruction = 0.0;
+    c.timing_matches = false;
+    m_cases.push_back(std::move(c));
+  }
+}
+
+uint32 OpcodeBenchmark::GetMismatchCount() const
+{
+  uint32 count = 0;
+  for (const Case& c : m_cases)
+    count += c.timing_matches ? 0 : 1;
+  return count;
+}
+
+void OpcodeBenchmark::BuildROM(const Case& c, std::vector<byte>* rom)
+{
+  rom->assign(ROM_SIZE, 0x00);
+  byte* data = rom->data();
+  uint32 pc = CART_HEADER_OFFSET;
+  auto emit = [data, &pc](uint8 value) { data[pc++] = value; };
+  auto emit16 = [&emit](uint16 value) {
+    emit(static_cast<uint8>(value));
+    emit(static_cast<uint8>(value >> 8));
+  };
+
+  // entry point, the header is left zeroed (ROM ONLY, 32KB, no ram) other than the title
+  emit(0x00);
+  emit(0xC3);
+  emit16(SETUP_ADDRESS);
+
+  String title;
+  title.Format("%s %02X %s", c.cb_prefix ? "CB" : "OP", c.opcode, TARGET_NAMES[c.target]);
+  CART_HEADER* header = reinterpret_cast<CART_HEADER*>(data + CART_HEADER_OFFSET);
+  Y_memcpy(header->title, title.GetCharArray(), Min(title.GetLength(), static_cast<uint32>(sizeof(header->title))));
+
+  // checksum covers the title through the rom version
+  uint8 header_checksum = 0;
+  for (uint32 address = 0x0134; address < 0x014D; address++)
+    header_checksum = header_checksum - data[address] - 1;
+  header->header_checksum = header_checksum;
+
+  // interrupts stay off for good
+  pc = SETUP_ADDRESS;
+  emit(0xF3);
+  emit(0xAF);
+  emit(0xE0);
+  emit(0xFF);
+
+  uint16 pointer = TARGET_ADDRESSES[c.target];
+  DebugAssert(pc == LOOP_ADDRESS);
+  emit(0x31);
+  emit16(STACK_ADDRESS);
+  emit(0x01);
+  emit16(pointer);
+  emit(0x11);
+  emit16(pointer);
+  emit(0x21);
+  emit16(pointer);
+  emit(0xAF);
+
+  DebugAssert(pc == BODY_ADDRESS);
+  for (uint32 i = 0; i < c.unroll_count; i++)
+  {
+    if (c.cb_prefix)
+    {
+      emit(0xCB);
+      emit(c.opcode);
+      continue;
+    }
+
+    emit(c.opcode);
+    uint32 length = BASE_LENGTHS[c.opcode];
+    switch (c.opcode)
+    {
+    // branches go to the following instruction
+    case 0x18:
+    case 0x20:
+    case 0x28:
+    case 0x30:
+    case 0x38:
+      emit(0x00);
+      break;
+
+    case 0xC2:
+    case 0xC3:
+    case 0xCA:
+    case 0xD2:
+    case 0xDA:
+      emit16(static_cast<uint16>(pc + 2));
+      break;
+
+    // memory operands go to the target
+    case 0x08:
+    case 0xEA:
+    case 0xFA:
+      emit16(pointer);
+      break;
+
+    case 0xE0:
+    case 0xF0:
+      emit(static_cast<uint8>(pointer));
+      break;
+
+    // LD SP,d16 keeps the stack where the loop put it
+    case 0x31:
+      emit16(STACK_ADDRESS);
+      break;
+
+    default:
+      if (length == 2)
+        emit(0x01);
+      else if (length == 3)
+        emit16(TARGET_ADDRESSES[TARGET_WRAM]);
+      break;
+    }
+  }
+
+  emit(0xC3);
+  emit16(LOOP_ADDRESS);
+}
+
+bool OpcodeBenchmark::WriteROMs(const char* directory, Error* pError) const
+{
+  std::vector<byte> rom;
+  for (const Case& c : m_cases)
+  {
+    BuildROM(c, &rom);
+
+    String filename;
+    filename.Format("%s/%s_%02X_%s.gb", directory, c.cb_prefix ? "cb" : "op", c.opcode, TARGET_NAMES[c.target]);
+    ByteStream* pStream = FileSystem::OpenFile(filename, BYTESTREAM_OPEN_CREATE | BYTESTREAM_OPEN_CREATE_PATH |
+                                                           BYTESTREAM_OPEN_WRITE | BYTESTREAM_OPEN_TRUNCATE |
+                                                           BYTESTREAM_OPEN_STREAMED);
+    if (pStream == nullptr)
+    {
+      pError->SetErrorUserFormatted(1, "Could not open '%s'", filename.GetCharArray());
+      return false;
+    }
+
+    bool result = pStream->Write2(rom.data(), static_cast<uint32>(rom.size())) && pStream->Commit();
+    pStream->Release();
+    if (!result)
+    {
+      pError->SetErrorUserFormatted(1, "Failed to write '%s'", filename.GetCharArray());
+      return false;
+    }
+  }
+
+  Log_InfoPrintf("Wrote %u opcode roms to '%s'", GetCaseCount(), directory);
+  return true;
+}
+
+bool OpcodeBenchmark::RunCase(Case* c, uint32 instructions)
+{
+  std::vector<byte> rom;
+  BuildROM(*c, &rom);
+
+  System* system = new System(this);
+  Cartridge* cartridge = new Cartridge(system);
+
+  Error error;
+  ByteStream* pStream = ByteStream_CreateReadOnlyMemoryStream(rom.data(), static_cast<uint32>(rom.size()));
+  bool result = cartridge->Load(pStream, &error);
+  pStream->Release();
+  if (!result || !system->Init(SYSTEM_MODE_DMG, nullptr, 0, cartridge))
+  {
+    Log_ErrorPrintf("Failed to start rom for %02X: %s", c->opcode, error.GetErrorDescription().GetCharArray());
+    delete system;
+    delete cartridge;
+    return false;
+  }
+
+  SetupHeadlessSystem(system, cartridge);
+
+  String disassembly;
+  if (CPU::Disassemble(&disassembly, system, BODY_ADDRESS) && disassembly.GetLength() > DISASSEMBLY_MNEMONIC_OFFSET)
+    c->mnemonic = disassembly.GetCharArray() + DISASSEMBLY_MNEMONIC_OFFSET;
+
+  const CPU::Registers* registers = system->GetCPU()->GetRegisters();
+  for (uint32 i = 0; i < SETUP_INSTRUCTIONS && registers->PC != LOOP_ADDRESS; i++)
+    system->Step();
+
+  // step through one iteration for the timing check, which also has to end up back at the top
+  uint32 loop_instructions = LOOP_OVERHEAD_INSTRUCTIONS + c->unroll_count;
+  uint64 loop_start_clocks = system->GetClocksSinceReset();
+  for (uint32 i = 0; i < loop_instructions; i++)
+    system->Step();
+
+  uint64 loop_clocks = system->GetClocksSinceReset() - loop_start_clocks;
+  if (registers->PC != LOOP_ADDRESS)
+  {
+    Log_ErrorPrintf("%s: ended up at $%04X rather than the top of the loop", c->mnemonic.GetCharArray(),
+                    registers->PC);
+    delete system;
+    delete cartridge;
+    return false;
+  }
+
+  c->measured_cycles =
+    static_cast<double>(static_cast<int64>(loop_clocks) - static_cast<int64>(LOOP_OVERHEAD_CYCLES)) /
+    static_cast<double>(c->unroll_count);
+  c->timing_matches = (loop_clocks == LOOP_OVERHEAD_CYCLES + c->unroll_count * c->expected_cycles);
+
+  // whole iterations, through the normal execution loop
+  uint64 loops = Max(instructions / loop_instructions, 1u);
+  uint64 target_clocks = system->GetClocksSinceReset() + loops * loop_clocks;
+  Timer timer;
+  while (system->GetClocksSinceReset() < target_clocks)
+    system->RunUntil(target_clocks);
+
+  c->ns_per_instruction = timer.GetTimeSeconds() * 1000000000.0 / static_cast<double>(loops * loop_instructions);
+
+  delete system;
+  delete cartridge;
+  return true;
+}
+
+void OpcodeBenchmark::Run(uint32 instructions_per_case)
+{
+  Log_InfoPrintf("Running %u opcode roms, %u instructions each...", GetCaseCount(), instructions_per_case);
+
+  Timer timer;
+  for (Case& c : m_cases)
+  {
+    if (!RunCase(&c, instructions_per_case))
+      continue;
+
+    if (c.timing_matches)
+    {
+      Log_InfoPrintf("%s%02X %-16s %-4s %2u clocks %8.2f ns/instruction", c.cb_prefix ? "CB " : "   ", c.opcode,
+                     c.mnemonic.GetCharArray(), TARGET_NAMES[c.target], c.expected_cycles, c.ns_per_instruction);
+    }
+    else
+    {
+      Log_WarningPrintf("%s%02X %-16s %-4s %2u clocks %8.2f ns/instruction, TIMING MISMATCH: took %.2f clocks",
+                        c.cb_prefix ? "CB " : "   ", c.opcode, c.mnemonic.GetCharArray(), TARGET_NAMES[c.target],
+                        c.expected_cycles, c.ns_per_instruction, c.measured_cycles);
+    }
+  }
+
+  // the loop's own instructions are included, so these are relative rather than absolute
+  Log_InfoPrintf("%u roms in %.2f seconds, %u with timing mismatches", GetCaseCount(), timer.GetTimeSeconds(),
+                 GetMismatchCount());
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "YBaseLib/Common.h"
+#include "YBaseLib/String.h"
+#include "headless.h"
+#include <vector>
+
+class Error;
+
+// Per-opcode throughput benchmark. Generates a synthetic rom for each opcode (and each memory target it can access),
+// consisting of a long unrolled run of that one instruction, then reports the host time per emulated instruction and
+// checks the emulated cycle count against the documented timings.
+//
+// Opcodes which can't be unrolled in a straight line are left out: HALT, STOP, CALL, RET, RETI, RST, JP (HL) and the
+// unused opcodes. JR and JP are included, jumping to the following instruction.
+class OpcodeBenchmark : private HeadlessCallbacks
+{
+public:
+  enum TARGET
+  {
+    TARGET_NONE,
+    TARGET_WRAM,
+    TARGET_HRAM,
+    TARGET_ROM,
+    TARGET_IO,
+    NUM_TARGETS
+  };
+
+  struct Case
+  {
+    uint8 opcode;
+    bool cb_prefix;
+    TARGET target;
+    uint32 unroll_count;
+    uint32 expected_cycles;
+
+    // filled in by Run
+    String mnemonic;
+    double measured_cycles;
+    double ns_per_instruction;
+    bool timing_matches;
+  };
+
+  OpcodeBenchmark();
+  ~OpcodeBenchmark();
+
+  uint32 GetCaseCount() const { return static_cast<uint32>(m_cases.size()); }
+  const Case& GetCase(uint32 index) const { return m_cases[index]; }
+  uint32 GetMismatchCount() const;
+
+  // writes each generated rom to the directory, for running elsewhere
+  bool WriteROMs(const char* directory, Error* pError) const;
+
+  // runs each rom for roughly the given number of instructions
+  void Run(uint32 instructions_per_case);
+
+private:
+  void AddCases(uint8 opcode, bool cb_prefix);
+  static void BuildROM(const Case& c, std::vector<byte>* rom);
+  bool RunCase(Case* c, uint32 instructions);
+
+  std::vector<Case> m_cases;
+};
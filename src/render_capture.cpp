@@ -0,0 +1,420 @@
+#include "render_capture.h"
+#include "YBaseLib/BinaryWriter.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Error.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/Timer.h"
+#include "display.h"
+#include <algorithm>
+#include <zlib.h>
+Log_SetChannel(RenderCapture);
+
+// 'GBRC'
+static const uint32 CAPTURE_FILE_MAGIC = 0x43524247;
+static const uint32 CAPTURE_FILE_VERSION = 1;
+static const char* CAPTURE_FILE_EXTENSION = ".rcap";
+
+static const uint32 CHUNK_SIZE = 64;
+static const uint32 NUM_CHUNKS = sizeof(RenderCaptureState) / CHUNK_SIZE;
+static_assert((sizeof(RenderCaptureState) % CHUNK_SIZE) == 0, "state is a whole number of chunks");
+
+// LCDC, SCX, SCY, WX, WY, BGP, OBP0, OBP1
+static const uint32 LINE_REGISTER_COUNT = 8;
+static const uint32 FRAME_BUFFER_SIZE = Display::SCREEN_WIDTH * Display::SCREEN_HEIGHT * 4;
+
+// 40 sprites, the rest of the oam block is unused
+static const uint32 OAM_SIZE = 0xA0;
+
+// Frame record, zlib compressed and prefixed with the uncompressed and compressed sizes:
+//   uint8 boot mode, uint8 current mode
+//   per visible line: line registers, uint16 chunk count, then (uint16 chunk index, chunk data) per changed chunk
+//   the rendered frame buffer
+
+template<typename T>
+static void AppendValue(std::vector<byte>& data, T value)
+{
+  const byte* bytes = reinterpret_cast<const byte*>(&value);
+  data.insert(data.end(), bytes, bytes + sizeof(value));
+}
+
+template<typename T>
+static T ReadValue(const byte*& ptr)
+{
+  T value;
+  Y_memcpy(&value, ptr, sizeof(value));
+  ptr += sizeof(value);
+  return value;
+}
+
+RenderCaptureWriter::RenderCaptureWriter()
+  : m_stream(nullptr), m_max_frames(0), m_frame_count(0), m_next_line(0), m_shadow_valid(false)
+{
+}
+
+RenderCaptureWriter::~RenderCaptureWriter()
+{
+  Close();
+}
+
+bool RenderCaptureWriter::Open(const char* filename, uint32 max_frames, Error* pError)
+{
+  Close();
+
+  m_stream = FileSystem::OpenFile(filename, BYTESTREAM_OPEN_CREATE | BYTESTREAM_OPEN_CREATE_PATH |
+                                              BYTESTREAM_OPEN_WRITE | BYTESTREAM_OPEN_TRUNCATE |
+                                              BYTESTREAM_OPEN_STREAMED | BYTESTREAM_OPEN_ATOMIC_UPDATE);
+  if (m_stream == nullptr)
+  {
+    pError->SetErrorUserFormatted(1, "Could not open '%s'", filename);
+    return false;
+  }
+
+  BinaryWriter binaryWriter(m_stream);
+  binaryWriter.WriteUInt32(CAPTURE_FILE_MAGIC);
+  binaryWriter.WriteUInt32(CAPTURE_FILE_VERSION);
+
+  m_filename = filename;
+  m_max_frames = max_frames;
+  m_frame_count = 0;
+  m_frame_data.clear();
+  m_next_line = 0;
+  m_shadow_valid = false;
+  Log_InfoPrintf("Capturing %u frames of renderer input to '%s'.", max_frames, filename);
+  return true;
+}
+
+void RenderCaptureWriter::Close()
+{
+  if (m_stream == nullptr)
+    return;
+
+  if (m_stream->InErrorState() || !m_stream->Commit())
+  {
+    Log_ErrorPrintf("Failed to write render capture '%s'", m_filename.GetCharArray());
+    m_stream->Discard();
+  }
+  else
+  {
+    Log_InfoPrintf("Wrote %u frames to render capture '%s'.", m_frame_count, m_filename.GetCharArray());
+  }
+
+  m_stream->Release();
+  m_stream = nullptr;
+}
+
+void RenderCaptureWriter::AddScanline(const Display* display, uint8 line)
+{
+  if (m_stream == nullptr)
+    return;
+
+  // the lcd was switched off or on mid-frame, drop the partial frame along with the state changes it held
+  if (line != m_next_line)
+  {
+    m_frame_data.clear();
+    m_next_line = 0;
+    m_shadow_valid = false;
+    if (line != 0)
+      return;
+  }
+
+  if (line == 0)
+  {
+    m_frame_data.clear();
+    AppendValue(m_frame_data, uint8(display->m_system->GetBootMode()));
+    AppendValue(m_frame_data, uint8(display->m_system->GetCurrentMode()));
+  }
+
+  const Display::Registers& registers = display->m_registers;
+  const uint8 line_registers[LINE_REGISTER_COUNT] = {registers.LCDC, registers.SCX,  registers.SCY,
+                                                     registers.WX,   registers.WY,   registers.BGP,
+                                                     registers.OBP0, registers.OBP1};
+  m_frame_data.insert(m_frame_data.end(), line_registers, line_registers + LINE_REGISTER_COUNT);
+
+  RenderCaptureState state;
+  Y_memcpy(state.vram[0], display->GetVRAM(0), sizeof(state.vram[0]));
+  Y_memcpy(state.vram[1], display->GetVRAM(1), sizeof(state.vram[1]));
+  Y_memcpy(state.oam, display->GetOAMEntries(), OAM_SIZE);
+  Y_memzero(state.oam + OAM_SIZE, sizeof(state.oam) - OAM_SIZE);
+  Y_memcpy(state.cgb_bg_palette, display->m_cgb_bg_palette, sizeof(state.cgb_bg_palette));
+  Y_memcpy(state.cgb_sprite_palette, display->m_cgb_sprite_palette, sizeof(state.cgb_sprite_palette));
+
+  // chunk count is filled in once known
+  size_t count_offset = m_frame_data.size();
+  AppendValue(m_frame_data, uint16(0));
+
+  const byte* current = reinterpret_cast<const byte*>(&state);
+  byte* shadow = reinterpret_cast<byte*>(&m_shadow_state);
+  uint16 num_chunks = 0;
+  for (uint32 i = 0; i < NUM_CHUNKS; i++)
+  {
+    const byte* current_chunk = current + i * CHUNK_SIZE;
+    byte* shadow_chunk = shadow + i * CHUNK_SIZE;
+    if (m_shadow_valid && Y_memcmp(current_chunk, shadow_chunk, CHUNK_SIZE) == 0)
+      continue;
+
+    AppendValue(m_frame_data, uint16(i));
+    m_frame_data.insert(m_frame_data.end(), current_chunk, current_chunk + CHUNK_SIZE);
+    Y_memcpy(shadow_chunk, current_chunk, CHUNK_SIZE);
+    num_chunks++;
+  }
+  Y_memcpy(&m_frame_data[count_offset], &num_chunks, sizeof(num_chunks));
+  m_shadow_valid = true;
+
+  m_next_line = (line + 1) % Display::SCREEN_HEIGHT;
+  if (m_next_line == 0)
+  {
+    const byte* frame_buffer = display->GetFrameBuffer();
+    m_frame_data.insert(m_frame_data.end(), frame_buffer, frame_buffer + FRAME_BUFFER_SIZE);
+    WriteFrame();
+  }
+}
+
+void RenderCaptureWriter::WriteFrame()
+{
+  uint32 data_size = static_cast<uint32>(m_frame_data.size());
+  uLongf compressed_size = compressBound(data_size);
+  std::vector<byte> compressed_data(compressed_size);
+  if (compress2(compressed_data.data(), &compressed_size, m_frame_data.data(), data_size, Z_BEST_SPEED) != Z_OK)
+  {
+    Log_ErrorPrintf("Failed to compress %u byte render capture frame", data_size);
+    Close();
+    return;
+  }
+
+  BinaryWriter binaryWriter(m_stream);
+  binaryWriter.WriteUInt32(data_size);
+  binaryWriter.WriteUInt32(static_cast<uint32>(compressed_size));
+  binaryWriter.WriteBytes(compressed_data.data(), static_cast<uint32>(compressed_size));
+  m_frame_data.clear();
+
+  m_frame_count++;
+  if (m_frame_count == m_max_frames)
+    Close();
+}
+
+// walks a frame record, returns false if it is malformed
+static bool ValidateFrame(const std::vector<byte>& data)
+{
+  const byte* ptr = data.data();
+  const byte* end = ptr + data.size();
+  if ((end - ptr) < 2 || ptr[0] >= NUM_SYSTEM_MODES || ptr[1] >= NUM_SYSTEM_MODES)
+    return false;
+  ptr += 2;
+
+  for (uint32 line = 0; line < Display::SCREEN_HEIGHT; line++)
+  {
+    if (static_cast<size_t>(end - ptr) < (LINE_REGISTER_COUNT + sizeof(uint16)))
+      return false;
+    ptr += LINE_REGISTER_COUNT;
+
+    uint16 num_chunks = ReadValue<uint16>(ptr);
+    if (num_chunks > NUM_CHUNKS || static_cast<size_t>(end - ptr) < (num_chunks * (sizeof(uint16) + CHUNK_SIZE)))
+      return false;
+
+    for (uint32 i = 0; i < num_chunks; i++)
+    {
+      if (ReadValue<uint16>(ptr) >= NUM_CHUNKS)
+        return false;
+      ptr += CHUNK_SIZE;
+    }
+  }
+
+  return (static_cast<size_t>(end - ptr) == FRAME_BUFFER_SIZE);
+}
+
+RenderReplay::RenderReplay() {}
+
+RenderReplay::~RenderReplay() {}
+
+bool RenderReplay::Load(const char* path, Error* pError)
+{
+  const char* extension = Y_strrchr(path, '.');
+  if (extension != nullptr && !Y_stricmp(extension, CAPTURE_FILE_EXTENSION))
+    return LoadFile(path, pError);
+
+  FileSystem::FindResultsArray results;
+  if (!FileSystem::FindFiles(path, "*.rcap", FILESYSTEM_FIND_FILES | FILESYSTEM_FIND_RECURSIVE, &results))
+  {
+    pError->SetErrorUserFormatted(1, "Failed to enumerate '%s'", path);
+    return false;
+  }
+
+  // same corpus order every run
+  std::vector<String> filenames;
+  for (uint32 i = 0; i < results.GetSize(); i++)
+    filenames.emplace_back(results[i].FileName);
+  std::sort(filenames.begin(), filenames.end(),
+            [](const String& lhs, const String& rhs) { return (Y_strcmp(lhs, rhs) < 0); });
+
+  for (const String& filename : filenames)
+  {
+    if (!LoadFile(filename, pError))
+      return false;
+  }
+
+  return true;
+}
+
+bool RenderReplay::LoadFile(const char* filename, Error* pError)
+{
+  ByteStream* pStream = FileSystem::OpenFile(filename, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_STREAMED);
+  if (pStream == nullptr)
+  {
+    pError->SetErrorUserFormatted(1, "Could not open '%s'", filename);
+    return false;
+  }
+
+  uint32 header[2];
+  if (!pStream->Read2(header, sizeof(header)) || header[0] != CAPTURE_FILE_MAGIC ||
+      header[1] != CAPTURE_FILE_VERSION)
+  {
+    pError->SetErrorUserFormatted(1, "'%s' is not a version %u render capture", filename, CAPTURE_FILE_VERSION);
+    pStream->Release();
+    return false;
+  }
+
+  uint32 capture_index = static_cast<uint32>(m_capture_filenames.size());
+  m_capture_filenames.emplace_back(filename);
+
+  // frames are decompressed up front, so the replay only measures rendering
+  uint32 sizes[2];
+  std::vector<byte> compressed_data;
+  while (pStream->Read2(sizes, sizeof(sizes)))
+  {
+    Frame frame;
+    frame.capture_index = capture_index;
+    frame.data.resize(sizes[0]);
+    compressed_data.resize(sizes[1]);
+
+    uLongf data_size = sizes[0];
+    if (!pStream->Read2(compressed_data.data(), sizes[1]) ||
+        uncompress(frame.data.data(), &data_size, compressed_data.data(), sizes[1]) != Z_OK ||
+        data_size != sizes[0] || !ValidateFrame(frame.data))
+    {
+      pError->SetErrorUserFormatted(1, "Corrupted frame %u in '%s'", static_cast<uint32>(m_frames.size()), filename);
+      pStream->Release();
+      return false;
+    }
+
+    m_frames.push_back(std::move(frame));
+  }
+
+  pStream->Release();
+  Log_InfoPrintf("Loaded render capture '%s'.", filename);
+  return true;
+}
+
+bool RenderReplay::Run(uint32 loops)
+{
+  if (m_frames.empty())
+  {
+    Log_ErrorPrintf("No frames to replay");
+    return false;
+  }
+
+  // a system is only needed for its memory, the cpu never runs
+  System* system = new System(this);
+  if (!system->Init(SYSTEM_MODE_DMG, nullptr, 0, nullptr))
+  {
+    delete system;
+    return false;
+  }
+
+  Display* display = system->GetDisplay();
+  Display::Registers& registers = display->m_registers;
+  RenderCaptureState state;
+  byte* state_bytes = reinterpret_cast<byte*>(&state);
+  uint32 mismatched_frames = 0;
+  double render_time = 0.0;
+  Timer total_timer;
+
+  Log_InfoPrintf("Replaying %u frames from %u captures, %u loops...", GetFrameCount(),
+                 static_cast<uint32>(m_capture_filenames.size()), loops);
+
+  for (uint32 loop = 0; loop < loops; loop++)
+  {
+    for (size_t frame_index = 0; frame_index < m_frames.size(); frame_index++)
+    {
+      const Frame& frame = m_frames[frame_index];
+      const byte* ptr = frame.data.data();
+      system->m_boot_mode = static_cast<SYSTEM_MODE>(ReadValue<uint8>(ptr));
+      system->m_current_mode = static_cast<SYSTEM_MODE>(ReadValue<uint8>(ptr));
+      bool cgb = system->InCGBMode();
+
+      for (uint32 line = 0; line < Display::SCREEN_HEIGHT; line++)
+      {
+        registers.LCDC = ptr[0];
+        registers.SCX = ptr[1];
+        registers.SCY = ptr[2];
+        registers.WX = ptr[3];
+        registers.WY = ptr[4];
+        registers.BGP = ptr[5];
+        registers.OBP0 = ptr[6];
+        registers.OBP1 = ptr[7];
+        ptr += LINE_REGISTER_COUNT;
+
+        uint16 num_chunks = ReadValue<uint16>(ptr);
+        for (uint32 i = 0; i < num_chunks; i++)
+        {
+          uint16 chunk_index = ReadValue<uint16>(ptr);
+          Y_memcpy(state_bytes + chunk_index * CHUNK_SIZE, ptr, CHUNK_SIZE);
+          ptr += CHUNK_SIZE;
+        }
+
+        if (num_chunks > 0)
+        {
+          Y_memcpy(system->m_memory_vram[0], state.vram[0], sizeof(state.vram[0]));
+          Y_memcpy(system->m_memory_vram[1], state.vram[1], sizeof(state.vram[1]));
+          Y_memcpy(system->m_memory_oam, state.oam, OAM_SIZE);
+          Y_memcpy(display->m_cgb_bg_palette, state.cgb_bg_palette, sizeof(state.cgb_bg_palette));
+          Y_memcpy(display->m_cgb_sprite_palette, state.cgb_sprite_palette, sizeof(state.cgb_sprite_palette));
+        }
+
+        Timer render_timer;
+        if (cgb)
+          display->RenderScanline_CGB(static_cast<uint8>(line));
+        else
+          display->RenderScanline(static_cast<uint8>(line));
+        render_time += render_timer.GetTimeSeconds();
+      }
+
+      // what's left is the reference frame
+      if (Y_memcmp(display->GetFrameBuffer(), ptr, FRAME_BUFFER_SIZE) != 0)
+      {
+        mismatched_frames++;
+        if (loop == 0)
+        {
+          uint32 offset = 0;
+          while (display->GetFrameBuffer()[offset] == ptr[offset])
+            offset++;
+
+          offset /= 4;
+          Log_ErrorPrintf("Frame %u of '%s' differs, first at %u,%u", static_cast<uint32>(frame_index),
+                          m_capture_filenames[frame.capture_index].GetCharArray(), offset % Display::SCREEN_WIDTH,
+                          offset / Display::SCREEN_WIDTH);
+        }
+      }
+    }
+  }
+
+  double total_time = total_timer.GetTimeSeconds();
+  delete system;
+
+  uint64 total_frames = uint64(GetFrameCount()) * loops;
+  Log_InfoPrintf("%llu frames in %.3f seconds, %.3f seconds rendering", static_cast<unsigned long long>(total_frames),
+                 total_time, render_time);
+  Log_InfoPrintf("%.1f us per frame, %.0f ns per line, %.0f frames/sec", render_time * 1000000.0 / double(total_frames),
+                 render_time * 1000000000.0 / double(total_frames * Display::SCREEN_HEIGHT),
+                 double(total_frames) / render_time);
+
+  if (mismatched_frames > 0)
+  {
+    Log_ErrorPrintf("%u of %llu frames did not match the reference", mismatched_frames,
+                    static_cast<unsigned long long>(total_frames));
+    return false;
+  }
+
+  Log_InfoPrintf("All frames match the reference.");
+  return true;
+}
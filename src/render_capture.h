@@ -0,0 +1,84 @@
+#pragma once
+#include "YBaseLib/Common.h"
+#include "YBaseLib/String.h"
+#include "headless.h"
+#include <vector>
+
+class ByteStream;
+class Display;
+class Error;
+
+// Everything the scanline renderers read other than the per-line registers.
+// Captures store this as the 64-byte chunks which changed since the previous line.
+struct RenderCaptureState
+{
+  byte vram[2][0x2000];
+  byte oam[0x100];
+  byte cgb_bg_palette[64];
+  byte cgb_sprite_palette[64];
+};
+
+// Records what the renderer saw on every line of every complete frame, along with the frame it produced, so the
+// renderer can be replayed and verified on its own. Frames interrupted by the lcd turning off are dropped, and the
+// next frame starts from a full copy of the state.
+class RenderCaptureWriter
+{
+public:
+  RenderCaptureWriter();
+  ~RenderCaptureWriter();
+
+  bool IsOpen() const { return (m_stream != nullptr); }
+  uint32 GetFrameCount() const { return m_frame_count; }
+
+  // closes itself after max_frames frames
+  bool Open(const char* filename, uint32 max_frames, Error* pError);
+  void Close();
+
+  // called by the display after rendering each visible line
+  void AddScanline(const Display* display, uint8 line);
+
+private:
+  void WriteFrame();
+
+  ByteStream* m_stream;
+  String m_filename;
+  uint32 m_max_frames;
+  uint32 m_frame_count;
+
+  // frame being recorded, written out once line 143 is added
+  std::vector<byte> m_frame_data;
+  uint32 m_next_line;
+
+  // state as of the last recorded line
+  RenderCaptureState m_shadow_state;
+  bool m_shadow_valid;
+};
+
+// Renderer-only benchmark. Replays captured frames through RenderScanline/RenderScanline_CGB with no cpu or
+// scheduling behind them, and checks each frame against the captured one pixel for pixel.
+class RenderReplay : private HeadlessCallbacks
+{
+public:
+  RenderReplay();
+  ~RenderReplay();
+
+  uint32 GetFrameCount() const { return static_cast<uint32>(m_frames.size()); }
+
+  // a directory loads every capture in it
+  bool Load(const char* path, Error* pError);
+
+  // replays every frame loops times, returns false if any frame didn't match
+  bool Run(uint32 loops);
+
+private:
+  struct Frame
+  {
+    uint32 capture_index;
+    std::vector<byte> data;
+  };
+
+  bool LoadFile(const char* filename, Error* pError);
+
+  std::vector<String> m_capture_filenames;
+  std::vector<Frame> m_frames;
+};
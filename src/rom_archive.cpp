@@ -0,0 +1,359 @@
+#include "rom_archive.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Error.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/Timer.h"
+#include "cartridge.h"
+#include <algorithm>
+Log_SetChannel(ROMArchiveReader);
+
+static const uint32 ZIP_LOCAL_FILE_HEADER_SIGNATURE = 0x04034B50;
+static const uint32 ZIP_LOCAL_FILE_HEADER_SIZE = 30;
+static const uint16 ZIP_FLAG_DATA_DESCRIPTOR = 0x0008;
+static const uint16 ZIP_METHOD_STORED = 0;
+static const uint16 ZIP_METHOD_DEFLATED = 8;
+
+static bool HasExtension(const char* filename, const char* extension)
+{
+  const char* pos = Y_strrchr(filename, '.');
+  return (pos != nullptr && !Y_stricmp(pos, extension));
+}
+
+static bool IsROMFileName(const char* filename)
+{
+  return HasExtension(filename, ".gb") || HasExtension(filename, ".gbc") || HasExtension(filename, ".sgb");
+}
+
+static uint16 ReadLE16(const byte* p)
+{
+  return uint16(p[0]) | (uint16(p[1]) << 8);
+}
+
+static uint32 ReadLE32(const byte* p)
+{
+  return uint32(p[0]) | (uint32(p[1]) << 8) | (uint32(p[2]) << 16) | (uint32(p[3]) << 24);
+}
+
+ROMArchiveReader::ROMArchiveReader(ByteStream* pStream)
+  : m_stream(pStream), m_zstream_initialized(false), m_gzip(false), m_stored(false), m_stored_remaining(0),
+    m_end_of_image(false)
+{
+  Y_memzero(&m_zstream, sizeof(m_zstream));
+}
+
+ROMArchiveReader::~ROMArchiveReader()
+{
+  if (m_zstream_initialized)
+    inflateEnd(&m_zstream);
+
+  m_stream->Release();
+}
+
+bool ROMArchiveReader::IsArchiveFileName(const char* filename)
+{
+  return HasExtension(filename, ".gz") || HasExtension(filename, ".zip");
+}
+
+ROMArchiveReader* ROMArchiveReader::Open(const char* filename, Error* pError)
+{
+  ByteStream* pStream = FileSystem::OpenFile(filename, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_STREAMED);
+  if (pStream == nullptr)
+  {
+    pError->SetErrorUserFormatted(1, "Could not open '%s'", filename);
+    return nullptr;
+  }
+
+  ROMArchiveReader* reader = new ROMArchiveReader(pStream);
+  bool result;
+  if (HasExtension(filename, ".zip"))
+  {
+    result = reader->OpenZipEntry(pError);
+  }
+  else
+  {
+    // image name is the archive name without the .gz
+    reader->m_entry_name = filename;
+    if (reader->m_entry_name.RFind('.') > 0)
+      reader->m_entry_name.Erase(reader->m_entry_name.RFind('.'));
+    result = reader->OpenGZip(pError);
+  }
+
+  if (!result)
+  {
+    delete reader;
+    return nullptr;
+  }
+
+  return reader;
+}
+
+bool ROMArchiveReader::OpenGZip(Error* pError)
+{
+  // 16 + window bits selects gzip framing
+  if (inflateInit2(&m_zstream, 16 + MAX_WBITS) != Z_OK)
+  {
+    pError->SetErrorUser(1, "Failed to initialize decompressor");
+    return false;
+  }
+
+  m_zstream_initialized = true;
+  m_gzip = true;
+  return true;
+}
+
+bool ROMArchiveReader::OpenZipEntry(Error* pError)
+{
+  // walk the local headers rather than the central directory, so the file is only read front to back
+  for (;;)
+  {
+    byte header[ZIP_LOCAL_FILE_HEADER_SIZE];
+    if (!m_stream->Read2(header, sizeof(header)) || ReadLE32(header) != ZIP_LOCAL_FILE_HEADER_SIGNATURE)
+    {
+      pError->SetErrorUser(1, "No rom image found in zip file");
+      return false;
+    }
+
+    uint16 flags = ReadLE16(header + 6);
+    uint16 method = ReadLE16(header + 8);
+    uint32 compressed_size = ReadLE32(header + 18);
+    uint16 name_length = ReadLE16(header + 26);
+    uint16 extra_length = ReadLE16(header + 28);
+
+    m_entry_name.Resize(name_length);
+    if ((name_length > 0 && !m_stream->Read2(m_entry_name.GetWriteableCharArray(), name_length)) ||
+        !SkipBytes(extra_length))
+    {
+      pError->SetErrorUser(1, "Truncated zip file");
+      return false;
+    }
+
+    if (!IsROMFileName(m_entry_name))
+    {
+      // sizes are only in the local header when there's no trailing data descriptor
+      if ((flags & ZIP_FLAG_DATA_DESCRIPTOR) || !SkipBytes(compressed_size))
+      {
+        pError->SetErrorUserFormatted(1, "Can't skip zip entry '%s'", m_entry_name.GetCharArray());
+        return false;
+      }
+
+      continue;
+    }
+
+    if (method == ZIP_METHOD_STORED)
+    {
+      if (flags & ZIP_FLAG_DATA_DESCRIPTOR)
+      {
+        pError->SetErrorUserFormatted(1, "Stored zip entry '%s' has no size", m_entry_name.GetCharArray());
+        return false;
+      }
+
+      m_stored = true;
+      m_stored_remaining = compressed_size;
+      return true;
+    }
+    else if (method == ZIP_METHOD_DEFLATED)
+    {
+      // negative window bits selects raw deflate
+      if (inflateInit2(&m_zstream, -MAX_WBITS) != Z_OK)
+      {
+        pError->SetErrorUser(1, "Failed to initialize decompressor");
+        return false;
+      }
+
+      m_zstream_initialized = true;
+      return true;
+    }
+
+    pError->SetErrorUserFormatted(1, "Zip entry '%s' uses unsupported compression method %u",
+                                  m_entry_name.GetCharArray(), method);
+    return false;
+  }
+}
+
+bool ROMArchiveReader::FillInputBuffer()
+{
+  uint32 nbytes = m_stream->Read(m_input_buffer, sizeof(m_input_buffer));
+  m_zstream.next_in = m_input_buffer;
+  m_zstream.avail_in = nbytes;
+  return (nbytes > 0);
+}
+
+bool ROMArchiveReader::SkipBytes(uint64 count)
+{
+  while (count > 0)
+  {
+    uint32 nbytes = static_cast<uint32>(std::min<uint64>(count, sizeof(m_input_buffer)));
+    if (!m_stream->Read2(m_input_buffer, nbytes))
+      return false;
+
+    count -= nbytes;
+  }
+
+  return true;
+}
+
+bool ROMArchiveReader::Read(void* buffer, uint32 size, uint32* bytes_read, Error* pError)
+{
+  *bytes_read = 0;
+
+  if (m_stored)
+  {
+    uint32 nbytes = static_cast<uint32>(std::min<uint64>(size, m_stored_remaining));
+    if (nbytes > 0 && !m_stream->Read2(buffer, nbytes))
+    {
+      pError->SetErrorUser(1, "Truncated zip file");
+      return false;
+    }
+
+    m_stored_remaining -= nbytes;
+    *bytes_read = nbytes;
+    return true;
+  }
+
+  if (m_end_of_image)
+    return true;
+
+  m_zstream.next_out = static_cast<Bytef*>(buffer);
+  m_zstream.avail_out = size;
+  while (m_zstream.avail_out > 0)
+  {
+    if (m_zstream.avail_in == 0 && !FillInputBuffer())
+    {
+      pError->SetErrorUser(1, "Unexpected end of compressed data");
+      return false;
+    }
+
+    int ret = inflate(&m_zstream, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END)
+    {
+      // concatenated gzip members continue the same image
+      if (m_gzip && (m_zstream.avail_in > 0 || FillInputBuffer()))
+      {
+        inflateReset(&m_zstream);
+        continue;
+      }
+
+      m_end_of_image = true;
+      break;
+    }
+    else if (ret != Z_OK)
+    {
+      pError->SetErrorUserFormatted(1, "Decompression error: %s",
+                                    (m_zstream.msg != nullptr) ? m_zstream.msg : "unknown");
+      return false;
+    }
+  }
+
+  *bytes_read = size - m_zstream.avail_out;
+  return true;
+}
+
+// Writes the cartridge's rom banks as a plain image. Skipped when the banks don't reproduce the archive's CRC, i.e.
+// the image had data past its last whole bank, since the cached copy would then be identified as a different rom.
+static bool WriteCacheImage(const Cartridge* cartridge, const char* cache_filename)
+{
+  uLong crc = crc32(0, Z_NULL, 0);
+  for (uint32 i = 0; i < cartridge->GetROMBankCount(); i++)
+    crc = crc32(crc, cartridge->GetROMBank(i), ROM_BANK_SIZE);
+  if (static_cast<uint32>(crc) != cartridge->GetCRC())
+  {
+    Log_DevPrintf("Not caching '%s', image has data outside whole banks", cache_filename);
+    return false;
+  }
+
+  ByteStream* pStream = FileSystem::OpenFile(cache_filename, BYTESTREAM_OPEN_CREATE | BYTESTREAM_OPEN_CREATE_PATH |
+                                                               BYTESTREAM_OPEN_WRITE | BYTESTREAM_OPEN_TRUNCATE |
+                                                               BYTESTREAM_OPEN_STREAMED |
+                                                               BYTESTREAM_OPEN_ATOMIC_UPDATE);
+  if (pStream == nullptr)
+  {
+    Log_WarningPrintf("Failed to write rom cache '%s': could not open file", cache_filename);
+    return false;
+  }
+
+  for (uint32 i = 0; i < cartridge->GetROMBankCount(); i++)
+  {
+    if (!pStream->Write2(cartridge->GetROMBank(i), ROM_BANK_SIZE))
+    {
+      Log_WarningPrintf("Failed to write rom cache '%s': write error", cache_filename);
+      pStream->Discard();
+      pStream->Release();
+      return false;
+    }
+  }
+
+  pStream->Commit();
+  pStream->Release();
+  return true;
+}
+
+bool ROMArchiveReader::LoadCartridge(Cartridge* cartridge, const char* filename, const char* cache_directory,
+                                     Error* pError)
+{
+  Timer load_timer;
+
+  // cache entries are named by a hash of the archive path, and the archive's modification time
+  SmallString cache_filename;
+  SmallString cache_pattern;
+  if (cache_directory != nullptr)
+  {
+    FILESYSTEM_STAT_DATA stat_data;
+    if (!FileSystem::StatFile(filename, &stat_data))
+    {
+      pError->SetErrorUserFormatted(1, "Could not open '%s'", filename);
+      return false;
+    }
+
+    uint32 path_hash = static_cast<uint32>(crc32(0, reinterpret_cast<const Bytef*>(filename), Y_strlen(filename)));
+    cache_pattern.Format("%08X_*.gb", path_hash);
+    cache_filename.Format("%s/%08X_%llX.gb", cache_directory, path_hash,
+                          static_cast<unsigned long long>(stat_data.ModificationTime.AsUnixTimestamp()));
+
+    ByteStream* pCachedStream = FileSystem::OpenFile(cache_filename, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_STREAMED);
+    if (pCachedStream != nullptr)
+    {
+      Error cache_error;
+      bool result = cartridge->Load(pCachedStream, &cache_error);
+      pCachedStream->Release();
+      if (result)
+      {
+        Log_InfoPrintf("Loaded '%s' from rom cache in %.2f ms.", filename, load_timer.GetTimeMilliseconds());
+        return true;
+      }
+
+      // a truncated or corrupt cache is dropped and rebuilt from the archive
+      Log_WarningPrintf("Discarding rom cache '%s': %s", cache_filename.GetCharArray(),
+                        cache_error.GetErrorDescription().GetCharArray());
+      FileSystem::DeleteFile(cache_filename);
+    }
+  }
+
+  ROMArchiveReader* reader = Open(filename, pError);
+  if (reader == nullptr)
+    return false;
+
+  bool result = cartridge->LoadFromArchive(reader, pError);
+  if (result)
+  {
+    Log_InfoPrintf("Decompressed '%s' from '%s' in %.2f ms.", reader->GetEntryName().GetCharArray(), filename,
+                   load_timer.GetTimeMilliseconds());
+  }
+  delete reader;
+
+  if (result && cache_directory != nullptr && WriteCacheImage(cartridge, cache_filename))
+  {
+    // remove images cached for earlier versions of this archive
+    FileSystem::FindResultsArray results;
+    if (FileSystem::FindFiles(cache_directory, cache_pattern, FILESYSTEM_FIND_FILES, &results))
+    {
+      for (uint32 i = 0; i < results.GetSize(); i++)
+      {
+        if (Y_strcmp(results[i].FileName, cache_filename) != 0)
+          FileSystem::DeleteFile(results[i].FileName);
+      }
+    }
+  }
+
+  return result;
+}
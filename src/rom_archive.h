@@ -0,0 +1,54 @@
+#pragma once
+#include "YBaseLib/Common.h"
+#include "YBaseLib/String.h"
+#include <zlib.h>
+
+class ByteStream;
+class Cartridge;
+class Error;
+
+// Sequential reader for rom images inside .gz and .zip files.
+// The compressed file is read through a small fixed buffer and inflated directly into the caller's memory, so no
+// temporary file or full decompressed copy is needed. Zip files use the first entry with a rom extension.
+class ROMArchiveReader
+{
+public:
+  ~ROMArchiveReader();
+
+  static bool IsArchiveFileName(const char* filename);
+
+  // returns nullptr on error
+  static ROMArchiveReader* Open(const char* filename, Error* pError);
+
+  // name of the image inside the archive
+  const String& GetEntryName() const { return m_entry_name; }
+
+  // reads up to size bytes, bytes_read is less than size only at the end of the image
+  bool Read(void* buffer, uint32 size, uint32* bytes_read, Error* pError);
+
+  // Loads an archive into the cartridge, using a decompressed copy in cache_directory when one exists for the
+  // archive's current modification time, and writing one otherwise. cache_directory can be null to disable caching.
+  static bool LoadCartridge(Cartridge* cartridge, const char* filename, const char* cache_directory, Error* pError);
+
+private:
+  ROMArchiveReader(ByteStream* pStream);
+
+  bool OpenGZip(Error* pError);
+  bool OpenZipEntry(Error* pError);
+  bool FillInputBuffer();
+  bool SkipBytes(uint64 count);
+
+  ByteStream* m_stream;
+  String m_entry_name;
+
+  z_stream m_zstream;
+  bool m_zstream_initialized;
+
+  // gzip files can hold several members, zip entries can be stored rather than deflated
+  bool m_gzip;
+  bool m_stored;
+  uint64 m_stored_remaining;
+  bool m_end_of_image;
+
+  byte m_input_buffer[32768];
+};
@@ -0,0 +1,518 @@
+#include "rom_library.h"
+#include "YBaseLib/BinaryReader.h"
+#include "YBaseLib/BinaryWriter.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Error.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/Timer.h"
+#include "rom_archive.h"
+#include "structures.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <zlib.h>
+Log_SetChannel(ROMLibrary);
+
+#ifdef Y_PLATFORM_WINDOWS
+#include "YBaseLib/Windows/WindowsHeaders.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// 'GBLI'
+static const uint32 INDEX_FILE_MAGIC = 0x494C4247;
+static const uint32 INDEX_FILE_VERSION = 1;
+
+// two empty strings plus the fixed fields
+static const uint32 INDEX_ENTRY_MIN_SIZE = 40;
+
+static const char* ROM_FILE_EXTENSIONS[] = {".gb", ".gbc", ".sgb", ".gz", ".zip"};
+
+static bool HasROMExtension(const char* path)
+{
+  const char* extension = Y_strrchr(path, '.');
+  if (extension == nullptr)
+    return false;
+
+  for (uint32 i = 0; i < countof(ROM_FILE_EXTENSIONS); i++)
+  {
+    if (!Y_stricmp(extension, ROM_FILE_EXTENSIONS[i]))
+      return true;
+  }
+
+  return false;
+}
+
+static bool IsPathInDirectory(const char* path, const char* directory, uint32 directory_length)
+{
+  if (Y_strncmp(path, directory, directory_length) != 0)
+    return false;
+
+  // "/roms" must not match "/roms2/..."
+  if (directory_length > 0 && (directory[directory_length - 1] == '/' || directory[directory_length - 1] == '\\'))
+    return true;
+
+  return (path[directory_length] == '/' || path[directory_length] == '\\');
+}
+
+static void WriteIndexString(BinaryWriter& binaryWriter, const String& str)
+{
+  binaryWriter.WriteUInt32(str.GetLength());
+  binaryWriter.WriteBytes(str.GetCharArray(), str.GetLength());
+}
+
+static bool ReadIndexString(BinaryReader& binaryReader, String& str)
+{
+  uint32 length = binaryReader.ReadUInt32();
+  if (length > 65536)
+    return false;
+
+  str.Resize(length);
+  if (length > 0)
+    binaryReader.ReadBytes(str.GetWriteableCharArray(), length);
+
+  return true;
+}
+
+ROMLibrary::ROMLibrary() {}
+
+ROMLibrary::~ROMLibrary() {}
+
+const ROMLibrary::Entry* ROMLibrary::FindEntryByCRC(uint32 crc) const
+{
+  for (const Entry& entry : m_entries)
+  {
+    if (entry.crc == crc)
+      return &entry;
+  }
+
+  return nullptr;
+}
+
+const ROMLibrary::Entry* ROMLibrary::FindEntryByPath(const char* path) const
+{
+  auto iter = m_path_map.find(path);
+  return (iter != m_path_map.end()) ? &m_entries[iter->second] : nullptr;
+}
+
+void ROMLibrary::RebuildPathMap()
+{
+  m_path_map.clear();
+  for (size_t i = 0; i < m_entries.size(); i++)
+    m_path_map[m_entries[i].path.GetCharArray()] = i;
+}
+
+bool ROMLibrary::LoadIndex(const char* filename, Error* pError)
+{
+  m_entries.clear();
+  m_path_map.clear();
+
+  ByteStream* pStream = FileSystem::OpenFile(filename, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_STREAMED);
+  if (pStream == nullptr)
+    return true;
+
+  BinaryReader binaryReader(pStream);
+  uint32 magic = binaryReader.ReadUInt32();
+  uint32 version = binaryReader.ReadUInt32();
+  uint32 count = binaryReader.ReadUInt32();
+  if (pStream->InErrorState() || magic != INDEX_FILE_MAGIC || version != INDEX_FILE_VERSION)
+  {
+    pError->SetErrorUserFormatted(1, "'%s' is not a library index, or is from another version", filename);
+    pStream->Release();
+    return false;
+  }
+
+  // don't trust the count further than the file can back it
+  if ((pStream->GetSize() - pStream->GetPosition()) / INDEX_ENTRY_MIN_SIZE < count)
+  {
+    pError->SetErrorUserFormatted(1, "Library index '%s' is truncated or corrupted", filename);
+    pStream->Release();
+    return false;
+  }
+
+  m_entries.resize(count);
+  for (uint32 i = 0; i < count; i++)
+  {
+    Entry& entry = m_entries[i];
+    if (!ReadIndexString(binaryReader, entry.path) || !ReadIndexString(binaryReader, entry.name))
+      break;
+
+    entry.modification_time = binaryReader.ReadUInt64();
+    entry.file_size = binaryReader.ReadUInt64();
+    entry.crc = binaryReader.ReadUInt32();
+    entry.cart_type = binaryReader.ReadUInt8();
+    entry.mbc = static_cast<MBC>(binaryReader.ReadUInt8());
+    entry.num_rom_banks = binaryReader.ReadUInt32();
+    entry.external_ram_size = binaryReader.ReadUInt32();
+    entry.cgb_flag = binaryReader.ReadUInt8();
+    entry.system_mode = static_cast<SYSTEM_MODE>(binaryReader.ReadUInt8());
+  }
+
+  if (pStream->InErrorState() || pStream->GetPosition() != pStream->GetSize())
+  {
+    pError->SetErrorUserFormatted(1, "Library index '%s' is truncated or corrupted", filename);
+    pStream->Release();
+    m_entries.clear();
+    return false;
+  }
+
+  pStream->Release();
+  RebuildPathMap();
+  return true;
+}
+
+bool ROMLibrary::SaveIndex(const char* filename) const
+{
+  ByteStream* pStream =
+    FileSystem::OpenFile(filename, BYTESTREAM_OPEN_CREATE | BYTESTREAM_OPEN_CREATE_PATH | BYTESTREAM_OPEN_WRITE |
+                                     BYTESTREAM_OPEN_TRUNCATE | BYTESTREAM_OPEN_STREAMED |
+                                     BYTESTREAM_OPEN_ATOMIC_UPDATE);
+  if (pStream == nullptr)
+  {
+    Log_ErrorPrintf("Failed to write library index '%s': could not open file", filename);
+    return false;
+  }
+
+  BinaryWriter binaryWriter(pStream);
+  binaryWriter.WriteUInt32(INDEX_FILE_MAGIC);
+  binaryWriter.WriteUInt32(INDEX_FILE_VERSION);
+  binaryWriter.WriteUInt32(GetEntryCount());
+  for (const Entry& entry : m_entries)
+  {
+    WriteIndexString(binaryWriter, entry.path);
+    WriteIndexString(binaryWriter, entry.name);
+    binaryWriter.WriteUInt64(entry.modification_time);
+    binaryWriter.WriteUInt64(entry.file_size);
+    binaryWriter.WriteUInt32(entry.crc);
+    binaryWriter.WriteUInt8(entry.cart_type);
+    binaryWriter.WriteUInt8(static_cast<uint8>(entry.mbc));
+    binaryWriter.WriteUInt32(entry.num_rom_banks);
+    binaryWriter.WriteUInt32(entry.external_ram_size);
+    binaryWriter.WriteUInt8(entry.cgb_flag);
+    binaryWriter.WriteUInt8(static_cast<uint8>(entry.system_mode));
+  }
+
+  if (pStream->InErrorState())
+  {
+    Log_ErrorPrintf("Failed to write library index '%s': write error", filename);
+    pStream->Discard();
+    pStream->Release();
+    return false;
+  }
+
+  pStream->Commit();
+  pStream->Release();
+  return true;
+}
+
+// Archives can't be mapped, so the image is inflated through a buffer and hashed as it goes. The crc is of the
+// decompressed image so it matches Cartridge::GetCRC(), the size is of the archive so Scan() can detect changes.
+static bool ReadArchiveROMInfo(const char* path, ROMLibrary::Entry* entry, Error* pError)
+{
+  FILESYSTEM_STAT_DATA stat_data;
+  if (!FileSystem::StatFile(path, &stat_data))
+  {
+    pError->SetErrorUser(1, "Could not open file");
+    return false;
+  }
+
+  ROMArchiveReader* reader = ROMArchiveReader::Open(path, pError);
+  if (reader == nullptr)
+    return false;
+
+  static const uint32 BUFFER_SIZE = 65536;
+  std::unique_ptr<byte[]> buffer(new byte[BUFFER_SIZE]);
+  CartridgeHeaderInfo info;
+  uLong crc = crc32(0, Z_NULL, 0);
+  uint64 image_size = 0;
+  bool header_valid = false;
+  for (;;)
+  {
+    uint32 bytes_read;
+    if (!reader->Read(buffer.get(), BUFFER_SIZE, &bytes_read, pError))
+    {
+      delete reader;
+      return false;
+    }
+    if (bytes_read == 0)
+      break;
+
+    // the first read fills the whole buffer unless the image is smaller than it
+    if (image_size == 0)
+    {
+      if (bytes_read < CART_HEADER_OFFSET + sizeof(CART_HEADER))
+      {
+        pError->SetErrorUser(1, "File is too small to contain a cartridge header");
+        delete reader;
+        return false;
+      }
+      if (!Cartridge::DecodeHeader(reinterpret_cast<const CART_HEADER*>(buffer.get() + CART_HEADER_OFFSET), &info,
+                                   pError))
+      {
+        delete reader;
+        return false;
+      }
+      header_valid = true;
+    }
+
+    crc = crc32(crc, buffer.get(), bytes_read);
+    image_size += bytes_read;
+  }
+  delete reader;
+
+  if (!header_valid)
+  {
+    pError->SetErrorUser(1, "Archive contains an empty image");
+    return false;
+  }
+
+  entry->path = path;
+  entry->name = info.name;
+  entry->file_size = stat_data.Size;
+  entry->crc = static_cast<uint32>(crc);
+  entry->cart_type = info.typeinfo->id;
+  entry->mbc = info.typeinfo->mbc;
+  entry->num_rom_banks = info.num_rom_banks;
+  entry->external_ram_size = info.external_ram_size;
+  entry->cgb_flag = info.cgb_flag;
+  entry->system_mode = info.system_mode;
+  return true;
+}
+
+bool ROMLibrary::ReadROMInfo(const char* path, Entry* entry, Error* pError)
+{
+  if (ROMArchiveReader::IsArchiveFileName(path))
+    return ReadArchiveROMInfo(path, entry, pError);
+
+  // the whole file is hashed, so map it rather than copying it through a stream
+  const byte* data;
+  uint64 size;
+
+#ifdef Y_PLATFORM_WINDOWS
+  HANDLE hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                             nullptr);
+  if (hFile == INVALID_HANDLE_VALUE)
+  {
+    pError->SetErrorUser(1, "Could not open file");
+    return false;
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(hFile, &file_size) || file_size.QuadPart == 0)
+  {
+    pError->SetErrorUser(1, "Could not get file size");
+    CloseHandle(hFile);
+    return false;
+  }
+
+  HANDLE hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  data = (hMapping != nullptr) ? (const byte*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  if (data == nullptr)
+  {
+    pError->SetErrorUser(1, "Could not map file");
+    if (hMapping != nullptr)
+      CloseHandle(hMapping);
+    CloseHandle(hFile);
+    return false;
+  }
+  size = static_cast<uint64>(file_size.QuadPart);
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    pError->SetErrorUser(1, "Could not open file");
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    pError->SetErrorUser(1, "Could not get file size");
+    close(fd);
+    return false;
+  }
+
+  void* mapping = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+  {
+    pError->SetErrorUser(1, "Could not map file");
+    return false;
+  }
+  madvise(mapping, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+  data = (const byte*)mapping;
+  size = static_cast<uint64>(st.st_size);
+#endif
+
+  bool result = false;
+  CartridgeHeaderInfo info;
+  if (size < CART_HEADER_OFFSET + sizeof(CART_HEADER))
+  {
+    pError->SetErrorUser(1, "File is too small to contain a cartridge header");
+  }
+  else if (Cartridge::DecodeHeader(reinterpret_cast<const CART_HEADER*>(data + CART_HEADER_OFFSET), &info, pError))
+  {
+    // zlib's crc32 uses the slice-by-n/hardware paths where available, and matches Cartridge::GetCRC()
+    uLong crc = crc32(0, Z_NULL, 0);
+    for (uint64 offset = 0; offset < size;)
+    {
+      uInt chunk = static_cast<uInt>(std::min<uint64>(size - offset, 0x40000000));
+      crc = crc32(crc, data + offset, chunk);
+      offset += chunk;
+    }
+
+    entry->path = path;
+    entry->name = info.name;
+    entry->file_size = size;
+    entry->crc = static_cast<uint32>(crc);
+    entry->cart_type = info.typeinfo->id;
+    entry->mbc = info.typeinfo->mbc;
+    entry->num_rom_banks = info.num_rom_banks;
+    entry->external_ram_size = info.external_ram_size;
+    entry->cgb_flag = info.cgb_flag;
+    entry->system_mode = info.system_mode;
+    result = true;
+  }
+
+#ifdef Y_PLATFORM_WINDOWS
+  UnmapViewOfFile(data);
+  CloseHandle(hMapping);
+  CloseHandle(hFile);
+#else
+  munmap(const_cast<byte*>(data), static_cast<size_t>(size));
+#endif
+
+  return result;
+}
+
+void ROMLibrary::Scan(const char* directory, uint32 num_threads, ScanStatistics* stats)
+{
+  Timer scan_timer;
+  Y_memzero(stats, sizeof(*stats));
+
+  FileSystem::FindResultsArray results;
+  if (!FileSystem::FindFiles(directory, "*", FILESYSTEM_FIND_FILES | FILESYSTEM_FIND_RECURSIVE, &results))
+  {
+    Log_ErrorPrintf("Failed to enumerate '%s'", directory);
+    return;
+  }
+
+  // split into unchanged files, and files which need to be read
+  struct PendingFile
+  {
+    Entry entry;
+    bool valid;
+  };
+  enum : uint8
+  {
+    ENTRY_MISSING,
+    ENTRY_UNCHANGED,
+    ENTRY_REPLACED
+  };
+  std::vector<PendingFile> pending;
+  std::vector<uint8> entry_status(m_entries.size(), ENTRY_MISSING);
+  for (uint32 i = 0; i < results.GetSize(); i++)
+  {
+    const FILESYSTEM_FIND_DATA& fd = results[i];
+    if (!HasROMExtension(fd.FileName))
+      continue;
+
+    stats->files_found++;
+
+    uint64 modification_time = static_cast<uint64>(fd.ModificationTime.AsUnixTimestamp());
+    auto iter = m_path_map.find(fd.FileName);
+    if (iter != m_path_map.end())
+    {
+      const Entry& entry = m_entries[iter->second];
+      if (entry.modification_time == modification_time && entry.file_size == fd.Size)
+      {
+        entry_status[iter->second] = ENTRY_UNCHANGED;
+        stats->files_unchanged++;
+        continue;
+      }
+
+      entry_status[iter->second] = ENTRY_REPLACED;
+    }
+
+    PendingFile file;
+    file.entry.path = fd.FileName;
+    file.entry.modification_time = modification_time;
+    file.valid = false;
+    pending.push_back(std::move(file));
+  }
+
+  // each worker pulls the next file until the list is exhausted
+  if (num_threads == 0)
+    num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  num_threads = std::min(num_threads, static_cast<uint32>(pending.size()));
+
+  std::atomic<size_t> next_file(0);
+  auto worker = [&pending, &next_file]() {
+    for (;;)
+    {
+      size_t index = next_file.fetch_add(1);
+      if (index >= pending.size())
+        break;
+
+      PendingFile& file = pending[index];
+      Error error;
+      file.valid = ReadROMInfo(file.entry.path, &file.entry, &error);
+      if (!file.valid)
+      {
+        Log_WarningPrintf("Skipping '%s': %s", file.entry.path.GetCharArray(),
+                          error.GetErrorDescription().GetCharArray());
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (uint32 i = 1; i < num_threads; i++)
+    threads.emplace_back(worker);
+  worker();
+  for (std::thread& thread : threads)
+    thread.join();
+
+  // drop entries which were re-read, and entries under this directory which are no longer present
+  std::vector<Entry> entries;
+  entries.reserve(m_entries.size() + pending.size());
+  uint32 directory_length = Y_strlen(directory);
+  for (size_t i = 0; i < m_entries.size(); i++)
+  {
+    if (entry_status[i] == ENTRY_REPLACED)
+      continue;
+
+    if (entry_status[i] == ENTRY_MISSING && IsPathInDirectory(m_entries[i].path, directory, directory_length))
+    {
+      stats->entries_removed++;
+      continue;
+    }
+
+    entries.push_back(std::move(m_entries[i]));
+  }
+
+  for (PendingFile& file : pending)
+  {
+    if (file.valid)
+    {
+      stats->files_read++;
+      entries.push_back(std::move(file.entry));
+    }
+    else
+    {
+      stats->files_failed++;
+    }
+  }
+
+  m_entries = std::move(entries);
+  RebuildPathMap();
+
+  stats->elapsed_seconds = scan_timer.GetTimeSeconds();
+  Log_InfoPrintf("Scanned '%s' in %.2f seconds: %u roms, %u read, %u unchanged, %u failed, %u removed", directory,
+                 stats->elapsed_seconds, stats->files_found, stats->files_read, stats->files_unchanged,
+                 stats->files_failed, stats->entries_removed);
+}
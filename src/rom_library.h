@@ -0,0 +1,66 @@
+#pragma once
+#include "YBaseLib/Common.h"
+#include "YBaseLib/String.h"
+#include "cartridge.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Error;
+
+// Index of the cartridge headers found in a set of directories.
+// Scanning only re-reads files whose size or modification time changed since the index was written, and reads
+// them on a pool of worker threads. The index can then be listed or searched without touching the rom files.
+class ROMLibrary
+{
+public:
+  struct Entry
+  {
+    String path;
+    String name;
+    uint64 modification_time;
+    uint64 file_size;
+    uint32 crc;
+    uint8 cart_type;
+    MBC mbc;
+    uint32 num_rom_banks;
+    uint32 external_ram_size;
+    uint8 cgb_flag;
+    SYSTEM_MODE system_mode;
+  };
+
+  struct ScanStatistics
+  {
+    uint32 files_found;
+    uint32 files_read;
+    uint32 files_unchanged;
+    uint32 files_failed;
+    uint32 entries_removed;
+    double elapsed_seconds;
+  };
+
+  ROMLibrary();
+  ~ROMLibrary();
+
+  uint32 GetEntryCount() const { return static_cast<uint32>(m_entries.size()); }
+  const Entry& GetEntry(uint32 index) const { return m_entries[index]; }
+  const Entry* FindEntryByCRC(uint32 crc) const;
+  const Entry* FindEntryByPath(const char* path) const;
+
+  // a missing index file is not an error, the library is just empty
+  bool LoadIndex(const char* filename, Error* pError);
+  bool SaveIndex(const char* filename) const;
+
+  // recursively scans a directory, entries for files under it which no longer exist are removed
+  // num_threads of zero uses one thread per hardware thread
+  void Scan(const char* directory, uint32 num_threads, ScanStatistics* stats);
+
+  // reads the header and hashes a single file
+  static bool ReadROMInfo(const char* path, Entry* entry, Error* pError);
+
+private:
+  void RebuildPathMap();
+
+  std::vector<Entry> m_entries;
+  std::unordered_map<std::string, size_t> m_path_map;
+};
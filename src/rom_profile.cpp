@@ -0,0 +1,107 @@
+#include "rom_profile.h"
+#include "YBaseLib/BinaryReader.h"
+#include "YBaseLib/BinaryWriter.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+Log_SetChannel(ROMProfile);
+
+// 'GBRP'
+static const uint32 PROFILE_FILE_MAGIC = 0x50524247;
+static const uint32 PROFILE_FILE_VERSION = 1;
+
+// about a minute of play
+static const uint32 TRUSTED_FRAME_COUNT = 60 * 60;
+
+ROMProfile::ROMProfile() : m_crc(0), m_flags(0), m_observed_frames(0), m_modified(false) {}
+
+bool ROMProfile::IsTrusted() const
+{
+  return (m_observed_frames >= TRUSTED_FRAME_COUNT);
+}
+
+void ROMProfile::Reset(uint32 crc)
+{
+  m_crc = crc;
+  m_flags = 0;
+  m_observed_frames = 0;
+  m_modified = false;
+}
+
+void ROMProfile::SetFlag(uint32 flag)
+{
+  if (m_flags & flag)
+    return;
+
+  m_flags |= flag;
+  m_modified = true;
+}
+
+void ROMProfile::AddObservedFrames(uint32 frames)
+{
+  if (frames == 0)
+    return;
+
+  m_observed_frames += frames;
+  m_modified = true;
+}
+
+bool ROMProfile::LoadFromFile(const char* filename, uint32 crc)
+{
+  ByteStream* pStream = FileSystem::OpenFile(filename, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_STREAMED);
+  if (pStream == nullptr)
+    return false;
+
+  BinaryReader binaryReader(pStream);
+  uint32 magic = binaryReader.ReadUInt32();
+  uint32 version = binaryReader.ReadUInt32();
+  uint32 file_crc = binaryReader.ReadUInt32();
+  uint32 flags = binaryReader.ReadUInt32();
+  uint32 observed_frames = binaryReader.ReadUInt32();
+  bool error = pStream->InErrorState();
+  pStream->Release();
+
+  if (error || magic != PROFILE_FILE_MAGIC || version != PROFILE_FILE_VERSION || file_crc != crc)
+  {
+    Log_WarningPrintf("Ignoring stale or invalid rom profile '%s'", filename);
+    return false;
+  }
+
+  m_crc = crc;
+  m_flags = flags;
+  m_observed_frames = observed_frames;
+  m_modified = false;
+  Log_DevPrintf("Loaded rom profile '%s': flags %08X, %u frames observed", filename, m_flags, m_observed_frames);
+  return true;
+}
+
+bool ROMProfile::SaveToFile(const char* filename)
+{
+  ByteStream* pStream =
+    FileSystem::OpenFile(filename, BYTESTREAM_OPEN_CREATE | BYTESTREAM_OPEN_CREATE_PATH | BYTESTREAM_OPEN_WRITE |
+                                     BYTESTREAM_OPEN_TRUNCATE | BYTESTREAM_OPEN_STREAMED |
+                                     BYTESTREAM_OPEN_ATOMIC_UPDATE);
+  if (pStream == nullptr)
+  {
+    Log_WarningPrintf("Failed to write rom profile '%s': could not open file", filename);
+    return false;
+  }
+
+  BinaryWriter binaryWriter(pStream);
+  binaryWriter.WriteUInt32(PROFILE_FILE_MAGIC);
+  binaryWriter.WriteUInt32(PROFILE_FILE_VERSION);
+  binaryWriter.WriteUInt32(m_crc);
+  binaryWriter.WriteUInt32(m_flags);
+  binaryWriter.WriteUInt32(m_observed_frames);
+  if (pStream->InErrorState() || !pStream->Commit())
+  {
+    Log_WarningPrintf("Failed to write rom profile '%s': write error", filename);
+    pStream->Discard();
+    pStream->Release();
+    return false;
+  }
+
+  pStream->Release();
+  m_modified = false;
+  return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "YBaseLib/Common.h"
+
+// Facts about a rom learned while it runs, cached across sessions so fast paths can be picked from the first frame.
+// Profiles are keyed by the rom's CRC and versioned. A missing, stale or newly created profile is never trusted, so
+// deleting the cache only costs speed until the game has been watched for a while again.
+class ROMProfile
+{
+public:
+  ROMProfile();
+
+  uint32 GetCRC() const { return m_crc; }
+  uint32 GetObservedFrames() const { return m_observed_frames; }
+  bool IsModified() const { return m_modified; }
+
+  // fast paths only rely on a profile that has seen a reasonable amount of play
+  bool IsTrusted() const;
+
+  // the game has started a serial transfer at some point
+  bool UsesLink() const { return (m_flags & FLAG_USES_LINK) != 0; }
+  void SetUsesLink() { SetFlag(FLAG_USES_LINK); }
+
+  // starts an empty profile for the rom
+  void Reset(uint32 crc);
+
+  void AddObservedFrames(uint32 frames);
+
+  // fails without touching the profile if the file is missing, from another version, or for another rom
+  bool LoadFromFile(const char* filename, uint32 crc);
+  bool SaveToFile(const char* filename);
+
+private:
+  enum FLAGS : uint32
+  {
+    FLAG_USES_LINK = (1 << 0)
+  };
+
+  void SetFlag(uint32 flag);
+
+  uint32 m_crc;
+  uint32 m_flags;
+  uint32 m_observed_frames;
+  bool m_modified;
+};
@@ -2,10 +2,14 @@
 #include "YBaseLib/AutoReleasePtr.h"
 #include "YBaseLib/Log.h"
 #include "YBaseLib/NumericLimits.h"
+#include "cartridge.h"
 #include "link.h"
 #include "system.h"
 Log_SetChannel(Serial);
 
+// socket polling interval while connected, for games known not to use the link
+static const uint32 IDLE_LINK_POLL_CLOCKS = 70224;
+
 Serial::Serial(System* system)
   : m_system(system), m_last_cycle(0), m_has_connection(false), m_serial_control(0x00), m_serial_read_data(0xFF),
     m_serial_write_data(0xFF), m_sequence(0), m_expected_sequence(Y_UINT32_MAX), m_external_clocks(0),
@@ -47,6 +51,10 @@ void Serial::SetSerialControl(uint8 value)
   // Start transfer?
   if (start_transfer)
   {
+    // remembered for later sessions, and stops the idle polling below
+    if (m_system->GetCartridge() != nullptr)
+      m_system->GetCartridge()->GetProfile()->SetUsesLink();
+
     // Are we the one providing the clock?
     m_clocks_since_transfer_start = 0;
     if (internal_clock)
@@ -77,6 +85,7 @@ void Serial::SetSerialControl(uint8 value)
       }
 
       // No client, or a send error. so just "clock out" nothing
+      m_system->m_callbacks->SerialDataSent(m_serial_write_data);
       m_serial_read_data = 0xFF;
       m_serial_wait_clocks = GetTransferClocks();
     }
@@ -224,6 +233,13 @@ void Serial::Synchronize()
   ScheduleSynchronization();
 }
 
+bool Serial::IsLinkIdle() const
+{
+  // a connected peer is normally polled every instruction, which isn't needed if the game never transfers
+  const Cartridge* cartridge = m_system->GetCartridge();
+  return (cartridge != nullptr && cartridge->GetProfile()->IsTrusted() && !cartridge->GetProfile()->UsesLink());
+}
+
 void Serial::ScheduleSynchronization()
 {
   // determine number of cycles to next execution
@@ -233,6 +249,8 @@ void Serial::ScheduleSynchronization()
     m_system->SetNextSerialSyncCycle(m_serial_wait_clocks);
   else if (m_nonready_clocks > 0)
     m_system->SetNextSerialSyncCycle(m_nonready_clocks);
+  else if (m_has_connection && IsLinkIdle())
+    m_system->SetNextSerialSyncCycle(IDLE_LINK_POLL_CLOCKS);
   else if (m_has_connection)
     m_system->SetNextSerialSyncCycle(4);
   else
@@ -380,6 +398,6 @@ void Serial::HandleRequests()
     }
     }
 
-    delete packet;
+    LinkConnectionManager::GetInstance().ReleasePacket(packet);
   }
 }
@@ -26,6 +26,7 @@ public:
 
 private:
   uint32 GetTransferClocks() const;
+  bool IsLinkIdle() const;
   void ScheduleSynchronization();
   void SendNotReadyResponse();
   void EndTransfer(uint32 clocks);
@@ -0,0 +1,195 @@
+#include "state_snapshot.h"
+#include "YBaseLib/BinaryReader.h"
+#include "YBaseLib/BinaryWriter.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Error.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+#include "cartridge.h"
+#include "system.h"
+#include <zlib.h>
+Log_SetChannel(StateSnapshot);
+
+// 'GBSS'
+static const uint32 SNAPSHOT_FILE_MAGIC = 0x53534247;
+
+// far larger than any real state, which is mostly the fixed memory blocks plus cartridge ram
+static const uint32 MAX_STATE_SIZE = 16 * 1024 * 1024;
+
+StateSnapshot::StateSnapshot()
+  : m_state_data(nullptr), m_compressed_data(nullptr), m_compressed_size(0), m_state_size(0), m_cartridge_crc(0)
+{
+}
+
+StateSnapshot::~StateSnapshot()
+{
+  delete[] m_compressed_data;
+  delete[] m_state_data;
+}
+
+StateSnapshot* StateSnapshot::Capture(System* system)
+{
+  if (system->GetCartridge() == nullptr)
+    return nullptr;
+
+  GrowableMemoryByteStream* pStream = ByteStream_CreateGrowableMemoryStream();
+  if (!system->SaveState(pStream))
+  {
+    pStream->Release();
+    return nullptr;
+  }
+
+  StateSnapshot* snapshot = new StateSnapshot();
+  snapshot->m_state_size = (uint32)pStream->GetSize();
+  snapshot->m_state_data = new byte[snapshot->m_state_size];
+  Y_memcpy(snapshot->m_state_data, pStream->GetMemoryPointer(), snapshot->m_state_size);
+  snapshot->m_cartridge_crc = system->GetCartridge()->GetCRC();
+  pStream->Release();
+  return snapshot;
+}
+
+bool StateSnapshot::Compress()
+{
+  if (m_compressed_data != nullptr)
+    return true;
+
+  // most of the state is zeroed or repeated memory, so favour speed over ratio
+  uLongf compressed_size = compressBound(m_state_size);
+  byte* compressed_data = new byte[compressed_size];
+  if (compress2(compressed_data, &compressed_size, m_state_data, m_state_size, Z_BEST_SPEED) != Z_OK)
+  {
+    Log_ErrorPrintf("Failed to compress %u byte state", m_state_size);
+    delete[] compressed_data;
+    return false;
+  }
+
+  m_compressed_data = compressed_data;
+  m_compressed_size = (uint32)compressed_size;
+  delete[] m_state_data;
+  m_state_data = nullptr;
+  return true;
+}
+
+StateSnapshot* StateSnapshot::ReadFromFile(const char* filename, Error* pError)
+{
+  ByteStream* pStream = FileSystem::OpenFile(filename, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_STREAMED);
+  if (pStream == nullptr)
+  {
+    pError->SetErrorUserFormatted(1, "Could not open '%s'", filename);
+    return nullptr;
+  }
+
+  BinaryReader binaryReader(pStream);
+  uint32 magic = binaryReader.ReadUInt32();
+  uint32 version = binaryReader.ReadUInt32();
+  uint32 cartridge_crc = binaryReader.ReadUInt32();
+  uint32 state_size = binaryReader.ReadUInt32();
+  uint32 compressed_size = binaryReader.ReadUInt32();
+  if (pStream->InErrorState() || magic != SNAPSHOT_FILE_MAGIC)
+  {
+    pError->SetErrorUser(1, "Not a snapshot file");
+    pStream->Release();
+    return nullptr;
+  }
+  if (version != SAVESTATE_SAVE_VERSION)
+  {
+    pError->SetErrorUserFormatted(1, "Snapshot version mismatch, expected %u, got %u", (uint32)SAVESTATE_SAVE_VERSION,
+                                  version);
+    pStream->Release();
+    return nullptr;
+  }
+
+
+  // sizes come from the file, check them before allocating anything
+  uint64 remaining_size = pStream->GetSize() - pStream->GetPosition();
+  if (state_size == 0 || state_size > MAX_STATE_SIZE || compressed_size == 0 ||
+      compressed_size > compressBound(state_size) || compressed_size > remaining_size)
+  {
+    pError->SetErrorUser(1, "Corrupted snapshot file");
+    pStream->Release();
+    return nullptr;
+  }
+
+  byte* compressed_data = new byte[compressed_size];
+  if (!pStream->Read2(compressed_data, compressed_size))
+  {
+    pError->SetErrorUser(1, "Truncated snapshot file");
+    delete[] compressed_data;
+    pStream->Release();
+    return nullptr;
+  }
+  pStream->Release();
+
+  StateSnapshot* snapshot = new StateSnapshot();
+  snapshot->m_compressed_data = compressed_data;
+  snapshot->m_compressed_size = compressed_size;
+  snapshot->m_state_size = state_size;
+  snapshot->m_cartridge_crc = cartridge_crc;
+  return snapshot;
+}
+
+bool StateSnapshot::Restore(System* system, Error* pError) const
+{
+  if (system->GetCartridge() == nullptr || system->GetCartridge()->GetCRC() != m_cartridge_crc)
+  {
+    pError->SetErrorUser(1, "Snapshot is for a different cartridge");
+    return false;
+  }
+
+  if (m_state_data != nullptr)
+  {
+    ByteStream* pStream = ByteStream_CreateReadOnlyMemoryStream(m_state_data, m_state_size);
+    bool result = system->LoadState(pStream, pError);
+    pStream->Release();
+    return result;
+  }
+
+  byte* state_data = new byte[m_state_size];
+  uLongf state_size = m_state_size;
+  if (uncompress(state_data, &state_size, m_compressed_data, m_compressed_size) != Z_OK || state_size != m_state_size)
+  {
+    pError->SetErrorUser(1, "Failed to decompress snapshot");
+    delete[] state_data;
+    return false;
+  }
+
+  ByteStream* pStream = ByteStream_CreateReadOnlyMemoryStream(state_data, m_state_size);
+  bool result = system->LoadState(pStream, pError);
+  pStream->Release();
+  delete[] state_data;
+  return result;
+}
+
+bool StateSnapshot::WriteToFile(const char* filename) const
+{
+  DebugAssert(m_compressed_data != nullptr);
+
+  ByteStream* pStream =
+    FileSystem::OpenFile(filename, BYTESTREAM_OPEN_CREATE | BYTESTREAM_OPEN_CREATE_PATH | BYTESTREAM_OPEN_WRITE |
+                                     BYTESTREAM_OPEN_TRUNCATE | BYTESTREAM_OPEN_STREAMED |
+                                     BYTESTREAM_OPEN_ATOMIC_UPDATE);
+  if (pStream == nullptr)
+  {
+    Log_ErrorPrintf("Failed to write snapshot '%s': could not open file", filename);
+    return false;
+  }
+
+  BinaryWriter binaryWriter(pStream);
+  binaryWriter.WriteUInt32(SNAPSHOT_FILE_MAGIC);
+  binaryWriter.WriteUInt32(SAVESTATE_SAVE_VERSION);
+  binaryWriter.WriteUInt32(m_cartridge_crc);
+  binaryWriter.WriteUInt32(m_state_size);
+  binaryWriter.WriteUInt32(m_compressed_size);
+  binaryWriter.WriteBytes(m_compressed_data, m_compressed_size);
+  if (pStream->InErrorState())
+  {
+    Log_ErrorPrintf("Failed to write snapshot '%s': write error", filename);
+    pStream->Discard();
+    pStream->Release();
+    return false;
+  }
+
+  pStream->Commit();
+  pStream->Release();
+  return true;
+}
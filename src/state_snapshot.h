@@ -0,0 +1,42 @@
+#pragma once
+#include "YBaseLib/Common.h"
+
+class Error;
+class System;
+
+// In-memory save state, used for session resume.
+// Capturing is done on the emulation thread, the snapshot can then be compressed and written from any thread.
+class StateSnapshot
+{
+public:
+  ~StateSnapshot();
+
+  uint32 GetCartridgeCRC() const { return m_cartridge_crc; }
+  uint32 GetStateSize() const { return m_state_size; }
+  uint32 GetCompressedSize() const { return m_compressed_size; }
+  bool IsCompressed() const { return (m_compressed_data != nullptr); }
+
+  // save the current system state, uncompressed
+  static StateSnapshot* Capture(System* system);
+
+  // replaces the state with its compressed form, required before WriteToFile
+  bool Compress();
+
+  // read a snapshot written by WriteToFile
+  static StateSnapshot* ReadFromFile(const char* filename, Error* pError);
+
+  // load the snapshot into the system, the cartridge must match
+  bool Restore(System* system, Error* pError) const;
+
+  // written atomically, a partial write never replaces an existing snapshot
+  bool WriteToFile(const char* filename) const;
+
+private:
+  StateSnapshot();
+
+  byte* m_state_data;
+  byte* m_compressed_data;
+  uint32 m_compressed_size;
+  uint32 m_state_size;
+  uint32 m_cartridge_crc;
+};
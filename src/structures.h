@@ -139,5 +139,5 @@ struct CART_HEADER
 
 #define CART_HEADER_OFFSET (0x0100)
 
-#define SAVESTATE_LOAD_VERSION (5)
-#define SAVESTATE_SAVE_VERSION (5)
+#define SAVESTATE_LOAD_VERSION (9)
+#define SAVESTATE_SAVE_VERSION (9)
@@ -10,37 +10,82 @@
 #include "YBaseLib/Thread.h"
 #include "audio.h"
 #include "cartridge.h"
+#include "cheats.h"
 #include "cpu.h"
 #include "display.h"
+#include "input_movie.h"
 #include "serial.h"
 #include <cmath>
+#include <new>
 Log_SetChannel(System);
 
 // TODO: Split to separate files
 const uint32 DMG_BIOS_LENGTH = 256;
 const uint32 CGB_BIOS_LENGTH = 2048;
+const uint32 OAM_DMA_LENGTH = 160;
 
 System::System(CallbackInterface* callbacks)
 {
+  static_assert(sizeof(CPU) <= CPU_STORAGE_SIZE, "CPU no longer fits in its slot in System");
   m_cpu = nullptr;
   m_display = nullptr;
   m_audio = nullptr;
   m_serial = nullptr;
   m_cartridge = nullptr;
+  m_cheat_engine = nullptr;
+  m_memory = nullptr;
+  m_memory_vram = nullptr;
+  m_memory_wram = nullptr;
+  m_memory_oam = nullptr;
+  m_memory_zram = nullptr;
+  m_memory_ioreg = nullptr;
   m_callbacks = callbacks;
   m_bios = nullptr;
   m_bios_length = 0;
+  m_frame_counter = 0;
+  m_scanline_slice_size = 0;
+  m_accurate_oam_dma = false;
+  m_turbo_boot = false;
+  m_turbo_boot_active = false;
+  m_turbo_boot_audio_enabled = true;
+  m_stop_execution = false;
+  m_magic_breakpoint = false;
+  m_magic_breakpoint_hit = false;
+  m_clocks_since_reset = 0;
+  m_clock_base = 0;
+  m_input_queue_head = 0;
+  m_input_queue_count = 0;
+  m_input_recorder = nullptr;
+  m_input_playback = nullptr;
+  m_input_playback_index = 0;
+  m_input_timing_events = 0;
+  m_input_queued_error_ms = 0.0;
+  m_input_immediate_error_ms = 0.0;
   m_biosLatch = false;
   m_vramLocked = false;
   m_oamLocked = false;
+  Y_memzero(m_cartridge_read_map, sizeof(m_cartridge_read_map));
+  Y_memzero(m_cartridge_write_map, sizeof(m_cartridge_write_map));
+}
+
+void* System::operator new(size_t size)
+{
+  return Y_aligned_malloc(size, CACHE_LINE_SIZE);
+}
+
+void System::operator delete(void* ptr)
+{
+  Y_aligned_free(ptr);
 }
 
 System::~System()
 {
+  delete m_cheat_engine;
   delete m_serial;
   delete m_audio;
   delete m_display;
-  delete m_cpu;
+  if (m_cpu != nullptr)
+    m_cpu->~CPU();
 }
 
 bool System::Init(SYSTEM_MODE mode, const byte* bios, uint32 bios_length, Cartridge* cartridge)
@@ -60,10 +105,21 @@ bool System::Init(SYSTEM_MODE mode, const byte* bios, uint32 bios_length, Cartri
     }
   }
 
-  m_cpu = new CPU(this);
+  m_cpu = new (m_cpu_storage) CPU(this);
   m_display = new Display(this);
   m_audio = new Audio(this);
   m_serial = new Serial(this);
+  m_cheat_engine = new CheatEngine(this);
+
+  // internal memory lives in a single zeroed block
+  if (!m_memory_arena.Create(sizeof(InternalMemory)))
+    return false;
+  m_memory = reinterpret_cast<InternalMemory*>(m_memory_arena.Allocate(sizeof(InternalMemory)));
+  m_memory_vram = m_memory->vram;
+  m_memory_wram = m_memory->wram;
+  m_memory_oam = m_memory->oam;
+  m_memory_zram = m_memory->zram;
+  m_memory_ioreg = m_memory->ioreg;
 
   m_cycle_number = 0;
   m_last_sync_cycle = 0;
@@ -71,15 +127,17 @@ bool System::Init(SYSTEM_MODE mode, const byte* bios, uint32 bios_length, Cartri
   m_next_audio_sync_cycle = 0;
   m_next_serial_sync_cycle = 0;
   m_next_timer_sync_cycle = 0;
+  m_next_cartridge_sync_cycle = 0;
   m_next_event_cycle = 0;
   m_event = false;
 
   m_reset_timer.Reset();
   m_clocks_since_reset = 0;
+  m_clock_base = 0;
   m_last_vblank_clocks = 0;
 
   m_speed_timer.Reset();
-  m_cycles_since_speed_update = 0;
+  m_speed_update_clocks = 0;
   m_frames_since_speed_update = 0;
   m_current_fps = 0;
 
@@ -95,6 +153,10 @@ bool System::Init(SYSTEM_MODE mode, const byte* bios, uint32 bios_length, Cartri
   m_memory_locked_start = 0;
   m_memory_locked_end = 0;
   m_memory_permissive = false;
+  m_oam_dma_source_pointer = nullptr;
+  m_oam_dma_start_cycle = 0;
+  m_oam_dma_source_address = 0;
+  m_oam_dma_bytes_copied = 0;
 
   m_high_wram_bank = 1;
   m_vram_bank = 0;
@@ -116,6 +178,8 @@ bool System::Init(SYSTEM_MODE mode, const byte* bios, uint32 bios_length, Cartri
   // if bios not provided, emulate post-bootstrap state
   if (m_bios == nullptr)
     SetPostBootstrapState();
+  else if (m_turbo_boot)
+    BeginTurboBoot();
 
   Log_InfoPrintf("Initialized system in mode %s.", NameTable_GetNameString(NameTables::SystemMode, m_current_mode));
   return true;
@@ -131,21 +195,25 @@ void System::Reset()
   m_next_audio_sync_cycle = 0;
   m_next_serial_sync_cycle = 0;
   m_next_timer_sync_cycle = 0;
+  m_next_cartridge_sync_cycle = 0;
   m_next_event_cycle = 0;
   m_event = false;
 
   m_reset_timer.Reset();
   m_clocks_since_reset = 0;
+  m_clock_base = 0;
   m_last_vblank_clocks = 0;
 
   m_speed_timer.Reset();
-  m_cycles_since_speed_update = 0;
+  m_speed_update_clocks = 0;
   m_frames_since_speed_update = 0;
   m_current_fps = 0;
 
   m_frame_counter = 0;
 
   m_memory_locked_cycles = 0;
+  m_oam_dma_source_pointer = nullptr;
+  m_oam_dma_bytes_copied = 0;
 
   m_high_wram_bank = 1;
   m_vram_bank = 0;
@@ -164,6 +232,8 @@ void System::Reset()
   // if bios not provided, emulate post-bootstrap state
   if (m_bios == nullptr)
     SetPostBootstrapState();
+  else if (m_turbo_boot)
+    BeginTurboBoot();
 
   Log_InfoPrintf("System reset.");
 }
@@ -176,12 +246,10 @@ void System::SetPaused(bool paused)
   m_paused = paused;
   if (!m_paused)
   {
-    m_reset_timer.Reset();
-    m_clocks_since_reset = 0;
-    m_last_vblank_clocks = 0;
+    ResetPacing();
 
     m_speed_timer.Reset();
-    m_cycles_since_speed_update = 0;
+    m_speed_update_clocks = 0;
   }
 }
 
@@ -207,10 +275,12 @@ void System::UpdateNextEventCycle()
   uint32 cycles_to_serial_sync = m_next_serial_sync_cycle - m_cycle_number;
   uint32 cycles_to_audio_sync = m_next_audio_sync_cycle - m_cycle_number;
   uint32 cycles_to_display_sync = m_next_display_sync_cycle - m_cycle_number;
+  uint32 cycles_to_cartridge_sync = m_next_cartridge_sync_cycle - m_cycle_number;
 
   // find the lowest sync cycle
   uint32 cycles_to_first_sync =
     Min(cycles_to_timer_sync, Min(cycles_to_serial_sync, Min(cycles_to_audio_sync, cycles_to_display_sync)));
+  cycles_to_first_sync = Min(cycles_to_first_sync, cycles_to_cartridge_sync);
   if (m_memory_locked_cycles > 0)
     cycles_to_first_sync = Min(cycles_to_first_sync, m_memory_locked_cycles);
 
@@ -223,7 +293,6 @@ void System::AddCPUCycles(uint32 cpu_clocks)
   DebugAssert((cpu_clocks % 4) == 0);
   m_cycle_number += cpu_clocks;
   m_clocks_since_reset += (cpu_clocks >> GetDoubleSpeedDivider());
-  m_cycles_since_speed_update += (cpu_clocks >> GetDoubleSpeedDivider());
   m_next_event_cycle -= (int32)cpu_clocks;
   if (m_next_event_cycle > 0)
     return;
@@ -236,14 +305,19 @@ void System::AddCPUCycles(uint32 cpu_clocks)
   bool sync_serial = (m_cycle_number >= m_next_serial_sync_cycle);
   bool sync_display = (m_cycle_number >= m_next_display_sync_cycle);
   bool sync_audio = (m_cycle_number >= m_next_audio_sync_cycle);
+  bool sync_cartridge = (m_cycle_number >= m_next_cartridge_sync_cycle);
   uint32 cycles_since_sync = CalculateDoubleSpeedCycleCount(m_last_sync_cycle);
   m_last_sync_cycle = m_cycle_number;
   m_event = true;
 
   // Handle memory locking for OAM transfers [affected by double speed]
   if (m_memory_locked_cycles > 0)
+  {
     m_memory_locked_cycles =
       (cycles_since_sync > m_memory_locked_cycles) ? 0 : (m_memory_locked_cycles - cycles_since_sync);
+    if (m_memory_locked_cycles == 0)
+      SynchronizeOAMDMA();
+  }
 
   // Simulate display [not affected by double speed]
   if (sync_display)
@@ -261,6 +335,15 @@ void System::AddCPUCycles(uint32 cpu_clocks)
   if (sync_timers)
     SynchronizeTimers();
 
+  // Simulate cartridge clock [not affected by double speed]
+  if (sync_cartridge)
+  {
+    if (m_cartridge != nullptr)
+      m_cartridge->Synchronize();
+    else
+      SetNextCartridgeSyncCycle(4194304);
+  }
+
   // Update time to next event
   m_event = false;
   UpdateNextEventCycle();
@@ -271,13 +354,19 @@ void System::SetSerialPause(bool enabled)
   if (m_serial_pause == enabled)
     return;
 
+  // either way the clock is about to stop or restart, so leave the run loop
   m_serial_pause = enabled;
+  m_stop_execution = true;
   if (!m_serial_pause)
-  {
-    m_clocks_since_reset = 0;
-    m_last_vblank_clocks = 0;
-    m_reset_timer.Reset();
-  }
+    ResetPacing();
+}
+
+void System::ResetPacing()
+{
+  m_clock_base += m_clocks_since_reset;
+  m_clocks_since_reset = 0;
+  m_last_vblank_clocks = 0;
+  m_reset_timer.Reset();
 }
 
 void System::TriggerOAMBug()
@@ -311,6 +400,46 @@ double System::ClocksToTime(uint64 clocks)
   return (double)clocks / (4194304.0 * m_speed_multiplier);
 }
 
+void System::RunUntil(uint64 target_clocks)
+{
+  if (m_paused || m_serial_pause)
+    return;
+
+  m_stop_execution = false;
+
+  // stop at each queued input event on the way
+  while (m_input_queue_count > 0)
+  {
+    const QueuedInputEvent& queued = m_input_queue[m_input_queue_head];
+    uint64 event_clocks = (queued.event.clock > m_clock_base) ? (queued.event.clock - m_clock_base) : 0;
+    if (event_clocks >= target_clocks)
+      break;
+
+    m_cpu->ExecuteUntil(event_clocks);
+    if (m_clocks_since_reset < event_clocks)
+      return;
+
+    // against applying it as soon as it was queued, at the start of the next batch of execution
+    if (queued.from_host)
+    {
+      uint64 immediate_error = (queued.host_clock > queued.queue_clock) ? (queued.host_clock - queued.queue_clock) :
+                                                                          (queued.queue_clock - queued.host_clock);
+      m_input_queued_error_ms += ClocksToTime(GetEmulatedClocks() - queued.host_clock) * 1000.0;
+      m_input_immediate_error_ms += ClocksToTime(immediate_error) * 1000.0;
+      m_input_timing_events++;
+    }
+
+    ApplyInputEvent(queued.event);
+    m_input_queue_head = (m_input_queue_head + 1) & (INPUT_QUEUE_SIZE - 1);
+    m_input_queue_count--;
+    QueuePlaybackEvents();
+    if (m_stop_execution)
+      return;
+  }
+
+  m_cpu->ExecuteUntil(target_clocks);
+}
+
 double System::ExecuteFrame()
 {
   static const float VBLANK_INTERVAL = 0.0166f; // 16.6ms
@@ -323,12 +452,22 @@ double System::ExecuteFrame()
     return 0.001;
   }
 
+  // turbo boot, run the boot rom as fast as possible, but return periodically so the frontend stays responsive
+  if (m_turbo_boot_active)
+  {
+    // the run loop stops as soon as the boot rom unmaps itself
+    Timer exec_timer;
+    while (m_turbo_boot_active && !m_serial_pause && exec_timer.GetTimeSeconds() < 0.1)
+      RunUntil(m_clocks_since_reset + 70224);
+
+    return 0.0;
+  }
+
   // framelimiter on?
   double sleep_time;
   if (m_frame_limiter)
   {
     // using "accurate" timing?
-    Timer exec_timer;
     uint64 clocks_executed;
     if (m_accurate_timing)
     {
@@ -342,8 +481,16 @@ double System::ExecuteFrame()
       {
         // keep executing until we meet our target
         clocks_executed = target_clocks - current_clocks;
+        uint64 clock_base = m_clock_base;
         while (m_clocks_since_reset < target_clocks && !m_serial_pause)
-          Step();
+        {
+          RunUntil(target_clocks);
+
+          // pacing was reset part way through, e.g. by a serial pause or the end of turbo boot, so the target and
+          // start time are against the old timer. pick up from the new base on the next call.
+          if (m_clock_base != clock_base)
+            return 0.0;
+        }
       }
       else
       {
@@ -364,25 +511,18 @@ double System::ExecuteFrame()
     }
     else
     {
-      uint64 cycles_executed = 0;
-      uint64 last_vblank_clocks = m_last_vblank_clocks;
-
-      // If the display is turned off, this loop will never exit.
-      // Run a maximum of two vblank intervals worth of cycles in this case.
-      while (cycles_executed < (70224 * 2) && last_vblank_clocks == m_last_vblank_clocks && !m_serial_pause)
-      {
-        Step();
-      }
+      // Run until the next vblank, which still arrives with the display turned off as a blank frame. Two vblank
+      // intervals worth of cycles is only a backstop.
+      Timer exec_timer;
+      RunUntil(m_clocks_since_reset + 70224 * 2);
 
       sleep_time = Max((VBLANK_INTERVAL / m_speed_multiplier) - exec_timer.GetTimeSeconds(), 0.0);
     }
   }
   else
   {
-    // framelimiter off, just execute as many as quickly as possible, say, 16ms worth at a time
-    uint64 target_clocks = m_clocks_since_reset + 70224;
-    while (m_clocks_since_reset < target_clocks && !m_serial_pause)
-      Step();
+    // framelimiter off, just execute as many as quickly as possible, a frame at a time
+    RunUntil(m_clocks_since_reset + 70224);
 
     // don't sleep
     sleep_time = 0.0;
@@ -393,14 +533,55 @@ double System::ExecuteFrame()
 
 void System::CalculateCurrentSpeed()
 {
+  // counted from the clock total rather than per instruction, which restarts when pacing is reset
+  uint64 clocks = (m_clocks_since_reset >= m_speed_update_clocks) ? (m_clocks_since_reset - m_speed_update_clocks) :
+                                                                     m_clocks_since_reset;
   float diff = float(m_speed_timer.GetTimeSeconds());
-  m_current_speed = float(m_cycles_since_speed_update) / (4194304 * diff);
+  m_current_speed = float(clocks) / (4194304 * diff);
   m_current_fps = float(m_frames_since_speed_update) / diff;
-  m_cycles_since_speed_update = 0;
+  m_speed_update_clocks = m_clocks_since_reset;
   m_frames_since_speed_update = 0;
   m_speed_timer.Reset();
 }
 
+void System::SetTurboBoot(bool on)
+{
+  m_turbo_boot = on;
+  if (on && m_biosLatch && m_bios != nullptr)
+    BeginTurboBoot();
+  else if (!on)
+    EndTurboBoot();
+}
+
+void System::BeginTurboBoot()
+{
+  if (m_turbo_boot_active)
+    return;
+
+  m_turbo_boot_active = true;
+  m_turbo_boot_audio_enabled = m_audio->GetOutputEnabled();
+  m_audio->SetOutputEnabled(false);
+  m_turbo_boot_timer.Reset();
+}
+
+void System::EndTurboBoot()
+{
+  if (!m_turbo_boot_active)
+    return;
+
+  m_turbo_boot_active = false;
+  m_audio->SetOutputEnabled(m_turbo_boot_audio_enabled);
+  Log_InfoPrintf("Turbo boot finished after %.2f ms (%u frames).", m_turbo_boot_timer.GetTimeMilliseconds(),
+                 m_frame_counter);
+
+  // resume pacing from here, rather than trying to catch up to real time
+  m_stop_execution = true;
+  m_clock_base += m_clocks_since_reset;
+  m_clocks_since_reset = 0;
+  m_last_vblank_clocks = 0;
+  m_reset_timer.Reset();
+}
+
 void System::SetPadDirection(PAD_DIRECTION direction)
 {
   uint8 old_direction_state = m_pad_direction_state;
@@ -466,38 +647,200 @@ void System::SetPadButtonState(uint8 state)
   CPUInterruptRequest(CPU_INT_JOYPAD);
 }
 
+void System::QueueInputEvent(const InputEvent& event)
+{
+  QueuedInputEvent queued;
+  queued.event = event;
+  queued.host_clock = event.clock;
+  queued.queue_clock = event.clock;
+  queued.from_host = false;
+  InsertInputEvent(queued);
+}
+
+void System::ClearInputQueue()
+{
+  m_input_queue_head = 0;
+  m_input_queue_count = 0;
+  m_input_playback = nullptr;
+}
+
+void System::InsertInputEvent(const QueuedInputEvent& queued)
+{
+  // only a flood of host input fills the ring, make room by applying the earliest event now
+  if (m_input_queue_count == INPUT_QUEUE_SIZE)
+  {
+    Log_WarningPrintf("Input queue full, applying the event for clock %llu early",
+                      static_cast<unsigned long long>(m_input_queue[m_input_queue_head].event.clock));
+    ApplyInputEvent(m_input_queue[m_input_queue_head].event);
+    m_input_queue_head = (m_input_queue_head + 1) & (INPUT_QUEUE_SIZE - 1);
+    m_input_queue_count--;
+  }
+
+  // usually goes on the end, otherwise later events move up one
+  uint32 position = m_input_queue_count;
+  for (; position > 0; position--)
+  {
+    const QueuedInputEvent& previous = m_input_queue[(m_input_queue_head + position - 1) & (INPUT_QUEUE_SIZE - 1)];
+    if (previous.event.clock <= queued.event.clock)
+      break;
+
+    m_input_queue[(m_input_queue_head + position) & (INPUT_QUEUE_SIZE - 1)] = previous;
+  }
+
+  m_input_queue[(m_input_queue_head + position) & (INPUT_QUEUE_SIZE - 1)] = queued;
+  m_input_queue_count++;
+}
+
+void System::SetInputPlayback(const InputMovie* movie)
+{
+  m_input_playback = movie;
+  m_input_playback_index = 0;
+  if (movie == nullptr)
+    return;
+
+  Log_InfoPrintf("Playing back %u movie events, ending at clock %llu", movie->GetEventCount(),
+                 static_cast<unsigned long long>(
+                   (movie->GetEventCount() > 0) ? movie->GetEvent(movie->GetEventCount() - 1).clock : 0));
+  QueuePlaybackEvents();
+}
+
+void System::QueuePlaybackEvents()
+{
+  if (m_input_playback == nullptr)
+    return;
+
+  while (m_input_queue_count < (INPUT_QUEUE_SIZE / 2) && m_input_playback_index < m_input_playback->GetEventCount())
+    QueueInputEvent(m_input_playback->GetEvent(m_input_playback_index++));
+}
+
+System::InputEvent System::GetLastQueuedInput() const
+{
+  if (m_input_queue_count > 0)
+    return m_input_queue[(m_input_queue_head + m_input_queue_count - 1) & (INPUT_QUEUE_SIZE - 1)].event;
+
+  // flip off bits to on
+  InputEvent event;
+  event.clock = GetEmulatedClocks();
+  event.direction_state = ~m_pad_direction_state & PAD_DIRECTION_MASK;
+  event.button_state = ~m_pad_button_state & PAD_BUTTON_MASK;
+  return event;
+}
+
+uint64 System::QueuePadDirection(PAD_DIRECTION direction, bool state, double host_seconds_ago)
+{
+  InputEvent event = GetLastQueuedInput();
+  if (state)
+    event.direction_state |= (direction & PAD_DIRECTION_MASK);
+  else
+    event.direction_state &= ~(direction & PAD_DIRECTION_MASK);
+
+  return QueueHostInputEvent(event, host_seconds_ago);
+}
+
+uint64 System::QueuePadButton(PAD_BUTTON button, bool state, double host_seconds_ago)
+{
+  InputEvent event = GetLastQueuedInput();
+  if (state)
+    event.button_state |= (button & PAD_BUTTON_MASK);
+  else
+    event.button_state &= ~(button & PAD_BUTTON_MASK);
+
+  return QueueHostInputEvent(event, host_seconds_ago);
+}
+
+uint64 System::QueueHostInputEvent(const InputEvent& event, double host_seconds_ago)
+{
+  // without pacing there's no relation between host and emulated time, so it goes in as soon as possible
+  QueuedInputEvent queued;
+  queued.event = event;
+  queued.queue_clock = GetEmulatedClocks();
+  queued.host_clock = queued.queue_clock;
+  queued.from_host = true;
+  if (m_frame_limiter && m_accurate_timing && !m_paused && !m_serial_pause)
+  {
+    double event_time = Max(m_reset_timer.GetTimeSeconds() - host_seconds_ago, 0.0);
+    queued.host_clock = m_clock_base + TimeToClocks(event_time);
+  }
+
+  // can't go back in time, or ahead of anything already queued
+  queued.event.clock = Max(queued.host_clock, queued.queue_clock);
+  if (m_input_queue_count > 0)
+    queued.event.clock = Max(queued.event.clock, GetLastQueuedInput().clock);
+
+  InsertInputEvent(queued);
+  return queued.event.clock;
+}
+
+uint32 System::GetInputTimingStatistics(double* queued_error_ms, double* immediate_error_ms)
+{
+  uint32 events = m_input_timing_events;
+  *queued_error_ms = (events > 0) ? (m_input_queued_error_ms / double(events)) : 0.0;
+  *immediate_error_ms = (events > 0) ? (m_input_immediate_error_ms / double(events)) : 0.0;
+  m_input_timing_events = 0;
+  m_input_queued_error_ms = 0.0;
+  m_input_immediate_error_ms = 0.0;
+  return events;
+}
+
+void System::ApplyInputEvent(const InputEvent& event)
+{
+  uint8 old_direction_state = m_pad_direction_state;
+  uint8 old_button_state = m_pad_button_state;
+  SetPadDirectionState(event.direction_state);
+  SetPadButtonState(event.button_state);
+
+  if (m_input_recorder != nullptr &&
+      (m_pad_direction_state != old_direction_state || m_pad_button_state != old_button_state))
+  {
+    InputEvent recorded = event;
+    recorded.clock = GetEmulatedClocks();
+    m_input_recorder->AddEvent(recorded);
+  }
+}
+
 void System::SetTargetSpeed(float multiplier)
 {
   m_speed_multiplier = multiplier;
   m_reset_timer.Reset();
+  m_clock_base += m_clocks_since_reset;
   m_clocks_since_reset = 0;
-  m_cycles_since_speed_update = 0;
   m_last_vblank_clocks = 0;
 
   m_speed_timer.Reset();
-  m_cycles_since_speed_update = 0;
+  m_speed_update_clocks = 0;
 }
 
 void System::SetFrameLimiter(bool on)
 {
   m_frame_limiter = on;
   m_reset_timer.Reset();
+  m_clock_base += m_clocks_since_reset;
   m_clocks_since_reset = 0;
   m_last_vblank_clocks = 0;
 
   m_speed_timer.Reset();
-  m_cycles_since_speed_update = 0;
+  m_speed_update_clocks = 0;
 }
 
 void System::SetAccurateTiming(bool on)
 {
   m_accurate_timing = on;
   m_reset_timer.Reset();
+  m_clock_base += m_clocks_since_reset;
   m_clocks_since_reset = 0;
   m_last_vblank_clocks = 0;
 
   m_speed_timer.Reset();
-  m_cycles_since_speed_update = 0;
+  m_speed_update_clocks = 0;
+}
+
+void System::SetScanlineOutputSliceSize(uint32 lines)
+{
+  m_scanline_slice_size = Min(lines, uint32(Display::SCREEN_HEIGHT));
+  if (m_scanline_slice_size > 0)
+    Log_InfoPrintf("Scanline output enabled (%u lines per slice).", m_scanline_slice_size);
+  else
+    Log_InfoPrintf("Scanline output disabled.");
 }
 
 bool System::GetAudioEnabled() const
@@ -535,10 +878,10 @@ bool System::LoadState(ByteStream* pStream, Error* pError)
   }
 
   // Read memory
-  binaryReader.ReadBytes(m_memory_vram, sizeof(m_memory_vram));
-  binaryReader.ReadBytes(m_memory_wram, sizeof(m_memory_wram));
-  binaryReader.ReadBytes(m_memory_oam, sizeof(m_memory_oam));
-  binaryReader.ReadBytes(m_memory_zram, sizeof(m_memory_zram));
+  binaryReader.ReadBytes(m_memory_vram, sizeof(m_memory->vram));
+  binaryReader.ReadBytes(m_memory_wram, sizeof(m_memory->wram));
+  binaryReader.ReadBytes(m_memory_oam, sizeof(m_memory->oam));
+  binaryReader.ReadBytes(m_memory_zram, sizeof(m_memory->zram));
 
   // Read registers
   m_vram_bank = binaryReader.ReadUInt8();
@@ -546,6 +889,11 @@ bool System::LoadState(ByteStream* pStream, Error* pError)
   m_reg_FF4C = binaryReader.ReadUInt8();
   m_reg_FF6C = binaryReader.ReadUInt8();
   m_memory_locked_cycles = binaryReader.ReadUInt32();
+  m_memory_locked_start = binaryReader.ReadUInt16();
+  m_memory_locked_end = binaryReader.ReadUInt16();
+  m_oam_dma_source_address = binaryReader.ReadUInt16();
+  m_oam_dma_bytes_copied = binaryReader.ReadUInt8();
+  bool oam_dma_active = binaryReader.ReadBool();
   m_timer_clocks = binaryReader.ReadUInt32();
   m_timer_divider_clocks = binaryReader.ReadUInt32();
   m_timer_divider = binaryReader.ReadUInt8();
@@ -555,6 +903,8 @@ bool System::LoadState(ByteStream* pStream, Error* pError)
   m_pad_row_select = binaryReader.ReadUInt8();
   m_pad_direction_state = binaryReader.ReadUInt8();
   m_pad_button_state = binaryReader.ReadUInt8();
+  m_clock_base = binaryReader.ReadUInt64() - m_clocks_since_reset;
+  ClearInputQueue(); // timestamps are relative to the timeline being replaced
   m_cgb_speed_switch = binaryReader.ReadUInt8();
   m_biosLatch = binaryReader.ReadBool();
   m_vramLocked = binaryReader.ReadBool();
@@ -574,6 +924,14 @@ bool System::LoadState(ByteStream* pStream, Error* pError)
     return false;
   }
 
+  // Resume OAM DMA transfer now that the cartridge banks are restored
+  m_oam_dma_source_pointer = nullptr;
+  if (oam_dma_active)
+  {
+    m_oam_dma_source_pointer = GetDMASourcePointer(m_oam_dma_source_address, OAM_DMA_LENGTH);
+    m_oam_dma_start_cycle = m_cycle_number - (uint32(m_oam_dma_bytes_copied) * 4);
+  }
+
   // Read CPU state
   if (!m_cpu->LoadState(pStream, binaryReader, pError))
     return false;
@@ -618,6 +976,12 @@ bool System::LoadState(ByteStream* pStream, Error* pError)
     return false;
   }
 
+  // the loaded state may be mid-boot, or past it
+  if (m_biosLatch && m_turbo_boot && m_bios != nullptr)
+    BeginTurboBoot();
+  else if (!m_biosLatch)
+    EndTurboBoot();
+
   // All good
   Log_DevPrintf("State loaded.");
   Log_ProfilePrintf("State load took %.4fms", loadTimer.GetTimeMilliseconds());
@@ -637,11 +1001,14 @@ bool System::SaveState(ByteStream* pStream)
   binaryWriter.WriteUInt8((uint8)m_current_mode);
   binaryWriter.WriteUInt32(m_frame_counter);
 
+  // Bring OAM up to date with any in-progress DMA transfer
+  SynchronizeOAMDMA();
+
   // Write memory
-  binaryWriter.WriteBytes(m_memory_vram, sizeof(m_memory_vram));
-  binaryWriter.WriteBytes(m_memory_wram, sizeof(m_memory_wram));
-  binaryWriter.WriteBytes(m_memory_oam, sizeof(m_memory_oam));
-  binaryWriter.WriteBytes(m_memory_zram, sizeof(m_memory_zram));
+  binaryWriter.WriteBytes(m_memory_vram, sizeof(m_memory->vram));
+  binaryWriter.WriteBytes(m_memory_wram, sizeof(m_memory->wram));
+  binaryWriter.WriteBytes(m_memory_oam, sizeof(m_memory->oam));
+  binaryWriter.WriteBytes(m_memory_zram, sizeof(m_memory->zram));
 
   // Write registers
   binaryWriter.WriteUInt8(m_vram_bank);
@@ -649,6 +1016,11 @@ bool System::SaveState(ByteStream* pStream)
   binaryWriter.WriteUInt8(m_reg_FF4C);
   binaryWriter.WriteUInt8(m_reg_FF6C);
   binaryWriter.WriteUInt32(m_memory_locked_cycles);
+  binaryWriter.WriteUInt16(m_memory_locked_start);
+  binaryWriter.WriteUInt16(m_memory_locked_end);
+  binaryWriter.WriteUInt16(m_oam_dma_source_address);
+  binaryWriter.WriteUInt8(m_oam_dma_bytes_copied);
+  binaryWriter.WriteBool(m_oam_dma_source_pointer != nullptr);
   binaryWriter.WriteUInt32(m_timer_clocks);
   binaryWriter.WriteUInt32(m_timer_divider_clocks);
   binaryWriter.WriteUInt8(m_timer_divider);
@@ -658,6 +1030,7 @@ bool System::SaveState(ByteStream* pStream)
   binaryWriter.WriteUInt8(m_pad_row_select);
   binaryWriter.WriteUInt8(m_pad_direction_state);
   binaryWriter.WriteUInt8(m_pad_button_state);
+  binaryWriter.WriteUInt64(GetEmulatedClocks());
   binaryWriter.WriteUInt8(m_cgb_speed_switch);
   binaryWriter.WriteBool(m_biosLatch);
   binaryWriter.WriteBool(m_vramLocked);
@@ -762,9 +1135,10 @@ void System::OAMDMATransfer(uint16 source_address)
   break;
   }
 
-  // Allow transfers from vram regardless of locking state.
-  // Is this correct?
-  bool vramLocked = m_vramLocked;
+  // A transfer started while another is in progress restarts it.
+  m_oam_dma_source_pointer = nullptr;
+  m_oam_dma_source_address = source_address;
+  m_oam_dma_bytes_copied = 0;
 
   if (source_address == 0xFE00)
   {
@@ -774,23 +1148,108 @@ void System::OAMDMATransfer(uint16 source_address)
   else if (source_address == 0xFF00)
   {
     // MMIO/ZRAM->OAM - copy zeros?
-    for (uint32 i = 0; i < 160; i++)
-      m_memory_oam[i] = 0;
+    Y_memzero(m_memory_oam, OAM_DMA_LENGTH);
   }
   else
   {
-    // slow but due to the ranges has to be done this way
-    // TODO: break this up for reads/writes when in progress
-    for (uint32 i = 0; i < 160; i++)
-      m_memory_oam[i] = CPURead(source_address + (uint16)i);
+    // Allow transfers from vram regardless of locking state.
+    // Is this correct?
+    const byte* source_pointer = GetDMASourcePointer(source_address, OAM_DMA_LENGTH);
+    if (source_pointer == nullptr)
+    {
+      // not directly addressable (bootstrap rom, disabled cart ram, rtc registers), fall back to bus reads
+      for (uint32 i = 0; i < OAM_DMA_LENGTH; i++)
+        m_memory_oam[i] = CPURead(source_address + (uint16)i);
+    }
+    else if (!m_accurate_oam_dma)
+    {
+      // copy the whole block up front
+      Y_memcpy(m_memory_oam, source_pointer, OAM_DMA_LENGTH);
+    }
+    else
+    {
+      // Copied lazily by SynchronizeOAMDMA() as the transfer progresses. The source is resolved here, so a bank
+      // switch during the transfer does not redirect the remaining bytes, unlike the real hardware.
+      m_oam_dma_source_pointer = source_pointer;
+      m_oam_dma_start_cycle = m_cycle_number;
+    }
   }
 
   // Stall memory access for ~160 microseconds
-  m_vramLocked = vramLocked;
-  m_memory_locked_cycles = 640;
+  m_memory_locked_cycles = OAM_DMA_LENGTH * 4;
   UpdateNextEventCycle();
 }
 
+const byte* System::GetDMASourcePointer(uint16 source_address, uint32 length) const
+{
+  // All regions start on a 4KB boundary, so a range within one 4KB page is contiguous.
+  if (((source_address & 0xFFF) + length) > 0x1000)
+    return nullptr;
+
+  switch (source_address & 0xF000)
+  {
+  case 0x0000:
+  case 0x1000:
+  case 0x2000:
+  case 0x3000:
+  case 0x4000:
+  case 0x5000:
+  case 0x6000:
+  case 0x7000:
+  case 0xA000:
+  case 0xB000:
+  {
+    // bootstrap rom is overlaid on the low pages while mapped
+    if (m_biosLatch && source_address < 0x0900)
+      return nullptr;
+
+    const byte* page = m_cartridge_read_map[source_address >> 12];
+    return (page != nullptr) ? (page + (source_address & 0xFFF)) : nullptr;
+  }
+
+  case 0x8000:
+  case 0x9000:
+    return &m_memory_vram[m_vram_bank][source_address & 0x1FFF];
+
+  case 0xC000:
+  case 0xE000:
+    return &m_memory_wram[0][source_address & 0xFFF];
+
+  case 0xD000:
+    return &m_memory_wram[m_high_wram_bank][source_address & 0xFFF];
+
+  case 0xF000:
+  {
+    if (source_address < 0xFE00)
+      return &m_memory_wram[m_high_wram_bank][source_address & 0xFFF];
+  }
+  break;
+  }
+
+  return nullptr;
+}
+
+void System::SynchronizeOAMDMA()
+{
+  if (m_oam_dma_source_pointer == nullptr)
+    return;
+
+  // One byte per m-cycle, the remainder is flushed once the lock expires.
+  uint32 target_bytes = OAM_DMA_LENGTH;
+  if (m_memory_locked_cycles > 0)
+    target_bytes = Min(CalculateDoubleSpeedCycleCount(m_oam_dma_start_cycle) / 4, OAM_DMA_LENGTH);
+
+  if (target_bytes > m_oam_dma_bytes_copied)
+  {
+    Y_memcpy(m_memory_oam + m_oam_dma_bytes_copied, m_oam_dma_source_pointer + m_oam_dma_bytes_copied,
+             target_bytes - m_oam_dma_bytes_copied);
+    m_oam_dma_bytes_copied = (uint8)target_bytes;
+  }
+
+  if (m_oam_dma_bytes_copied == OAM_DMA_LENGTH)
+    m_oam_dma_source_pointer = nullptr;
+}
+
 bool System::SwitchCGBSpeed()
 {
   if (!(m_cgb_speed_switch & (1 << 0)))
@@ -817,8 +1276,11 @@ bool System::SwitchCGBSpeed()
   m_display->Synchronize();
   m_audio->Synchronize();
   m_serial->Synchronize();
+  if (m_cartridge != nullptr)
+    m_cartridge->Synchronize();
   SynchronizeTimers();
   UpdateNextEventCycle();
+
   return true;
 }
 
@@ -828,14 +1290,217 @@ void System::ResetMemory()
   m_biosLatch = true;
 
   // zero all memory
-  Y_memzero(m_memory_vram, sizeof(m_memory_vram));
-  Y_memzero(m_memory_wram, sizeof(m_memory_wram));
-  Y_memzero(m_memory_oam, sizeof(m_memory_oam));
-  Y_memzero(m_memory_zram, sizeof(m_memory_zram));
-  Y_memzero(m_memory_ioreg, sizeof(m_memory_ioreg));
+  Y_memzero(m_memory_vram, sizeof(m_memory->vram));
+  Y_memzero(m_memory_wram, sizeof(m_memory->wram));
+  Y_memzero(m_memory_oam, sizeof(m_memory->oam));
+  Y_memzero(m_memory_zram, sizeof(m_memory->zram));
+  Y_memzero(m_memory_ioreg, sizeof(m_memory->ioreg));
 
   // pad
   m_pad_row_select = 0;
+
+  // cartridge windows are republished when the cartridge is reset
+  SetCartridgeMemoryMap(nullptr, nullptr, nullptr);
+}
+
+void System::SetCartridgeMemoryMap(const byte* rom0, const byte* romx, byte* ram)
+{
+  for (uint32 i = 0; i < 4; i++)
+  {
+    m_cartridge_read_map[0x0 + i] = (rom0 != nullptr) ? (rom0 + i * 0x1000) : nullptr;
+    m_cartridge_read_map[0x4 + i] = (romx != nullptr) ? (romx + i * 0x1000) : nullptr;
+  }
+  for (uint32 i = 0; i < 2; i++)
+  {
+    m_cartridge_read_map[0xA + i] = (ram != nullptr) ? (ram + i * 0x1000) : nullptr;
+    m_cartridge_write_map[0xA + i] = (ram != nullptr) ? (ram + i * 0x1000) : nullptr;
+  }
+}
+
+void System::CheatWriteMemory(uint16 address, uint8 value, uint8 wram_bank)
+{
+  if (address >= 0xA000 && address < 0xC000)
+  {
+    // only while the game has cart ram enabled
+    byte* page = m_cartridge_write_map[address >> 12];
+    if (page != nullptr && page[address & 0xFFF] != value)
+    {
+      page[address & 0xFFF] = value;
+      m_cartridge->m_external_ram_modified = true;
+    }
+  }
+  else if (address >= 0xC000 && address < 0xFE00)
+  {
+    // including the echo area
+    uint8 bank = ((address & 0x1000) == 0) ? 0 : ((wram_bank != 0) ? wram_bank : m_high_wram_bank);
+    m_memory_wram[bank][address & 0xFFF] = value;
+  }
+  else if (address >= 0xFF80 && address < 0xFFFF)
+  {
+    m_memory_zram[address - 0xFF80] = value;
+  }
+}
+
+const byte* System::GetDebugMemoryPointer(uint16 address, bool write, uint32* span) const
+{
+  uint32 next_page = (uint32(address) + 0x1000) & ~uint32(0xFFF);
+  switch (address & 0xF000)
+  {
+  case 0x0000:
+  case 0x1000:
+  case 0x2000:
+  case 0x3000:
+  case 0x4000:
+  case 0x5000:
+  case 0x6000:
+  case 0x7000:
+  {
+    if (write)
+      break;
+
+    // same overlay rules as CPURead, spans stop at the edges of the boot rom
+    bool bios_mapped = (m_current_mode == SYSTEM_MODE_DMG || m_current_mode == SYSTEM_MODE_CGB);
+    if (m_biosLatch && bios_mapped && address <= 0x08FF)
+    {
+      if (address <= 0x00FF)
+      {
+        *span = 0x100 - address;
+        return m_bios + address;
+      }
+      else if (m_current_mode == SYSTEM_MODE_CGB && address >= 0x0200)
+      {
+        *span = 0x900 - address;
+        return m_bios + 0x0100 + (address - 0x0200);
+      }
+
+      next_page = (m_current_mode == SYSTEM_MODE_CGB && address < 0x0200) ? 0x200 : next_page;
+    }
+
+    *span = next_page - address;
+    const byte* page = m_cartridge_read_map[address >> 12];
+    return (page != nullptr) ? (page + (address & 0xFFF)) : nullptr;
+  }
+
+  case 0x8000:
+  case 0x9000:
+    *span = 0xA000 - address;
+    return m_memory_vram[m_vram_bank] + (address & 0x1FFF);
+
+  case 0xA000:
+  case 0xB000:
+  {
+    // only while the game has cart ram enabled, rtc and other registers read as FF
+    *span = next_page - address;
+    const byte* page = write ? m_cartridge_write_map[address >> 12] : m_cartridge_read_map[address >> 12];
+    return (page != nullptr) ? (page + (address & 0xFFF)) : nullptr;
+  }
+
+  case 0xC000:
+  case 0xE000:
+    *span = next_page - address;
+    return m_memory_wram[0] + (address & 0xFFF);
+
+  case 0xD000:
+    *span = next_page - address;
+    return m_memory_wram[m_high_wram_bank] + (address & 0xFFF);
+
+  case 0xF000:
+  {
+    if (address < 0xFE00)
+    {
+      *span = 0xFE00 - address;
+      return m_memory_wram[m_high_wram_bank] + (address & 0xFFF);
+    }
+    else if (address < 0xFEA0)
+    {
+      *span = 0xFEA0 - address;
+      return m_memory_oam + (address - 0xFE00);
+    }
+    else if (address >= 0xFF80 && address < 0xFFFF)
+    {
+      *span = 0xFFFF - address;
+      return m_memory_zram + (address - 0xFF80);
+    }
+
+    // unusable oam and i/o, one byte at a time
+    *span = 1;
+    return nullptr;
+  }
+  }
+
+  *span = next_page - address;
+  return nullptr;
+}
+
+uint8 System::PeekMemory(uint16 address) const
+{
+  uint8 value;
+  PeekMemory(address, &value, 1);
+  return value;
+}
+
+void System::PeekMemory(uint16 address, void* buffer, uint32 length) const
+{
+  byte* destination = static_cast<byte*>(buffer);
+  while (length > 0)
+  {
+    uint32 span;
+    const byte* source = GetDebugMemoryPointer(address, false, &span);
+    span = Min(span, length);
+    if (source != nullptr)
+      Y_memcpy(destination, source, span);
+    else if (address == 0xFF0F)
+      *destination = m_cpu->GetRegisters()->IF;
+    else if (address == 0xFFFF)
+      *destination = m_cpu->GetRegisters()->IE;
+    else
+      Y_memset(destination, 0xFF, span);
+
+    destination += span;
+    address = uint16(address + span);
+    length -= span;
+  }
+}
+
+void System::PeekMemoryRanges(const MemoryRange* ranges, uint32 num_ranges) const
+{
+  for (uint32 i = 0; i < num_ranges; i++)
+    PeekMemory(ranges[i].address, ranges[i].buffer, ranges[i].length);
+}
+
+void System::PokeMemory(uint16 address, const void* buffer, uint32 length)
+{
+  const byte* source = static_cast<const byte*>(buffer);
+  while (length > 0)
+  {
+    // for writes the pointer is always into ram
+    uint32 span;
+    byte* destination = const_cast<byte*>(GetDebugMemoryPointer(address, true, &span));
+    span = Min(span, length);
+    if (destination != nullptr)
+    {
+      if (address >= 0xA000 && address < 0xC000 && !m_cartridge->m_external_ram_modified)
+        m_cartridge->m_external_ram_modified = (Y_memcmp(destination, source, span) != 0);
+
+      Y_memcpy(destination, source, span);
+
+      // the vram span never crosses 0xA000, and is in the currently selected bank
+      if (address >= 0x8000 && address < 0xA000)
+        m_display->MarkVRAMDirty(m_vram_bank, address & 0x1FFF, span);
+    }
+    else if (address == 0xFF0F)
+    {
+      m_cpu->SetInterruptFlags(*source);
+    }
+    else if (address == 0xFFFF)
+    {
+      m_cpu->SetInterruptEnable(*source);
+    }
+
+    source += span;
+    address = uint16(address + span);
+    length -= span;
+  }
 }
 
 void System::ResetTimer()
@@ -854,6 +1519,9 @@ void System::ResetPad()
   m_pad_row_select = 0x30;      // neither selected
   m_pad_direction_state = 0x0F; // nothing down
   m_pad_button_state = 0x0F;    // nothing down
+
+  // anything still queued was meant for the old state
+  ClearInputQueue();
 }
 
 void System::SetPostBootstrapState()
@@ -1024,7 +1692,11 @@ uint8 System::CPURead(uint16 address)
       }
     }
 
-    // Cart read
+    // Cart read, registers and unmapped ram go through the mapper
+    const byte* page = m_cartridge_read_map[address >> 12];
+    if (page != nullptr)
+      return page[address & 0xFFF];
+
     return (m_cartridge != nullptr) ? m_cartridge->CPURead(address) : 0x00;
   }
 
@@ -1080,6 +1752,7 @@ uint8 System::CPURead(uint16 address)
     case 0xE00:
     {
       m_display->Synchronize();
+      SynchronizeOAMDMA();
       if (m_oamLocked && !m_memory_permissive)
       {
         // Apparently returns 0xFF?
@@ -1146,6 +1819,19 @@ void System::CPUWrite(uint16 address, uint8 value)
   case 0xA000:
   case 0xB000:
   {
+    // Cart ram, registers and unmapped ram go through the mapper
+    byte* page = m_cartridge_write_map[address >> 12];
+    if (page != nullptr)
+    {
+      if (page[address & 0xFFF] != value)
+      {
+        page[address & 0xFFF] = value;
+        m_cartridge->m_external_ram_modified = true;
+      }
+
+      return;
+    }
+
     if (m_cartridge != nullptr)
       m_cartridge->CPUWrite(address, value);
 
@@ -1171,6 +1857,8 @@ void System::CPUWrite(uint16 address, uint8 value)
     //             }
 
     m_memory_vram[m_vram_bank][address & 0x1FFF] = value;
+    if (m_display->IsVRAMTrackingEnabled())
+      m_display->MarkVRAMDirty(m_vram_bank, address & 0x1FFF, 1);
     return;
   }
 
@@ -1215,6 +1903,7 @@ void System::CPUWrite(uint16 address, uint8 value)
     case 0xE00:
     {
       m_display->Synchronize();
+      SynchronizeOAMDMA();
       if (m_oamLocked && !m_memory_permissive)
       {
         // Apparently returns 0xFF?
@@ -1559,7 +2248,7 @@ void System::CPUWriteIORegister(uint8 index, uint8 value)
       m_serial->Synchronize();
       m_display->Synchronize();
       SynchronizeTimers();
-      m_cpu->GetRegisters()->IF = value;
+      m_cpu->SetInterruptFlags(value);
       return;
     }
 
@@ -1680,6 +2369,8 @@ void System::CPUWriteIORegister(uint8 index, uint8 value)
     {
     case 0x00: // FF00 - BIOS enable/disable latch
       m_biosLatch = (value == 0);
+      if (!m_biosLatch)
+        EndTurboBoot();
 
       // 0x4C is set to 0x04 for CGB-in-DMG mode, 0xC0 otherwise.
       if (m_boot_mode == SYSTEM_MODE_CGB)
@@ -1696,7 +2387,7 @@ void System::CPUWriteIORegister(uint8 index, uint8 value)
     {
     case 0x0F:
       // F0-FE is high ram below, FF = interrupt flag
-      m_cpu->GetRegisters()->IE = value;
+      m_cpu->SetInterruptEnable(value);
       return;
     }
 
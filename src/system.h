@@ -1,7 +1,9 @@
 #pragma once
 #include "YBaseLib/Common.h"
 #include "YBaseLib/Timer.h"
+#include "memory_arena.h"
 #include "structures.h"
+#include <vector>
 
 class ByteStream;
 class BinaryReader;
@@ -13,6 +15,12 @@ class Display;
 class Audio;
 class Serial;
 class Cartridge;
+class CheatEngine;
+class InputMovie;
+class RenderReplay;
+
+// host cache line size, the hot members of System are aligned to this
+#define CACHE_LINE_SIZE (64)
 
 class System
 {
@@ -21,6 +29,8 @@ class System
   friend Audio;
   friend Cartridge;
   friend Serial;
+  friend CheatEngine;
+  friend RenderReplay;
 
 public:
   struct CallbackInterface
@@ -28,17 +38,30 @@ public:
     // Display updated callback.
     virtual void PresentDisplayBuffer(const void* pPixels, uint32 row_stride) = 0;
 
+    // Partial display update callback, invoked as each slice of scanlines finishes rendering.
+    // Only called when scanline output is enabled. pPixels points to the first line of the slice.
+    virtual void PresentDisplayScanlines(const void* pPixels, uint32 row_stride, uint32 first_line, uint32 num_lines)
+    {
+    }
+
     // Cartridge external ram callbacks.
     virtual bool LoadCartridgeRAM(void* pData, size_t expected_data_size) = 0;
     virtual void SaveCartridgeRAM(const void* pData, size_t data_size) = 0;
     virtual bool LoadCartridgeRTC(void* pData, size_t expected_data_size) = 0;
     virtual void SaveCartridgeRTC(const void* pData, size_t data_size) = 0;
+
+    // Byte clocked out on the internal clock with no link peer connected. Test roms print their results this way.
+    virtual void SerialDataSent(uint8 value) {}
   };
 
 public:
   System(CallbackInterface* callbacks);
   ~System();
 
+  // the hot state is cache line aligned, which plain new doesn't guarantee before c++17
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr);
+
   SYSTEM_MODE GetBootMode() const { return m_boot_mode; }
   SYSTEM_MODE GetCurrentMode() const { return m_current_mode; }
   bool InDMGMode() const { return (m_current_mode == SYSTEM_MODE_DMG); }
@@ -51,6 +74,7 @@ public:
   Serial* GetSerial() const { return m_serial; }
 
   Cartridge* GetCartridge() const { return m_cartridge; }
+  CheatEngine* GetCheatEngine() const { return m_cheat_engine; }
 
   bool Init(SYSTEM_MODE mode, const byte* bios, uint32 bios_length, Cartridge* cartridge);
   void Reset();
@@ -60,6 +84,13 @@ public:
   bool GetPaused() const { return m_paused; }
   void SetPaused(bool paused);
 
+  // waiting on the link peer's answer to a transfer, Step() polls for it
+  bool GetSerialPause() const { return m_serial_pause; }
+
+  // Runs until target_clocks (in the same units as GetClocksSinceReset), a frame completes, the link pauses the
+  // system or turbo boot finishes, whichever comes first.
+  void RunUntil(uint64 target_clocks);
+
   // Returns the number of seconds to sleep for.
   double ExecuteFrame();
 
@@ -70,9 +101,48 @@ public:
   void SetPadButton(PAD_BUTTON button, bool state);
   void SetPadButtonState(uint8 state);
 
+  // currently pressed directions/buttons, a set bit is pressed
+  uint8 GetPadDirectionState() const { return m_pad_direction_state; }
+  uint8 GetPadButtonState() const { return m_pad_button_state; }
+
+  // Timestamped pad input. Each event holds the pressed directions/buttons from its clock onwards (in
+  // GetEmulatedClocks units), and is applied when execution reaches that clock, raising the joypad interrupt there
+  // rather than at the start of the next frame. Events for clocks already passed are applied straight away.
+  struct InputEvent
+  {
+    uint64 clock;
+    uint8 direction_state;
+    uint8 button_state;
+  };
+  void QueueInputEvent(const InputEvent& event);
+  void ClearInputQueue();
+
+  // Queues a change on top of everything already queued, which happened host_seconds_ago. While emulation is paced
+  // against the host clock (frame limiter and accurate timing), this is mapped onto the matching emulated clock.
+  // Returns the clock the change is applied at.
+  uint64 QueuePadDirection(PAD_DIRECTION direction, bool state, double host_seconds_ago);
+  uint64 QueuePadButton(PAD_BUTTON button, bool state, double host_seconds_ago);
+
+  // Average distance between host input events' timestamps and the clocks they were applied at, against what it
+  // would have been had they been applied when queued, in milliseconds. Resets the counts.
+  uint32 GetInputTimingStatistics(double* queued_error_ms, double* immediate_error_ms);
+
+  // records every pad change applied from the queue, can be null
+  void SetInputRecorder(InputMovie* movie) { m_input_recorder = movie; }
+
+  // Feeds a movie's events into the queue a few at a time as execution reaches them, until the queue is cleared.
+  // The movie must outlive playback, null stops it.
+  void SetInputPlayback(const InputMovie* movie);
+
   // frame number
   uint32 GetFrameCounter() const { return m_frame_counter; }
 
+  // single speed clocks since the last reset of frame pacing
+  uint64 GetClocksSinceReset() const { return m_clocks_since_reset; }
+
+  // single speed clocks since the system was reset, not restarted by frame pacing and kept in save states
+  uint64 GetEmulatedClocks() const { return m_clock_base + m_clocks_since_reset; }
+
   // current speed
   void CalculateCurrentSpeed();
   float GetCurrentSpeed() const { return m_current_speed; }
@@ -90,10 +160,32 @@ public:
   bool GetAccurateTiming() const { return m_accurate_timing; }
   void SetAccurateTiming(bool on);
 
+  // cycle-accurate OAM DMA, transfers one byte per m-cycle instead of all at once
+  bool GetAccurateOAMDMA() const { return m_accurate_oam_dma; }
+  void SetAccurateOAMDMA(bool on) { m_accurate_oam_dma = on; }
+
+  // turbo boot, runs the boot rom unthrottled without rendering or audio until it unmaps itself
+  bool GetTurboBoot() const { return m_turbo_boot; }
+  void SetTurboBoot(bool on);
+  bool IsTurboBootActive() const { return m_turbo_boot_active; }
+
+  // true while the boot rom is overlaid on the cartridge
+  bool IsBootROMMapped() const { return m_biosLatch; }
+
+  // LD B,B breakpoint used by test roms, stops RunUntil and sets the hit flag until it is cleared
+  bool GetMagicBreakpointEnabled() const { return m_magic_breakpoint; }
+  void SetMagicBreakpointEnabled(bool on) { m_magic_breakpoint = on; }
+  bool HasHitMagicBreakpoint() const { return m_magic_breakpoint_hit; }
+  void ClearMagicBreakpointHit() { m_magic_breakpoint_hit = false; }
+
   // permissive memory access
   bool GetPermissiveMemoryAccess() const { return m_memory_permissive; }
   void SetPermissiveMemoryAccess(bool on) { m_memory_permissive = on; }
 
+  // scanline output, number of lines per slice passed to PresentDisplayScanlines, 0 = disabled
+  uint32 GetScanlineOutputSliceSize() const { return m_scanline_slice_size; }
+  void SetScanlineOutputSliceSize(uint32 lines);
+
   // audio enable/disable
   bool GetAudioEnabled() const;
   void SetAudioEnabled(bool enabled);
@@ -102,6 +194,20 @@ public:
   bool LoadState(ByteStream* pStream, Error* pError);
   bool SaveState(ByteStream* pStream);
 
+  // Debug memory access for tools, the debugger and the disassembler. Addresses are resolved against the current
+  // bank mapping and copied in bulk, without synchronizing, obeying locks, logging or register side effects.
+  // I/O registers other than IF and IE, mapper registers and unusable oam read as FF and ignore pokes, as does rom.
+  struct MemoryRange
+  {
+    uint16 address;
+    uint32 length;
+    void* buffer;
+  };
+  uint8 PeekMemory(uint16 address) const;
+  void PeekMemory(uint16 address, void* buffer, uint32 length) const;
+  void PeekMemoryRanges(const MemoryRange* ranges, uint32 num_ranges) const;
+  void PokeMemory(uint16 address, const void* buffer, uint32 length);
+
 private:
   // cpu view of memory
   uint8 CPURead(uint16 address);
@@ -130,6 +236,8 @@ private:
 
   // OAM DMA Transfer
   void OAMDMATransfer(uint16 source_address);
+  const byte* GetDMASourcePointer(uint16 source_address, uint32 length) const;
+  void SynchronizeOAMDMA();
 
   // CGB Speed Switch
   bool SwitchCGBSpeed();
@@ -137,6 +245,9 @@ private:
   // serial pause
   void SetSerialPause(bool enabled);
 
+  // restart frame limiting from the current clock, after the clock has been run without it
+  void ResetPacing();
+
   // trigger OAM bug if all conditions are met
   void TriggerOAMBug();
 
@@ -164,6 +275,11 @@ private:
     m_next_timer_sync_cycle = m_cycle_number + cycles;
     UpdateNextEventCycle();
   }
+  void SetNextCartridgeSyncCycle(uint32 cycles)
+  {
+    m_next_cartridge_sync_cycle = m_cycle_number + (cycles << GetDoubleSpeedDivider());
+    UpdateNextEventCycle();
+  }
   void UpdateNextEventCycle();
 
   // helper to calculate difference
@@ -186,67 +302,130 @@ private:
   void ResetMemory();
   void ResetTimer();
   void ResetPad();
+  struct QueuedInputEvent;
+  InputEvent GetLastQueuedInput() const;
+  void InsertInputEvent(const QueuedInputEvent& queued);
+  void QueuePlaybackEvents();
+  uint64 QueueHostInputEvent(const InputEvent& event, double host_seconds_ago);
+  void ApplyInputEvent(const InputEvent& event);
   void SetPostBootstrapState();
+  void BeginTurboBoot();
+  void EndTurboBoot();
   void SynchronizeTimers();
+  void SetCartridgeMemoryMap(const byte* rom0, const byte* romx, byte* ram);
+
+  // backing memory for a debug access, and the number of contiguous bytes it covers from address
+  // returns nullptr where there is no plain memory, or for writes, no ram
+  const byte* GetDebugMemoryPointer(uint16 address, bool write, uint32* span) const;
+
+  // cheat ram write, bypassing locks and i/o side effects. wram_bank of zero uses the current bank.
+  void CheatWriteMemory(uint16 address, uint8 value, uint8 wram_bank);
   void ScheduleTimerSynchronization();
   void DisassembleCart(const char* outfile);
   uint64 TimeToClocks(double time);
   double ClocksToTime(uint64 clocks);
 
+  // Hot state, touched by every instruction or memory access. The cpu is constructed in place at the front of the
+  // object, so its registers and the scalar state after them fill three cache lines. Everything after the page maps
+  // is used on events, per frame or less.
+  static const uint32 CPU_STORAGE_SIZE = 48;
+  alignas(CACHE_LINE_SIZE) byte m_cpu_storage[CPU_STORAGE_SIZE];
+  uint32 m_cycle_number;
+  int32 m_next_event_cycle;
+  uint64 m_clocks_since_reset;
+  CPU* m_cpu;
+
+  // when doing DMA transfer, locked memory # cycles
+  uint32 m_memory_locked_cycles;
+  uint16 m_memory_locked_start;
+  uint16 m_memory_locked_end;
+
+  uint8 m_vram_bank;
+  uint8 m_high_wram_bank;
+
+  // cgb speed switch
+  uint8 m_cgb_speed_switch;
+
+  bool m_event;
+  bool m_stop_execution;
+  bool m_serial_pause;
+  bool m_memory_permissive;
+  bool m_biosLatch;
+  bool m_vramLocked;
+  bool m_oamLocked;
+
+  Cartridge* m_cartridge;
+  const byte* m_bios;
+
+  // internal memory, pointers into m_memory
+  byte (*m_memory_vram)[0x2000];
+  byte (*m_memory_wram)[0x1000];
+  byte* m_memory_oam;
+  byte* m_memory_zram;
+  byte* m_memory_ioreg;
+
+  // cartridge windows published by the mapper, one entry per 4KB page
+  // null pages, and writes to rom, go through the cartridge
+  // in their own lines, so a cartridge access pulls in one line of the maps rather than sharing the scalars' lines
+  alignas(CACHE_LINE_SIZE) const byte* m_cartridge_read_map[16];
+  byte* m_cartridge_write_map[16];
+
+  // end of hot state
   SYSTEM_MODE m_boot_mode;
   SYSTEM_MODE m_current_mode;
-  CPU* m_cpu;
   Display* m_display;
   Audio* m_audio;
   Serial* m_serial;
 
   CallbackInterface* m_callbacks;
-  Cartridge* m_cartridge;
-  const byte* m_bios;
+  CheatEngine* m_cheat_engine;
   uint32 m_bios_length;
 
   // synchronization
-  uint32 m_cycle_number;
   uint32 m_last_sync_cycle;
   uint32 m_next_display_sync_cycle;
   uint32 m_next_audio_sync_cycle;
   uint32 m_next_serial_sync_cycle;
   uint32 m_next_timer_sync_cycle;
-  int32 m_next_event_cycle;
-  bool m_event;
-
-  Timer m_speed_timer;
-  uint64 m_cycles_since_speed_update;
-  uint32 m_frames_since_speed_update;
-  float m_current_speed;
-  float m_current_fps;
+  uint32 m_next_cartridge_sync_cycle;
 
-  Timer m_reset_timer;
-  uint64 m_clocks_since_reset;
   uint64 m_last_vblank_clocks;
   float m_speed_multiplier;
   uint32 m_frame_counter;
   bool m_frame_limiter;
   bool m_accurate_timing;
+  uint32 m_scanline_slice_size;
   bool m_paused;
-  bool m_serial_pause;
+  bool m_magic_breakpoint;
+  bool m_magic_breakpoint_hit;
+
+  // turbo boot, audio output state is restored once the boot rom finishes
+  bool m_turbo_boot;
+  bool m_turbo_boot_active;
+  bool m_turbo_boot_audio_enabled;
+
+  // internal memory, kept in its own arena rather than inline between the hot members
+  struct InternalMemory
+  {
+    byte vram[2][0x2000];
+    byte wram[8][0x1000]; // 8 banks of 4KB each in CGB mode
+    byte oam[0xFF];
+    byte zram[127];
+    byte ioreg[256];
+  };
+  MemoryArena m_memory_arena;
+  InternalMemory* m_memory;
 
-  // bios, rom banks 0-1
-  byte m_memory_vram[2][0x2000];
-  byte m_memory_wram[8][0x1000]; // 8 banks of 4KB each in CGB mode
-  byte m_memory_oam[0xFF];
-  byte m_memory_zram[127];
-  byte m_memory_ioreg[256];
-  uint8 m_vram_bank;
-  uint8 m_high_wram_bank;
   uint8 m_reg_FF4C;
   uint8 m_reg_FF6C;
 
-  // when doing DMA transfer, locked memory # cycles
-  uint32 m_memory_locked_cycles;
-  uint16 m_memory_locked_start;
-  uint16 m_memory_locked_end;
-  bool m_memory_permissive;
+  // in-progress OAM DMA transfer, source is null when no transfer is active
+  // the source bank is fixed when the transfer starts, bytes are read when they are caught up to
+  const byte* m_oam_dma_source_pointer;
+  uint32 m_oam_dma_start_cycle;
+  uint16 m_oam_dma_source_address;
+  uint8 m_oam_dma_bytes_copied;
+  bool m_accurate_oam_dma;
 
   // timer
   uint32 m_timer_last_cycle;
@@ -262,10 +441,35 @@ private:
   uint8 m_pad_direction_state;
   uint8 m_pad_button_state;
 
-  // cgb speed switch
-  uint8 m_cgb_speed_switch;
-
-  bool m_biosLatch;
-  bool m_vramLocked;
-  bool m_oamLocked;
+  // Queued input, a fixed ring in clock order starting at m_input_queue_head, and what the clocks since reset started
+  // from. Nothing is allocated while queueing. Movie playback keeps half the ring topped up, leaving the rest for
+  // host and control input.
+  // Host events also keep the clock their timestamp mapped to and the clock they were queued at, for statistics.
+  struct QueuedInputEvent
+  {
+    InputEvent event;
+    uint64 host_clock;
+    uint64 queue_clock;
+    bool from_host;
+  };
+  static const uint32 INPUT_QUEUE_SIZE = 64;
+  QueuedInputEvent m_input_queue[INPUT_QUEUE_SIZE];
+  uint32 m_input_queue_head;
+  uint32 m_input_queue_count;
+  uint64 m_clock_base;
+  InputMovie* m_input_recorder;
+  const InputMovie* m_input_playback;
+  uint32 m_input_playback_index;
+  uint32 m_input_timing_events;
+  double m_input_queued_error_ms;
+  double m_input_immediate_error_ms;
+
+  // statistics and timers, only read once per frame or less
+  Timer m_reset_timer;
+  Timer m_speed_timer;
+  Timer m_turbo_boot_timer;
+  uint64 m_speed_update_clocks;
+  uint32 m_frames_since_speed_update;
+  float m_current_speed;
+  float m_current_fps;
 };
@@ -0,0 +1,375 @@
+#include "test_runner.h"
+#include "YBaseLib/ByteStream.h"
+#include "YBaseLib/Error.h"
+#include "YBaseLib/FileSystem.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/Timer.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "headless.h"
+#include "system.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+Log_SetChannel(TestRunner);
+
+// one frame's worth of clocks, results are checked once per frame
+static const uint64 FRAME_CLOCKS = 70224;
+static const uint32 FRAMES_PER_SECOND = 60;
+
+// blargg's cart ram result block
+static const uint16 BLARGG_STATUS_ADDRESS = 0xA000;
+static const uint8 BLARGG_STATUS_RUNNING = 0x80;
+static const uint8 BLARGG_SIGNATURE[3] = {0xDE, 0xB0, 0x61};
+static const uint32 BLARGG_MAX_MESSAGE_LENGTH = 1024;
+
+// mooneye's registers at the breakpoint
+static const uint8 MOONEYE_PASS_REGISTERS[6] = {3, 5, 8, 13, 21, 34};
+
+static const char* RESULT_NAMES[] = {"passed", "failed", "timeout", "error"};
+
+static bool HasROMExtension(const char* path)
+{
+  const char* extension = Y_strrchr(path, '.');
+  return (extension != nullptr &&
+          (!Y_stricmp(extension, ".gb") || !Y_stricmp(extension, ".gbc") || !Y_stricmp(extension, ".sgb")));
+}
+
+// collects serial output
+class TestSession : public HeadlessCallbacks
+{
+public:
+  TestSession() : serial_updated(false) {}
+
+  String serial_output;
+  bool serial_updated;
+
+  void SerialDataSent(uint8 value) override final
+  {
+    serial_output.AppendCharacter(static_cast<char>(value));
+    serial_updated = true;
+  }
+};
+
+// returns true once the rom has reported a result
+static bool CheckTestResult(System* system, TestSession* session, TestRunner::Test* test)
+{
+  if (system->HasHitMagicBreakpoint())
+  {
+    const CPU::Registers* registers = system->GetCPU()->GetRegisters();
+    uint8 values[6] = {registers->B, registers->C, registers->D, registers->E, registers->H, registers->L};
+    test->result = (Y_memcmp(values, MOONEYE_PASS_REGISTERS, sizeof(values)) == 0) ? TestRunner::RESULT_PASSED :
+                                                                                       TestRunner::RESULT_FAILED;
+    test->message.Format("LD B,B breakpoint at $%04X, B=%02X C=%02X D=%02X E=%02X H=%02X L=%02X",
+                         registers->PC - 1, values[0], values[1], values[2], values[3], values[4], values[5]);
+    return true;
+  }
+
+  // reads back as FF while cart ram is disabled
+  uint8 status[4];
+  system->PeekMemory(BLARGG_STATUS_ADDRESS, status, sizeof(status));
+  if (Y_memcmp(status + 1, BLARGG_SIGNATURE, sizeof(BLARGG_SIGNATURE)) == 0 && status[0] != BLARGG_STATUS_RUNNING)
+  {
+    char text[BLARGG_MAX_MESSAGE_LENGTH + 1];
+    system->PeekMemory(BLARGG_STATUS_ADDRESS + 4, text, BLARGG_MAX_MESSAGE_LENGTH);
+    text[BLARGG_MAX_MESSAGE_LENGTH] = '\0';
+    for (uint32 length = Y_strlen(text); length > 0 && (text[length - 1] == '\n' || text[length - 1] == ' '); length--)
+      text[length - 1] = '\0';
+
+    test->result = (status[0] == 0) ? TestRunner::RESULT_PASSED : TestRunner::RESULT_FAILED;
+    test->message.Format("Result %02X: %s", status[0], text);
+    return true;
+  }
+
+  if (session->serial_updated)
+  {
+    session->serial_updated = false;
+    if (Y_strstr(session->serial_output, "Passed") != nullptr)
+    {
+      test->result = TestRunner::RESULT_PASSED;
+      test->message = "Serial output reports passed";
+      return true;
+    }
+    else if (Y_strstr(session->serial_output, "Failed") != nullptr)
+    {
+      test->result = TestRunner::RESULT_FAILED;
+      test->message = "Serial output reports failed";
+      return true;
+    }
+  }
+
+  return false;
+}
+
+TestRunner::TestRunner() : m_total_runtime(0.0) {}
+
+TestRunner::~TestRunner() {}
+
+uint32 TestRunner::GetResultCount(RESULT result) const
+{
+  uint32 count = 0;
+  for (const Test& test : m_tests)
+    count += (test.result == result) ? 1 : 0;
+  return count;
+}
+
+bool TestRunner::AddTests(const char* path, Error* pError)
+{
+  std::vector<String> filenames;
+  if (HasROMExtension(path))
+  {
+    filenames.emplace_back(path);
+  }
+  else
+  {
+    FileSystem::FindResultsArray results;
+    if (!FileSystem::FindFiles(path, "*", FILESYSTEM_FIND_FILES | FILESYSTEM_FIND_RECURSIVE, &results))
+    {
+      pError->SetErrorUserFormatted(1, "Failed to enumerate '%s'", path);
+      return false;
+    }
+
+    for (uint32 i = 0; i < results.GetSize(); i++)
+    {
+      if (HasROMExtension(results[i].FileName))
+        filenames.emplace_back(results[i].FileName);
+    }
+
+    // stable report order regardless of directory order
+    std::sort(filenames.begin(), filenames.end(),
+              [](const String& lhs, const String& rhs) { return (Y_strcmp(lhs, rhs) < 0); });
+  }
+
+  for (const String& filename : filenames)
+  {
+    Test test;
+    test.filename = filename;
+    test.result = RESULT_ERROR;
+    test.frames = 0;
+    test.runtime = 0.0;
+    m_tests.push_back(std::move(test));
+  }
+
+  return true;
+}
+
+void TestRunner::RunTest(Test* test, SYSTEM_MODE mode, uint32 timeout_frames)
+{
+  Timer timer;
+  TestSession session;
+  System* system = new System(&session);
+  Cartridge* cartridge = new Cartridge(system);
+
+  Error error;
+  ByteStream* pStream = FileSystem::OpenFile(test->filename, BYTESTREAM_OPEN_READ | BYTESTREAM_OPEN_STREAMED);
+  if (pStream == nullptr)
+  {
+    test->message.Format("Could not open '%s'", test->filename.GetCharArray());
+  }
+  else
+  {
+    bool loaded = cartridge->Load(pStream, &error);
+    pStream->Release();
+    if (!loaded)
+      test->message = error.GetErrorDescription();
+    else if (!system->Init(mode, nullptr, 0, cartridge))
+      test->message = "Failed to initialize system";
+    else
+      test->result = RESULT_TIMEOUT;
+  }
+
+  if (test->result == RESULT_TIMEOUT)
+  {
+    SetupHeadlessSystem(system, cartridge);
+    system->SetMagicBreakpointEnabled(true);
+
+    for (; test->frames < timeout_frames; test->frames++)
+    {
+      uint64 target_clocks = system->GetClocksSinceReset() + FRAME_CLOCKS;
+      while (system->GetClocksSinceReset() < target_clocks && !system->HasHitMagicBreakpoint())
+        system->RunUntil(target_clocks);
+
+      if (CheckTestResult(system, &session, test))
+        break;
+    }
+
+    if (test->result == RESULT_TIMEOUT)
+      test->message.Format("No result after %u frames", timeout_frames);
+  }
+
+  test->serial_output = session.serial_output;
+  test->runtime = timer.GetTimeSeconds();
+  delete system;
+  delete cartridge;
+
+  Log_InfoPrintf("%s: %s (%.2f seconds, %u frames) %s", RESULT_NAMES[test->result], test->filename.GetCharArray(),
+                 test->runtime, test->frames, test->message.GetCharArray());
+}
+
+void TestRunner::Run(SYSTEM_MODE mode, uint32 timeout_seconds, uint32 num_threads)
+{
+  Timer timer;
+  uint32 timeout_frames = timeout_seconds * FRAMES_PER_SECOND;
+
+  // each worker pulls the next rom until the list is exhausted
+  if (num_threads == 0)
+    num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  num_threads = std::max(std::min(num_threads, GetTestCount()), 1u);
+  Log_InfoPrintf("Running %u test roms on %u threads...", GetTestCount(), num_threads);
+
+  std::atomic<size_t> next_test(0);
+  auto worker = [this, &next_test, mode, timeout_frames]() {
+    for (;;)
+    {
+      size_t index = next_test.fetch_add(1);
+      if (index >= m_tests.size())
+        break;
+
+      RunTest(&m_tests[index], mode, timeout_frames);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (uint32 i = 1; i < num_threads; i++)
+    threads.emplace_back(worker);
+  worker();
+  for (std::thread& thread : threads)
+    thread.join();
+
+  m_total_runtime = timer.GetTimeSeconds();
+  Log_InfoPrintf("%u passed, %u failed, %u timed out, %u errors in %.2f seconds", GetResultCount(RESULT_PASSED),
+                 GetResultCount(RESULT_FAILED), GetResultCount(RESULT_TIMEOUT), GetResultCount(RESULT_ERROR),
+                 m_total_runtime);
+}
+
+static void AppendEscapedXML(String& out, const char* text)
+{
+  for (; *text != '\0'; text++)
+  {
+    switch (*text)
+    {
+    case '<':
+      out.AppendString("&lt;");
+      break;
+    case '>':
+      out.AppendString("&gt;");
+      break;
+    case '&':
+      out.AppendString("&amp;");
+      break;
+    case '"':
+      out.AppendString("&quot;");
+      break;
+    default:
+      // control characters aren't allowed in xml 1.0, even escaped
+      if (static_cast<uint8>(*text) >= 0x20 || *text == '\n' || *text == '\r' || *text == '\t')
+        out.AppendCharacter(*text);
+      else
+        out.AppendFormattedString("\\x%02X", static_cast<uint8>(*text));
+      break;
+    }
+  }
+}
+
+static void AppendEscapedJSON(String& out, const char* text)
+{
+  out.AppendCharacter('"');
+  for (; *text != '\0'; text++)
+  {
+    if (*text == '"' || *text == '\\')
+    {
+      out.AppendCharacter('\\');
+      out.AppendCharacter(*text);
+    }
+    else if (*text == '\n')
+    {
+      out.AppendString("\\n");
+    }
+    else if (static_cast<uint8>(*text) < 0x20 || static_cast<uint8>(*text) >= 0x80)
+    {
+      // serial output is arbitrary bytes, not utf-8
+      out.AppendFormattedString("\\u%04x", static_cast<uint8>(*text));
+    }
+    else
+    {
+      out.AppendCharacter(*text);
+    }
+  }
+  out.AppendCharacter('"');
+}
+
+static bool WriteReport(const char* filename, const String& report, Error* pError)
+{
+  ByteStream* pStream = FileSystem::OpenFile(filename, BYTESTREAM_OPEN_CREATE | BYTESTREAM_OPEN_CREATE_PATH |
+                                                         BYTESTREAM_OPEN_WRITE | BYTESTREAM_OPEN_TRUNCATE |
+                                                         BYTESTREAM_OPEN_STREAMED | BYTESTREAM_OPEN_ATOMIC_UPDATE);
+  if (pStream == nullptr)
+  {
+    pError->SetErrorUserFormatted(1, "Could not open '%s'", filename);
+    return false;
+  }
+
+  if (!pStream->Write2(report.GetCharArray(), report.GetLength()) || !pStream->Commit())
+  {
+    pError->SetErrorUserFormatted(1, "Failed to write '%s'", filename);
+    pStream->Discard();
+    pStream->Release();
+    return false;
+  }
+
+  pStream->Release();
+  return true;
+}
+
+bool TestRunner::WriteJUnitXML(const char* filename, Error* pError) const
+{
+  // timeouts and load errors are errors, wrong results are failures
+  String report;
+  report.AppendString("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  report.AppendFormattedString("<testsuite name=\"gbe\" tests=\"%u\" failures=\"%u\" errors=\"%u\" time=\"%.3f\">\n",
+                               GetTestCount(), GetResultCount(RESULT_FAILED),
+                               GetResultCount(RESULT_TIMEOUT) + GetResultCount(RESULT_ERROR), m_total_runtime);
+  for (const Test& test : m_tests)
+  {
+    report.AppendString("  <testcase name=\"");
+    AppendEscapedXML(report, test.filename);
+    report.AppendFormattedString("\" time=\"%.3f\">\n", test.runtime);
+    if (test.result != RESULT_PASSED)
+    {
+      report.AppendString((test.result == RESULT_FAILED) ? "    <failure message=\"" : "    <error message=\"");
+      AppendEscapedXML(report, test.message);
+      report.AppendString("\"/>\n");
+    }
+    if (!test.serial_output.IsEmpty())
+    {
+      report.AppendString("    <system-out>");
+      AppendEscapedXML(report, test.serial_output);
+      report.AppendString("</system-out>\n");
+    }
+    report.AppendString("  </testcase>\n");
+  }
+  report.AppendString("</testsuite>\n");
+
+  return WriteReport(filename, report, pError);
+}
+
+bool TestRunner::WriteJSON(const char* filename, Error* pError) const
+{
+  String report;
+  report.AppendFormattedString("{\n  \"total_time\": %.3f,\n  \"tests\": [\n", m_total_runtime);
+  for (size_t i = 0; i < m_tests.size(); i++)
+  {
+    const Test& test = m_tests[i];
+    report.AppendString("    {\"filename\": ");
+    AppendEscapedJSON(report, test.filename);
+    report.AppendFormattedString(", \"result\": \"%s\", \"time\": %.3f, \"frames\": %u, \"message\": ",
+                                 RESULT_NAMES[test.result], test.runtime, test.frames);
+    AppendEscapedJSON(report, test.message);
+    report.AppendString(", \"serial_output\": ");
+    AppendEscapedJSON(report, test.serial_output);
+    report.AppendString(((i + 1) < m_tests.size()) ? "},\n" : "}\n");
+  }
+  report.AppendString("  ]\n}\n");
+
+  return WriteReport(filename, report, pError);
+}
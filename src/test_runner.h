@@ -0,0 +1,57 @@
+#pragma once
+#include "YBaseLib/Common.h"
+#include "YBaseLib/String.h"
+#include "structures.h"
+#include <vector>
+
+class Error;
+
+// Headless test rom runner. Runs each rom on a pool of threads without the boot rom, frame limiter, video or audio,
+// and stops it as soon as it reports a result rather than after a fixed time:
+//  - LD B,B breakpoint (mooneye), passing if B/C/D/E/H/L hold 3/5/8/13/21/34
+//  - status byte at A000 once DE B0 61 is at A001 (blargg), passing if zero, with the message text from A004
+//  - "Passed" or "Failed" printed over the serial port (blargg)
+class TestRunner
+{
+public:
+  enum RESULT
+  {
+    RESULT_PASSED,
+    RESULT_FAILED,
+    RESULT_TIMEOUT,
+    RESULT_ERROR
+  };
+
+  struct Test
+  {
+    String filename;
+    RESULT result;
+    String message;
+    String serial_output;
+    uint32 frames;
+    double runtime;
+  };
+
+  TestRunner();
+  ~TestRunner();
+
+  uint32 GetTestCount() const { return static_cast<uint32>(m_tests.size()); }
+  const Test& GetTest(uint32 index) const { return m_tests[index]; }
+  uint32 GetResultCount(RESULT result) const;
+
+  // a directory is searched recursively for roms
+  bool AddTests(const char* path, Error* pError);
+
+  // timeout is in emulated seconds, num_threads of zero uses one per core
+  // mode can be NUM_SYSTEM_MODES to use each cartridge's mode
+  void Run(SYSTEM_MODE mode, uint32 timeout_seconds, uint32 num_threads);
+
+  bool WriteJUnitXML(const char* filename, Error* pError) const;
+  bool WriteJSON(const char* filename, Error* pError) const;
+
+private:
+  static void RunTest(Test* test, SYSTEM_MODE mode, uint32 timeout_frames);
+
+  std::vector<Test> m_tests;
+  double m_total_runtime;
+};
@@ -0,0 +1,354 @@
+#include "vram_viewer.h"
+#include "YBaseLib/Log.h"
+#include "YBaseLib/Memory.h"
+#include "system.h"
+#include <imgui.h>
+Log_SetChannel(VRAMViewer);
+
+static ImVec4 ColorToImVec4(uint32 color)
+{
+  return ImVec4(float(color & 0xFF) / 255.0f, float((color >> 8) & 0xFF) / 255.0f,
+                float((color >> 16) & 0xFF) / 255.0f, 1.0f);
+}
+
+VRAMViewer::VRAMViewer()
+  : show_tiles(false), show_maps(false), show_oam(false), show_palettes(false), m_tile_texture(0), m_dirty_maps(0),
+    m_map_lcdc(0), m_tile_palette_selection(0), m_tiles_valid(false), m_maps_valid(false)
+{
+  m_map_textures[0] = m_map_textures[1] = 0;
+  Y_memzero(m_tile_pixels, sizeof(m_tile_pixels));
+  Y_memzero(m_map_pixels, sizeof(m_map_pixels));
+  Y_memzero(m_dirty_tiles, sizeof(m_dirty_tiles));
+  Y_memzero(m_tile_palette_colors, sizeof(m_tile_palette_colors));
+  Y_memzero(m_map_palette_colors, sizeof(m_map_palette_colors));
+}
+
+VRAMViewer::~VRAMViewer()
+{
+  if (m_tile_texture != 0)
+    glDeleteTextures(1, &m_tile_texture);
+  if (m_map_textures[0] != 0)
+    glDeleteTextures(2, m_map_textures);
+}
+
+void VRAMViewer::CreateTextures()
+{
+  glGenTextures(1, &m_tile_texture);
+  glBindTexture(GL_TEXTURE_2D, m_tile_texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TILE_TEXTURE_WIDTH, TILE_TEXTURE_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+               m_tile_pixels);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  glGenTextures(2, m_map_textures);
+  for (uint32 i = 0; i < 2; i++)
+  {
+    glBindTexture(GL_TEXTURE_2D, m_map_textures[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, MAP_TEXTURE_SIZE, MAP_TEXTURE_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 m_map_pixels[i]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  }
+}
+
+void VRAMViewer::Draw(System* system)
+{
+  system->GetDisplay()->SetVRAMTracking(IsAnyWindowOpen());
+  if (!IsAnyWindowOpen())
+  {
+    // nothing is consuming the dirty state, so the caches will need rebuilding when opened again
+    m_tiles_valid = false;
+    m_maps_valid = false;
+    return;
+  }
+
+  Update(system);
+
+  if (show_tiles)
+    DrawTilesWindow(system);
+  if (show_maps)
+    DrawMapsWindow(system);
+  if (show_oam)
+    DrawOAMWindow(system);
+  if (show_palettes)
+    DrawPalettesWindow(system);
+}
+
+void VRAMViewer::Update(System* system)
+{
+  if (m_tile_texture == 0)
+    CreateTextures();
+
+  Display* display = system->GetDisplay();
+  display->TakeDirtyVRAM(m_dirty_tiles, &m_dirty_maps);
+
+  // oam window draws from the tile texture too
+  if (show_tiles || show_oam)
+    UpdateTiles(display, !m_tiles_valid);
+  else
+    m_tiles_valid = false;
+
+  if (show_maps)
+  {
+    // palette or addressing mode changes affect every entry
+    bool full_refresh = !m_maps_valid;
+    uint8 lcdc = display->GetRegisters().LCDC & 0x10;
+    if (lcdc != m_map_lcdc)
+    {
+      m_map_lcdc = lcdc;
+      full_refresh = true;
+    }
+
+    uint32 palette_colors[8][4];
+    for (uint32 i = 0; i < 8; i++)
+      display->GetPaletteColors(false, i, palette_colors[i]);
+    if (Y_memcmp(palette_colors, m_map_palette_colors, sizeof(palette_colors)) != 0)
+    {
+      Y_memcpy(m_map_palette_colors, palette_colors, sizeof(m_map_palette_colors));
+      full_refresh = true;
+    }
+
+    UpdateMap(system, 0, full_refresh || (m_dirty_maps & 0x01) != 0);
+    UpdateMap(system, 1, full_refresh || (m_dirty_maps & 0x02) != 0);
+    m_maps_valid = true;
+  }
+  else
+  {
+    m_maps_valid = false;
+  }
+}
+
+bool VRAMViewer::IsTileDirty(uint32 bank, uint32 tile) const
+{
+  return ((m_dirty_tiles[bank][tile / 32] >> (tile % 32)) & 0x1) != 0;
+}
+
+void VRAMViewer::UpdateTiles(const Display* display, bool full_refresh)
+{
+  uint32 colors[4];
+  if (m_tile_palette_selection == 0)
+    Y_memcpy(colors, Display::DMG_GRAYSCALE_COLORS, sizeof(colors));
+  else if (m_tile_palette_selection <= 8)
+    display->GetPaletteColors(false, uint32(m_tile_palette_selection - 1), colors);
+  else
+    display->GetPaletteColors(true, uint32(m_tile_palette_selection - 9), colors);
+
+  if (Y_memcmp(colors, m_tile_palette_colors, sizeof(colors)) != 0)
+  {
+    Y_memcpy(m_tile_palette_colors, colors, sizeof(m_tile_palette_colors));
+    full_refresh = true;
+  }
+
+  bool changed = false;
+  for (uint32 bank = 0; bank < 2; bank++)
+  {
+    for (uint32 tile = 0; tile < Display::TILES_PER_VRAM_BANK; tile++)
+    {
+      if (!full_refresh && !IsTileDirty(bank, tile))
+        continue;
+
+      uint32 x = bank * (TILE_TEXTURE_WIDTH / 2) + (tile % 16) * 8;
+      uint32 y = (tile / 16) * 8;
+      display->DecodeTile(bank, tile, colors, false, false, &m_tile_pixels[y * TILE_TEXTURE_WIDTH + x],
+                          TILE_TEXTURE_WIDTH);
+      changed = true;
+    }
+  }
+
+  if (changed)
+  {
+    glBindTexture(GL_TEXTURE_2D, m_tile_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TILE_TEXTURE_WIDTH, TILE_TEXTURE_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE,
+                    m_tile_pixels);
+  }
+
+  m_tiles_valid = true;
+}
+
+uint32 VRAMViewer::GetMapEntryTile(System* system, uint32 map, uint32 entry, uint32* bank, uint8* attributes) const
+{
+  const Display* display = system->GetDisplay();
+  uint32 offset = 0x1800 + map * 0x400 + entry;
+  uint8 index = display->GetVRAM(0)[offset];
+
+  // cgb stores the palette, bank and flip attributes in bank 1
+  *attributes = system->InCGBMode() ? display->GetVRAM(1)[offset] : 0;
+  *bank = (*attributes >> 3) & 0x1;
+
+  // LCDC bit 4 selects unsigned addressing from 8000, otherwise signed from 9000
+  if (m_map_lcdc & 0x10)
+    return index;
+  else
+    return uint32(256 + int32(int8(index)));
+}
+
+void VRAMViewer::UpdateMap(System* system, uint32 map, bool full_refresh)
+{
+  const Display* display = system->GetDisplay();
+  bool changed = false;
+  for (uint32 entry = 0; entry < 32 * 32; entry++)
+  {
+    uint32 bank;
+    uint8 attributes;
+    uint32 tile = GetMapEntryTile(system, map, entry, &bank, &attributes);
+    if (!full_refresh && !IsTileDirty(bank, tile))
+      continue;
+
+    uint32 x = (entry % 32) * 8;
+    uint32 y = (entry / 32) * 8;
+    display->DecodeTile(bank, tile, m_map_palette_colors[attributes & 0x7], (attributes & 0x20) != 0,
+                        (attributes & 0x40) != 0, &m_map_pixels[map][y * MAP_TEXTURE_SIZE + x], MAP_TEXTURE_SIZE);
+    changed = true;
+  }
+
+  if (changed)
+  {
+    glBindTexture(GL_TEXTURE_2D, m_map_textures[map]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, MAP_TEXTURE_SIZE, MAP_TEXTURE_SIZE, GL_RGBA, GL_UNSIGNED_BYTE,
+                    m_map_pixels[map]);
+  }
+}
+
+void VRAMViewer::DrawTilesWindow(System* system)
+{
+  ImGui::SetNextWindowSize(ImVec2(540.0f, 460.0f), ImGuiSetCond_FirstUseEver);
+  if (!ImGui::Begin("Tile Viewer", &show_tiles))
+  {
+    ImGui::End();
+    return;
+  }
+
+  ImGui::Combo("Palette", &m_tile_palette_selection, "Grayscale\0"
+                                                      "BG 0\0BG 1\0BG 2\0BG 3\0BG 4\0BG 5\0BG 6\0BG 7\0"
+                                                      "OBJ 0\0OBJ 1\0OBJ 2\0OBJ 3\0OBJ 4\0OBJ 5\0OBJ 6\0OBJ 7\0\0");
+
+  static const float scale = 2.0f;
+  ImGui::Image((ImTextureID)(intptr_t)m_tile_texture,
+               ImVec2(float(TILE_TEXTURE_WIDTH) * scale, float(TILE_TEXTURE_HEIGHT) * scale));
+  if (ImGui::IsItemHovered())
+  {
+    ImVec2 mouse_pos = ImGui::GetMousePos();
+    ImVec2 image_pos = ImGui::GetItemRectMin();
+    uint32 tx = uint32((mouse_pos.x - image_pos.x) / (8.0f * scale));
+    uint32 ty = uint32((mouse_pos.y - image_pos.y) / (8.0f * scale));
+    if (tx < 32 && ty < 24)
+    {
+      uint32 bank = tx / 16;
+      uint32 tile = ty * 16 + (tx % 16);
+      ImGui::SetTooltip("Bank %u Tile %u (0x%04X)", bank, tile, 0x8000 + tile * 16);
+    }
+  }
+
+  ImGui::End();
+}
+
+void VRAMViewer::DrawMapsWindow(System* system)
+{
+  const Display::Registers& registers = system->GetDisplay()->GetRegisters();
+
+  ImGui::SetNextWindowSize(ImVec2(560.0f, 340.0f), ImGuiSetCond_FirstUseEver);
+  if (!ImGui::Begin("Tile Map Viewer", &show_maps))
+  {
+    ImGui::End();
+    return;
+  }
+
+  ImGui::Text("BG map: %s  Window map: %s  Tile data: %s", (registers.LCDC & 0x08) ? "9C00" : "9800",
+              (registers.LCDC & 0x40) ? "9C00" : "9800", (registers.LCDC & 0x10) ? "8000" : "8800");
+  ImGui::Text("SCX: %u  SCY: %u  WX: %u  WY: %u", registers.SCX, registers.SCY, registers.WX, registers.WY);
+
+  ImGui::BeginGroup();
+  ImGui::Text("9800");
+  ImGui::Image((ImTextureID)(intptr_t)m_map_textures[0], ImVec2(float(MAP_TEXTURE_SIZE), float(MAP_TEXTURE_SIZE)));
+  ImGui::EndGroup();
+  ImGui::SameLine();
+  ImGui::BeginGroup();
+  ImGui::Text("9C00");
+  ImGui::Image((ImTextureID)(intptr_t)m_map_textures[1], ImVec2(float(MAP_TEXTURE_SIZE), float(MAP_TEXTURE_SIZE)));
+  ImGui::EndGroup();
+
+  ImGui::End();
+}
+
+void VRAMViewer::DrawOAMWindow(System* system)
+{
+  const Display* display = system->GetDisplay();
+  const OAM_ENTRY* entries = display->GetOAMEntries();
+  bool tall_sprites = (display->GetRegisters().LCDC & 0x04) != 0;
+
+  ImGui::SetNextWindowSize(ImVec2(360.0f, 480.0f), ImGuiSetCond_FirstUseEver);
+  if (!ImGui::Begin("OAM Viewer", &show_oam))
+  {
+    ImGui::End();
+    return;
+  }
+
+  const float tile_u = 8.0f / float(TILE_TEXTURE_WIDTH);
+  const float tile_v = 8.0f / float(TILE_TEXTURE_HEIGHT);
+  for (uint32 i = 0; i < 40; i++)
+  {
+    const OAM_ENTRY* entry = &entries[i];
+    uint32 bank = system->InCGBMode() ? entry->cgb_bank : 0;
+    uint32 tile = tall_sprites ? (entry->tile & 0xFE) : entry->tile;
+    uint32 num_tiles = tall_sprites ? 2 : 1;
+
+    ImGui::BeginGroup();
+    for (uint32 j = 0; j < num_tiles; j++)
+    {
+      uint32 t = tile + j;
+      ImVec2 uv0(float(bank * 16 + (t % 16)) * tile_u, float(t / 16) * tile_v);
+      ImVec2 uv1(uv0.x + tile_u, uv0.y + tile_v);
+      ImGui::Image((ImTextureID)(intptr_t)m_tile_texture, ImVec2(16.0f, 16.0f), uv0, uv1);
+    }
+    ImGui::EndGroup();
+
+    ImGui::SameLine();
+    ImGui::Text("%02u: X %3u Y %3u Tile %02X %s%s%s Pal %u", i, entry->x, entry->y, entry->tile,
+                entry->hflip ? "H" : "-", entry->vflip ? "V" : "-", entry->priority ? "P" : "-",
+                system->InCGBMode() ? uint32(entry->cgb_palette) : uint32(entry->palette));
+  }
+
+  ImGui::End();
+}
+
+void VRAMViewer::DrawPalettesWindow(System* system)
+{
+  const Display* display = system->GetDisplay();
+  uint32 num_bg_palettes = system->InCGBMode() ? 8 : 1;
+  uint32 num_obj_palettes = system->InCGBMode() ? 8 : 2;
+
+  ImGui::SetNextWindowSize(ImVec2(260.0f, 420.0f), ImGuiSetCond_FirstUseEver);
+  if (!ImGui::Begin("Palette Viewer", &show_palettes))
+  {
+    ImGui::End();
+    return;
+  }
+
+  for (uint32 sprite = 0; sprite < 2; sprite++)
+  {
+    uint32 count = sprite ? num_obj_palettes : num_bg_palettes;
+    for (uint32 i = 0; i < count; i++)
+    {
+      uint32 colors[4];
+      display->GetPaletteColors(sprite != 0, i, colors);
+
+      ImGui::Text("%s %u", sprite ? "OBJ" : "BG ", i);
+      for (uint32 j = 0; j < 4; j++)
+      {
+        ImGui::SameLine();
+        ImGui::PushID(int(sprite * 64 + i * 4 + j));
+        ImGui::ColorButton(ColorToImVec4(colors[j]));
+        if (ImGui::IsItemHovered())
+          ImGui::SetTooltip("%02X %02X %02X", colors[j] & 0xFF, (colors[j] >> 8) & 0xFF, (colors[j] >> 16) & 0xFF);
+        ImGui::PopID();
+      }
+    }
+
+    if (sprite == 0)
+      ImGui::Separator();
+  }
+
+  ImGui::End();
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "YBaseLib/Common.h"
+#include "display.h"
+#include <glad/glad.h>
+
+class System;
+
+// ImGui debug windows for tiles, tile maps, OAM and palettes.
+// Decoded tiles and maps are cached in textures, and only re-decoded when the display reports them as modified.
+class VRAMViewer
+{
+public:
+  VRAMViewer();
+  ~VRAMViewer();
+
+  bool IsAnyWindowOpen() const { return (show_tiles || show_maps || show_oam || show_palettes); }
+
+  // Call inside an ImGui frame.
+  void Draw(System* system);
+
+  bool show_tiles;
+  bool show_maps;
+  bool show_oam;
+  bool show_palettes;
+
+private:
+  // 16x24 tiles per bank, banks side by side
+  static const uint32 TILE_TEXTURE_WIDTH = 16 * 8 * 2;
+  static const uint32 TILE_TEXTURE_HEIGHT = 24 * 8;
+  static const uint32 MAP_TEXTURE_SIZE = 256;
+
+  void CreateTextures();
+  void Update(System* system);
+  void UpdateTiles(const Display* display, bool full_refresh);
+  void UpdateMap(System* system, uint32 map, bool full_refresh);
+  uint32 GetMapEntryTile(System* system, uint32 map, uint32 entry, uint32* bank, uint8* attributes) const;
+  bool IsTileDirty(uint32 bank, uint32 tile) const;
+
+  void DrawTilesWindow(System* system);
+  void DrawMapsWindow(System* system);
+  void DrawOAMWindow(System* system);
+  void DrawPalettesWindow(System* system);
+
+  GLuint m_tile_texture;
+  GLuint m_map_textures[2];
+  uint32 m_tile_pixels[TILE_TEXTURE_WIDTH * TILE_TEXTURE_HEIGHT];
+  uint32 m_map_pixels[2][MAP_TEXTURE_SIZE * MAP_TEXTURE_SIZE];
+
+  // dirty state taken from the display this frame
+  uint32 m_dirty_tiles[2][Display::TILES_PER_VRAM_BANK / 32];
+  uint8 m_dirty_maps;
+
+  // state the cached textures were decoded with, a change forces a full refresh
+  uint32 m_tile_palette_colors[4];
+  uint32 m_map_palette_colors[8][4];
+  uint8 m_map_lcdc;
+  int m_tile_palette_selection;
+  bool m_tiles_valid;
+  bool m_maps_valid;
+};